@@ -0,0 +1,76 @@
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// funbench [-t TRIALS] < CORPUS
+//    Persistent benchmark driver: read the lines of standard input, then
+//    call `fun` on each of them over and over, and print the nanoseconds
+//    per call (the best of TRIALS trials of about 20ms each). optbench.sh
+//    links this with each compiled puzzle.
+
+int fun(const char* s);
+
+static volatile int sink;
+
+static double now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Return the seconds taken by `passes` passes over `corpus`.
+static double run(const std::vector<std::string>& corpus, long passes) {
+    double t0 = now();
+    int x = 0;
+    for (long p = 0; p != passes; ++p) {
+        for (auto& s : corpus) {
+            x += fun(s.c_str());
+        }
+    }
+    sink = x;
+    return now() - t0;
+}
+
+int main(int argc, char** argv) {
+    int trials = 5;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        if (opt == 't') {
+            trials = strtol(optarg, nullptr, 0);
+        } else {
+            fprintf(stderr, "Usage: funbench [-t TRIALS] < CORPUS\n");
+            exit(1);
+        }
+    }
+
+    std::vector<std::string> corpus;
+    char* line = nullptr;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, stdin)) >= 0) {
+        if (len > 0 && line[len - 1] == '\n') {
+            --len;
+        }
+        corpus.emplace_back(line, len);
+    }
+    free(line);
+    if (corpus.empty()) {
+        fprintf(stderr, "funbench: empty corpus\n");
+        exit(1);
+    }
+
+    // choose a pass count that takes about 20ms
+    long passes = 1;
+    while (run(corpus, passes) < 0.02 && passes < (1L << 30)) {
+        passes *= 2;
+    }
+    double best = 1e100;
+    for (int t = 0; t < trials; ++t) {
+        double sec = run(corpus, passes);
+        best = sec < best ? sec : best;
+    }
+    printf("%.2f\n", best * 1e9 / (passes * corpus.size()));
+}
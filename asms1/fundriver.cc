@@ -1,34 +1,74 @@
-#include <sstream>
-#include <iostream>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
 
 int fun(const char* s);
 
 static void yay() {
-    std::cout << "🎉🎉🎉🎉🎊🎊🎊🎊🌽🌽🌽🎊🎊🎊🎊🎉🎉🎉🎉\n";
-    std::cout << "                 FUN\n";
-    std::cout << "🎉🎉🎉🎉🎊🎊🎊🎊🌽🌽🌽🎊🎊🎊🎊🎉🎉🎉🎉\n";
+    fputs("🎉🎉🎉🎉🎊🎊🎊🎊🌽🌽🌽🎊🎊🎊🎊🎉🎉🎉🎉\n"
+          "                 FUN\n"
+          "🎉🎉🎉🎉🎊🎊🎊🎊🌽🌽🌽🎊🎊🎊🎊🎉🎉🎉🎉\n", stdout);
     exit(0);
 }
 
 static void no_fun() {
-    std::cerr << "😿😿😿😿😿😿😿😿 no fun 😿😿😿😿😿😿😿😿\n";
+    fputs("😿😿😿😿😿😿😿😿 no fun 😿😿😿😿😿😿😿😿\n", stderr);
     exit(1);
 }
 
+// fun_lines()
+//    Persistent mode (`funNN --stdin`): call `fun` on each line of standard
+//    input, reusing one line buffer, and print the lines that are fun.
+//    Report the number of inputs and inputs per second to standard error.
+static void fun_lines() {
+    char* line = nullptr;
+    size_t cap = 0;
+    ssize_t len;
+    unsigned long ninputs = 0, nfun = 0;
+    timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while ((len = getline(&line, &cap, stdin)) >= 0) {
+        if (len > 0 && line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+        ++ninputs;
+        if (fun(line) == 0) {
+            ++nfun;
+            printf("fun: %s\n", line);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    fflush(stdout);
+    fprintf(stderr, "%lu inputs, %lu fun, %.0f inputs/sec\n",
+            ninputs, nfun, elapsed > 0 ? ninputs / elapsed : 0.0);
+    free(line);
+    exit(0);
+}
+
 int main(int argc, char** argv) {
-    // make a string from all the arguments
-    std::string argstr;
-    {
-        std::stringstream sbuf;
-        for (int i = 1; i < argc; ++i) {
-            sbuf << (i == 1 ? "" : " ") << argv[i];
+    if (argc == 2 && strcmp(argv[1], "--stdin") == 0) {
+        fun_lines();
+    }
+
+    // make a string from all the arguments, separated by spaces
+    size_t len = 0;
+    for (int i = 1; i < argc; ++i) {
+        len += strlen(argv[i]) + 1;
+    }
+    char* argstr = static_cast<char*>(malloc(len + 1));
+    char* p = argstr;
+    for (int i = 1; i < argc; ++i) {
+        if (i > 1) {
+            *p++ = ' ';
         }
-        argstr = sbuf.str();
+        p = stpcpy(p, argv[i]);
     }
+    *p = '\0';
 
     // call `fun`, and celebrate if it succeeds
-    if (fun(argstr.c_str()) == 0) {
+    if (fun(argstr) == 0) {
         yay();
     } else {
         no_fun();
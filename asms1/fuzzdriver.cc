@@ -0,0 +1,36 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+// libFuzzer entry point for the fun puzzles. `make fuzz COMPILER=clang`
+// links each `funNN` with this file, instead of fundriver.cc, into
+// `funNN-fuzz`. Run it as
+//    ./funNN-fuzz [CORPUSDIR]
+// It stops as soon as it finds a fun input, prints the input, and saves
+// it to `crash-*`. Rerun with `./funNN-fuzz crash-*` to check a saved
+// solution. The C++ puzzles are built with coverage instrumentation;
+// the assembly puzzles cannot be, so libFuzzer searches those blindly.
+
+int fun(const char* s);
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    // `fun` takes a C string, so inputs with null bytes mean nothing
+    if (memchr(data, '\0', size)) {
+        return -1;
+    }
+    static char* buf;
+    static size_t cap;
+    if (size + 1 > cap) {
+        cap = size + 1 > 2 * cap ? size + 1 : 2 * cap;
+        buf = static_cast<char*>(realloc(buf, cap));
+    }
+    memcpy(buf, data, size);
+    buf[size] = '\0';
+
+    if (fun(buf) == 0) {
+        fprintf(stderr, "🎉 fun input: \"%s\"\n", buf);
+        abort();
+    }
+    return 0;
+}
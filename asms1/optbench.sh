@@ -0,0 +1,73 @@
+#! /bin/sh
+# optbench.sh [COMPILER...]
+#    Compile each funNN.cc at -O0, -O1, -O2, -O3, and -Os with each
+#    COMPILER (default `g++ clang++`; missing compilers are skipped), time
+#    each variant with funbench on a fixed corpus, and print a table of
+#    nanoseconds per call and code bytes (the sizes of the text symbols
+#    in the variant's object file). Run via `make optbench`.
+
+LEVELS="0 1 2 3 s"
+BUILD=optbench.build
+test $# -gt 0 || set -- g++ clang++
+mkdir -p $BUILD || exit 1
+
+# fixed corpus: numbers for fun02, runs of repeated characters for
+# fun04/fun05, strings of assorted lengths, and a few fun inputs
+awk 'BEGIN {
+    srand(61);
+    for (i = 0; i < 1000; ++i) {
+        k = i % 5;
+        if (k == 0) {
+            printf("%d\n", int(rand() * 2000000) - 1000000);
+        } else if (k == 1) {
+            printf("0x%x\n", int(rand() * 65536));
+        } else if (k == 2) {
+            n = 1 + int(rand() * 30);
+            c = sprintf("%c", 97 + int(rand() * 26));
+            s = "";
+            for (j = 0; j < n; ++j) {
+                s = s c;
+            }
+            printf("%s%c\n", s, 97 + int(rand() * 26));
+        } else {
+            n = int(rand() * 60);
+            s = "";
+            for (j = 0; j < n; ++j) {
+                s = s sprintf("%c", 32 + int(rand() * 95));
+            }
+            printf("%s\n", s);
+        }
+    }
+}' > $BUILD/corpus
+
+# code bytes of an object file: the total size of its text symbols
+codesize () {
+    nm -S -t d --defined-only "$1" | awk '$3 ~ /^[Tt]$/ { n += $2 } END { print n + 0 }'
+}
+
+printf "%-6s %-8s" fun compiler
+for o in $LEVELS; do
+    printf " %14s" "-O$o ns/B"
+done
+printf "\n"
+
+for cxx in "$@"; do
+    if ! command -v $cxx >/dev/null 2>&1; then
+        echo "optbench.sh: $cxx not found, skipping" 1>&2
+        continue
+    fi
+    for src in fun[0-9][0-9].cc; do
+        f=`basename $src .cc`
+        printf "%-6s %-8s" $f $cxx
+        for o in $LEVELS; do
+            v=$BUILD/$f-$cxx-O$o
+            if $cxx -std=gnu++1z -O$o -c $src -o $v.o \
+                && $cxx -o $v $v.o funbench.o; then
+                printf " %7s/%-6s" `$v < $BUILD/corpus` `codesize $v.o`
+            else
+                printf " %14s" failed
+            fi
+        done
+        printf "\n"
+    done
+done
@@ -25,10 +25,12 @@
 #define SECTORSIZE          512
 #define ELFHDR              ((elf_header*) 0x3000) // scratch space
 #define KERNEL_START_SECTOR 1
+#define BOOT_MAXSECT        128     // sectors per disk command (64 KiB)
 
 extern "C" {
 [[noreturn]] void boot();
-static void boot_readsect(uintptr_t dst, uint32_t src_sect);
+static void boot_readsect(uint32_t src_sect, unsigned nsect);
+static void boot_waitdisk();
 static void boot_readseg(uintptr_t dst, uint32_t src_sect,
                          size_t filesz, size_t memsz);
 }
@@ -74,9 +76,16 @@ static void boot_readseg(uintptr_t ptr, uint32_t src_sect,
     // round down to sector boundary
     ptr &= ~(SECTORSIZE - 1);
 
-    // read sectors
-    for (; ptr < end_ptr; ptr += SECTORSIZE, ++src_sect) {
-        boot_readsect(ptr, src_sect);
+    // read sectors, starting a new disk command (of at most
+    // `BOOT_MAXSECT` sectors) whenever the previous one is used up
+    for (unsigned n = 0; ptr < end_ptr; ptr += SECTORSIZE, ++src_sect, --n) {
+        if (n == 0) {
+            n = (end_ptr - ptr + SECTORSIZE - 1) / SECTORSIZE;
+            n = n > BOOT_MAXSECT ? BOOT_MAXSECT : n;
+            boot_readsect(src_sect, n);
+        }
+        boot_waitdisk();
+        insl(0x1F0, (void*) ptr, SECTORSIZE/4); // read 128 words
     }
 
     // clear bss segment
@@ -97,19 +106,18 @@ static void boot_waitdisk() {
 }
 
 
-// boot_readsect(dst, src_sect)
-//    Read disk sector number `src_sect` into address `dst`.
-static void boot_readsect(uintptr_t dst, uint32_t src_sect) {
-    // programmed I/O for "read sector"
+// boot_readsect(src_sect, nsect)
+//    Start reading `nsect` disk sectors, beginning at sector number
+//    `src_sect`. `nsect` must be between 1 and 255. The caller then
+//    waits for each sector with `boot_waitdisk` and reads it from the
+//    data port.
+__noinline static void boot_readsect(uint32_t src_sect, unsigned nsect) {
+    // programmed I/O for "read sectors"
     boot_waitdisk();
-    outb(0x1F2, 1);             // send `count = 1` as an ATA argument
+    outb(0x1F2, nsect);         // send `count = nsect` as an ATA argument
     outb(0x1F3, src_sect);      // send `src_sect`, the sector number
     outb(0x1F4, src_sect >> 8);
     outb(0x1F5, src_sect >> 16);
     outb(0x1F6, (src_sect >> 24) | 0xE0);
     outb(0x1F7, 0x20);          // send the command: 0x20 = read sectors
-
-    // then move the data into memory
-    boot_waitdisk();
-    insl(0x1F0, (void*) dst, SECTORSIZE/4); // read 128 words from the disk
 }
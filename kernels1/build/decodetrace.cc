@@ -0,0 +1,165 @@
+#include "trace.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cinttypes>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+// decodetrace [LOGFILE]
+//    Read the kernel event trace dumped to LOGFILE (default `log.txt`)
+//    by the 't' key, and print it as a single timeline, followed by
+//    wakeup and context-switch latencies. Times are in ticks since the
+//    first record. If the log holds several dumps, the last is used.
+
+struct event {
+    int cpu;
+    trace_record r;
+};
+
+static uint64_t tsc_per_tick = 0;
+static uint64_t tsc_origin = 0;
+
+static double tick_time(uint64_t tsc) {
+    return double(tsc - tsc_origin) / double(tsc_per_tick);
+}
+
+static void print_event(const event& e) {
+    const trace_record& r = e.r;
+    printf("%10.3f  cpu %d  pid %2d  ", tick_time(r.tsc), e.cpu, r.pid);
+    switch (r.event) {
+    case TRACE_SYSCALL:
+        printf("syscall %" PRIu64 " (%#" PRIx64 ")\n", r.arg0, r.arg1);
+        break;
+    case TRACE_EXCEPTION:
+        printf("exception %" PRIu64 " at %#" PRIx64 "\n", r.arg0, r.arg1);
+        break;
+    case TRACE_SCHEDULE:
+        printf("schedule, %" PRIu64 " queued\n", r.arg0);
+        break;
+    case TRACE_RUN:
+        printf("run until %.3f\n", tick_time(r.arg0));
+        break;
+    case TRACE_WAKE:
+        printf("wake pid %" PRIu64 " on cpu %" PRIu64 "\n", r.arg0, r.arg1);
+        break;
+    default:
+        printf("event %u (%#" PRIx64 ", %#" PRIx64 ")\n",
+               r.event, r.arg0, r.arg1);
+        break;
+    }
+}
+
+
+// `latency` accumulates the delays between pairs of events.
+
+struct latency {
+    const char* name_;
+    unsigned long n_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t max_ = 0;
+
+    explicit latency(const char* name)
+        : name_(name) {
+    }
+    void add(uint64_t delta) {
+        ++n_;
+        sum_ += delta;
+        max_ = std::max(max_, delta);
+    }
+    void print() const {
+        if (n_ == 0) {
+            printf("%-16s none\n", name_);
+        } else {
+            printf("%-16s %lu, mean %.3f, max %.3f ticks\n", name_, n_,
+                   double(sum_) / n_ / tsc_per_tick,
+                   double(max_) / tsc_per_tick);
+        }
+    }
+};
+
+
+int main(int argc, char** argv) {
+    if (argc > 2) {
+        fprintf(stderr, "Usage: decodetrace [LOGFILE]\n");
+        exit(1);
+    }
+    const char* filename = argc == 2 ? argv[1] : "log.txt";
+    FILE* f = fopen(filename, "r");
+    if (!f) {
+        perror(filename);
+        exit(1);
+    }
+
+    std::vector<event> dump, events;
+    char buf[BUFSIZ];
+    while (fgets(buf, sizeof(buf), f)) {
+        event e;
+        unsigned long long tsc, arg0, arg1, per_tick;
+        unsigned evno, pid;
+        if (sscanf(buf, "trace end %llx", &per_tick) == 1) {
+            events.swap(dump);
+            dump.clear();
+            tsc_per_tick = per_tick;
+        } else if (sscanf(buf, "trace %d %llx %x %x %llx %llx",
+                          &e.cpu, &tsc, &evno, &pid, &arg0, &arg1) == 6) {
+            e.r.tsc = tsc;
+            e.r.event = evno;
+            e.r.pid = pid;
+            e.r.arg0 = arg0;
+            e.r.arg1 = arg1;
+            dump.push_back(e);
+        }
+    }
+    fclose(f);
+    if (events.empty() || tsc_per_tick == 0) {
+        fprintf(stderr, "%s: no trace dump (press 't' in WeensyOS)\n",
+                filename);
+        exit(1);
+    }
+
+    // Each CPU's records are in order, but CPUs' rings cover different
+    // periods. Start the timeline where every CPU has records.
+    std::stable_sort(events.begin(), events.end(),
+                     [] (const event& a, const event& b) {
+                         return a.r.tsc < b.r.tsc;
+                     });
+    std::map<int, uint64_t> first_tsc;
+    for (auto& e : events) {
+        first_tsc.emplace(e.cpu, e.r.tsc);
+    }
+    for (auto& ft : first_tsc) {
+        tsc_origin = std::max(tsc_origin, ft.second);
+    }
+
+    latency wakeup("wake -> run"), cswitch("schedule -> run");
+    std::map<int, uint64_t> woken;      // pid -> TSC of pending wake
+    std::map<int, uint64_t> scheduling; // cpu -> TSC of pending schedule
+    for (auto& e : events) {
+        if (e.r.tsc < tsc_origin) {
+            continue;
+        }
+        print_event(e);
+        if (e.r.event == TRACE_WAKE) {
+            woken.emplace(int(e.r.arg0), e.r.tsc);
+        } else if (e.r.event == TRACE_SCHEDULE) {
+            scheduling[e.cpu] = e.r.tsc;
+        } else if (e.r.event == TRACE_RUN) {
+            auto it = woken.find(e.r.pid);
+            if (it != woken.end()) {
+                wakeup.add(e.r.tsc - it->second);
+                woken.erase(it);
+            }
+            auto jt = scheduling.find(e.cpu);
+            if (jt != scheduling.end()) {
+                cswitch.add(e.r.tsc - jt->second);
+                scheduling.erase(jt);
+            }
+        }
+    }
+
+    printf("\n");
+    wakeup.print();
+    cswitch.print();
+}
@@ -10,6 +10,9 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <errno.h>
+#include <map>
+#include <string>
+#include <vector>
 #if defined(_MSDOS) || defined(_WIN32)
 # include <fcntl.h>
 # include <io.h>
@@ -23,6 +26,10 @@
  * two bytes in the sector equal 0x55 and 0xAA.
  * This code makes sure the code intended for the boot sector is at most
  * 512 - 2 = 510 bytes long, then appends the 0x55-0xAA signature.
+ *
+ * `mkbootdisk -z NAME=FILE...` instead writes a compressed archive of
+ * the FILEs, which the kernel embeds as its program images (see
+ * `do_compress`).
  */
 
 int diskfd;
@@ -31,12 +38,14 @@ off_t curoff = 0;
 
 int find_partition(off_t partition_sect, off_t extended_sect, int partoff);
 void do_multiboot(const char *filename);
+void do_compress(int nfiles, char **files);
 
 
 void usage(void) {
     fprintf(stderr, "Usage: mkbootdisk BOOTSECTORFILE [FILE | @SECNUM]...\n");
     fprintf(stderr, "   or: mkbootdisk -p DISK [FILE | @SECNUM]...\n");
     fprintf(stderr, "   or: mkbootdisk -m KERNELFILE\n");
+    fprintf(stderr, "   or: mkbootdisk -z NAME=FILE...\n");
     exit(1);
 }
 
@@ -114,6 +123,14 @@ int main(int argc, char *argv[]) {
         do_multiboot(argv[2]);
     }
 
+    // Check for compress option
+    if (argc >= 2 && strcmp(argv[1], "-z") == 0) {
+        if (argc < 3) {
+            usage();
+        }
+        do_compress(argc - 2, argv + 2);
+    }
+
     // Read files
     if (argc < 2) {
         usage();
@@ -315,3 +332,176 @@ void do_multiboot(const char *filename) {
     diskwrite(multiboot_header, sizeof(multiboot_header));
     exit(0);
 }
+
+
+// Program archives
+//    `lz4archive_header` in `elf.h` describes the format. Chunks are
+//    compressed as standard LZ4 blocks
+//    (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md) by a
+//    simple greedy compressor; the kernel's decompressor is in
+//    `k-hardware.cc`.
+
+#define LZ4_HASHBITS            12
+#define LZ4_MINMATCH            4
+#define LZ4_MAXOFFSET           65535
+#define LZ4_LASTLITERALS        5       // last bytes are always literals
+#define LZ4_MFLIMIT             12      // no match starts this near the end
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint8_t *lz4_putlength(uint8_t *out, size_t len) {
+    for (; len >= 255; len -= 255) {
+        *out++ = 255;
+    }
+    *out++ = len;
+    return out;
+}
+
+// lz4_sequence(out, lit, litlen, offset, matchlen)
+//    Write one LZ4 sequence: `litlen` literal bytes from `lit`, then (if
+//    `matchlen != 0`) a match of `matchlen` bytes `offset` bytes back.
+static uint8_t *lz4_sequence(uint8_t *out, const uint8_t *lit, size_t litlen,
+                             size_t offset, size_t matchlen) {
+    size_t ml = matchlen ? matchlen - LZ4_MINMATCH : 0;
+    *out++ = ((litlen < 15 ? litlen : 15) << 4) | (ml < 15 ? ml : 15);
+    if (litlen >= 15) {
+        out = lz4_putlength(out, litlen - 15);
+    }
+    memcpy(out, lit, litlen);
+    out += litlen;
+    if (matchlen) {
+        *out++ = offset;
+        *out++ = offset >> 8;
+        if (ml >= 15) {
+            out = lz4_putlength(out, ml - 15);
+        }
+    }
+    return out;
+}
+
+static size_t lz4_compress(uint8_t *out, const uint8_t *in, size_t n) {
+    static long table[1 << LZ4_HASHBITS];
+    for (size_t i = 0; i != sizeof(table) / sizeof(table[0]); ++i) {
+        table[i] = -1;
+    }
+
+    uint8_t *out0 = out;
+    size_t anchor = 0, pos = 0;
+    while (n >= LZ4_MFLIMIT && pos < n - LZ4_MFLIMIT) {
+        uint32_t v = read32(in + pos);
+        uint32_t h = (v * 2654435761U) >> (32 - LZ4_HASHBITS);
+        long ref = table[h];
+        table[h] = pos;
+        if (ref < 0 || pos - ref > LZ4_MAXOFFSET || read32(in + ref) != v) {
+            ++pos;
+            continue;
+        }
+        size_t len = LZ4_MINMATCH;
+        while (pos + len < n - LZ4_LASTLITERALS
+               && in[ref + len] == in[pos + len]) {
+            ++len;
+        }
+        out = lz4_sequence(out, in + anchor, pos - anchor, pos - ref, len);
+        pos += len;
+        anchor = pos;
+    }
+    out = lz4_sequence(out, in + anchor, n - anchor, 0, 0);
+    return out - out0;
+}
+
+static std::string read_file(const char *filename) {
+    FILE *f = fopencheck(filename);
+    std::string data;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data.append(buf, n);
+    }
+    fclose(f);
+    return data;
+}
+
+template <typename T>
+static void append(std::string &out, const T &x) {
+    out.append(reinterpret_cast<const char *>(&x), sizeof(x));
+}
+
+void do_compress(int nfiles, char **files) {
+    if (nfiles == 0) {
+        usage();
+    }
+    std::vector<lz4archive_image> images;
+    std::vector<lz4archive_chunk> chunks;
+    std::string names, data;
+    std::map<std::string, lz4archive_chunk> chunk_index;   // by contents
+    std::map<std::string, uint32_t> image_index;           // first chunk
+    std::vector<uint8_t> zbuf(LZ4ARCHIVE_CHUNKSIZE * 2);
+
+    for (int i = 0; i != nfiles; ++i) {
+        char *eq = strchr(files[i], '=');
+        if (!eq || eq == files[i]) {
+            usage();
+        }
+        std::string contents = read_file(eq + 1);
+        lz4archive_image im;
+        im.name = names.size();
+        names.append(files[i], eq - files[i]);
+        names.push_back('\0');
+        im.size = contents.size();
+
+        // an identical earlier image shares its chunk table entries
+        auto it = image_index.find(contents);
+        if (it != image_index.end()) {
+            im.first_chunk = it->second;
+            images.push_back(im);
+            continue;
+        }
+        im.first_chunk = chunks.size();
+        image_index[contents] = im.first_chunk;
+        images.push_back(im);
+
+        for (size_t off = 0; off < contents.size();
+             off += LZ4ARCHIVE_CHUNKSIZE) {
+            std::string raw = contents.substr(off, LZ4ARCHIVE_CHUNKSIZE);
+            size_t zsize = lz4_compress(zbuf.data(),
+                                        (const uint8_t *) raw.data(),
+                                        raw.size());
+            std::string z = zsize < raw.size()
+                ? std::string((const char *) zbuf.data(), zsize)
+                : raw;
+            auto cit = chunk_index.find(z);
+            if (cit == chunk_index.end()) {
+                lz4archive_chunk c = { (uint32_t) data.size(),
+                                       (uint32_t) z.size() };
+                data += z;
+                cit = chunk_index.insert({z, c}).first;
+            }
+            chunks.push_back(cit->second);
+        }
+    }
+
+    // header, image table, chunk table, names, then chunk data
+    lz4archive_header h = { LZ4ARCHIVE_MAGIC, (uint32_t) images.size(),
+                            (uint32_t) chunks.size() };
+    uint32_t names_off = sizeof(h) + images.size() * sizeof(lz4archive_image)
+        + chunks.size() * sizeof(lz4archive_chunk);
+    uint32_t data_off = names_off + names.size();
+    std::string out;
+    append(out, h);
+    for (auto &im : images) {
+        im.name += names_off;
+        append(out, im);
+    }
+    for (auto &c : chunks) {
+        c.offset += data_off;
+        append(out, c);
+    }
+    out += names;
+    out += data;
+    diskwrite(out.data(), out.size());
+    exit(0);
+}
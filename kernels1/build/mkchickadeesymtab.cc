@@ -15,7 +15,6 @@
 #include <cassert>
 #include <cinttypes>
 #include <vector>
-#include <random>
 #include <algorithm>
 #if defined(_MSDOS) || defined(_WIN32)
 # include <fcntl.h>
@@ -48,9 +47,7 @@ struct elf_info {
     uint64_t first_offset() const;
     elf_symbol* symtab() const;
     elf_symbol* find_symbol(const char* name, elf_symbol* after = nullptr) const;
-    void sort_symtab();
-
-    void shift_sections(size_t offset, ptrdiff_t diff);
+    char* data_at(uint64_t va, size_t sz) const;
 };
 
 
@@ -228,38 +225,6 @@ elf_symbol* elf_info::symtab() const {
     return symtab_;
 }
 
-static inline bool symbol_less(const elf_symbol& a, const elf_symbol& b) {
-    bool asp = (a.st_info & ELF_STT_MASK) > ELF_STT_FUNC;
-    bool bsp = (b.st_info & ELF_STT_MASK) > ELF_STT_FUNC;
-    if (asp || bsp) {
-        return asp && !bsp;
-    } else {
-        return (a.st_value < b.st_value)
-            || (a.st_value == b.st_value
-                && a.st_size < b.st_size);
-    }
-}
-
-void elf_info::sort_symtab() {
-    symtab();
-    unsigned i = 2;
-    while (i < nsymtab_ && !symbol_less(symtab_[i], symtab_[i - 1])) {
-        ++i;
-    }
-    if (i < nsymtab_) {
-        if (verbose) {
-            fprintf(stderr, "%s: sorting <.symtab>\n", filename_);
-            fprintf(stderr, "  `%s` #%u @%" PRIx64 " > `%s` #%u @%" PRIx64 "\n",
-                    symstrtab_ + symtab_[i - 1].st_name, i - 1,
-                    symtab_[i - 1].st_value,
-                    symstrtab_ + symtab_[i].st_name, i,
-                    symtab_[i].st_value);
-        }
-        std::stable_sort(&symtab_[1], &symtab_[nsymtab_], symbol_less);
-        changed_ = true;
-    }
-}
-
 elf_symbol* elf_info::find_symbol(const char* name,
                                   elf_symbol* after) const {
     unsigned i = 0;
@@ -278,122 +243,203 @@ elf_symbol* elf_info::find_symbol(const char* name,
     }
 }
 
-void elf_info::shift_sections(size_t offset, ptrdiff_t diff) {
-    assert(offset < size_ && diff > 0);
 
-    // update program headers
-    if (eh_->e_phoff + eh_->e_phnum * sizeof(*pht_) >= offset) {
-        fprintf(stderr, "%s: program header spans alignment boundary\n", filename_);
-        exit(1);
+// elf_info::data_at(va, sz)
+//    Return a pointer to the file contents loaded at address `va`, or
+//    nullptr if `[va, va + sz)` is not all in one PROGBITS section.
+
+char* elf_info::data_at(uint64_t va, size_t sz) const {
+    for (unsigned i = 0; i != eh_->e_shnum; ++i) {
+        auto& sh = sht_[i];
+        if (sh.sh_type == ELF_SHT_PROGBITS
+            && va >= sh.sh_addr
+            && sz <= sh.sh_size
+            && va - sh.sh_addr <= sh.sh_size - sz) {
+            return data_ + sh.sh_offset + (va - sh.sh_addr);
+        }
     }
-    for (unsigned i = 0; i != eh_->e_phnum; ++i) {
-        auto& ph = pht_[i];
-        if (ph.p_offset >= offset) {
-            ph.p_offset += diff;
-        } else if (ph.p_offset + ph.p_filesz > offset) {
-            fprintf(stderr, "%s: program %u spans alignment boundary\n", filename_, i);
-            fprintf(stderr, "  shifting %zu+%zu, program %" PRIu64 "+%" PRIu64 "\n",
-                    offset, diff, ph.p_offset, ph.p_filesz);
+    return nullptr;
+}
+
+
+static void usage() {
+    fprintf(stderr, "Usage: mkchickadeesymtab [-a ADDR] [-s SYMTABREF] [-y SYMFILE] [IMAGE [OUTPUT]]\n");
+    exit(1);
+}
+
+// read_elf(ei, filename)
+//    Read the ELF file `filename` (or standard input, for "-") into `ei`
+//    and validate it. Returns the file's mode bits.
+
+static mode_t read_elf(elf_info& ei, const char* filename) {
+    ei.filename_ = "<stdin>";
+    int fd = STDIN_FILENO;
+    if (strcmp(filename, "-") != 0) {
+        ei.filename_ = filename;
+        fd = open(ei.filename_, O_RDONLY);
+        if (fd == -1) {
+            fprintf(stderr, "%s: %s\n", ei.filename_, strerror(errno));
             exit(1);
         }
     }
 
-    // update section headers
-    for (unsigned i = 0; i != eh_->e_shnum; ++i) {
-        auto& sh = sht_[i];
-        if (sh.sh_offset >= offset) {
-            sh.sh_offset += diff;
-        } else if (sh.sh_type != ELF_SHT_NULL
-                   && sh.sh_type != ELF_SHT_NOBITS
-                   && sh.sh_offset + sh.sh_size > offset) {
-            fprintf(stderr, "%s: section <%s> spans alignment boundary\n", filename_, section_display_name(i));
-            fprintf(stderr, "  shifting %zu+%zu, section %" PRIu64 "+%" PRIu64 "\n",
-                    offset, diff, sh.sh_offset, sh.sh_size);
+    struct stat s;
+    int r = fstat(fd, &s);
+    assert(r == 0);
+    ei.grow(S_ISREG(s.st_mode) ? (s.st_size + 32767) & ~32767 : 262144);
+
+    while (true) {
+        if (ei.size_ == ei.capacity_) {
+            ei.grow(ei.capacity_ * 2);
+        }
+        ssize_t r = read(fd, &ei.data_[ei.size_], ei.capacity_ - ei.size_);
+        if (r == 0) {
+            break;
+        } else if (r == -1 && errno != EAGAIN) {
+            fprintf(stderr, "%s: %s\n", ei.filename_, strerror(errno));
             exit(1);
+        } else if (r > 0) {
+            ei.size_ += r;
         }
     }
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
 
-    // move data
-    grow(size_ + diff);
-    memmove(&data_[offset + diff], &data_[offset], size_ - offset);
-    memset(&data_[offset], 0, diff);
-    size_ += diff;
-    changed_ = true;
-
-    // update main offsets
-    if (eh_->e_shoff >= offset) {
-        eh_->e_shoff += diff;
-        sht_ = reinterpret_cast<elf_section*>(data_ + eh_->e_shoff);
+    if (!ei.validate()) {
+        exit(1);
     }
+    return s.st_mode;
 }
 
 
-static void usage() {
-    fprintf(stderr, "Usage: mkchickadeesymtab [-s SYMTABREF] [IMAGE]\n");
-    exit(1);
-}
-
-static unsigned rewrite_symtabref(elf_info& ei, const char* name,
-                                  uint64_t& loadaddr, size_t strtab_off,
-                                  size_t size) {
-    auto sym = ei.find_symbol(name);
-    unsigned nfound = 0;
-    while (sym) {
-        if ((sym->st_info & ELF_STT_MASK) == ELF_STT_OBJECT
-            && sym->st_shndx < ei.eh_->e_shnum) {
-            if (sym->st_size != sizeof(elf_symtabref)) {
-                fprintf(stderr, "%s: `%s` symbol @0x%" PRIx64 " has size %" PRIu64 " (expected %zu)\n",
-                        ei.filename_, name, sym->st_value,
-                        sym->st_size, sizeof(elf_symtabref));
-                exit(1);
-            }
+// build_compact_symtab(ei, data)
+//    Set `data` to an `elf_compact_symtab` for `ei`'s symbols. Section
+//    and file symbols and symbols at address 0 are dropped, as is every
+//    symbol but the last among those at one address (the last one is the
+//    one a lookup finds). Buckets are the smallest power of two (at least
+//    16 bytes) that leaves no more buckets than symbols.
+
+static void build_compact_symtab(const elf_info& ei, std::vector<char>& data) {
+    elf_symbol* sym = ei.symtab();
+    std::vector<elf_symbol> syms;
+    for (unsigned i = 1; i < ei.nsymtab_; ++i) {
+        if ((sym[i].st_info & ELF_STT_MASK) <= ELF_STT_FUNC
+            && sym[i].st_value != 0) {
+            syms.push_back(sym[i]);
+        }
+    }
+    std::stable_sort(syms.begin(), syms.end(),
+                     [] (const elf_symbol& a, const elf_symbol& b) {
+                         return a.st_value < b.st_value
+                             || (a.st_value == b.st_value
+                                 && a.st_size < b.st_size);
+                     });
+    size_t nkept = 0;
+    for (size_t i = 0; i != syms.size(); ++i) {
+        if (i + 1 == syms.size() || syms[i + 1].st_value != syms[i].st_value) {
+            syms[nkept++] = syms[i];
+        }
+    }
+    syms.resize(nkept);
+    uint32_t nsym = syms.size();
 
-            auto& sh = ei.sht_[sym->st_shndx];
-            if (sh.sh_type != ELF_SHT_PROGBITS
-                || sym->st_value < sh.sh_addr
-                || sym->st_value >= sh.sh_addr + sh.sh_size - sizeof(elf_symtabref)) {
-                fprintf(stderr, "%s: `%s` symbol @0x%" PRIx64 " bad reference\n",
-                        ei.filename_, name, sym->st_value);
-                fprintf(stderr, "  %s addresses [0x%" PRIx64 ", 0x%" PRIx64 ")\n",
-                        ei.shstrtab() + sh.sh_name,
-                        sh.sh_addr, sh.sh_addr + sh.sh_size);
-                exit(1);
+    uint64_t lo = 0, hi = 0;
+    if (nsym != 0) {
+        lo = syms.front().st_value;
+        hi = syms.back().st_value + 0x1000;
+    }
+    unsigned shift = 4;
+    lo &= ~uint64_t(0xF);
+    while (((hi - lo) >> shift) >= std::max(nsym, uint32_t(16))) {
+        ++shift;
+    }
+    lo &= ~((uint64_t(1) << shift) - 1);
+    if (hi - lo > UINT32_MAX) {
+        fprintf(stderr, "%s: symbols span more than 4 GiB\n", ei.filename_);
+        exit(1);
+    }
+    uint32_t nbuckets = ((hi - lo) >> shift) + 1;
+
+    // names, longest suffix first among those sharing an ending, so each
+    // name either starts a new string or ends the previous one
+    std::vector<uint32_t> order(nsym);
+    for (uint32_t i = 0; i != nsym; ++i) {
+        order[i] = i;
+    }
+    auto name = [&] (uint32_t i) {
+        return ei.symstrtab_ + syms[i].st_name;
+    };
+    auto rless = [&] (uint32_t a, uint32_t b) {
+        const char* an = name(a);
+        const char* bn = name(b);
+        size_t al = strlen(an), bl = strlen(bn);
+        while (al != 0 && bl != 0) {
+            --al, --bl;
+            if (an[al] != bn[bl]) {
+                return (unsigned char) an[al] > (unsigned char) bn[bl];
             }
+        }
+        return al > bl;
+    };
+    std::sort(order.begin(), order.end(), rless);
+    std::vector<char> strings;
+    std::vector<uint32_t> name_off(nsym);
+    const char* prev = nullptr;
+    size_t prev_len = 0, prev_off = 0;
+    for (uint32_t i : order) {
+        const char* n = name(i);
+        size_t len = strlen(n);
+        if (prev && len <= prev_len
+            && memcmp(prev + prev_len - len, n, len) == 0) {
+            name_off[i] = prev_off + prev_len - len;
+        } else {
+            prev = n;
+            prev_len = len;
+            prev_off = strings.size();
+            name_off[i] = prev_off;
+            strings.insert(strings.end(), n, n + len + 1);
+        }
+    }
 
-            size_t stref_off = sh.sh_offset + (sym->st_value - sh.sh_addr);
-            if (!loadaddr) {
-                memcpy(&loadaddr, ei.data_ + stref_off, sizeof(loadaddr));
-            }
-            elf_symtabref stref;
-            memcpy(&stref, ei.data_ + stref_off, sizeof(stref));
-
-            elf_symtabref xstref = {
-                reinterpret_cast<elf_symbol*>(loadaddr),
-                ei.nsymtab_,
-                reinterpret_cast<char*>(loadaddr + strtab_off),
-                size
-            };
-            if (memcmp(ei.data_ + stref_off, &xstref, sizeof(xstref)) != 0) {
-                memcpy(ei.data_ + stref_off, &xstref, sizeof(xstref));
-                ei.changed_ = true;
-                if (verbose) {
-                    fprintf(stderr, "%s: filling out `%s`\n", ei.filename_, name);
-                }
-            }
-            ++nfound;
+    size_t nwords = 3 * size_t(nsym) + nbuckets + 1;
+    data.assign(sizeof(elf_compact_symtab) + nwords * sizeof(uint32_t)
+                + strings.size(), 0);
+    elf_compact_symtab* st = reinterpret_cast<elf_compact_symtab*>(data.data());
+    st->magic = ELF_COMPACT_SYMTAB_MAGIC;
+    st->nsym = nsym;
+    st->base = lo;
+    st->shift = shift;
+    st->nbuckets = nbuckets;
+    uint32_t* addr = st->data;
+    uint32_t* size = addr + nsym;
+    uint32_t* names = size + nsym;
+    uint32_t* first = names + nsym;
+    for (uint32_t i = 0; i != nsym; ++i) {
+        addr[i] = syms[i].st_value - lo;
+        size[i] = std::min(syms[i].st_size, uint64_t(UINT32_MAX));
+        names[i] = name_off[i];
+    }
+    // `first[b]` is the last symbol starting at or before the bucket
+    uint32_t j = 0;
+    for (uint32_t b = 0; b <= nbuckets; ++b) {
+        uint64_t a = uint64_t(b) << shift;
+        while (j + 1 < nsym && addr[j + 1] <= a) {
+            ++j;
         }
-        sym = ei.find_symbol(name, sym);
+        first[b] = j;
     }
-    return nfound;
+    memcpy(first + nbuckets + 1, strings.data(), strings.size());
 }
 
 int main(int argc, char** argv) {
     uint64_t loadaddr = 0;
     const char* lsymtab_name = "symtab";
     bool lsymtab_set = false;
+    const char* symfile = nullptr;
 
     int opt;
-    while ((opt = getopt(argc, argv, "a:s:V")) != -1) {
+    while ((opt = getopt(argc, argv, "a:s:y:V")) != -1) {
         switch (opt) {
         case 'a': {
             char* end;
@@ -409,6 +455,9 @@ int main(int argc, char** argv) {
             lsymtab_set = true;
             break;
         }
+        case 'y':
+            symfile = optarg;
+            break;
         case 'V':
             verbose = true;
             break;
@@ -421,159 +470,143 @@ int main(int argc, char** argv) {
         usage();
     }
 
-    // open and read ELF file
+    // read the image, and the file with its symbols if that is separate
     elf_info ei;
-
-    ei.filename_ = "<stdin>";
-    int fd = STDIN_FILENO;
-    if (optind < argc && strcmp(argv[optind], "-") != 0) {
-        ei.filename_ = argv[optind];
-        fd = open(ei.filename_, O_RDONLY);
-        if (fd == -1) {
-            fprintf(stderr, "%s: %s\n", ei.filename_, strerror(errno));
-            exit(1);
-        }
-    }
-
     mode_t creatmode = S_IRWXU | S_IRWXG | S_IRWXO;
-    {
-        struct stat s;
-        int r = fstat(fd, &s);
-        assert(r == 0);
-        ei.grow(S_ISREG(s.st_mode) ? (s.st_size + 32767) & ~32767 : 262144);
-        creatmode &= s.st_mode;
-    }
-
-    while (true) {
-        if (ei.size_ == ei.capacity_) {
-            ei.grow(ei.capacity_ * 2);
-        }
-        ssize_t r = read(fd, &ei.data_[ei.size_], ei.capacity_ - ei.size_);
-        if (r == 0) {
-            break;
-        } else if (r == -1 && errno != EAGAIN) {
-            fprintf(stderr, "%s: %s\n", ei.filename_, strerror(errno));
-            exit(1);
-        } else if (r > 0) {
-            ei.size_ += r;
-        }
+    creatmode &= read_elf(ei, optind < argc ? argv[optind] : "-");
+    elf_info symei;
+    elf_info& src = symfile ? symei : ei;
+    if (symfile) {
+        read_elf(symei, symfile);
     }
 
-    // check contents
-    if (!ei.validate()) {
+    unsigned symtabndx = src.find_section(".symtab");
+    if (symtabndx == 0
+        || src.sht_[symtabndx].sh_type != ELF_SHT_SYMTAB) {
+        fprintf(stderr, "%s: no .symtab section\n", src.filename_);
         exit(1);
     }
 
-    // align symbol table
-    auto symtabndx = ei.find_section(".symtab");
-    if (symtabndx == 0
-        || ei.sht_[symtabndx].sh_type != ELF_SHT_SYMTAB) {
-        fprintf(stderr, "%s: no .symtab section\n", ei.filename_);
-        exit(1);
+    std::vector<char> table;
+    build_compact_symtab(src, table);
+    if (verbose) {
+        fprintf(stderr, "%s: %zu-byte compact symbol table\n",
+                ei.filename_, table.size());
     }
 
-    {
-        auto& symtab = ei.sht_[symtabndx];
-        if (symtab.sh_link >= ei.eh_->e_shnum
-            || symtab.sh_link != symtabndx + 1
-            || ei.sht_[symtab.sh_link].sh_type != ELF_SHT_STRTAB) {
-            fprintf(stderr, "%s: .symtab has unexpected links\n", ei.filename_);
-            exit(1);
+    // find `lsymtab_name` and the load address it holds
+    char* stref_data = nullptr;
+    for (auto sym = src.find_symbol(lsymtab_name);
+         sym;
+         sym = src.find_symbol(lsymtab_name, sym)) {
+        if ((sym->st_info & ELF_STT_MASK) != ELF_STT_OBJECT
+            || sym->st_shndx == ELF_SHN_UNDEF) {
+            continue;
         }
-
-        // align symbol table on a page boundary
-        if (symtab.sh_offset & 0xFFF) {
-            assert(symtab.sh_addralign < 0x1000);
-            symtab.sh_addralign = 0x1000;
-            ei.changed_ = true;
-            ei.shift_sections(symtab.sh_offset,
-                              0x1000 - (symtab.sh_offset & 0xFFF));
-            if (verbose) {
-                fprintf(stderr, "%s: aligning <.symtab>\n", ei.filename_);
-            }
+        if (sym->st_size != sizeof(elf_symtabref)) {
+            fprintf(stderr, "%s: `%s` symbol @0x%" PRIx64 " has size %" PRIu64 " (expected %zu)\n",
+                    src.filename_, lsymtab_name, sym->st_value,
+                    sym->st_size, sizeof(elf_symtabref));
+            exit(1);
         }
-    }
-
-    // figure out allocation range
-    uint64_t first_offset = ei.sht_[symtabndx].sh_offset;
-    uint64_t strtab_offset = ei.sht_[symtabndx + 1].sh_offset;
-    uint64_t last_offset = ei.sht_[symtabndx + 1].sh_offset
-        + ei.sht_[symtabndx + 1].sh_size;
-
-    // find `lsymtab_name`
-    if (!rewrite_symtabref(ei, lsymtab_name, loadaddr,
-                           strtab_offset - first_offset,
-                           last_offset - first_offset)
-        && lsymtab_set) {
-        fprintf(stderr, "%s: no `%s` symbol found\n", ei.filename_, lsymtab_name);
-        exit(1);
-    }
-
-    // sort symbol table by address
-    ei.sort_symtab();
-
-    // mark symbol table as allocated
-    if (loadaddr && !(ei.sht_[symtabndx].sh_flags & ELF_SHF_ALLOC)) {
-        ei.sht_[symtabndx].sh_flags |= ELF_SHF_ALLOC;
-        ei.sht_[symtabndx].sh_addr = loadaddr;
-        ei.changed_ = true;
-        if (verbose) {
-            fprintf(stderr, "%s: marking <.symtab> as allocated\n", ei.filename_);
+        stref_data = ei.data_at(sym->st_value, sizeof(elf_symtabref));
+        if (!stref_data) {
+            fprintf(stderr, "%s: `%s` symbol @0x%" PRIx64 " bad reference\n",
+                    ei.filename_, lsymtab_name, sym->st_value);
+            exit(1);
         }
+        break;
     }
-    if (loadaddr && !(ei.sht_[symtabndx + 1].sh_flags & ELF_SHF_ALLOC)) {
-        ei.sht_[symtabndx + 1].sh_flags |= ELF_SHF_ALLOC;
-        ei.sht_[symtabndx + 1].sh_addr = loadaddr
-            + strtab_offset - first_offset;
-        ei.changed_ = true;
-        if (verbose) {
-            fprintf(stderr, "%s: marking <.symstrtab> as allocated\n", ei.filename_);
+    if (!stref_data) {
+        if (lsymtab_set) {
+            fprintf(stderr, "%s: no `%s` symbol found\n", src.filename_, lsymtab_name);
+            exit(1);
         }
+    } else if (!loadaddr) {
+        memcpy(&loadaddr, stref_data, sizeof(loadaddr));
     }
 
-    // find or add a program header
-    if (loadaddr) {
+    // load the table at `loadaddr` from a page-aligned spot at the end of
+    // the file, replacing a table added by an earlier run
+    size_t table_size = table.size();
+    size_t nsym = reinterpret_cast<elf_compact_symtab*>(table.data())->nsym;
+    if (loadaddr && nsym != 0) {
         unsigned i = 0;
-        while (i != ei.eh_->e_phnum
-               && ei.pht_[i].p_va + ei.pht_[i].p_filesz < loadaddr) {
+        while (i != ei.eh_->e_phnum && ei.pht_[i].p_va < loadaddr) {
             ++i;
         }
-
-        bool found = false;
-        if (i != ei.eh_->e_phnum
-            && ei.pht_[i].p_va == loadaddr
-            && ei.pht_[i].p_offset == first_offset
-            && ei.pht_[i].p_filesz >= last_offset - first_offset) {
-            found = true;
+        bool replace = i != ei.eh_->e_phnum && ei.pht_[i].p_va == loadaddr;
+        if (replace) {
+            auto& ph = ei.pht_[i];
+            if (ph.p_offset + ph.p_filesz != ei.size_
+                || ph.p_filesz < sizeof(elf_compact_symtab)
+                || memcmp(&ei.data_[ph.p_offset], "kSym", 4) != 0) {
+                fprintf(stderr, "%s: another segment loads at 0x%" PRIx64 "\n",
+                        ei.filename_, loadaddr);
+                exit(1);
+            }
+            if (ph.p_filesz == table_size
+                && memcmp(&ei.data_[ph.p_offset], table.data(), table_size) == 0) {
+                table_size = 0;         // unchanged
+            } else {
+                ei.size_ = ph.p_offset;
+            }
+        } else if (ei.eh_->e_phoff + (ei.eh_->e_phnum + 1) * sizeof(*ei.pht_)
+                       > ei.first_offset()
+                   || ei.eh_->e_shoff <= ei.first_offset()) {
+            fprintf(stderr, "%s: unexpected program headers\n", ei.filename_);
+            exit(1);
         }
 
-        if (!found) {
-            uint64_t offset0 = ei.first_offset();
-            if (ei.eh_->e_phoff + (ei.eh_->e_phnum + 1) * sizeof(*ei.pht_)
-                    > offset0
-                || ei.eh_->e_shoff <= offset0) {
-                fprintf(stderr, "%s: unexpected program headers\n", ei.filename_);
-                exit(1);
+        if (table_size != 0) {
+            size_t offset = (ei.size_ + 0xFFF) & ~size_t(0xFFF);
+            // `grow` moves `data_`, and `stref_data` points into it
+            ptrdiff_t stref_offset = stref_data ? stref_data - ei.data_ : -1;
+            ei.grow(offset + table_size);
+            if (stref_data) {
+                stref_data = ei.data_ + stref_offset;
             }
+            memset(&ei.data_[ei.size_], 0, offset - ei.size_);
+            memcpy(&ei.data_[offset], table.data(), table_size);
+            ei.size_ = offset + table_size;
+
             auto& ph = ei.pht_[i];
-            memmove(&ph + 1, &ph, (ei.eh_->e_phnum - i) * sizeof(ph));
-            ++ei.eh_->e_phnum;
+            if (!replace) {
+                memmove(&ph + 1, &ph, (ei.eh_->e_phnum - i) * sizeof(ph));
+                ++ei.eh_->e_phnum;
+            }
             ph.p_type = ELF_PTYPE_LOAD;
             ph.p_flags = ELF_PFLAG_READ;
-            ph.p_offset = first_offset;
+            ph.p_offset = offset;
             ph.p_va = ph.p_pa = loadaddr;
-            ph.p_filesz = last_offset - first_offset;
-            ph.p_memsz = ph.p_filesz;
+            ph.p_filesz = ph.p_memsz = table_size;
             ph.p_align = 0x1000;
             ei.changed_ = true;
             if (verbose) {
-                fprintf(stderr, "%s: adding program header\n", ei.filename_);
+                fprintf(stderr, "%s: %s program header\n", ei.filename_,
+                        replace ? "replacing" : "adding");
+            }
+        }
+    }
+
+    // fill out `lsymtab_name`
+    if (stref_data) {
+        elf_symtabref xstref = {
+            reinterpret_cast<const elf_compact_symtab*>(loadaddr),
+            loadaddr && nsym != 0 ? table.size() : 0
+        };
+        if (memcmp(stref_data, &xstref, sizeof(xstref)) != 0) {
+            memcpy(stref_data, &xstref, sizeof(xstref));
+            ei.changed_ = true;
+            if (verbose) {
+                fprintf(stderr, "%s: filling out `%s`\n", ei.filename_, lsymtab_name);
             }
         }
     }
 
     // write output
-    if (!ei.changed_ && optind + 1 == argc && fd != STDIN_FILENO) {
+    bool stdin_image = optind >= argc || strcmp(argv[optind], "-") == 0;
+    if (!ei.changed_ && optind + 1 == argc && !stdin_image) {
         exit(0);
     }
 
@@ -157,7 +157,7 @@ always:
 .PHONY: all always clean realclean distclean cleanfs fsck \
 	run run-graphic run-console run-monitor \
 	run-gdb run-gdb-graphic run-gdb-console run-gdb-report \
-	check-qemu-console check-qemu stop kill \
+	check-qemu-console check-qemu stop kill trace \
 	run-% run-graphic-% run-console-% run-monitor-% \
 	run-gdb-% run-gdb-graphic-% run-gdb-console-%
 
@@ -70,12 +70,69 @@ struct elf_symbol {
     uint64_t st_size;
 };
 
-// in-memory reference to debug symbol table + string table
+// compact kernel symbol table (built by `mkchickadeesymtab`). Symbols
+// are sorted by address; symbol `i` starts at `base + addr[i]`, spans
+// `size[i]` bytes (0 if unknown), and is named `strings + name[i]`.
+// Names are deduplicated, and a name that ends another shares its bytes.
+// `data` holds the arrays `addr`, `size`, and `name` (`nsym` words each),
+// then `first` (`nbuckets + 1` words), then the strings. The symbol
+// containing an address in bucket `b = (a - base) >> shift` has index
+// in `[first[b], first[b + 1]]`.
+#define ELF_COMPACT_SYMTAB_MAGIC 0x6D79536BU    // "kSym"
+struct elf_compact_symtab {
+    uint32_t magic;
+    uint32_t nsym;
+    uint64_t base;
+    uint32_t shift;
+    uint32_t nbuckets;
+    uint32_t data[];
+
+    const uint32_t* addr() const {
+        return data;
+    }
+    const uint32_t* size() const {
+        return data + nsym;
+    }
+    const uint32_t* name() const {
+        return data + 2 * nsym;
+    }
+    const uint32_t* first() const {
+        return data + 3 * nsym;
+    }
+    const char* strings() const {
+        return reinterpret_cast<const char*>(first() + nbuckets + 1);
+    }
+};
+
+// in-memory reference to the compact symbol table
 struct elf_symtabref {
-    elf_symbol* sym;
-    size_t nsym;
-    char* strtab;
-    size_t size;
+    const elf_compact_symtab* symtab;
+    size_t size;                        // 0 if there is no table
+};
+
+// program archive (built by `mkbootdisk -z`): the kernel's embedded
+// program images. Each image is split into LZ4ARCHIVE_CHUNKSIZE-byte
+// chunks, and each chunk is one independent LZ4 block (or, if that would
+// not be smaller, stored as is), so any page of an image can be read
+// without decompressing the rest. Identical chunks, and so identical
+// images, are stored once. The header is followed by `nimages`
+// `lz4archive_image`s, then `nchunks` `lz4archive_chunk`s; offsets are
+// from the start of the archive, which need not be aligned.
+#define LZ4ARCHIVE_MAGIC        0x345A4C57U     // "WLZ4"
+#define LZ4ARCHIVE_CHUNKSIZE    4096
+struct lz4archive_header {
+    uint32_t magic;
+    uint32_t nimages;
+    uint32_t nchunks;
+};
+struct lz4archive_image {
+    uint32_t name;                      // offset of NUL-terminated name
+    uint32_t size;                      // uncompressed size
+    uint32_t first_chunk;               // index of the image's first chunk
+};
+struct lz4archive_chunk {
+    uint32_t offset;
+    uint32_t size;                      // == uncompressed size if stored
 };
 
 // Values for elf_header::e_type
@@ -0,0 +1,199 @@
+#include "k-ata.hh"
+#include "k-pci.hh"
+
+// ATA command block register offsets
+enum {
+    reg_data = 0, reg_error = 1, reg_count = 2, reg_lba0 = 3,
+    reg_lba1 = 4, reg_lba2 = 5, reg_drive = 6, reg_status = 7,
+    reg_command = 7
+};
+
+// status bits
+enum {
+    status_err = 0x01, status_drq = 0x08, status_df = 0x20,
+    status_drdy = 0x40, status_bsy = 0x80
+};
+
+// commands
+enum {
+    cmd_read_sectors = 0x20, cmd_write_sectors = 0x30,
+    cmd_flush_cache = 0xE7, cmd_identify = 0xEC
+};
+
+// device control: mask the interrupt (polled I/O only)
+#define ATA_CTL_NIEN 0x02
+
+// a command that takes longer than this many status polls has failed
+#define ATA_SPIN_LIMIT 100000000UL
+
+static ata_disk data_disk;
+static bool data_disk_probed = false;
+static bool data_disk_found = false;
+
+
+// ata_disk::wait(drq)
+//    Wait until the drive is not busy and, if `drq`, ready to move data.
+//    Return 0, or -1 on error or timeout.
+
+int ata_disk::wait(bool drq) {
+    for (unsigned long n = 0; n != ATA_SPIN_LIMIT; ++n) {
+        uint8_t s = inb(cmd_ + reg_status);
+        if (s & status_bsy) {
+            continue;
+        } else if (s & (status_err | status_df)) {
+            return -1;
+        } else if (!drq || (s & status_drq)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// ata_disk::command(cmd, sector, nsect)
+//    Issue `cmd` for `nsect` (1-256) sectors at `sector`.
+
+void ata_disk::command(uint8_t cmd, size_t sector, size_t nsect) {
+    outb(cmd_ + reg_drive, 0xE0 | (slave_ << 4) | ((sector >> 24) & 0x0F));
+    outb(cmd_ + reg_count, nsect);  // 256 is sent as 0
+    outb(cmd_ + reg_lba0, sector);
+    outb(cmd_ + reg_lba1, sector >> 8);
+    outb(cmd_ + reg_lba2, sector >> 16);
+    outb(cmd_ + reg_command, cmd);
+}
+
+// ata_disk::identify()
+//    Return true if an ATA disk answers at this position, setting
+//    `nsectors_` from its IDENTIFY data.
+
+bool ata_disk::identify() {
+    outb(ctl_, ATA_CTL_NIEN);
+    outb(cmd_ + reg_drive, 0xA0 | (slave_ << 4));
+    for (int i = 0; i != 4; ++i) {
+        (void) inb(ctl_);               // 400ns for the drive to respond
+    }
+    outb(cmd_ + reg_count, 0);
+    outb(cmd_ + reg_lba0, 0);
+    outb(cmd_ + reg_lba1, 0);
+    outb(cmd_ + reg_lba2, 0);
+    outb(cmd_ + reg_command, cmd_identify);
+    uint8_t s = inb(cmd_ + reg_status);
+    if (s == 0 || s == 0xFF) {
+        return false;                   // no drive, or a floating bus
+    }
+    for (unsigned long n = 0; (s & status_bsy) && n != ATA_SPIN_LIMIT; ++n) {
+        s = inb(cmd_ + reg_status);
+    }
+    if ((s & status_bsy)
+        || inb(cmd_ + reg_lba1) != 0 || inb(cmd_ + reg_lba2) != 0) {
+        return false;                   // hung, or ATAPI (a CD drive)
+    }
+    if (wait(true) < 0) {
+        return false;
+    }
+    uint16_t id[256];
+    insw(cmd_ + reg_data, id, 256);
+    nsectors_ = id[60] | (uint32_t(id[61]) << 16);
+    return (id[49] & 0x200) != 0 && nsectors_ != 0;     // LBA supported
+}
+
+
+// ata_disk::find()
+//    Return the data disk, probing for it the first time.
+
+ata_disk* ata_disk::find() {
+    if (data_disk_probed) {
+        return data_disk_found ? &data_disk : nullptr;
+    }
+    data_disk_probed = true;
+
+    auto& pci = pcistate::get();
+    for (int addr = pci.find([&] (int a) {
+                return pci.readw(a + pci.config_subclass) == 0x0101;
+            });
+         addr >= 0 && !data_disk_found;
+         addr = pci.find([&] (int a) {
+                 return pci.readw(a + pci.config_subclass) == 0x0101;
+             }, pci.next(addr))) {
+        pci.enable(addr);
+        uint8_t progif = pci.readb(addr + pci.config_rpsc + 1);
+        for (int chan = 0; chan != 2 && !data_disk_found; ++chan) {
+            uint16_t cmd = chan ? 0x170 : 0x1F0, ctl = chan ? 0x376 : 0x3F6;
+            if (progif & (1 << (2 * chan))) {   // native mode: use BARs
+                cmd = pci.readl(addr + pci.config_bar0 + 8 * chan) & ~3U;
+                ctl = (pci.readl(addr + pci.config_bar1 + 8 * chan) & ~3U) + 2;
+            }
+            for (int drive = chan ? 0 : 1; drive != 2; ++drive) {
+                data_disk.cmd_ = cmd;
+                data_disk.ctl_ = ctl;
+                data_disk.slave_ = drive;
+                if (data_disk.identify()) {
+                    data_disk_found = true;
+                    log_printf("ata: %zu-sector disk at %x%s\n",
+                               data_disk.nsectors_, cmd,
+                               drive ? " (slave)" : "");
+                    break;
+                }
+            }
+        }
+    }
+    return data_disk_found ? &data_disk : nullptr;
+}
+
+
+// ata_disk::read(sector, buf, nsect), ata_disk::write(sector, buf, nsect)
+//    Transfer sectors, at most 256 per command.
+
+int ata_disk::read(size_t sector, void* buf, size_t nsect) {
+    if (sector + nsect > nsectors_) {
+        return -1;
+    }
+    uint8_t* p = reinterpret_cast<uint8_t*>(buf);
+    while (nsect != 0) {
+        size_t n = min(nsect, size_t(256));
+        if (wait(false) < 0) {
+            return -1;
+        }
+        command(cmd_read_sectors, sector, n);
+        for (size_t i = 0; i != n; ++i, p += sectorsize) {
+            if (wait(true) < 0) {
+                return -1;
+            }
+            insw(cmd_ + reg_data, p, sectorsize / 2);
+        }
+        sector += n;
+        nsect -= n;
+    }
+    return 0;
+}
+
+int ata_disk::write(size_t sector, const void* buf, size_t nsect) {
+    if (sector + nsect > nsectors_) {
+        return -1;
+    }
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(buf);
+    while (nsect != 0) {
+        size_t n = min(nsect, size_t(256));
+        if (wait(false) < 0) {
+            return -1;
+        }
+        command(cmd_write_sectors, sector, n);
+        for (size_t i = 0; i != n; ++i, p += sectorsize) {
+            if (wait(true) < 0) {
+                return -1;
+            }
+            outsw(cmd_ + reg_data, p, sectorsize / 2);
+        }
+        sector += n;
+        nsect -= n;
+    }
+    return wait(false);
+}
+
+int ata_disk::flush() {
+    if (wait(false) < 0) {
+        return -1;
+    }
+    outb(cmd_ + reg_drive, 0xE0 | (slave_ << 4));
+    outb(cmd_ + reg_command, cmd_flush_cache);
+    return wait(false);
+}
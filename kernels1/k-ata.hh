@@ -0,0 +1,46 @@
+#ifndef WEENSYOS_K_ATA_HH
+#define WEENSYOS_K_ATA_HH
+#include "kernel.hh"
+
+// `ata_disk` drives one ATA hard disk by programmed I/O: the CPU moves
+// every word through the data port and polls the status register, with
+// the disk's interrupt masked. Commands use 28-bit sector numbers, so
+// at most 128 GiB of a disk is reachable.
+//
+// `ata_disk::find` looks for IDE controllers on the PCI bus (class 1,
+// subclass 1), using each channel's BARs in native mode and the legacy
+// ports (0x1F0, 0x170) in compatibility mode. It returns the first disk
+// other than the primary master, which holds the boot image. The
+// `GNUmakefile` attaches `weensydisk.img` as the secondary master.
+//
+// Commands spin with `kernel_lock` held.
+
+struct ata_disk {
+    static constexpr size_t sectorsize = 512;
+
+    // Return the data disk, or `nullptr` if there is none
+    static ata_disk* find();
+
+    // Read (write) `nsect` sectors starting at `sector`; return 0 or -1
+    int read(size_t sector, void* buf, size_t nsect);
+    int write(size_t sector, const void* buf, size_t nsect);
+    // Flush the drive's write cache; return 0 or -1
+    int flush();
+
+    // Return the number of sectors
+    size_t nsectors() const {
+        return nsectors_;
+    }
+
+  private:
+    uint16_t cmd_;                      // command block registers
+    uint16_t ctl_;                      // device control register
+    bool slave_;                        // drive 1 on its channel
+    size_t nsectors_;
+
+    bool identify();
+    int wait(bool drq);
+    void command(uint8_t cmd, size_t sector, size_t nsect);
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include "k-bufcache.hh"
+
+bufcache disk_cache;
+
+static constexpr size_t sectors_per_block =
+    bufcache::blocksize / ata_disk::sectorsize;
+
+
+// bufcache::init()
+//    Find the data disk and allocate the cache's buffers. Without a
+//    disk, the cache stays unready and disk system calls fail.
+
+bool bufcache::init() {
+    ata_disk* disk = ata_disk::find();
+    if (!disk || disk->nsectors() < sectors_per_block) {
+        return false;
+    }
+    for (bcentry& e : entries_) {
+        if (!(e.buf_ = reinterpret_cast<unsigned char*>(kalloc(blocksize)))) {
+            return false;
+        }
+        lru_.push_back(&e);
+    }
+    for (bcentry*& h : hash_) {
+        h = nullptr;
+    }
+    disk_ = disk;
+    stats_.nblocks = nblocks();
+    stats_.nentries = nentries;
+    return true;
+}
+
+size_t bufcache::nblocks() const {
+    return disk_ ? disk_->nsectors() / sectors_per_block : 0;
+}
+
+
+void bufcache::unhash(bcentry* e) {
+    bcentry** pp = &chain(e->bn_);
+    while (*pp != e) {
+        pp = &(*pp)->hash_next_;
+    }
+    *pp = e->hash_next_;
+    e->hash_next_ = nullptr;
+    e->bn_ = -1;
+}
+
+int bufcache::writeback(bcentry* e) {
+    if (e->dirty_) {
+        if (disk_->write(e->bn_ * sectors_per_block, e->buf_,
+                         sectors_per_block) < 0) {
+            return -1;
+        }
+        e->dirty_ = false;
+        ++stats_.nwritebacks;
+    }
+    return 0;
+}
+
+
+// bufcache::get(bn, fill)
+//    Return the entry for block `bn`, most recently used.
+
+bcentry* bufcache::get(size_t bn, bool fill) {
+    if (!disk_ || bn >= nblocks()) {
+        return nullptr;
+    }
+    bcentry* e = chain(bn);
+    while (e && e->bn_ != bn) {
+        e = e->hash_next_;
+    }
+    if (e) {
+        ++stats_.nhits;
+        lru_.erase(e);
+        lru_.push_front(e);
+        return e;
+    }
+
+    // evict the least recently used entry, writing it back if dirty
+    ++stats_.nmisses;
+    e = lru_.back();
+    if (writeback(e) < 0) {
+        return nullptr;
+    }
+    if (e->bn_ != size_t(-1)) {
+        unhash(e);
+    }
+    if (fill) {
+        if (disk_->read(bn * sectors_per_block, e->buf_,
+                        sectors_per_block) < 0) {
+            return nullptr;
+        }
+        ++stats_.nreads;
+    }
+    e->bn_ = bn;
+    e->hash_next_ = chain(bn);
+    chain(bn) = e;
+    lru_.erase(e);
+    lru_.push_front(e);
+    return e;
+}
+
+
+void bufcache::discard(bcentry* e) {
+    assert(!e->dirty_);
+    unhash(e);
+    lru_.erase(e);
+    lru_.push_back(e);
+}
+
+
+// bufcache::sync()
+//    Write back every dirty block, in block order so the disk sees
+//    mostly sequential writes, then flush the drive's cache.
+
+int bufcache::sync() {
+    if (!disk_) {
+        return -1;
+    }
+    int r = 0;
+    while (true) {
+        bcentry* next = nullptr;
+        for (bcentry& e : entries_) {
+            if (e.dirty_ && (!next || e.bn_ < next->bn_)) {
+                next = &e;
+            }
+        }
+        if (!next) {
+            break;
+        }
+        if (writeback(next) < 0) {
+            next->dirty_ = false;       // drop it rather than loop forever
+            r = -1;
+        }
+    }
+    ++stats_.nsyncs;
+    return disk_->flush() < 0 ? -1 : r;
+}
@@ -0,0 +1,73 @@
+#ifndef WEENSYOS_K_BUFCACHE_HH
+#define WEENSYOS_K_BUFCACHE_HH
+#include "kernel.hh"
+#include "k-ata.hh"
+
+// `bufcache` keeps recently used blocks of the data disk in memory. A
+// block is one page (8 sectors), and the cache holds `nentries` of them
+// in pages from `kalloc`, so programs can work with more data than
+// physical memory holds.
+//
+// Entries are found through a hash table on block number and kept on an
+// LRU list, most recently used first. A miss takes the entry at the
+// back of the list. Writes only mark entries dirty; a dirty block goes
+// to disk when its entry is evicted or at `sync` (write-back).
+//
+// The cache is protected by `kernel_lock`.
+//
+//     bcentry* e = disk_cache.get(bn, true);      // read block `bn`
+//     memcpy(e->buf_ + off, data, n);
+//     disk_cache.mark_dirty(e);
+
+struct bcentry {
+    size_t bn_ = -1;                    // block number, or -1 if unused
+    unsigned char* buf_ = nullptr;      // contents (one page)
+    bool dirty_ = false;                // modified since read or written
+    bcentry* hash_next_ = nullptr;      // next in `bn_`'s hash chain
+    list_links lru_links_;              // links in `bufcache::lru_`
+};
+
+struct bufcache {
+    static constexpr size_t blocksize = PAGESIZE;
+    static constexpr size_t nentries = 64;
+    static constexpr size_t nhash = 128;
+
+    // Find the data disk and allocate buffers; return false on failure
+    bool init();
+    bool ready() const {
+        return disk_ != nullptr;
+    }
+    // Return the number of blocks on the disk
+    size_t nblocks() const;
+
+    // Return the entry for block `bn`, loading it from disk if `fill`
+    // (pass false if the caller will overwrite the whole block). Return
+    // `nullptr` on error or if `bn` is past the end of the disk.
+    bcentry* get(size_t bn, bool fill);
+    void mark_dirty(bcentry* e) {
+        e->dirty_ = true;
+    }
+    // Forget the clean entry `e`'s contents and reuse it first
+    void discard(bcentry* e);
+    // Write all dirty blocks to disk and flush it; return 0 or -1
+    int sync();
+
+    // counters, reported by `sys_disksync`
+    disk_stats stats_;
+
+  private:
+    ata_disk* disk_ = nullptr;
+    bcentry entries_[nentries];
+    bcentry* hash_[nhash];
+    list<bcentry, &bcentry::lru_links_> lru_;
+
+    bcentry*& chain(size_t bn) {
+        return hash_[bn % nhash];
+    }
+    void unhash(bcentry* e);
+    int writeback(bcentry* e);
+};
+
+extern bufcache disk_cache;
+
+#endif
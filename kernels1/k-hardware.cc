@@ -3,7 +3,10 @@
 #include "elf.h"
 #include "k-apic.hh"
 #include "k-pci.hh"
+#include "k-bufcache.hh"
 #include "k-vmiter.hh"
+#include "k-trace.hh"
+#include "k-profile.hh"
 #include <atomic>
 
 
@@ -20,7 +23,7 @@ pcistate pcistate::state;
 static void init_kernel_memory();
 static void init_interrupts();
 static void init_constructors();
-static void init_cpu_hardware();
+static void init_cpu_hardware(int cpuindex);
 static void stash_kernel_data(bool restore);
 
 void init_hardware() {
@@ -38,7 +41,7 @@ void init_hardware() {
     init_constructors();
 
     // initialize this CPU
-    init_cpu_hardware();
+    init_cpu_hardware(0);
 }
 
 
@@ -87,11 +90,43 @@ static void set_gate(x86_64_gatedescriptor* gate, uintptr_t addr,
 }
 
 x86_64_pagetable kernel_pagetable[5];
+uint64_t cr3_noflush;
+uintptr_t memsize_physical;
 static uint64_t gdt_segments[7];
 
+static uint8_t cmos_read(int reg) {
+    outb(0x70, reg);
+    return inb(0x71);
+}
+
+// detect_physical_memory()
+//    Return the size of physical memory as recorded by the BIOS in the
+//    CMOS: registers 0x34-0x35 count 64 KiB blocks above 16 MiB, and
+//    0x30-0x31 count KiB above 1 MiB (up to 64 MiB).
+
+static uintptr_t detect_physical_memory() {
+    uintptr_t blocks = cmos_read(0x34) | (cmos_read(0x35) << 8);
+    if (blocks != 0) {
+        return 0x1000000 + blocks * 0x10000;
+    }
+    uintptr_t kib = cmos_read(0x30) | (cmos_read(0x31) << 8);
+    return 0x100000 + kib * 1024;
+}
+
 void init_kernel_memory() {
     stash_kernel_data(false);
 
+    // size physical memory; beyond the first 4 MiB it is mapped with
+    // 2 MiB pages, so round it to that
+    memsize_physical = min(detect_physical_memory(),
+                           uintptr_t(MEMSIZE_PHYSICAL_MAX));
+    if (memsize_physical > 0x400000) {
+        memsize_physical = round_down(memsize_physical, 0x200000);
+    }
+    memsize_physical = round_down(max(memsize_physical,
+                                      uintptr_t(MEMSIZE_PHYSICAL_MIN)),
+                                  PAGESIZE);
+
     // initialize segment descriptors for kernel code and data
     gdt_segments[0] = 0;
     set_app_segment(&gdt_segments[SEGSEL_KERN_CODE >> 3],
@@ -125,18 +160,26 @@ void init_kernel_memory() {
     kernel_pagetable[1].entry[3] =
         (3UL << 30) | PTE_P | PTE_W | PTE_PS;
 
-    // user-accessible mappings for physical memory,
-    // except that (for debuggability) nullptr is totally inaccessible
-    for (vmiter it(kernel_pagetable, 0);
-         it.va() < MEMSIZE_PHYSICAL;
-         it += PAGESIZE) {
-        if (it.va() != 0) {
-            it.map(it.va(), PTE_P | PTE_W | PTE_U);
-        }
+    // user-accessible mappings for the first 4 MiB of physical memory,
+    // except that (for debuggability) nullptr is totally inaccessible;
+    // the rest gets kernel-only 2 MiB pages
+    uintptr_t low_memsize = min(memsize_physical, uintptr_t(0x400000));
+    vmiter(kernel_pagetable, PAGESIZE)
+        .map_range(PAGESIZE, low_memsize - PAGESIZE,
+                   PTE_P | PTE_W | PTE_U);
+    for (uintptr_t pa = low_memsize; pa < memsize_physical; pa += 0x200000) {
+        kernel_pagetable[2].entry[pa >> 21] = pa | PTE_P | PTE_W | PTE_PS;
     }
 
     wrcr3(kptr2pa(kernel_pagetable));
 
+    // use process-context identifiers if available, so switching page
+    // tables need not flush the whole TLB
+    if (cpuid(1).ecx & (1 << 17)) {
+        wrcr4(rdcr4() | CR4_PCIDE);
+        cr3_noflush = CR3_NOFLUSH;
+    }
+
 
     // Now that boot-time structures (pagetable and global descriptor
     // table) have been replaced, we can reuse boot-time memory.
@@ -189,30 +232,40 @@ void init_constructors() {
 }
 
 
-static x86_64_taskstate taskstate;
+std::atomic<int> ncpu;
+cpustate* cpus[MAXCPU];
+
+void init_cpu_hardware(int cpuindex) {
+    // initialize per-CPU state, which lives at the bottom of this CPU's
+    // kernel stack
+    cpustate* c = this_cpu();
+    assert(reinterpret_cast<uintptr_t>(c) + PAGESIZE
+           == cpu_stack_top(cpuindex));
+    new (c) cpustate();
+    c->cpuindex_ = cpuindex;
+    c->lapic_id_ = lapicstate::get().id();
 
-void init_cpu_hardware() {
     // initialize per-CPU segments
-    gdt_segments[0] = 0;
-    set_app_segment(&gdt_segments[SEGSEL_KERN_CODE >> 3],
+    uint64_t* segments = c->gdt_segments_;
+    segments[0] = 0;
+    set_app_segment(&segments[SEGSEL_KERN_CODE >> 3],
                     X86SEG_X | X86SEG_L, 0);
-    set_app_segment(&gdt_segments[SEGSEL_KERN_DATA >> 3],
+    set_app_segment(&segments[SEGSEL_KERN_DATA >> 3],
                     X86SEG_W, 0);
-    set_app_segment(&gdt_segments[SEGSEL_APP_CODE >> 3],
+    set_app_segment(&segments[SEGSEL_APP_CODE >> 3],
                     X86SEG_X | X86SEG_L, 3);
-    set_app_segment(&gdt_segments[SEGSEL_APP_DATA >> 3],
+    set_app_segment(&segments[SEGSEL_APP_DATA >> 3],
                     X86SEG_W, 3);
-    set_sys_segment(&gdt_segments[SEGSEL_TASKSTATE >> 3],
-                    (uintptr_t) &taskstate, sizeof(taskstate),
+    set_sys_segment(&segments[SEGSEL_TASKSTATE >> 3],
+                    (uintptr_t) &c->taskstate_, sizeof(c->taskstate_),
                     X86SEG_TSS, 0);
 
     // taskstate lets the kernel receive interrupts
-    memset(&taskstate, 0, sizeof(taskstate));
-    taskstate.ts_rsp[0] = KERNEL_STACK_TOP;
+    c->taskstate_.ts_rsp[0] = cpu_stack_top(cpuindex);
 
     x86_64_pseudodescriptor gdt, idt;
-    gdt.limit = sizeof(gdt_segments) - 1;
-    gdt.base = (uint64_t) gdt_segments;
+    gdt.limit = sizeof(c->gdt_segments_) - 1;
+    gdt.base = (uint64_t) segments;
     idt.limit = sizeof(interrupt_descriptors) - 1;
     idt.base = (uint64_t) interrupt_descriptors;
 
@@ -238,7 +291,7 @@ void init_cpu_hardware() {
     // set up syscall/sysret
     wrmsr(MSR_IA32_STAR, (uintptr_t(SEGSEL_KERN_CODE) << 32)
           | (uintptr_t(SEGSEL_APP_CODE) << 48));
-    wrmsr(MSR_IA32_LSTAR, reinterpret_cast<uint64_t>(syscall_entry));
+    wrmsr(MSR_IA32_LSTAR, syscall_entries[cpuindex]);
     wrmsr(MSR_IA32_FMASK, EFLAGS_TF | EFLAGS_DF | EFLAGS_IF
           | EFLAGS_IOPL_MASK | EFLAGS_AC | EFLAGS_NT);
 
@@ -247,10 +300,9 @@ void init_cpu_hardware() {
     auto& lapic = lapicstate::get();
     lapic.enable_lapic(INT_IRQ + IRQ_SPURIOUS);
 
-    // timer is in periodic mode
+    // timer is in one-shot mode, initially disarmed
     lapic.write(lapic.reg_timer_divide, lapic.timer_divide_1);
-    lapic.write(lapic.reg_lvt_timer,
-                lapic.timer_periodic | (INT_IRQ + IRQ_TIMER));
+    lapic.write(lapic.reg_lvt_timer, INT_IRQ + IRQ_TIMER);
     lapic.write(lapic.reg_timer_initial_count, 0);
 
     // disable logical interrupt lines
@@ -264,20 +316,107 @@ void init_cpu_hardware() {
     // acknowledge any outstanding interrupts
     lapic.error();
     lapic.ack();
+
+    // the boot CPU owns the keyboard; its interrupt wakes an idle kernel
+    if (cpuindex == 0) {
+        ioapicstate::get().enable_irq(IRQ_KEYBOARD, INT_IRQ + IRQ_KEYBOARD,
+                                      c->lapic_id_);
+    }
+
+    // use PCIDs if the boot CPU does
+    if (cr3_noflush) {
+        wrcr4(rdcr4() | CR4_PCIDE);
+    }
+
+    cpus[cpuindex] = c;
+    ++ncpu;
 }
 
 
-// init_timer(rate)
-//    Set the timer interrupt to fire `rate` times a second. Disables the
-//    timer interrupt if `rate <= 0`.
+// start_aps()
+//    Send INIT and startup IPIs to all other CPUs. Each one enters at
+//    `ap_entry` in real mode, switches to 64-bit mode on the kernel page
+//    table, claims the next index in `ap_next_cpuindex` (and with it a
+//    kernel stack), and calls `ap_start`. The Intel MP specification asks
+//    for 10ms and 200us delays between the IPIs; QEMU needs none, so we
+//    just wait for each IPI's delivery.
+
+int ap_next_cpuindex = 1;       // claimed with `lock xadd` in `ap_entry`
+
+void start_aps() {
+    uintptr_t entry_pa = kptr2pa(ap_entry);
+    assert((entry_pa & PAGEOFFMASK) == 0 && entry_pa < 0x100000);
 
-void init_timer(int rate) {
     auto& lapic = lapicstate::get();
-    if (rate > 0) {
-        lapic.write(lapic.reg_timer_initial_count, 1000000000 / rate);
-    } else {
-        lapic.write(lapic.reg_timer_initial_count, 0);
+    lapic.ipi_others(lapic.ipi_init);
+    while (lapic.ipi_pending()) {
+        pause();
+    }
+    for (int i = 0; i != 2; ++i) {
+        lapic.ipi_others(lapic.ipi_startup, entry_pa >> 12);
+        while (lapic.ipi_pending()) {
+            pause();
+        }
+    }
+}
+
+
+// ap_start(cpuindex)
+//    First C++ code run by an application processor, on its own kernel
+//    stack. Initializes the CPU, then joins the scheduler.
+
+extern "C" [[noreturn]] void ap_start(int cpuindex);
+
+void ap_start(int cpuindex) {
+    init_cpu_hardware(cpuindex);
+    kernel_lock.lock();
+    trace_init();
+    log_printf("CPU %d started (APIC ID %u)\n",
+               cpuindex, this_cpu()->lapic_id_);
+    schedule();
+}
+
+
+// init_timer()
+//    Measure the TSC against one tick of the LAPIC timer, which counts at
+//    1 GHz under QEMU with divisor 1. The timer's LVT entry is masked
+//    while we poll so the calibration tick raises no interrupt.
+
+static constexpr uint64_t lapic_timer_hz = 1000000000;
+
+uint64_t tsc_boot;
+uint64_t tsc_per_tick;
+
+void init_timer() {
+    auto& lapic = lapicstate::get();
+    lapic.write(lapic.reg_lvt_timer, lapic.lvt_masked);
+    lapic.write(lapic.reg_timer_initial_count, lapic_timer_hz / HZ);
+    uint64_t t0 = rdtsc();
+    while (lapic.read(lapic.reg_timer_current_count) != 0) {
+        pause();
+    }
+    tsc_per_tick = rdtsc() - t0;
+    tsc_boot = t0;
+    lapic.write(lapic.reg_lvt_timer, INT_IRQ + IRQ_TIMER);
+}
+
+
+// set_timer(deadline)
+//    Program this CPU's one-shot timer. Deadlines more than a few seconds
+//    away are clamped so the count fits; the timer then fires early and
+//    the kernel re-arms it.
+
+void set_timer(uint64_t deadline) {
+    auto& lapic = lapicstate::get();
+    uint64_t count = 0;
+    if (deadline) {
+        uint64_t now = rdtsc();
+        uint64_t delta = min(deadline > now ? deadline - now : 0,
+                             400 * tsc_per_tick);
+        count = max(delta * (lapic_timer_hz / HZ) / tsc_per_tick,
+                    uint64_t(1));
     }
+    lapic.write(lapic.reg_timer_initial_count, count);
 }
 
 
@@ -285,11 +424,7 @@ void init_timer(int rate) {
 //    Allocate and return a new, empty page table.
 
 x86_64_pagetable* kalloc_pagetable() {
-    x86_64_pagetable* pt = reinterpret_cast<x86_64_pagetable*>(kalloc(PAGESIZE));
-    if (pt) {
-        memset(&pt->entry[0], 0, sizeof(x86_64_pageentry_t) * 512);
-    }
-    return pt;
+    return reinterpret_cast<x86_64_pagetable*>(kalloc_zeroed());
 }
 
 
@@ -323,6 +458,11 @@ void set_pagetable(x86_64_pagetable* pagetable) {
 #define IOPHYSMEM       0x000A0000
 #define EXTPHYSMEM      0x00100000
 
+// The kernel symbol table is loaded at SYMTAB_ADDR, and the soft-reboot
+// copy of the initial `.data` is stashed just below it.
+#define SYMTAB_ADDR     0x1000000
+extern elf_symtabref symtab;
+
 bool reserved_physical_address(uintptr_t pa) {
     return pa < PAGESIZE || (pa >= IOPHYSMEM && pa < EXTPHYSMEM);
 }
@@ -333,13 +473,22 @@ bool reserved_physical_address(uintptr_t pa) {
 //    not reserved or holding kernel data.
 
 bool allocatable_physical_address(uintptr_t pa) {
+    extern uint8_t _data_start, _edata;
     extern char _kernel_end[];
     return !reserved_physical_address(pa)
         && (pa < KERNEL_START_ADDR
             || pa >= round_up((uintptr_t) _kernel_end, PAGESIZE))
         && (pa < KERNEL_STACK_TOP - PAGESIZE
             || pa >= KERNEL_STACK_TOP)
-        && pa < MEMSIZE_PHYSICAL;
+        && (pa < AP_STACKS_ADDR
+            || pa >= KERNEL_START_ADDR)
+        && (pa < PHYSPAGES_ADDR
+            || pa >= PHYSPAGES_ADDR
+                      + round_up(nphyspages * sizeof(physpageinfo), PAGESIZE))
+        && (pa < round_down(SYMTAB_ADDR - uintptr_t(&_edata - &_data_start),
+                            PAGESIZE)
+            || pa >= SYMTAB_ADDR + round_up(symtab.size, PAGESIZE))
+        && pa < memsize_physical;
 }
 
 
@@ -371,11 +520,25 @@ void pcistate::enable(int addr) {
 }
 
 
+// flush_before_shutdown()
+//    Write the buffer cache's dirty blocks to disk and drain the log, so
+//    neither is lost when the machine goes away. Callers hold
+//    `kernel_lock`, except after a panic, when it may be held elsewhere.
+
+static void flush_before_shutdown() {
+    if (disk_cache.ready()) {
+        disk_cache.sync();
+    }
+    log_flush();
+}
+
+
 // poweroff
 //    Turn off the virtual machine. This requires finding a PCI device
 //    that speaks ACPI.
 
 void poweroff() {
+    flush_before_shutdown();
     auto& pci = pcistate::get();
     int addr = pci.find([&] (int a) {
             uint32_t vd = pci.readl(a + pci.config_vendor);
@@ -399,6 +562,7 @@ void poweroff() {
 //    Reboot the virtual machine.
 
 void reboot() {
+    flush_before_shutdown();
     outb(0x92, 3); // does not return
     while (true) {
     }
@@ -556,6 +720,13 @@ int keyboard_readc() {
 // log_printf, log_vprintf
 //    Print debugging messages to the host's `log.txt` file. We run QEMU
 //    so that messages written to the QEMU "parallel port" end up in `log.txt`.
+//    With `make LOGSINK=debugcon`, QEMU's debug console at port 0xE9 is
+//    the sink instead; it takes one `outb` per character and never waits.
+//
+//    Messages are appended to an in-memory ring and reach the port when
+//    `log_flush` drains it: when a CPU idles, during housekeeping, and
+//    before the machine stops. A full ring is drained on the spot, so no
+//    message is lost.
 
 #define IO_PARALLEL1_DATA       0x378
 #define IO_PARALLEL1_STATUS     0x379
@@ -564,6 +735,7 @@ int keyboard_readc() {
 # define IO_PARALLEL_CONTROL_SELECT     0x08
 # define IO_PARALLEL_CONTROL_INIT       0x04
 # define IO_PARALLEL_CONTROL_STROBE     0x01
+#define IO_DEBUGCON             0xE9    // reads back 0xE9 if present
 
 static void delay() {
     (void) inb(0x84);
@@ -573,12 +745,6 @@ static void delay() {
 }
 
 static void parallel_port_putc(unsigned char c) {
-    static int initialized;
-    if (!initialized) {
-        outb(IO_PARALLEL1_CONTROL, 0);
-        initialized = 1;
-    }
-
     for (int i = 0;
          i < 12800 && (inb(IO_PARALLEL1_STATUS) & IO_PARALLEL_STATUS_BUSY) == 0;
          ++i) {
@@ -591,19 +757,84 @@ static void parallel_port_putc(unsigned char c) {
          | IO_PARALLEL_CONTROL_INIT);
 }
 
+#define LOG_RINGSIZE 4096
+static char log_ring[LOG_RINGSIZE];
+static size_t log_head;                 // next byte to drain
+static size_t log_tail;                 // next byte to fill
+static spinlock log_lock;
+
+// drain the ring to the log port; must hold `log_lock`
+static void log_drain() {
+    static int sink;                    // 0 = unknown, 1 = parallel, 2 = 0xE9
+    if (!sink) {
+        sink = inb(IO_DEBUGCON) == IO_DEBUGCON ? 2 : 1;
+        if (sink == 1) {
+            outb(IO_PARALLEL1_CONTROL, 0);
+        }
+    }
+    for (; log_head != log_tail; ++log_head) {
+        unsigned char c = log_ring[log_head % LOG_RINGSIZE];
+        if (sink == 2) {
+            outb(IO_DEBUGCON, c);
+        } else {
+            parallel_port_putc(c);
+        }
+    }
+}
+
+extern std::atomic<bool> panicking;
+
+void log_flush() {
+    // A panic may interrupt a CPU that holds the lock; drain anyway.
+    bool locked = log_lock.try_lock();
+    while (!locked && !panicking) {
+        pause();
+        locked = log_lock.try_lock();
+    }
+    log_drain();
+    if (locked) {
+        log_lock.unlock();
+    }
+}
+
 namespace {
 struct log_printer : public printer {
     void putc(unsigned char c, int) override {
-        parallel_port_putc(c);
+        if (log_tail - log_head == LOG_RINGSIZE) {
+            log_drain();
+        }
+        log_ring[log_tail % LOG_RINGSIZE] = c;
+        ++log_tail;
+    }
+    void write(const char* s, size_t n, int) override {
+        while (n > 0) {
+            if (log_tail - log_head == LOG_RINGSIZE) {
+                log_drain();
+            }
+            size_t pos = log_tail % LOG_RINGSIZE;
+            size_t k = min(n, LOG_RINGSIZE - (log_tail - log_head),
+                           LOG_RINGSIZE - pos);
+            memcpy(&log_ring[pos], s, k);
+            log_tail += k;
+            s += k;
+            n -= k;
+        }
     }
 };
 }
 
 void log_vprintf(const char* format, va_list val) {
+    spinlock_guard guard(log_lock);
     log_printer p;
     p.vprintf(0, format, val);
 }
 
+void log_print_using(void (*fn)(printer&, void*), void* arg) {
+    spinlock_guard guard(log_lock);
+    log_printer p;
+    fn(p, arg);
+}
+
 void log_printf(const char* format, ...) {
     va_list val;
     va_start(val, format);
@@ -613,12 +844,56 @@ void log_printf(const char* format, ...) {
 
 
 // symtab: reference to kernel symbol table; useful for debugging.
-// The `mkchickadeesymtab` program fills this structure in.
-#define SYMTAB_ADDR 0x1000000
+// The `mkchickadeesymtab` program fills this structure in and loads the
+// table at SYMTAB_ADDR, which stays unmapped until the first lookup.
 elf_symtabref symtab = {
-    reinterpret_cast<elf_symbol*>(SYMTAB_ADDR), 0, nullptr, 0
+    reinterpret_cast<const elf_compact_symtab*>(SYMTAB_ADDR), 0
 };
 
+// find_symbol(addr)
+//    Return the index of the symbol containing `addr`, or `~0U` if there
+//    is none. `addr`'s bucket narrows the search to a few symbols, and the
+//    binary search reads only the 32-bit address array.
+
+__no_asan
+static unsigned find_symbol(uintptr_t addr) {
+    const elf_compact_symtab* st = symtab.symtab;
+    if (addr < st->base
+        || ((addr - st->base) >> st->shift) >= st->nbuckets) {
+        return ~0U;
+    }
+    uint32_t off = addr - st->base;
+    const uint32_t* saddr = st->addr();
+    const uint32_t* first = st->first();
+    uint32_t b = off >> st->shift;
+    // find the last symbol starting at or before `addr`
+    size_t l = first[b];
+    size_t r = first[b + 1] + 1;
+    while (r - l > 1) {
+        size_t m = l + ((r - l) >> 1);
+        if (saddr[m] <= off) {
+            l = m;
+        } else {
+            r = m;
+        }
+    }
+    uint32_t size = st->size()[l];
+    if (saddr[l] <= off
+        && (l + 1 == st->nsym
+            ? off < saddr[l] + 0x1000
+            : off < saddr[l + 1])
+        && (size == 0 || off <= saddr[l] + size)) {
+        return l;
+    }
+    return ~0U;
+}
+
+// symcache: recently looked-up addresses. An entry packs a 32-bit address
+// (low half) with its symbol index from `find_symbol` (high half), so
+// CPUs can read and replace entries without a lock.
+static constexpr unsigned symcache_size = 64;
+static std::atomic<uint64_t> symcache[symcache_size];
+
 // lookup_symbol(addr, name, start)
 //    Use the debugging symbol table to look up `addr`. Return the
 //    corresponding symbol name (usually a function name) in `*name`
@@ -626,39 +901,36 @@ elf_symtabref symtab = {
 
 __no_asan
 bool lookup_symbol(uintptr_t addr, const char** name, uintptr_t* start) {
-    extern elf_symtabref symtab;
+    if (symtab.size == 0) {
+        return false;
+    }
     if (!kernel_pagetable[2].entry[SYMTAB_ADDR / 0x200000]) {
         kernel_pagetable[2].entry[SYMTAB_ADDR / 0x200000] =
             SYMTAB_ADDR | PTE_P | PTE_W | PTE_PS;
     }
 
-    size_t l = 0;
-    size_t r = symtab.nsym;
-    while (l < r) {
-        size_t m = l + ((r - l) >> 1);
-        auto& sym = symtab.sym[m];
-        if (sym.st_value <= addr
-            && (m + 1 == symtab.nsym
-                ? addr < sym.st_value + 0x1000
-                : addr < (&sym)[1].st_value)
-            && (sym.st_size == 0 || addr <= sym.st_value + sym.st_size)) {
-            if (!sym.st_value) {
-                return false;
-            }
-            if (name) {
-                *name = symtab.strtab + sym.st_name;
-            }
-            if (start) {
-                *start = sym.st_value;
-            }
-            return true;
-        } else if (sym.st_value < addr) {
-            l = m + 1;
-        } else {
-            r = m;
+    unsigned i;
+    bool cacheable = addr != 0 && addr == uint32_t(addr);
+    auto& slot = symcache[(addr ^ (addr >> 6)) % symcache_size];
+    uint64_t entry = cacheable ? slot.load(std::memory_order_relaxed) : 0;
+    if (entry != 0 && uint32_t(entry) == addr) {
+        i = entry >> 32;
+    } else {
+        i = find_symbol(addr);
+        if (cacheable) {
+            slot.store((uint64_t(i) << 32) | addr, std::memory_order_relaxed);
         }
     }
-    return false;
+    if (i == ~0U) {
+        return false;
+    }
+    if (name) {
+        *name = symtab.symtab->strings() + symtab.symtab->name()[i];
+    }
+    if (start) {
+        *start = symtab.symtab->base + symtab.symtab->addr()[i];
+    }
+    return true;
 }
 
 
@@ -666,7 +938,7 @@ namespace {
 struct backtracer {
     backtracer(uintptr_t rbp, uintptr_t rsp, uintptr_t stack_top)
         : rbp_(rbp), rsp_(rsp), stack_top_(stack_top) {
-        pt_ = pa2kptr<x86_64_pagetable*>(rdcr3());
+        pt_ = pa2kptr<x86_64_pagetable*>(rdcr3() & PTE_PAMASK);
         check();
     }
     bool ok() const {
@@ -748,14 +1020,30 @@ int error_vprintf(int cpos, int color, const char* format, va_list val) {
 //    * 's': Soft reboot to run p-spawn.
 //    * '1': Soft reboot to run p-allocator.
 //    * '2': Soft reboot to run p-allocator2.
-//    * 'q' or Control-C: Exit the virtual machine.
+//    * 't': Dump the kernel event trace to `log.txt`.
+//    * 'q' or Control-C: Exit the virtual machine (after printing the
+//      profile, if profiling).
 //    Otherwise returns the key typed, or -1 if no key was typed.
 
 int check_keyboard() {
     int c = keyboard_readc();
+    keyboard_command(c);
+    return c;
+}
+
+
+// keyboard_command(c)
+//    Act on `c` if it is one of `check_keyboard`'s control keys.
+
+void keyboard_command(int c) {
     if (c == 'a' || c == 'f' || c == '1' || c == '2' || c == 'p' || c == 's') {
-        // Turn off the timer interrupt.
-        init_timer(-1);
+        // Turn off the timer and keyboard interrupts, and park the other
+        // CPUs until the new kernel restarts them. Logged messages in
+        // memory, and dirty blocks in the buffer cache, would not survive.
+        flush_before_shutdown();
+        set_timer(0);
+        ioapicstate::get().disable_irq(IRQ_KEYBOARD);
+        lapicstate::get().ipi_others(lapicstate::ipi_init);
         // Install a temporary page table to carry us through the
         // process of reinitializing memory. This replicates work the
         // bootloader does.
@@ -764,6 +1052,8 @@ int check_keyboard() {
         pt[0].entry[0] = 0x2000 | PTE_P | PTE_W;
         pt[1].entry[0] = PTE_P | PTE_W | PTE_PS;
         wrcr3((uintptr_t) pt);
+        wrcr4(rdcr4() & ~CR4_PCIDE);
+        cr3_noflush = 0;
         // The soft reboot process doesn't modify memory, so it's
         // safe to pass `multiboot_info` on the kernel stack, even
         // though it will get overwritten as the kernel runs.
@@ -797,10 +1087,14 @@ int check_keyboard() {
         // restart kernel
         asm volatile("movl $0x2BADB002, %%eax; jmp kernel_entry"
                      : : "b" (multiboot_info) : "memory");
+    } else if (c == 't') {
+        trace_dump();
     } else if (c == 0x03 || c == 'q') {
+        if (profiling) {
+            profile_report();
+        }
         poweroff();
     }
-    return c;
 }
 
 
@@ -808,6 +1102,7 @@ int check_keyboard() {
 //    Loop until user presses Control-C, then poweroff.
 
 [[noreturn]] void fail() {
+    log_flush();
     while (true) {
         check_keyboard();
     }
@@ -913,46 +1208,195 @@ void assert_fail(const char* file, int line, const char* msg,
 //    Types representing program images. For documentation, please see
 //    `kernel.hh`.
 
-#define DECLARE_PROCESS_IMAGE_LOCATION(x) \
-    extern uint8_t _binary_obj_p_##x##_start[], _binary_obj_p_##x##_end[];
-#define DECLARE_PROCESS_IMAGE_RAMIMAGE(x) \
-    { #x, _binary_obj_p_##x##_start, _binary_obj_p_##x##_end },
-
-DECLARE_PROCESS_IMAGE_LOCATION(hello)
-DECLARE_PROCESS_IMAGE_LOCATION(bigdata)
-DECLARE_PROCESS_IMAGE_LOCATION(alice)
-DECLARE_PROCESS_IMAGE_LOCATION(eve)
-DECLARE_PROCESS_IMAGE_LOCATION(pipereader)
-DECLARE_PROCESS_IMAGE_LOCATION(pipewriter)
-DECLARE_PROCESS_IMAGE_LOCATION(spawn)
-
-struct ramimage {
-    const char* name;
-    void* begin;
-    void* end;
-} ramimages[] = {
-    DECLARE_PROCESS_IMAGE_RAMIMAGE(hello)
-    DECLARE_PROCESS_IMAGE_RAMIMAGE(bigdata)
-    DECLARE_PROCESS_IMAGE_RAMIMAGE(alice)
-    DECLARE_PROCESS_IMAGE_RAMIMAGE(eve)
-    DECLARE_PROCESS_IMAGE_RAMIMAGE(pipereader)
-    DECLARE_PROCESS_IMAGE_RAMIMAGE(pipewriter)
-    DECLARE_PROCESS_IMAGE_RAMIMAGE(spawn)
-};
+extern uint8_t _binary_obj_programs_lz4_start[],
+    _binary_obj_programs_lz4_end[];
 
-program_image::program_image(int program_number) {
-    elf_ = nullptr;
-    if (program_number >= 0
-        && size_t(program_number) < sizeof(ramimages) / sizeof(ramimages[0])) {
-        elf_ = (elf_header*) ramimages[program_number].begin;
-        assert(elf_->e_magic == ELF_MAGIC);
+// The archive is linked as raw bytes, so it may be unaligned; read its
+// tables with `archive_get`.
+template <typename T>
+static T archive_get(size_t off) {
+    T x;
+    assert(off + sizeof(T) <= size_t(_binary_obj_programs_lz4_end
+                                     - _binary_obj_programs_lz4_start));
+    memcpy(&x, _binary_obj_programs_lz4_start + off, sizeof(T));
+    return x;
+}
+
+static lz4archive_header archive_header() {
+    return archive_get<lz4archive_header>(0);
+}
+
+static lz4archive_image archive_image(int program_number) {
+    return archive_get<lz4archive_image>(sizeof(lz4archive_header)
+        + program_number * sizeof(lz4archive_image));
+}
+
+// lz4_decompress(dst, dstsz, src, srcsz)
+//    Decompress the LZ4 block `[src, src+srcsz)` into `dst`, which has
+//    room for `dstsz` bytes. Returns the decompressed size, or -1 if the
+//    block is malformed or would overflow `dst`.
+
+static bool lz4_length(size_t& len, const uint8_t*& src, const uint8_t* send) {
+    uint8_t b;
+    do {
+        if (src == send) {
+            return false;
+        }
+        b = *src++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+static ssize_t lz4_decompress(uint8_t* dst, size_t dstsz,
+                              const uint8_t* src, size_t srcsz) {
+    const uint8_t* send = src + srcsz;
+    uint8_t* d = dst;
+    uint8_t* dend = dst + dstsz;
+    while (src != send) {
+        // literals
+        unsigned token = *src++;
+        size_t len = token >> 4;
+        if ((len == 15 && !lz4_length(len, src, send))
+            || len > size_t(send - src)
+            || len > size_t(dend - d)) {
+            return -1;
+        }
+        memcpy(d, src, len);
+        d += len;
+        src += len;
+        if (src == send) {
+            break;              // the last sequence has no match
+        }
+
+        // match, which may overlap the bytes it produces
+        if (send - src < 2) {
+            return -1;
+        }
+        size_t offset = src[0] | (src[1] << 8);
+        src += 2;
+        len = (token & 15) + 4;
+        if (((token & 15) == 15 && !lz4_length(len, src, send))
+            || offset == 0
+            || offset > size_t(d - dst)
+            || len > size_t(dend - d)) {
+            return -1;
+        }
+        for (const uint8_t* m = d - offset; len != 0; --len) {
+            *d++ = *m++;
+        }
+    }
+    return d - dst;
+}
+
+// chunk_buf: the most recently decompressed chunk (a page allocated by
+// `init_program_images`), for reads that cover part of a chunk. A page of
+// a segment usually straddles two chunks, and the next page starts in
+// the second, so this saves about half the work of filling consecutive
+// pages.
+static spinlock chunk_lock("chunk_lock");   // protects `chunk_buf`
+static uint8_t* chunk_buf;
+static uint32_t chunk_buf_index = -1;
+
+// archive_chunk_read(index, dst, n)
+//    Decompress the `n`-byte chunk number `index` into `dst`.
+
+static void archive_chunk_read(uint32_t index, uint8_t* dst, size_t n) {
+    lz4archive_header h = archive_header();
+    assert(index < h.nchunks);
+    auto c = archive_get<lz4archive_chunk>(sizeof(h)
+        + h.nimages * sizeof(lz4archive_image)
+        + index * sizeof(lz4archive_chunk));
+    assert(c.offset + c.size <= size_t(_binary_obj_programs_lz4_end
+                                       - _binary_obj_programs_lz4_start));
+    const uint8_t* src = _binary_obj_programs_lz4_start + c.offset;
+    if (c.size == n) {
+        memcpy(dst, src, n);
     } else {
-        elf_ = nullptr;
+        ssize_t r = lz4_decompress(dst, n, src, c.size);
+        assert(r == ssize_t(n), "corrupt compressed program image");
+    }
+}
+
+bool program_image_read(int program_number, size_t off, void* dst,
+                        size_t sz) {
+    if (program_number < 0
+        || unsigned(program_number) >= archive_header().nimages) {
+        return false;
+    }
+    lz4archive_image im = archive_image(program_number);
+    if (off > im.size || sz > im.size - off) {
+        return false;
+    }
+    uint8_t* d = reinterpret_cast<uint8_t*>(dst);
+    while (sz != 0) {
+        size_t ci = off / LZ4ARCHIVE_CHUNKSIZE;
+        size_t coff = off % LZ4ARCHIVE_CHUNKSIZE;
+        size_t csize = min(size_t(LZ4ARCHIVE_CHUNKSIZE),
+                           im.size - ci * LZ4ARCHIVE_CHUNKSIZE);
+        size_t n = min(sz, csize - coff);
+        uint32_t index = im.first_chunk + ci;
+        if (coff == 0 && n == csize) {
+            archive_chunk_read(index, d, n);
+        } else {
+            spinlock_guard guard(chunk_lock);
+            if (chunk_buf_index != index) {
+                chunk_buf_index = -1;
+                archive_chunk_read(index, chunk_buf, csize);
+                chunk_buf_index = index;
+            }
+            memcpy(d, chunk_buf + coff, n);
+        }
+        d += n;
+        off += n;
+        sz -= n;
+    }
+    return true;
+}
+
+void init_program_images() {
+    static_assert(LZ4ARCHIVE_CHUNKSIZE == PAGESIZE);
+    chunk_buf = reinterpret_cast<uint8_t*>(kalloc(PAGESIZE));
+    assert(chunk_buf);
+    lz4archive_header h = archive_header();
+    assert(h.magic == LZ4ARCHIVE_MAGIC, "bad program archive");
+    for (unsigned i = 0; i != h.nimages; ++i) {
+        program_image pgm(i);
+        assert(!pgm.empty());
+    }
+}
+
+program_image::program_image(int program_number) {
+    elf_header eh;
+    if (program_number < 0
+        || !program_image_read(program_number, 0, &eh, sizeof(eh))) {
+        return;
+    }
+    assert(eh.e_magic == ELF_MAGIC);
+    number_ = program_number;
+    entry_ = eh.e_entry;
+    for (unsigned i = 0; i != eh.e_phnum; ++i) {
+        elf_program ph;
+        bool ok = program_image_read(program_number,
+                                     eh.e_phoff + i * sizeof(ph),
+                                     &ph, sizeof(ph));
+        assert(ok);
+        if (ph.p_type == ELF_PTYPE_LOAD) {
+            assert(nph_ < NPROCSEGS - 1, "too many program segments");
+            assert(ph.p_filesz <= ph.p_memsz
+                   && ph.p_offset + ph.p_filesz
+                      <= archive_image(program_number).size);
+            ph_[nph_] = ph;
+            ++nph_;
+        }
     }
 }
 int program_image::program_number(const char* program_name) {
-    for (size_t i = 0; i != sizeof(ramimages) / sizeof(ramimages[0]); ++i) {
-        if (strcmp(program_name, ramimages[i].name) == 0) {
+    lz4archive_header h = archive_header();
+    for (unsigned i = 0; i != h.nimages; ++i) {
+        const char* name = reinterpret_cast<const char*>
+            (_binary_obj_programs_lz4_start + archive_image(i).name);
+        if (strcmp(program_name, name) == 0) {
             return i;
         }
     }
@@ -962,36 +1406,20 @@ program_image::program_image(const char* program_name)
     : program_image(program_number(program_name)) {
 }
 uintptr_t program_image::entry() const {
-    return elf_ ? elf_->e_entry : 0;
+    return entry_;
 }
 bool program_image::empty() const {
-    return !elf_ || elf_->e_phnum == 0;
-}
-static elf_program* elf_header_program(elf_header* elf, bool end) {
-    if (elf) {
-        elf_program* ph = reinterpret_cast<elf_program*>
-            (reinterpret_cast<uint8_t*>(elf) + elf->e_phoff);
-        return ph + (end ? elf->e_phnum : 0);
-    } else {
-        return nullptr;
-    }
+    return nph_ == 0;
 }
 program_image_segment program_image::begin() const {
-    return program_image_segment(elf_header_program(elf_, false), elf_);
+    return program_image_segment(ph_);
 }
 program_image_segment program_image::end() const {
-    return program_image_segment(elf_header_program(elf_, true), elf_);
+    return program_image_segment(ph_ + nph_);
 }
 
-inline void program_image_segment::fix() {
-    elf_program* eph = elf_header_program(elf_, true);
-    while (ph_ != eph && ph_->p_type != ELF_PTYPE_LOAD) {
-        ++ph_;
-    }
-}
-program_image_segment::program_image_segment(elf_program* ph, elf_header* elf)
-    : ph_(ph), elf_(elf) {
-    fix();
+program_image_segment::program_image_segment(const elf_program* ph)
+    : ph_(ph) {
 }
 uintptr_t program_image_segment::va() const {
     return ph_->p_va;
@@ -999,8 +1427,8 @@ uintptr_t program_image_segment::va() const {
 size_t program_image_segment::size() const {
     return ph_->p_memsz;
 }
-const char* program_image_segment::data() const {
-    return (const char*) elf_ + ph_->p_offset;
+size_t program_image_segment::data_offset() const {
+    return ph_->p_offset;
 }
 size_t program_image_segment::data_size() const {
     return ph_->p_filesz;
@@ -1008,6 +1436,9 @@ size_t program_image_segment::data_size() const {
 bool program_image_segment::writable() const {
     return ph_->p_flags & ELF_PFLAG_WRITE;
 }
+bool program_image_segment::executable() const {
+    return ph_->p_flags & ELF_PFLAG_EXEC;
+}
 bool program_image_segment::operator==(const program_image_segment& x) const {
     return ph_ == x.ph_;
 }
@@ -1015,9 +1446,7 @@ bool program_image_segment::operator!=(const program_image_segment& x) const {
     return ph_ != x.ph_;
 }
 void program_image_segment::operator++() {
-    assert(ph_ != elf_header_program(elf_, true));
     ++ph_;
-    fix();
 }
 void program_image_segment::operator++(int) {
     ++*this;
@@ -1099,3 +1528,13 @@ static void stash_kernel_data(bool reboot) {
 static_assert(offsetof(proc, pagetable) == 0, "proc::pagetable has bad offset");
 static_assert(offsetof(proc, state) == 12, "proc::state has bad offset");
 static_assert(offsetof(proc, regs) == 16, "proc::refs has bad offset");
+
+// `syscall_entry` stores these `regstate` members by offset
+static_assert(offsetof(regstate, reg_rax) == 0, "bad regstate offset");
+static_assert(offsetof(regstate, reg_rdx) == 16, "bad regstate offset");
+static_assert(offsetof(regstate, reg_r10) == 72, "bad regstate offset");
+static_assert(offsetof(regstate, reg_r15) == 112, "bad regstate offset");
+static_assert(offsetof(regstate, reg_gs) == 128, "bad regstate offset");
+static_assert(offsetof(regstate, reg_intno) == 136, "bad regstate offset");
+static_assert(offsetof(regstate, reg_rip) == 152, "bad regstate offset");
+static_assert(offsetof(regstate, reg_ss) == 184, "bad regstate offset");
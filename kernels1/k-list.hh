@@ -0,0 +1,144 @@
+#ifndef WEENSYOS_K_LIST_HH
+#define WEENSYOS_K_LIST_HH
+#include "lib.hh"
+
+// `list<T, &T::links>` is an intrusive, circular, doubly-linked list.
+//
+// Each element embeds a `list_links` member; the list itself is a
+// sentinel `list_links`. Insertion and removal take constant time and
+// never allocate. An element can be on at most one list per
+// `list_links` member.
+//
+//     struct proc {
+//         ...
+//         list_links runq_links_;
+//     };
+//     list<proc, &proc::runq_links_> runq;
+//     runq.push_back(p);
+//     proc* next = runq.pop_front();
+
+struct list_links {
+    list_links* next_ = nullptr;
+    list_links* prev_ = nullptr;
+
+    // Return true iff this element is on a list
+    inline bool is_linked() const;
+    // Remove this element from its list (must be linked)
+    inline void erase();
+    // Insert this element before `x`
+    inline void insert_before(list_links* x);
+};
+
+template <typename T, list_links T::* member>
+class list {
+  public:
+    inline list();
+    NO_COPY_OR_ASSIGN(list);
+
+    // Return true iff the list is empty
+    inline bool empty() const;
+    // Return the first/last element, or `nullptr` if empty
+    inline T* front() const;
+    inline T* back() const;
+    // Return the element after/before `x`, or `nullptr` at the end
+    inline T* next(T* x) const;
+    inline T* prev(T* x) const;
+
+    // Add `x` at the end/beginning of the list
+    inline void push_back(T* x);
+    inline void push_front(T* x);
+    // Remove and return the first/last element, or `nullptr` if empty
+    inline T* pop_front();
+    inline T* pop_back();
+    // Remove `x`, which must be on this list
+    inline void erase(T* x);
+
+  private:
+    list_links head_;
+
+    static inline T* owner(list_links* l);
+    static inline list_links* links(T* x);
+};
+
+
+inline bool list_links::is_linked() const {
+    return next_ != nullptr;
+}
+inline void list_links::erase() {
+    assert(is_linked());
+    prev_->next_ = next_;
+    next_->prev_ = prev_;
+    next_ = prev_ = nullptr;
+}
+inline void list_links::insert_before(list_links* x) {
+    assert(!is_linked());
+    prev_ = x->prev_;
+    next_ = x;
+    x->prev_->next_ = this;
+    x->prev_ = this;
+}
+
+template <typename T, list_links T::* member>
+inline list<T, member>::list() {
+    head_.next_ = head_.prev_ = &head_;
+}
+template <typename T, list_links T::* member>
+inline T* list<T, member>::owner(list_links* l) {
+    return mem_container(l, member);
+}
+template <typename T, list_links T::* member>
+inline list_links* list<T, member>::links(T* x) {
+    return &(x->*member);
+}
+template <typename T, list_links T::* member>
+inline bool list<T, member>::empty() const {
+    return head_.next_ == &head_;
+}
+template <typename T, list_links T::* member>
+inline T* list<T, member>::front() const {
+    return empty() ? nullptr : owner(head_.next_);
+}
+template <typename T, list_links T::* member>
+inline T* list<T, member>::back() const {
+    return empty() ? nullptr : owner(head_.prev_);
+}
+template <typename T, list_links T::* member>
+inline T* list<T, member>::next(T* x) const {
+    list_links* l = links(x)->next_;
+    return l == &head_ ? nullptr : owner(l);
+}
+template <typename T, list_links T::* member>
+inline T* list<T, member>::prev(T* x) const {
+    list_links* l = links(x)->prev_;
+    return l == &head_ ? nullptr : owner(l);
+}
+template <typename T, list_links T::* member>
+inline void list<T, member>::push_back(T* x) {
+    links(x)->insert_before(&head_);
+}
+template <typename T, list_links T::* member>
+inline void list<T, member>::push_front(T* x) {
+    links(x)->insert_before(head_.next_);
+}
+template <typename T, list_links T::* member>
+inline T* list<T, member>::pop_front() {
+    T* x = front();
+    if (x) {
+        links(x)->erase();
+    }
+    return x;
+}
+template <typename T, list_links T::* member>
+inline T* list<T, member>::pop_back() {
+    T* x = back();
+    if (x) {
+        links(x)->erase();
+    }
+    return x;
+}
+template <typename T, list_links T::* member>
+inline void list<T, member>::erase(T* x) {
+    links(x)->erase();
+}
+
+#endif
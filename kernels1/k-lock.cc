@@ -0,0 +1,31 @@
+#include "kernel.hh"
+
+#if LOCK_STATS
+std::atomic<lock_stats*> lock_stats::all;
+
+
+// lock_stats::snapshot(recs, first, n)
+//    Copy the counters of up to `n` named locks into `recs`, skipping the
+//    first `first`. Locks are listed in the order they were first
+//    acquired, most recent first. The counters of a lock that is held
+//    elsewhere may be slightly stale.
+
+int lock_stats::snapshot(lock_stat_record* recs, int first, int n) {
+    int nlocks = 0;
+    for (lock_stats* ls = all.load(std::memory_order_acquire);
+         ls;
+         ls = ls->next_, ++nlocks) {
+        if (nlocks >= first && nlocks - first < n) {
+            lock_stat_record& r = recs[nlocks - first];
+            memset(r.name, 0, sizeof(r.name));
+            strncpy(r.name, ls->name_, sizeof(r.name) - 1);
+            r.nacquires = ls->nacquires_;
+            r.ncontended = ls->ncontended_;
+            r.nspins = ls->nspins_;
+            r.hold_cycles = ls->hold_cycles_;
+            r.max_hold_cycles = ls->max_hold_cycles_;
+        }
+    }
+    return nlocks;
+}
+#endif
@@ -0,0 +1,278 @@
+#ifndef WEENSYOS_K_LOCK_HH
+#define WEENSYOS_K_LOCK_HH
+#include "x86-64.h"
+#include "lib.hh"
+#include <atomic>
+
+// Three lock types share one interface (`lock`, `try_lock`, `unlock`):
+//
+// `spinlock` is a simple test-and-set mutual-exclusion lock. The kernel
+// runs with interrupts disabled, so a spinlock never needs to disable
+// interrupts itself; but code that re-enables interrupts (the idle loop)
+// must not hold one at the time. This applies to all three types.
+//
+// `ticket_lock` hands the lock out in arrival order, so no CPU starves;
+// waiters still spin on one shared word.
+//
+// `mcs_lock` also grants in arrival order, but each waiter spins on its
+// own `mcs_lock::node`, so a handoff touches only the next waiter's cache
+// line. `lock` and `unlock` take the caller's node, which must stay put
+// (usually on the stack) until `unlock` returns; `mcs_guard` packages
+// one.
+//
+// A lock constructed with a name can keep contention statistics. In
+// kernels built with `make LOCKSTATS=1`, every named lock counts its
+// acquisitions, contended acquisitions, spin iterations, and hold times,
+// and `sys_lockstats` reports them. Otherwise `lock_stats` is empty and
+// costs nothing.
+
+#ifndef LOCK_STATS
+#define LOCK_STATS 0
+#endif
+
+struct lock_stats {
+#if LOCK_STATS
+    constexpr lock_stats(const char* name = nullptr)
+        : name_(name) {
+    }
+    inline void acquired(uint64_t nspins);
+    inline void released();
+
+    // Copy the counters of up to `n` locks, starting with the `first`th,
+    // into `recs`; return the number of locks that have been used
+    static int snapshot(lock_stat_record* recs, int first, int n);
+
+  private:
+    const char* name_;
+    uint64_t nacquires_ = 0;
+    uint64_t ncontended_ = 0;
+    uint64_t nspins_ = 0;
+    uint64_t hold_cycles_ = 0;
+    uint64_t max_hold_cycles_ = 0;
+    uint64_t acquired_tsc_ = 0;
+    lock_stats* next_ = nullptr;        // in `all`, once first acquired
+    bool listed_ = false;
+
+    static std::atomic<lock_stats*> all;
+#else
+    constexpr lock_stats(const char* = nullptr) {
+    }
+    inline void acquired(uint64_t) {
+    }
+    inline void released() {
+    }
+#endif
+};
+
+
+struct spinlock {
+    spinlock() = default;
+    explicit constexpr spinlock(const char* name)
+        : stats_(name) {
+    }
+    NO_COPY_OR_ASSIGN(spinlock)
+
+    inline void lock();
+    inline bool try_lock();
+    inline void unlock();
+
+  private:
+    std::atomic_flag f_ = ATOMIC_FLAG_INIT;
+    lock_stats stats_;
+};
+
+struct ticket_lock {
+    ticket_lock() = default;
+    explicit constexpr ticket_lock(const char* name)
+        : stats_(name) {
+    }
+    NO_COPY_OR_ASSIGN(ticket_lock)
+
+    inline void lock();
+    inline bool try_lock();
+    inline void unlock();
+
+  private:
+    std::atomic<unsigned> next_ = 0;    // next ticket to hand out
+    std::atomic<unsigned> serving_ = 0; // ticket that holds the lock
+    lock_stats stats_;
+};
+
+struct mcs_lock {
+    struct node {
+        std::atomic<node*> next_ = nullptr;
+        std::atomic<bool> waiting_ = false;
+    };
+
+    mcs_lock() = default;
+    explicit constexpr mcs_lock(const char* name)
+        : stats_(name) {
+    }
+    NO_COPY_OR_ASSIGN(mcs_lock)
+
+    inline void lock(node& n);
+    inline bool try_lock(node& n);
+    inline void unlock(node& n);
+
+  private:
+    std::atomic<node*> tail_ = nullptr; // last waiter, or the holder
+    lock_stats stats_;
+};
+
+
+// `lock_guard<L>` holds a `spinlock` or `ticket_lock` for the duration
+// of a scope; `mcs_guard` does the same for an `mcs_lock`.
+
+template <typename L>
+struct lock_guard {
+    explicit inline lock_guard(L& lock)
+        : lock_(lock) {
+        lock_.lock();
+    }
+    inline ~lock_guard() {
+        lock_.unlock();
+    }
+    NO_COPY_OR_ASSIGN(lock_guard)
+
+  private:
+    L& lock_;
+};
+
+using spinlock_guard = lock_guard<spinlock>;
+using ticket_lock_guard = lock_guard<ticket_lock>;
+
+struct mcs_guard {
+    explicit inline mcs_guard(mcs_lock& lock)
+        : lock_(lock) {
+        lock_.lock(node_);
+    }
+    inline ~mcs_guard() {
+        lock_.unlock(node_);
+    }
+    NO_COPY_OR_ASSIGN(mcs_guard)
+
+  private:
+    mcs_lock& lock_;
+    mcs_lock::node node_;
+};
+
+
+#if LOCK_STATS
+// The counters belong to the lock holder: `acquired` runs just after the
+// lock is taken and `released` just before it is given up.
+inline void lock_stats::acquired(uint64_t nspins) {
+    ++nacquires_;
+    if (nspins != 0) {
+        ++ncontended_;
+        nspins_ += nspins;
+    }
+    if (!listed_ && name_) {
+        listed_ = true;
+        next_ = all.load(std::memory_order_relaxed);
+        while (!all.compare_exchange_weak(next_, this,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed)) {
+        }
+    }
+    acquired_tsc_ = rdtsc();
+}
+inline void lock_stats::released() {
+    uint64_t held = rdtsc() - acquired_tsc_;
+    hold_cycles_ += held;
+    max_hold_cycles_ = max(max_hold_cycles_, held);
+}
+#endif
+
+
+inline void spinlock::lock() {
+    uint64_t nspins = 0;
+    while (f_.test_and_set(std::memory_order_acquire)) {
+        pause();
+        ++nspins;
+    }
+    stats_.acquired(nspins);
+}
+inline bool spinlock::try_lock() {
+    if (f_.test_and_set(std::memory_order_acquire)) {
+        return false;
+    }
+    stats_.acquired(0);
+    return true;
+}
+inline void spinlock::unlock() {
+    stats_.released();
+    f_.clear(std::memory_order_release);
+}
+
+
+inline void ticket_lock::lock() {
+    unsigned t = next_.fetch_add(1, std::memory_order_relaxed);
+    uint64_t nspins = 0;
+    while (serving_.load(std::memory_order_acquire) != t) {
+        pause();
+        ++nspins;
+    }
+    stats_.acquired(nspins);
+}
+inline bool ticket_lock::try_lock() {
+    unsigned t = serving_.load(std::memory_order_relaxed);
+    unsigned expected = t;
+    if (!next_.compare_exchange_strong(expected, t + 1,
+                                       std::memory_order_acquire,
+                                       std::memory_order_relaxed)) {
+        return false;
+    }
+    stats_.acquired(0);
+    return true;
+}
+inline void ticket_lock::unlock() {
+    stats_.released();
+    serving_.store(serving_.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+}
+
+
+inline void mcs_lock::lock(node& n) {
+    n.next_.store(nullptr, std::memory_order_relaxed);
+    n.waiting_.store(true, std::memory_order_relaxed);
+    uint64_t nspins = 0;
+    node* prev = tail_.exchange(&n, std::memory_order_acq_rel);
+    if (prev) {
+        prev->next_.store(&n, std::memory_order_release);
+        while (n.waiting_.load(std::memory_order_acquire)) {
+            pause();
+            ++nspins;
+        }
+    }
+    stats_.acquired(nspins);
+}
+inline bool mcs_lock::try_lock(node& n) {
+    n.next_.store(nullptr, std::memory_order_relaxed);
+    node* expected = nullptr;
+    if (!tail_.compare_exchange_strong(expected, &n,
+                                       std::memory_order_acquire,
+                                       std::memory_order_relaxed)) {
+        return false;
+    }
+    stats_.acquired(0);
+    return true;
+}
+inline void mcs_lock::unlock(node& n) {
+    stats_.released();
+    node* succ = n.next_.load(std::memory_order_acquire);
+    if (!succ) {
+        // no known successor: release unless one is arriving
+        node* expected = &n;
+        if (tail_.compare_exchange_strong(expected, nullptr,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed)) {
+            return;
+        }
+        while (!(succ = n.next_.load(std::memory_order_acquire))) {
+            pause();
+        }
+    }
+    succ->waiting_.store(false, std::memory_order_release);
+}
+
+#endif
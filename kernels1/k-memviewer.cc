@@ -1,25 +1,29 @@
 #include "kernel.hh"
 #include "k-vmiter.hh"
+#include "k-slab.hh"
 
 // k-memviewer.cc
 //
 //    The `memusage` class tracks memory usage by walking page tables,
 //    looks for errors, and prints the memory map to the console.
+//
+//    The map is incremental. `kalloc` and `kfree` report pages whose
+//    allocation state changes, and `vmiter` reports page tables it
+//    modifies (see `memusage_note_pages` and `memusage_note_pagetable`).
+//    A refresh rewalks only the reported page tables, recomputes symbols
+//    only for affected pages, and the console writes only changed cells.
 
 
 class memusage {
   public:
     // tracks physical addresses in the range [0, maxpa)
     static constexpr uintptr_t maxpa = 1024 * PAGESIZE;
+    static constexpr size_t npages = maxpa / PAGESIZE;
     // shows physical addresses in the range [0, max_view_pa)
     static constexpr uintptr_t max_view_pa = 512 * PAGESIZE;
     // shows virtual addresses in the range [0, max_view_va)
     static constexpr uintptr_t max_view_va = 768 * PAGESIZE;
 
-    memusage()
-        : v_(nullptr) {
-    }
-
     // Flag bits for memory types:
     static constexpr unsigned f_kernel = 1;     // kernel-restricted
     static constexpr unsigned f_user = 2;       // user-accessible
@@ -37,22 +41,71 @@ class memusage {
     // both as kernel-only and process-associated.
 
 
-    // Refresh the memory map from current state
+    // Bring the memory map up to date with the current state
     void refresh();
 
     // Return the symbol (character & color) associated with `pa`
-    uint16_t symbol_at(uintptr_t pa) const;
+    uint16_t symbol_at(uintptr_t pa) const {
+        return pa < maxpa ? pages_[pa / PAGESIZE].sym : compute_symbol(pa);
+    }
+    // Return true if any symbol changed in the last refresh
+    bool changed() const {
+        return changed_;
+    }
+    // Return true if `pid`'s page table was rewalked in the last refresh
+    bool rewalked(pid_t pid) const {
+        return rewalked_ & f_process(pid);
+    }
 
-  private:
-    unsigned* v_;
+    // Cached virtual-memory view (see `console_memviewer_virtual`)
+    uint16_t* vsyms_ = nullptr;
+    pid_t vpid_ = 0;
 
-    // add `flags` to the page containing `pa`
+    // Pages and page tables reported changed since the last refresh
+    static std::atomic<uint64_t> dirty_pages[npages / 64];
+    static std::atomic<uint64_t> dirty_pagetables[npages / 64];
+
+  private:
+    struct pageinfo {
+        unsigned pk;            // `f_process` bits of page tables using
+                                // this page, plus `f_kernel` if the
+                                // kernel page table does
+        unsigned pu;            // `f_process` bits of user mappings
+        bool kmisc;             // slab page or the viewer's own memory
+        uint16_t sym;           // cached `compute_symbol` result
+    };
+    pageinfo* pages_ = nullptr;
+    uintptr_t roots_[NPROC] = {}; // page table root walked for each pid
+    uint64_t touched_[npages / 64]; // pages whose marks changed
+    unsigned rewalked_ = 0;
+    bool changed_ = false;
+
+    // return the combined flags for page `pn`
+    unsigned flags(size_t pn) const {
+        const pageinfo& pi = pages_[pn];
+        return pi.pk | (pi.pk ? f_kernel : 0)
+            | pi.pu | (pi.pu ? f_user : 0)
+            | (pi.kmisc ? f_kernel : 0);
+    }
+    // add `bits` to the page-table or user marks of the page at `pa`
     // This is safe to call even if `pa >= maxpa`.
-    void mark(uintptr_t pa, unsigned flags) {
+    void mark(uintptr_t pa, unsigned pageinfo::* field, unsigned bits) {
         if (pa < maxpa) {
-            v_[pa / PAGESIZE] |= flags;
+            size_t pn = pa / PAGESIZE;
+            if ((pages_[pn].*field & bits) != bits) {
+                pages_[pn].*field |= bits;
+                touched_[pn / 64] |= uint64_t(1) << (pn % 64);
+            }
         }
     }
+    // remove `bits` from every page's page-table and user marks
+    void unmark_all(unsigned bits);
+    // walk `pid`'s page table (if `root` is nonzero)
+    void walk_process(pid_t pid, uintptr_t root);
+    // recompute slab and viewer-memory marks
+    void mark_kmisc();
+
+    uint16_t compute_symbol(uintptr_t pa) const;
     // return one of the processes set in a mark
     static int marked_pid(unsigned v) {
         return lsb(v >> 2);
@@ -61,68 +114,154 @@ class memusage {
     void page_error(uintptr_t pa, const char* desc, int pid) const;
 };
 
+std::atomic<uint64_t> memusage::dirty_pages[npages / 64];
+std::atomic<uint64_t> memusage::dirty_pagetables[npages / 64];
+
+
+// memusage_note_pages(pa, sz), memusage_note_pagetable(pt)
+//    Hooks called by `kalloc`/`kfree` and `vmiter`.
+
+void memusage_note_pages(uintptr_t pa, size_t sz) {
+    for (; sz != 0 && pa < memusage::maxpa; pa += PAGESIZE, sz -= PAGESIZE) {
+        size_t pn = pa / PAGESIZE;
+        memusage::dirty_pages[pn / 64].fetch_or(uint64_t(1) << (pn % 64),
+                                                std::memory_order_relaxed);
+    }
+}
+
+void memusage_note_pagetable(x86_64_pagetable* pt) {
+    size_t pn = kptr2pa(pt) / PAGESIZE;
+    if (pn < memusage::npages) {
+        memusage::dirty_pagetables[pn / 64].fetch_or(
+            uint64_t(1) << (pn % 64), std::memory_order_relaxed);
+    }
+}
+
 
 // memusage::refresh()
-//    Calculate the current physical usage map, using the current process
-//    table.
+//    Update the physical usage map from the pages and page tables that
+//    changed since the last refresh. The first refresh walks everything.
 
 void memusage::refresh() {
-    if (!v_) {
-        v_ = reinterpret_cast<unsigned*>(kalloc(PAGESIZE));
-        assert(v_ != nullptr);
+    bool full = !pages_;
+    if (full) {
+        static_assert(npages * sizeof(pageinfo)
+                      + (max_view_va / PAGESIZE) * sizeof(uint16_t)
+                      <= 4 * PAGESIZE, "memusage state too big");
+        pages_ = reinterpret_cast<pageinfo*>(kalloc(4 * PAGESIZE));
+        assert(pages_ != nullptr);
+        memset(pages_, 0, npages * sizeof(pageinfo));
+        vsyms_ = reinterpret_cast<uint16_t*>(pages_ + npages);
     }
 
-    memset(v_, 0, (maxpa / PAGESIZE) * sizeof(*v_));
+    uint64_t ptdirty[npages / 64];
+    bool any_pages = full;
+    for (size_t i = 0; i != npages / 64; ++i) {
+        ptdirty[i] = dirty_pagetables[i].exchange(0);
+        touched_[i] = dirty_pages[i].exchange(0);
+        any_pages = any_pages || touched_[i] != 0;
+    }
+    auto pt_dirty = [&] (uintptr_t root) {
+        size_t pn = root / PAGESIZE;
+        return full || (pn < npages && (ptdirty[pn / 64] >> (pn % 64)) & 1);
+    };
 
     // mark kernel page tables
-    for (ptiter it(kernel_pagetable); !it.done(); it.next()) {
-        mark(it.pa(), f_kernel);
+    uintptr_t kroot = kptr2pa(kernel_pagetable);
+    if (pt_dirty(kroot)) {
+        unmark_all(f_kernel);
+        for (ptiter it(kernel_pagetable); !it.done(); it.next()) {
+            mark(it.pa(), &pageinfo::pk, f_kernel);
+        }
+        mark(kroot, &pageinfo::pk, f_kernel);
     }
-    mark(kptr2pa(kernel_pagetable), f_kernel);
 
-    // mark pages accessible from each process's page table
-    bool any = false;
-    for (int pid = 1; pid < NPROC; ++pid) {
+    // mark pages accessible from each changed process's page table
+    rewalked_ = 0;
+    for (pid_t pid = 1; pid < NPROC; ++pid) {
         proc* p = &ptable[pid];
+        uintptr_t root = 0;
         if (p->state != P_FREE
             && p->pagetable
             && p->pagetable != kernel_pagetable) {
-            any = true;
+            root = kptr2pa(p->pagetable);
+        }
+        if (root != roots_[pid] || (root && pt_dirty(root))) {
+            walk_process(pid, root);
+        }
+    }
 
-            for (ptiter it(p); it.va() < VA_LOWEND; it.next()) {
-                mark(it.pa(), f_kernel | f_process(pid));
-            }
-            mark(kptr2pa(p->pagetable), f_kernel | f_process(pid));
-
-            for (vmiter it(p, 0); it.va() < VA_LOWEND; ) {
-                if (it.user()) {
-                    mark(it.pa(), f_user | f_process(pid));
-                    it.next();
-                } else {
-                    it.next_range();
-                }
-            }
+    // slab pages come and go through `kalloc`
+    if (any_pages) {
+        mark_kmisc();
+    }
+
+    // recompute symbols for affected pages
+    changed_ = false;
+    for (size_t pn = 0; pn != npages; ++pn) {
+        if (full || (touched_[pn / 64] >> (pn % 64)) & 1) {
+            uint16_t sym = compute_symbol(pn * PAGESIZE);
+            changed_ = changed_ || sym != pages_[pn].sym;
+            pages_[pn].sym = sym;
         }
     }
+}
 
-    // if no different process page tables, use physical address instead
-    if (!any) {
-        for (vmiter it(kernel_pagetable, 0); it.va() < VA_LOWEND; ) {
-            if (it.user()
-                && it.pa() < MEMSIZE_PHYSICAL
-                && physpages[it.pa() / PAGESIZE].used()) {
-                unsigned owner = (it.pa() - PROC_START_ADDR) / 0x40000;
-                mark(it.pa(), f_user | f_process(owner + 1));
-                it.next();
-            } else {
-                it.next_range();
-            }
+void memusage::unmark_all(unsigned bits) {
+    for (size_t pn = 0; pn != npages; ++pn) {
+        pageinfo& pi = pages_[pn];
+        if ((pi.pk | pi.pu) & bits) {
+            pi.pk &= ~bits;
+            pi.pu &= ~bits;
+            touched_[pn / 64] |= uint64_t(1) << (pn % 64);
         }
     }
+}
 
+void memusage::walk_process(pid_t pid, uintptr_t root) {
+    unmark_all(f_process(pid));
+    roots_[pid] = root;
+    rewalked_ |= f_process(pid);
+    if (!root) {
+        return;
+    }
+    proc* p = &ptable[pid];
+    for (ptiter it(p); it.va() < VA_LOWEND; it.next()) {
+        mark(it.pa(), &pageinfo::pk, f_process(pid));
+    }
+    mark(root, &pageinfo::pk, f_process(pid));
+
+    for (vmiter it(p, 0); it.va() < VA_LOWEND; ) {
+        if (it.user()) {
+            mark(it.pa(), &pageinfo::pu, f_process(pid));
+            it.next();
+        } else {
+            it.next_range();
+        }
+    }
+}
+
+void memusage::mark_kmisc() {
+    // collect the new marks, then compare them with the old ones
+    uint64_t kmisc[npages / 64] = {};
+    auto set = [&] (uintptr_t pa) {
+        if (pa < maxpa) {
+            kmisc[pa / PAGESIZE / 64] |= uint64_t(1) << (pa / PAGESIZE % 64);
+        }
+    };
+    for (auto sc = slab_cache_base::first(); sc; sc = sc->next()) {
+        sc->for_each_slab(set);
+    }
     // mark my own memory
-    if (any) {
-        mark(kptr2pa(v_), f_kernel);
+    for (int i = 0; i != 4; ++i) {
+        set(kptr2pa(pages_) + i * PAGESIZE);
+    }
+    for (size_t pn = 0; pn != npages; ++pn) {
+        bool k = (kmisc[pn / 64] >> (pn % 64)) & 1;
+        if (k != pages_[pn].kmisc) {
+            pages_[pn].kmisc = k;
+            touched_[pn / 64] |= uint64_t(1) << (pn % 64);
+        }
     }
 }
 
@@ -134,7 +273,7 @@ void memusage::page_error(uintptr_t pa, const char* desc, int pid) const {
     log_printf(fmt, pa, desc, pid);
 }
 
-uint16_t memusage::symbol_at(uintptr_t pa) const {
+uint16_t memusage::compute_symbol(uintptr_t pa) const {
     bool is_reserved = reserved_physical_address(pa);
     bool is_kernel = !is_reserved && !allocatable_physical_address(pa);
 
@@ -148,7 +287,7 @@ uint16_t memusage::symbol_at(uintptr_t pa) const {
         }
     }
 
-    auto v = v_[pa / PAGESIZE];
+    auto v = flags(pa / PAGESIZE);
     if (pa >= (uintptr_t) console && pa < (uintptr_t) console + PAGESIZE) {
         return 'C' | 0x0700;
     } else if (is_reserved && v > (f_kernel | f_user)) {
@@ -161,7 +300,7 @@ uint16_t memusage::symbol_at(uintptr_t pa) const {
         return 'K' | 0xCD00;
     } else if (is_kernel) {
         return 'K' | 0x0D00;
-    } else if (pa >= MEMSIZE_PHYSICAL) {
+    } else if (pa >= memsize_physical) {
         return ' ' | 0x0700;
     } else {
         if (v == 0) {
@@ -198,37 +337,61 @@ uint16_t memusage::symbol_at(uintptr_t pa) const {
 }
 
 
+// put_cell(cpos, ch)
+//    Write `ch` to the console at `cpos` unless it is already there.
+
+static inline void put_cell(int cpos, uint16_t ch) {
+    if (console[cpos] != ch) {
+        console[cpos] = ch;
+    }
+}
+
+
 static void console_memviewer_virtual(memusage& mu, proc* vmp) {
     assert(vmp->pagetable != nullptr);
 
     const char* statemsg = vmp->state == P_FAULTED ? " (faulted)" : "";
-    console_printf(CPOS(10, 26), 0x0F00,
-                   "VIRTUAL ADDRESS SPACE FOR %d%C%s\n", vmp->pid,
-                   0x0700, statemsg);
-
-    for (vmiter it(vmp, 0);
-         it.va() < memusage::max_view_va;
-         it += PAGESIZE) {
-        unsigned long pn = it.va() / PAGESIZE;
-        if (pn % 64 == 0) {
-            console_printf(CPOS(11 + pn / 64, 3), 0x0F00,
-                           "0x%06X ", it.va());
-        }
-        uint16_t ch;
-        if (!it.present()) {
-            ch = ' ';
-        } else {
-            ch = mu.symbol_at(it.pa());
-            if (it.user()) { // switch foreground & background colors
-                if (ch == (0x0F00 | 'S')) {
-                    ch ^= 0xFE00;
-                } else {
-                    uint16_t z = (ch & 0x0F00) ^ ((ch & 0xF000) >> 4);
-                    ch ^= z | (z << 4);
+    static int last_state = -1;
+    bool redraw = vmp->pid != mu.vpid_ || vmp->state != last_state
+        || mu.rewalked(vmp->pid) || mu.changed();
+    if (redraw || console[CPOS(10, 26)] != ('V' | 0x0F00)) {
+        console_printf(CPOS(10, 26), 0x0F00,
+                       "VIRTUAL ADDRESS SPACE FOR %d%C%s\n", vmp->pid,
+                       0x0700, statemsg);
+    }
+    mu.vpid_ = vmp->pid;
+    last_state = vmp->state;
+
+    // Without changes to this page table or to any symbol, the cached
+    // cells are still right; otherwise walk the address space again.
+    if (redraw) {
+        for (vmiter it(vmp, 0);
+             it.va() < memusage::max_view_va;
+             it += PAGESIZE) {
+            uint16_t ch;
+            if (!it.present()) {
+                ch = ' ';
+            } else {
+                ch = mu.symbol_at(it.pa());
+                if (it.user()) { // switch foreground & background colors
+                    if (ch == (0x0F00 | 'S')) {
+                        ch ^= 0xFE00;
+                    } else {
+                        uint16_t z = (ch & 0x0F00) ^ ((ch & 0xF000) >> 4);
+                        ch ^= z | (z << 4);
+                    }
                 }
             }
+            mu.vsyms_[it.va() / PAGESIZE] = ch;
+        }
+    }
+
+    for (unsigned long pn = 0; pn * PAGESIZE < memusage::max_view_va; ++pn) {
+        if (pn % 64 == 0 && console[CPOS(11 + pn / 64, 3)] != ('0' | 0x0F00)) {
+            console_printf(CPOS(11 + pn / 64, 3), 0x0F00,
+                           "0x%06X ", pn * PAGESIZE);
         }
-        console[CPOS(11 + pn/64, 12 + pn%64)] = ch;
+        put_cell(CPOS(11 + pn/64, 12 + pn%64), mu.vsyms_[pn]);
     }
 }
 
@@ -242,13 +405,34 @@ void console_memviewer(proc* vmp) {
     mu.refresh();
 
     // print physical memory
-    console_printf(CPOS(0, 32), 0x0F00, "PHYSICAL MEMORY\n");
+    if (console[CPOS(0, 32)] != ('P' | 0x0F00)) {
+        console_printf(CPOS(0, 32), 0x0F00, "PHYSICAL MEMORY\n");
+    }
 
     for (int pn = 0; pn * PAGESIZE < memusage::max_view_pa; ++pn) {
-        if (pn % 64 == 0) {
+        if (pn % 64 == 0 && console[CPOS(1 + pn/64, 3)] != ('0' | 0x0F00)) {
             console_printf(CPOS(1 + pn/64, 3), 0x0F00, "0x%06X ", pn << 12);
         }
-        console[CPOS(1 + pn/64, 12 + pn%64)] = mu.symbol_at(pn * PAGESIZE);
+        put_cell(CPOS(1 + pn/64, 12 + pn%64), mu.symbol_at(pn * PAGESIZE));
+    }
+
+    // print slab cache occupancy (allocated/capacity objects)
+    int cpos = CPOS(9, 3);
+    for (auto sc = slab_cache_base::first();
+         sc && cpos < CPOS(9, 60);
+         sc = sc->next()) {
+        cpos = console_printf(cpos, 0x0700, "%s %zu/%zu  ", sc->name(),
+                              sc->nallocated(), sc->capacity());
+    }
+
+    // print per-CPU scheduler counters (switches/steals/idle ticks)
+    cpos = console_printf(CPOS(23, 3), 0x0700, "CPU sw/st/idle");
+    for (int i = 0; i != MAXCPU && cpos < CPOS(23, 56); ++i) {
+        if (cpustate* c = cpus[i]) {
+            cpos = console_printf(cpos, 0x0700, "  %d:%lu/%lu/%lu", i,
+                                  c->nswitches_, c->nsteals_,
+                                  c->idle_tsc_ / tsc_per_tick);
+        }
     }
 
     // print virtual memory
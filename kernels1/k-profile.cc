@@ -0,0 +1,143 @@
+#include "k-profile.hh"
+#include "k-vmiter.hh"
+
+// k-profile.cc
+//
+//    Timer-driven sampling profiler; see `k-profile.hh`.
+
+bool profiling;
+
+namespace {
+// A histogram entry counts samples with the same (pid, pc, caller).
+// Kernel entries have pid 0, and their addresses are rounded down to
+// the start of their functions so each function gets one entry.
+struct profile_entry {
+    uintptr_t pc;
+    uintptr_t caller;
+    pid_t pid;
+    unsigned count;
+};
+
+constexpr size_t profile_size = 256;    // entries (power of two)
+constexpr int profile_top = 20;         // entries printed by the report
+
+profile_entry* histogram;
+unsigned long nsamples;                 // samples taken
+unsigned long nlost;                    // samples that found no entry
+spinlock profile_lock("profile_lock"); // protects the histogram
+}
+
+void profile_init() {
+    static_assert(sizeof(profile_entry) * profile_size <= 2 * PAGESIZE,
+                  "histogram must fit in two pages");
+    histogram = reinterpret_cast<profile_entry*>(kalloc_pages(1));
+    assert(histogram);
+    memset(histogram, 0, sizeof(profile_entry) * profile_size);
+    profiling = true;
+}
+
+
+// kernel_function(addr)
+//    Return the start of the kernel function containing `addr`, or `addr`
+//    if it has no symbol.
+
+static uintptr_t kernel_function(uintptr_t addr) {
+    uintptr_t start;
+    return addr && lookup_symbol(addr, nullptr, &start) ? start : addr;
+}
+
+// sample_caller(regs)
+//    Return the return address in the interrupted code's current frame,
+//    or 0 if its frame pointer looks bogus. User frames are read through
+//    the current process's page table.
+
+static uintptr_t sample_caller(const regstate* regs) {
+    uintptr_t rbp = regs->reg_rbp;
+    if ((rbp & 7) != 0) {
+        return 0;
+    }
+    if ((regs->reg_cs & 3) == 0) {
+        // the idle loop runs on this CPU's one-page kernel stack
+        uintptr_t top = round_up(regs->reg_rsp, PAGESIZE);
+        if (rbp < regs->reg_rsp || top - rbp < 16) {
+            return 0;
+        }
+        return kernel_function(reinterpret_cast<uintptr_t*>(rbp)[1]);
+    }
+    vmiter it(this_cpu()->current_, rbp + 8);
+    return it.user() ? *it.kptr<uintptr_t*>() : 0;
+}
+
+void profile_sample(const regstate* regs) {
+    bool user = (regs->reg_cs & 3) != 0;
+    pid_t pid = user ? this_cpu()->current_->pid : 0;
+    uintptr_t pc = user ? regs->reg_rip : kernel_function(regs->reg_rip);
+    uintptr_t caller = sample_caller(regs);
+
+    size_t h = (pc ^ (caller << 7) ^ (uintptr_t(pid) << 13)) * 0x9E3779B1U;
+    spinlock_guard guard(profile_lock);
+    ++nsamples;
+    for (size_t i = 0; i != profile_size; ++i) {
+        profile_entry& e = histogram[(h + i) % profile_size];
+        if (e.count == 0) {
+            e.pc = pc;
+            e.caller = caller;
+            e.pid = pid;
+        }
+        if (e.pc == pc && e.caller == caller && e.pid == pid) {
+            ++e.count;
+            return;
+        }
+    }
+    ++nlost;
+}
+
+
+// print_address(prefix, pid, addr)
+//    Print `addr` as a function name if it is a kernel address with a
+//    symbol, otherwise as a number.
+
+static void print_address(const char* prefix, pid_t pid, uintptr_t addr) {
+    const char* name;
+    if (pid == 0 && addr && lookup_symbol(addr, &name, nullptr)) {
+        log_printf("%s%s", prefix, name);
+    } else {
+        log_printf("%s%p", prefix, addr);
+    }
+}
+
+void profile_report() {
+    spinlock_guard guard(profile_lock);
+    log_printf("profile: %lu samples, %lu lost\n", nsamples, nlost);
+    if (nsamples == 0) {
+        return;
+    }
+    // Select the hottest entries by repeated scans; zeroing each
+    // printed entry's count removes it from later scans.
+    for (int n = 0; n != profile_top; ++n) {
+        profile_entry* best = nullptr;
+        for (size_t i = 0; i != profile_size; ++i) {
+            if (histogram[i].count
+                && (!best || histogram[i].count > best->count)) {
+                best = &histogram[i];
+            }
+        }
+        if (!best) {
+            break;
+        }
+        unsigned long permille = best->count * 1000UL / nsamples;
+        log_printf("profile: %6u %3lu.%lu%%  ", best->count,
+                   permille / 10, permille % 10);
+        if (best->pid == 0) {
+            log_printf("kernel");
+        } else {
+            log_printf("pid %d", best->pid);
+        }
+        print_address(" ", best->pid, best->pc);
+        if (best->caller) {
+            print_address(" <- ", best->pid, best->caller);
+        }
+        log_printf("\n");
+        best->count = 0;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef WEENSYOS_K_PROFILE_HH
+#define WEENSYOS_K_PROFILE_HH
+#include "kernel.hh"
+
+// Sampling profiler
+//
+//    Booting with the command `profile` (`make run-profile`) runs the
+//    default processes with the profiler on. Every CPU's timer then
+//    fires at least PROFILE_RATE times per tick, and each timer
+//    interrupt records the interrupted %rip and its caller's return
+//    address in a histogram. Typing Control-C (or 'q') prints the
+//    hottest entries to `log.txt` before exiting.
+//
+//    The kernel runs with interrupts disabled except while idle, so
+//    kernel samples land in the idle loop. Kernel addresses are
+//    resolved to functions with `lookup_symbol`. Process images carry
+//    no symbols, so process samples print raw addresses; look them up
+//    in `obj/p-NAME.sym`.
+
+#define PROFILE_RATE 4                  // samples per CPU per tick
+
+extern bool profiling;
+
+// profile_init()
+//    Allocate the histogram and start profiling.
+void profile_init();
+
+// profile_sample(regs)
+//    Record a sample for a timer interrupt that arrived with registers
+//    `regs` (user or kernel mode).
+void profile_sample(const regstate* regs);
+
+// profile_report()
+//    Print the most frequent samples to `log.txt`.
+void profile_report();
+
+#endif
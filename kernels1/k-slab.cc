@@ -0,0 +1,107 @@
+#include "k-slab.hh"
+
+// k-slab.cc
+//
+//    Slab object caches; see `k-slab.hh`.
+
+slab_cache_base* slab_cache_base::all_caches;
+
+// Global caches are constructed by `init_constructors`, before memory
+// is available, so the constructor must not allocate.
+slab_cache_base::slab_cache_base(const char* name, size_t objsize,
+                                 size_t objalign)
+    : name_(name), next_cache_(all_caches) {
+    // a free object stores the next free pointer in its first word
+    objsize_ = round_up(max(objsize, sizeof(void*)), max(objalign, alignof(void*)));
+    objoff_ = round_up(sizeof(slab_header), max(objalign, alignof(void*)));
+    objs_per_slab_ = (PAGESIZE - objoff_) / objsize_;
+    assert(objs_per_slab_ >= 2);
+    all_caches = this;
+}
+
+
+static void slab_list_push(slab_header** list, slab_header* s) {
+    s->prev = nullptr;
+    s->next = *list;
+    if (s->next) {
+        s->next->prev = s;
+    }
+    *list = s;
+}
+
+static void slab_list_remove(slab_header** list, slab_header* s) {
+    if (s->prev) {
+        s->prev->next = s->next;
+    } else {
+        *list = s->next;
+    }
+    if (s->next) {
+        s->next->prev = s->prev;
+    }
+}
+
+
+// slab_cache_base::grow()
+//    Allocate a new slab, thread its free list, and add it to `partial_`.
+
+slab_header* slab_cache_base::grow() {
+    void* page = kalloc(PAGESIZE);
+    if (!page) {
+        return nullptr;
+    }
+    slab_header* s = reinterpret_cast<slab_header*>(page);
+    s->cache = this;
+    s->nfree = objs_per_slab_;
+    s->free = nullptr;
+    char* first = reinterpret_cast<char*>(page) + objoff_;
+    for (size_t i = objs_per_slab_; i != 0; --i) {
+        void* obj = first + (i - 1) * objsize_;
+        *reinterpret_cast<void**>(obj) = s->free;
+        s->free = obj;
+    }
+    slab_list_push(&partial_, s);
+    ++nslabs_;
+    return s;
+}
+
+void* slab_cache_base::allocate() {
+    slab_header* s = partial_;
+    if (!s && !(s = grow())) {
+        return nullptr;
+    }
+    void* obj = s->free;
+    s->free = *reinterpret_cast<void**>(obj);
+    --s->nfree;
+    if (s->nfree == 0) {
+        slab_list_remove(&partial_, s);
+        slab_list_push(&full_, s);
+    }
+    ++nallocated_;
+    return obj;
+}
+
+void slab_cache_base::deallocate(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    slab_header* s = reinterpret_cast<slab_header*>(
+        round_down(reinterpret_cast<uintptr_t>(ptr), PAGESIZE)
+    );
+    assert(s->cache == this);
+    assert((reinterpret_cast<uintptr_t>(ptr) - kptr2pa(s) - objoff_)
+           % objsize_ == 0);
+    *reinterpret_cast<void**>(ptr) = s->free;
+    s->free = ptr;
+    ++s->nfree;
+    --nallocated_;
+    if (s->nfree == 1) {
+        slab_list_remove(&full_, s);
+        slab_list_push(&partial_, s);
+    }
+    // release empty slabs, keeping one around to absorb churn
+    if (s->nfree == objs_per_slab_ && nslabs_ > 1) {
+        slab_list_remove(&partial_, s);
+        --nslabs_;
+        kfree(s);
+    }
+}
@@ -0,0 +1,129 @@
+#ifndef WEENSYOS_K_SLAB_HH
+#define WEENSYOS_K_SLAB_HH
+#include "kernel.hh"
+#include <utility>
+
+// `slab_cache<T>` is an object cache for small kernel objects.
+//
+// Each cache carves whole `kalloc` pages ("slabs") into equal-sized
+// objects. A slab starts with a `slab_header`; the rest of the page holds
+// objects, and free objects are chained into a per-slab free list. The
+// cache keeps slabs with free objects on a `partial` list and full slabs
+// on a `full` list. A slab whose objects are all freed goes back to
+// `kfree`, unless it is the cache's last slab.
+//
+// Allocating with `make(args...)` runs `T`'s constructor on the new
+// object; `destroy(x)` runs the destructor and returns the object to its
+// slab.
+//
+//     static slab_cache<pipe> pipe_cache("pipe");
+//     pipe* pp = pipe_cache.make();
+//     ...
+//     pipe_cache.destroy(pp);
+
+struct slab_header;
+
+class slab_cache_base {
+  public:
+    slab_cache_base(const char* name, size_t objsize, size_t objalign);
+    slab_cache_base(const slab_cache_base&) = delete;
+    slab_cache_base& operator=(const slab_cache_base&) = delete;
+
+    // Return the cache's name (for the memory viewer)
+    inline const char* name() const;
+    // Return the number of objects currently allocated
+    inline size_t nallocated() const;
+    // Return the number of object slots in all of this cache's slabs
+    inline size_t capacity() const;
+    // Return the number of slab pages owned by this cache
+    inline size_t nslabs() const;
+
+    // Return an uninitialized object, or `nullptr` if out of memory
+    void* allocate();
+    // Return object `ptr`, which came from `allocate()`, to its slab
+    void deallocate(void* ptr);
+
+    // Call `f(slab_pa)` for each slab page owned by this cache
+    template <typename F> void for_each_slab(F f) const;
+
+    // First element of the list of all caches
+    static inline slab_cache_base* first();
+    // Next cache in the list of all caches
+    inline slab_cache_base* next() const;
+
+  private:
+    const char* name_;
+    size_t objsize_;
+    size_t objoff_;                     // offset of first object in a slab
+    size_t objs_per_slab_;
+    size_t nallocated_ = 0;
+    size_t nslabs_ = 0;
+    slab_header* partial_ = nullptr;    // slabs with free objects
+    slab_header* full_ = nullptr;       // slabs with no free objects
+    slab_cache_base* next_cache_;
+
+    static slab_cache_base* all_caches;
+
+    slab_header* grow();
+};
+
+template <typename T>
+class slab_cache : public slab_cache_base {
+  public:
+    explicit slab_cache(const char* name)
+        : slab_cache_base(name, sizeof(T), alignof(T)) {
+    }
+
+    // Allocate and construct an object, or return `nullptr`
+    template <typename... Args>
+    T* make(Args&&... args) {
+        void* ptr = allocate();
+        return ptr ? new (ptr) T(std::forward<Args>(args)...) : nullptr;
+    }
+    // Destroy and free an object returned by `make()`
+    void destroy(T* x) {
+        if (x) {
+            x->~T();
+            deallocate(x);
+        }
+    }
+};
+
+
+struct slab_header {
+    slab_cache_base* cache;
+    slab_header* next;
+    slab_header* prev;
+    void* free;                         // first free object in slab
+    size_t nfree;
+};
+
+inline const char* slab_cache_base::name() const {
+    return name_;
+}
+inline size_t slab_cache_base::nallocated() const {
+    return nallocated_;
+}
+inline size_t slab_cache_base::capacity() const {
+    return nslabs_ * objs_per_slab_;
+}
+inline size_t slab_cache_base::nslabs() const {
+    return nslabs_;
+}
+inline slab_cache_base* slab_cache_base::first() {
+    return all_caches;
+}
+inline slab_cache_base* slab_cache_base::next() const {
+    return next_cache_;
+}
+template <typename F>
+void slab_cache_base::for_each_slab(F f) const {
+    for (slab_header* s = partial_; s; s = s->next) {
+        f(kptr2pa(s));
+    }
+    for (slab_header* s = full_; s; s = s->next) {
+        f(kptr2pa(s));
+    }
+}
+
+#endif
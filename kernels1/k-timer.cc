@@ -0,0 +1,97 @@
+#include "k-timer.hh"
+
+// k-timer.cc
+//
+//    Hierarchical timing wheel for sleeping processes; see `k-timer.hh`.
+
+timer_wheel sleepers;
+
+
+// timer_wheel::insert(p, t)
+//    Place `p` in the slot that expires or cascades at tick `t`, where
+//    `t >= now_`. Wakeups beyond the wheel's range are clamped to its
+//    last tick; `advance` re-inserts such processes when they surface.
+
+void timer_wheel::insert(proc* p, unsigned long t) {
+    unsigned long delta = t - now_;
+    if (delta >= 1UL << (slot_bits * nlevels)) {
+        delta = (1UL << (slot_bits * nlevels)) - 1;
+        t = now_ + delta;
+    }
+    int level = 0;
+    while (delta >= 1UL << (slot_bits * (level + 1))) {
+        ++level;
+    }
+    slots_[level][(t >> (slot_bits * level)) & (nslots - 1)].push_back(p);
+}
+
+void timer_wheel::add(proc* p) {
+    assert(!p->timer_links_.is_linked());
+    insert(p, max(p->wakeup_tick_, now_ + 1));
+    ++n_;
+}
+
+void timer_wheel::remove(proc* p) {
+    p->timer_links_.erase();
+    --n_;
+}
+
+
+// timer_wheel::cascade(level)
+//    Move the processes in `level`'s current slot to finer levels. Called
+//    when `now_` reaches the start of that slot's range.
+
+void timer_wheel::cascade(int level) {
+    slot& s = slots_[level][(now_ >> (slot_bits * level)) & (nslots - 1)];
+    while (proc* p = s.pop_front()) {
+        insert(p, max(p->wakeup_tick_, now_));
+    }
+}
+
+
+// timer_wheel::advance(now)
+//    Process every tick up to `now`. Higher levels cascade before level 0
+//    expires, so a process cascaded to the current tick wakes on time.
+
+void timer_wheel::advance(unsigned long now) {
+    while (now_ < now) {
+        if (n_ == 0) {
+            now_ = now;
+            return;
+        }
+        ++now_;
+        for (int level = nlevels - 1; level > 0; --level) {
+            if ((now_ & ((1UL << (slot_bits * level)) - 1)) == 0) {
+                cascade(level);
+            }
+        }
+        slot& s = slots_[0][now_ & (nslots - 1)];
+        while (proc* p = s.pop_front()) {
+            if (p->wakeup_tick_ > now_) {
+                // clamped by `insert`; not yet due
+                insert(p, p->wakeup_tick_);
+            } else {
+                --n_;
+                wake(p);
+            }
+        }
+    }
+}
+
+
+// timer_wheel::next_event()
+//    Return the tick of the first nonempty level-0 slot in the next 64
+//    ticks, or the next level-1 boundary if that comes first (a cascade
+//    there may expose earlier wakeups). Returns 0 if nothing sleeps.
+
+unsigned long timer_wheel::next_event() const {
+    if (n_ == 0) {
+        return 0;
+    }
+    for (unsigned long t = now_ + 1; ; ++t) {
+        if (!slots_[0][t & (nslots - 1)].empty()
+            || (t & (nslots - 1)) == 0) {
+            return t;
+        }
+    }
+}
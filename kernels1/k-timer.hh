@@ -0,0 +1,54 @@
+#ifndef WEENSYOS_K_TIMER_HH
+#define WEENSYOS_K_TIMER_HH
+#include "kernel.hh"
+
+// `timer_wheel` is a hierarchical timing wheel of sleeping processes.
+//
+// Level 0 has one slot per tick for the next 64 ticks; a slot at level
+// L covers 64^L ticks. A process that sleeps until tick T goes into the
+// lowest level whose range reaches T. When the wheel's clock reaches
+// the start of a higher-level slot, the processes in that slot cascade
+// down to finer levels. A process therefore moves at most `nlevels`
+// times, and adding, removing, and expiring sleepers are all O(1).
+//
+// The wheel is protected by `kernel_lock`.
+//
+//     p->wakeup_tick_ = ticks + 10;
+//     sleepers.add(p);
+//     ...
+//     sleepers.advance(ticks);     // wakes `p` once 10 ticks pass
+
+struct timer_wheel {
+    static constexpr int slot_bits = 6;
+    static constexpr int nslots = 1 << slot_bits;
+    static constexpr int nlevels = 4;
+
+    // Sleep `p` until tick `p->wakeup_tick_`
+    void add(proc* p);
+    // Remove `p` from the wheel without waking it
+    void remove(proc* p);
+    // Advance the wheel to tick `now`, waking each expired process
+    void advance(unsigned long now);
+    // Return a tick at or before the earliest wakeup, or 0 if empty
+    unsigned long next_event() const;
+
+    // Return the number of sleeping processes
+    size_t size() const {
+        return n_;
+    }
+
+  private:
+    using slot = list<proc, &proc::timer_links_>;
+
+    slot slots_[nlevels][nslots];
+    unsigned long now_ = 0;             // last tick processed
+    size_t n_ = 0;                      // number of sleeping processes
+
+    void insert(proc* p, unsigned long t);
+    void cascade(int level);
+};
+
+// Processes blocked in `sys_sleep`
+extern timer_wheel sleepers;
+
+#endif
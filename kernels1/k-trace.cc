@@ -0,0 +1,35 @@
+#include "k-trace.hh"
+
+// k-trace.cc
+//
+//    Per-CPU kernel event trace rings; see `k-trace.hh` and `trace.h`.
+
+static_assert(sizeof(trace_record) * TRACE_NRECORDS <= PAGESIZE,
+              "trace ring must fit in a page");
+
+void trace_init() {
+    cpustate* c = this_cpu();
+    if (!c->trace_) {
+        c->trace_ = reinterpret_cast<trace_record*>(kalloc(PAGESIZE));
+        c->trace_pos_ = 0;
+    }
+}
+
+void trace_dump() {
+    for (int i = 0; i != MAXCPU; ++i) {
+        cpustate* c = cpus[i];
+        if (!c || !c->trace_) {
+            continue;
+        }
+        // Other CPUs keep tracing; a record they overwrite mid-dump may
+        // come out torn, which the decoder tolerates.
+        unsigned long pos = c->trace_pos_;
+        unsigned long n = min(pos, (unsigned long) TRACE_NRECORDS);
+        for (unsigned long j = pos - n; j != pos; ++j) {
+            const trace_record& r = c->trace_[j % TRACE_NRECORDS];
+            log_print("trace {} {x} {x} {x} {x} {x}\n", i, r.tsc, r.event,
+                      r.pid, r.arg0, r.arg1);
+        }
+    }
+    log_print("trace end {x}\n", tsc_per_tick);
+}
@@ -0,0 +1,35 @@
+#ifndef WEENSYOS_K_TRACE_HH
+#define WEENSYOS_K_TRACE_HH
+#include "kernel.hh"
+#include "trace.h"
+
+// Kernel event tracing
+//
+//    `trace(event, arg0, arg1)` appends a binary record to this CPU's
+//    trace ring. It costs an `rdtsc` and a 32-byte store, so it is cheap
+//    enough for the system call and scheduling paths. Only the owning
+//    CPU writes its ring, so no locking is needed.
+
+// trace_init()
+//    Allocate this CPU's trace ring. Until then, `trace` does nothing.
+void trace_init();
+
+// trace_dump()
+//    Write every CPU's trace ring to `log.txt`, oldest record first.
+void trace_dump();
+
+__always_inline void trace(uint32_t event, uint64_t arg0 = 0,
+                           uint64_t arg1 = 0) {
+    cpustate* c = this_cpu();
+    if (trace_record* ring = c->trace_) {
+        trace_record& r = ring[c->trace_pos_ % TRACE_NRECORDS];
+        ++c->trace_pos_;
+        r.tsc = rdtsc();
+        r.event = event;
+        r.pid = c->current_ ? c->current_->pid : 0;
+        r.arg0 = arg0;
+        r.arg1 = arg1;
+    }
+}
+
+#endif
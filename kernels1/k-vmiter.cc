@@ -3,7 +3,9 @@
 const x86_64_pageentry_t vmiter::zero_pe = 0;
 
 uint64_t vmiter::range_perm(size_t sz) const {
+    // `PTE_XD` restricts rather than grants, so it is ORed, not ANDed
     uint64_t p = perm();
+    uint64_t xd = p & PTE_XD;
     size_t rsz = pageoffmask(level_) + 1;
     if ((p & PTE_P) != 0 && sz > rsz) {
         if (sz > ((int64_t) va() < 0 ? 0 : VA_LOWEND) - va()) {
@@ -14,12 +16,14 @@ uint64_t vmiter::range_perm(size_t sz) const {
         do {
             sz -= rsz;
             it.next_range();
-            p &= it.perm();
+            uint64_t itp = it.perm();
+            p &= itp;
+            xd |= itp & PTE_XD;
             rsz = pageoffmask(it.level_) + 1;
         } while ((p & PTE_P) != 0 && sz > rsz);
     }
     if ((p & PTE_P) != 0) {
-        return p;
+        return p | xd;
     } else {
         return 0;
     }
@@ -65,7 +69,7 @@ void vmiter::next() {
     real_find((va_ | pageoffmask(level)) + 1);
 }
 
-int vmiter::try_map(uintptr_t pa, int perm) {
+int vmiter::try_map(uintptr_t pa, uint64_t perm) {
     if (pa == (uintptr_t) -1 && perm == 0) {
         pa = 0;
     }
@@ -81,6 +85,7 @@ int vmiter::try_map(uintptr_t pa, int perm) {
     // new permissions (`perm`) cannot be less restrictive than permissions
     // imposed by higher-level page tables (`perm_`)
     assert(!(perm & ~perm_ & (PTE_P | PTE_W | PTE_U)));
+    memusage_note_pagetable(pt_);
 
     while (level_ > 0 && perm) {
         assert(!(*pep_ & PTE_P));
@@ -99,6 +104,89 @@ int vmiter::try_map(uintptr_t pa, int perm) {
     return 0;
 }
 
+int vmiter::try_map_range(uintptr_t pa, size_t sz, uint64_t perm) {
+    assert((sz % PAGESIZE) == 0, "vmiter::try_map_range size not aligned");
+    uintptr_t end_va = va_ + sz;
+    while (va_ != end_va) {
+        // map the first page normally, allocating page table pages...
+        int r = try_map(pa, perm);
+        if (r < 0) {
+            return r;
+        }
+        // ...then fill the rest of this level-1 page table page directly.
+        // (If `perm` is not present and no level-1 page exists, the whole
+        // unmapped region is skipped.)
+        uintptr_t next_va = min(end_va, last_va());
+        if (level_ == 0) {
+            next_va = min(end_va, (va_ | pageoffmask(1)) + 1);
+            size_t n = (next_va - va_) / PAGESIZE;
+            for (size_t i = 1; i != n; ++i) {
+                pep_[i] = (perm & PTE_P ? pa + i * PAGESIZE : 0) | perm;
+            }
+        }
+        pa += next_va - va_;
+        find(next_va);
+    }
+    return 0;
+}
+
+void vmiter::unmap_range(size_t sz) {
+    assert((va_ % PAGESIZE) == 0 && (sz % PAGESIZE) == 0,
+           "vmiter::unmap_range not aligned");
+    memusage_note_pagetable(pt_);
+    uintptr_t end_va = va_ + sz;
+    while (va_ < end_va) {
+        if (level_ == 0) {
+            uintptr_t next_va = min(end_va, (va_ | pageoffmask(1)) + 1);
+            size_t n = (next_va - va_) / PAGESIZE;
+            for (size_t i = 0; i != n; ++i) {
+                pep_[i] = 0;
+            }
+            find(next_va);
+        } else if (*pep_ & PTE_P) {
+            // large page: must be unmapped as a whole
+            assert((va_ & pageoffmask(level_)) == 0
+                   && end_va - va_ > pageoffmask(level_),
+                   "vmiter::unmap_range splits a large page");
+            *pep_ = 0;
+            next_range();
+        } else {
+            next_range();
+        }
+    }
+    find(end_va);
+}
+
+int vmiter::try_map_large(uintptr_t pa, uint64_t perm) {
+    uintptr_t large_mask = pageoffmask(1);
+    assert((va_ & large_mask) == 0, "vmiter::try_map_large va not aligned");
+    assert(!(perm & ~perm_ & (PTE_P | PTE_W | PTE_U)));
+    memusage_note_pagetable(pt_);
+    if (perm & PTE_P) {
+        assert((pa & large_mask) == 0 && (pa & PTE_PS_PAMASK) == pa,
+               "vmiter::try_map_large pa not aligned");
+    } else {
+        pa = 0;
+    }
+
+    while (level_ > 1) {
+        assert(!(*pep_ & PTE_P));
+        x86_64_pagetable* pt = (x86_64_pagetable*) kalloc(PAGESIZE);
+        if (!pt) {
+            return -1;
+        }
+        memset(pt, 0, PAGESIZE);
+        *pep_ = (uintptr_t) pt | PTE_P | PTE_W | PTE_U;
+        down();
+    }
+    if (level_ == 0) {
+        // a level-1 page table page already covers this region
+        return -1;
+    }
+
+    *pep_ = perm & PTE_P ? pa | perm | PTE_PS : 0;
+    return 0;
+}
 
 ptiter::ptiter(x86_64_pagetable* pt)
     : pt_(pt), pep_(&pt_->entry[0]), level_(3), va_(0) {
@@ -36,7 +36,10 @@ class vmiter {
     inline bool writable() const;
     // Return true iff `va()` is present and unprivileged (`PTE_P|PTE_U`)
     inline bool user() const;
-    // Return intersection of permissions in [va(), va() + sz)
+    // Return intersection of permissions in [va(), va() + sz): bits
+    // 0-0xFFF are set if every page has them, and `PTE_XD` is set if any
+    // page has it, so the range is executable only if every page is.
+    // Returns 0 unless the whole range is present.
     uint64_t range_perm(size_t sz) const;
     // Return true iff `(perm() & desired_perm) == desired_perm`.
     inline bool perm(uint64_t desired_perm) const;
@@ -65,16 +68,39 @@ class vmiter {
     // Map current virtual address to `pa` with permissions `perm`.
     // The current virtual address must be page-aligned. Calls `kalloc`
     // to allocate page table pages if necessary; panics on failure.
-    inline void map(uintptr_t pa, int perm);
+    inline void map(uintptr_t pa, uint64_t perm);
     // Same, but map a kernel pointer
-    inline void map(void* kptr, int perm);
+    inline void map(void* kptr, uint64_t perm);
 
     // Map current virtual address to `pa` with permissions `perm`.
     // The current virtual address must be page-aligned. Calls `kalloc`
     // to allocate page table pages if necessary; returns 0 on success
     // and -1 on failure.
-    [[gnu::warn_unused_result]] int try_map(uintptr_t pa, int perm);
-    [[gnu::warn_unused_result]] inline int try_map(void* kptr, int perm);
+    [[gnu::warn_unused_result]] int try_map(uintptr_t pa, uint64_t perm);
+    [[gnu::warn_unused_result]] inline int try_map(void* kptr, uint64_t perm);
+
+    // Map the `sz` bytes starting at the current virtual address to the
+    // physical range starting at `pa`, all with permissions `perm`, then
+    // advance to `va() + sz`. `va()`, `pa`, and `sz` must be page-aligned.
+    // Each level-1 page table page is walked to only once. `map_range`
+    // panics on failure; `try_map_range` returns 0 on success and -1 on
+    // failure (a failed call may leave a prefix of the range mapped).
+    inline void map_range(uintptr_t pa, size_t sz, uint64_t perm);
+    [[gnu::warn_unused_result]] int try_map_range(uintptr_t pa, size_t sz,
+                                                  uint64_t perm);
+    // Clear the mappings for the `sz` bytes starting at the current
+    // virtual address, then advance to `va() + sz`. Does not free the
+    // mapped pages or any page table pages.
+    void unmap_range(size_t sz);
+
+    // Map the 2 MiB region starting at the current virtual address to the
+    // 2 MiB region starting at `pa` with a single large-page (`PTE_PS`)
+    // entry. Both addresses must be 2 MiB-aligned. Fails if the region is
+    // already split into 4 KiB pages by a level-1 page table page, or if
+    // a page table page can't be allocated. `map_large` panics on
+    // failure; `try_map_large` returns 0 on success and -1 on failure.
+    inline void map_large(uintptr_t pa, uint64_t perm);
+    [[gnu::warn_unused_result]] int try_map_large(uintptr_t pa, uint64_t perm);
 
   private:
     x86_64_pagetable* pt_;
@@ -178,9 +204,9 @@ inline T vmiter::kptr() const {
     }
 }
 inline uint64_t vmiter::perm() const {
-    // Returns 0-0xFFF. (XXX Does not track PTE_XD.)
+    // Returns 0-0xFFF, plus the entry's own PTE_XD bit.
     // Returns 0 unless `(*pep_ & perm_ & PTE_P) != 0`.
-    uint64_t ph = *pep_ & perm_;
+    uint64_t ph = *pep_ & (perm_ | PTE_XD);
     return ph & -(ph & PTE_P);
 }
 inline bool vmiter::perm(uint64_t desired_perm) const {
@@ -223,16 +249,24 @@ inline void vmiter::operator--(int) {
 inline void vmiter::next_range() {
     real_find(last_va());
 }
-inline void vmiter::map(uintptr_t pa, int perm) {
+inline void vmiter::map(uintptr_t pa, uint64_t perm) {
     int r = try_map(pa, perm);
     assert(r == 0, "vmiter::map failed");
 }
-inline void vmiter::map(void* kp, int perm) {
+inline void vmiter::map(void* kp, uint64_t perm) {
     map((uintptr_t) kp, perm);
 }
-inline int vmiter::try_map(void* kp, int perm) {
+inline int vmiter::try_map(void* kp, uint64_t perm) {
     return try_map((uintptr_t) kp, perm);
 }
+inline void vmiter::map_range(uintptr_t pa, size_t sz, uint64_t perm) {
+    int r = try_map_range(pa, sz, perm);
+    assert(r == 0, "vmiter::map_range failed");
+}
+inline void vmiter::map_large(uintptr_t pa, uint64_t perm) {
+    int r = try_map_large(pa, perm);
+    assert(r == 0, "vmiter::map_large failed");
+}
 
 inline ptiter::ptiter(const proc* p)
     : ptiter(p->pagetable) {
@@ -1,6 +1,11 @@
 #include "kernel.hh"
 #include "k-apic.hh"
 #include "k-vmiter.hh"
+#include "k-slab.hh"
+#include "k-timer.hh"
+#include "k-trace.hh"
+#include "k-profile.hh"
+#include "k-bufcache.hh"
 #include "obj/k-firstprocess.h"
 
 // kernel.cc
@@ -8,30 +13,40 @@
 //    This is the kernel.
 
 
-// INITIAL PHYSICAL MEMORY LAYOUT
+// PHYSICAL MEMORY LAYOUT
 //
 //  +-------------- Base Memory --------------+
 //  v                                         v
-// +-----+--------------------+----------------+--------------------+---------/
-// |     | Kernel      Kernel |       :    I/O | App 1        App 1 | App 2
-// |     | Code + Data  Stack |  ...  : Memory | Code + Data  Stack | Code ...
-// +-----+--------------------+----------------+--------------------+---------/
-// 0  0x40000              0x80000 0xA0000 0x100000             0x140000
+// +-----+--------------------+----------------+------------------------/
+// |     | Kernel      Kernel |       :    I/O | Free memory (kalloc):
+// |     | Code + Data  Stack |  ...  : Memory | process pages, page tables...
+// +-----+--------------------+----------------+------------------------/
+// 0  0x40000              0x80000 0xA0000 0x100000
 //                                             ^
-//                                             | \___ PROC_SIZE ___/
 //                                      PROC_START_ADDR
-
-#define PROC_SIZE 0x40000       // initial state only
+//
+// Each process has its own page table. Addresses below PROC_START_ADDR
+// are mapped as in `kernel_pagetable` (kernel-only, except the console);
+// process memory lives at [PROC_START_ADDR, MEMSIZE_VIRTUAL), with the
+// stack in the top page.
 
 proc ptable[NPROC];             // array of process descriptors
                                 // Note that `ptable[0]` is never used.
-proc* current;                  // pointer to currently executing proc
+spinlock kernel_lock("kernel_lock");   // big kernel lock (see `kernel.hh`)
+
+// `PTE_XD` if the CPU enforces no-execute (`IA32_EFER_NXE`), else 0.
+// User pages of non-executable segments and stacks are mapped with it.
+static uint64_t user_pte_xd;
 
 bool show_memory = false;       // whether to show memory
 
+#define HOUSEKEEPING_INTERVAL (HZ / 10) // ticks between console redraws
+static unsigned long housekeeping_tick; // last redraw (see `housekeeping`)
+
 
 // Memory state - see `kernel.hh`
-physpageinfo physpages[NPAGES];
+physpageinfo* physpages;
+size_t nphyspages;
 
 
 [[noreturn]] void schedule();
@@ -39,30 +54,64 @@ physpageinfo physpages[NPAGES];
 void exception(regstate* regs);
 uintptr_t syscall(regstate* regs);
 void memshow();
+static void housekeeping();
 
 
-// kernel_start(command)
+// kernel_start(command, boot_tsc)
 //    Initialize the hardware and processes and start running. The `command`
-//    string is an optional string passed from the boot loader.
+//    string is an optional string passed from the boot loader. `boot_tsc`
+//    is the low 32 bits of the TSC when the boot loader started, or 0 if
+//    the kernel was entered some other way (e.g., a soft reboot).
 
 static void process_setup(pid_t pid, const char* program_name);
+static int pipe_open(proc* p, int* pfd);
+static void pipe_connect(pid_t writer, pid_t reader);
+
+void kernel_start(const char* command, uint32_t boot_tsc) {
+    uint32_t entry_tsc = rdtsc();
 
-void kernel_start(const char* command) {
     // initialize hardware
     init_hardware();
+    if (rdmsr(MSR_IA32_EFER) & IA32_EFER_NXE) {
+        user_pte_xd = PTE_XD;
+    }
+    kernel_lock.lock();
+    check_memfuncs();
+    init_kalloc();
+    init_program_images();
+    trace_init();
     log_printf("Starting WeensyOS\n");
 
     ticks = 1;
-    init_timer(HZ);
+    init_timer();
+    if (boot_tsc != 0) {
+        log_printf("Boot loader took %lu ms to load the kernel\n",
+                   uint64_t(entry_tsc - boot_tsc) * 1000
+                   / (tsc_per_tick * HZ));
+    }
+    if (disk_cache.init()) {
+        log_printf("Buffer cache: %zu blocks of %zu\n",
+                   bufcache::nentries, disk_cache.nblocks());
+    }
 
     // clear screen
     console_clear();
 
-    // (re-)initialize kernel page table
+    // (re-)initialize kernel page table. Kernel-only 2 MiB regions get
+    // large pages; regions containing nullptr or the console, or already
+    // split by boot-time page table pages, are mapped 4 KiB at a time.
+    const uintptr_t large_pagesize = pageoffmask(1) + 1;
     for (vmiter it(kernel_pagetable, 0);
-         it.va() < MEMSIZE_PHYSICAL;
+         it.va() < memsize_physical;
          it += PAGESIZE) {
-        if (it.va() == CONSOLE_ADDR) {
+        uintptr_t va = it.va();
+        if (va % large_pagesize == 0
+            && va != 0
+            && va + large_pagesize <= memsize_physical
+            && (CONSOLE_ADDR < va || CONSOLE_ADDR >= va + large_pagesize)
+            && it.try_map_large(va, PTE_P | PTE_W) == 0) {
+            it += large_pagesize - PAGESIZE;
+        } else if (it.va() == CONSOLE_ADDR) {
             it.map(it.va(), PTE_P | PTE_W | PTE_U);
         } else if (it.va() != 0) {
             it.map(it.va(), PTE_P | PTE_W);
@@ -71,6 +120,8 @@ void kernel_start(const char* command) {
             it.map(it.va(), 0);
         }
     }
+    // flush PCID 0's translations of the old mappings
+    wrcr3(kptr2pa(kernel_pagetable));
 
     // set up process descriptors and run first processes
     for (pid_t i = 0; i < NPROC; i++) {
@@ -80,15 +131,26 @@ void kernel_start(const char* command) {
     if (!command) {
         command = WEENSYOS_FIRST_PROCESS;
     }
+    if (strcmp(command, "profile") == 0) {
+        // profile the default processes (below)
+        profile_init();
+    }
     if (!program_image(command).empty()) {
         process_setup(1, command);
     } else if (strcmp(command, "pipe") == 0) {
-        process_setup(1, "pipewriter");
-        process_setup(2, "pipereader");
+        // independent writer/reader pairs, each with its own pipe
+        for (pid_t pid = 1; pid + 1 <= 4; pid += 2) {
+            process_setup(pid, "pipewriter");
+            process_setup(pid + 1, "pipereader");
+            pipe_connect(pid, pid + 1);
+        }
     } else {
         process_setup(1, "alice");
         process_setup(2, "eve");
     }
+
+    // start the other CPUs; they wait for `kernel_lock`
+    start_aps();
     run(&ptable[1]);
 }
 
@@ -101,96 +163,646 @@ void kernel_start(const char* command) {
 //    the x86 instruction `int3` (this may help you debug). You'll
 //    probably want to reset it to something more useful.
 //
-//    On WeensyOS, `kalloc` is a page-based allocator: if `sz > PAGESIZE`
-//    the allocation fails; if `sz < PAGESIZE` it allocates a whole page
-//    anyway.
+//    On WeensyOS, `kalloc` is a page-based allocator: allocations are
+//    rounded up to a power-of-two number of pages and served by
+//    `kalloc_pages`.
 //
-//    The handout code returns the next allocatable free page it can find.
-//    It never reuses pages or supports freeing memory (you'll change that).
+//    Physical memory is managed by a buddy allocator. A free block of
+//    `1 << order` pages starts at a page whose index is a multiple of
+//    `1 << order`; its first `physpageinfo` records the order and links
+//    the block into `free_lists[order]`. Freeing a block merges it with
+//    its buddy whenever the buddy is free and of the same order.
 
-static uintptr_t next_alloc_pa;
+static physpageinfo* free_lists[KALLOC_MAX_ORDER + 1];
 
-void* kalloc(size_t sz) {
-    if (sz > PAGESIZE) {
-        return nullptr;
+// protects `free_lists`, the zeroed pool, and `physpages` bookkeeping
+static spinlock kalloc_lock("kalloc_lock");
+
+// pool of allocated, pre-zeroed pages (see `kalloc_zeroed`)
+#define ZEROED_POOL_SIZE 32
+static void* zeroed_pool[ZEROED_POOL_SIZE];
+static int zeroed_pool_size;
+
+static inline size_t physpage_index(const physpageinfo* pp) {
+    return pp - physpages;
+}
+
+static void free_list_push(physpageinfo* pp, int order) {
+    assert(pp->free_order < 0);
+    assert(physpage_index(pp) % (1U << order) == 0);
+    pp->free_order = order;
+    pp->free_prev = nullptr;
+    pp->free_next = free_lists[order];
+    if (pp->free_next) {
+        pp->free_next->free_prev = pp;
+    }
+    free_lists[order] = pp;
+}
+
+static void free_list_remove(physpageinfo* pp) {
+    int order = pp->free_order;
+    assert(order >= 0);
+    if (pp->free_prev) {
+        pp->free_prev->free_next = pp->free_next;
+    } else {
+        free_lists[order] = pp->free_next;
+    }
+    if (pp->free_next) {
+        pp->free_next->free_prev = pp->free_prev;
     }
+    pp->free_order = -1;
+    pp->free_next = pp->free_prev = nullptr;
+}
 
-    while (next_alloc_pa < MEMSIZE_PHYSICAL) {
-        uintptr_t pa = next_alloc_pa;
-        next_alloc_pa += PAGESIZE;
+// free_block(pfn, order)
+//    Return the block of `1 << order` pages starting at page `pfn` to the
+//    free lists, coalescing with free buddies.
 
-        if (allocatable_physical_address(pa)
-            && physpages[pa / PAGESIZE].refcount == 0) {
-            ++physpages[pa / PAGESIZE].refcount;
-            memset((void*) pa, 0xCC, PAGESIZE);
-            return (void*) pa;
+static void free_block(size_t pfn, int order) {
+    memusage_note_pages(pfn * PAGESIZE, PAGESIZE << order);
+    while (order < KALLOC_MAX_ORDER) {
+        size_t buddy = pfn ^ (size_t(1) << order);
+        if (buddy >= nphyspages || physpages[buddy].free_order != order) {
+            break;
         }
+        free_list_remove(&physpages[buddy]);
+        pfn &= ~(size_t(1) << order);
+        ++order;
     }
-    return nullptr;
+    free_list_push(&physpages[pfn], order);
+}
+
+// claim_block(pp, order)
+//    Mark the `1 << order` pages starting at `pp` as allocated and return
+//    their kernel address.
+
+static void* claim_block(physpageinfo* pp, int order) {
+    for (size_t i = 0; i != (size_t(1) << order); ++i) {
+        assert(pp[i].refcount == 0 && pp[i].free_order < 0);
+        pp[i].refcount = 1;
+    }
+    pp->alloc_order = order;
+    memusage_note_pages(physpage_index(pp) * PAGESIZE, PAGESIZE << order);
+    return pa2kptr<void*>(physpage_index(pp) * PAGESIZE);
+}
+
+// init_kalloc()
+//    Place `physpages[]` at `PHYSPAGES_ADDR`, sized for `memsize_physical`,
+//    and build the buddy free lists from it.
+
+void init_kalloc() {
+    for (int order = 0; order <= KALLOC_MAX_ORDER; ++order) {
+        free_lists[order] = nullptr;
+    }
+    nphyspages = memsize_physical / PAGESIZE;
+    physpages = pa2kptr<physpageinfo*>(PHYSPAGES_ADDR);
+    for (size_t pfn = 0; pfn != nphyspages; ++pfn) {
+        physpages[pfn] = physpageinfo();
+    }
+    for (size_t pfn = 0; pfn != nphyspages; ++pfn) {
+        if (allocatable_physical_address(pfn * PAGESIZE)
+            && physpages[pfn].refcount == 0) {
+            free_block(pfn, 0);
+        }
+    }
+}
+
+// kalloc_pages(order)
+//    Allocate `1 << order` physically-contiguous pages, aligned to their
+//    size. Returns `nullptr` on failure. Free with `kfree_pages` or `kfree`.
+
+void* kalloc_pages(int order) {
+    if (order < 0 || order > KALLOC_MAX_ORDER) {
+        return nullptr;
+    }
+    spinlock_guard guard(kalloc_lock);
+    int o = order;
+    while (o <= KALLOC_MAX_ORDER && !free_lists[o]) {
+        ++o;
+    }
+    if (o > KALLOC_MAX_ORDER) {
+        // out of free blocks: fall back on the pre-zeroed pool
+        if (order == 0 && zeroed_pool_size > 0) {
+            --zeroed_pool_size;
+            return zeroed_pool[zeroed_pool_size];
+        }
+        return nullptr;
+    }
+    physpageinfo* pp = free_lists[o];
+    free_list_remove(pp);
+    // split, returning upper halves to the free lists
+    while (o > order) {
+        --o;
+        free_list_push(pp + (size_t(1) << o), o);
+    }
+    void* kptr = claim_block(pp, order);
+    memset(kptr, 0xCC, PAGESIZE << order);
+    return kptr;
+}
+
+// kfree_pages(kptr, order)
+//    Free a block allocated by `kalloc_pages(order)`.
+
+void kfree_pages(void* kptr, int order) {
+    if (!kptr) {
+        return;
+    }
+    uintptr_t pa = kptr2pa(kptr);
+    assert((pa & PAGEOFFMASK) == 0 && pa < memsize_physical);
+    spinlock_guard guard(kalloc_lock);
+    size_t pfn = pa / PAGESIZE;
+    assert(pfn % (size_t(1) << order) == 0);
+    assert(physpages[pfn].alloc_order == order);
+    for (size_t i = 0; i != (size_t(1) << order); ++i) {
+        assert(physpages[pfn + i].refcount == 1);
+        physpages[pfn + i].refcount = 0;
+    }
+    free_block(pfn, order);
 }
 
+void* kalloc(size_t sz) {
+    size_t npages = (sz + PAGESIZE - 1) / PAGESIZE;
+    return kalloc_pages(npages <= 1 ? 0 : msb(npages - 1));
+}
 
 // kfree(kptr)
 //    Free `kptr`, which must have been previously returned by `kalloc`.
 //    If `kptr == nullptr` does nothing.
+//
+//    Single pages are reference counted: `kfree` drops a reference and
+//    the page returns to the free lists when the count reaches zero.
 
 void kfree(void* kptr) {
-    (void) kptr;
-    assert(false /* your code here */);
+    if (!kptr) {
+        return;
+    }
+    uintptr_t pa = kptr2pa(kptr);
+    assert((pa & PAGEOFFMASK) == 0 && allocatable_physical_address(pa));
+    physpageinfo* pp = &physpages[pa / PAGESIZE];
+    if (pp->alloc_order != 0) {
+        kfree_pages(kptr, pp->alloc_order);
+        return;
+    }
+    spinlock_guard guard(kalloc_lock);
+    assert(pp->refcount > 0);
+    --pp->refcount;
+    if (pp->refcount == 0) {
+        free_block(pa / PAGESIZE, 0);
+    }
+}
+
+
+// kalloc_zeroed()
+//    Allocate a single page of zero bytes; free it with `kfree`. Pages
+//    come from a small pool that `schedule` refills while the CPU would
+//    otherwise be idle, so the common case skips the `memset`.
+
+void* kalloc_zeroed() {
+    {
+        spinlock_guard guard(kalloc_lock);
+        if (zeroed_pool_size > 0) {
+            --zeroed_pool_size;
+            return zeroed_pool[zeroed_pool_size];
+        }
+    }
+    void* kptr = kalloc(PAGESIZE);
+    if (kptr) {
+        memset(kptr, 0, PAGESIZE);
+    }
+    return kptr;
+}
+
+// refill_zeroed_pool()
+//    Zero one free page and add it to the pool. Returns false if the pool
+//    is full or memory is exhausted. Needs only `kalloc_lock`, so idle
+//    CPUs can zero pages while another CPU holds the kernel lock.
+
+static bool refill_zeroed_pool() {
+    {
+        spinlock_guard guard(kalloc_lock);
+        if (zeroed_pool_size == ZEROED_POOL_SIZE) {
+            return false;
+        }
+    }
+    void* kptr = kalloc_pages(0);
+    if (!kptr) {
+        return false;
+    }
+    memset(kptr, 0, PAGESIZE);
+    {
+        spinlock_guard guard(kalloc_lock);
+        if (zeroed_pool_size != ZEROED_POOL_SIZE) {
+            zeroed_pool[zeroed_pool_size] = kptr;
+            ++zeroed_pool_size;
+            return true;
+        }
+    }
+    kfree(kptr);
+    return false;
+}
+
+
+// kernel_pagetable_copy()
+//    Return a new page table that maps addresses below PROC_START_ADDR
+//    like `kernel_pagetable` does and maps nothing else, or `nullptr` if
+//    out of memory. Runs of pages with the same permissions and
+//    contiguous physical addresses (nearly all of them: the low memory
+//    is identity-mapped) are copied with one `try_map_range` each.
+
+static void pagetable_free(x86_64_pagetable* pt);
+
+static x86_64_pagetable* kernel_pagetable_copy() {
+    x86_64_pagetable* pt = kalloc_pagetable();
+    if (!pt) {
+        return nullptr;
+    }
+    // ignore bits the hardware sets per page, and large-page-ness
+    const uint64_t permmask = ~(PTE_A | PTE_D | PTE_PS);
+    vmiter kit(kernel_pagetable, 0);
+    while (kit.va() < PROC_START_ADDR) {
+        uintptr_t va = kit.va(), pa = kit.pa();
+        uint64_t perm = kit.perm() & permmask;
+        do {
+            kit += PAGESIZE;
+        } while (kit.va() < PROC_START_ADDR
+                 && (kit.perm() & permmask) == perm
+                 && (!perm || kit.pa() == pa + (kit.va() - va)));
+        if (perm
+            && vmiter(pt, va).try_map_range(pa, kit.va() - va, perm) < 0) {
+            pagetable_free(pt);
+            return nullptr;
+        }
+    }
+    return pt;
+}
+
+// pagetable_free(pt)
+//    Free a process page table: drop references to all user pages at or
+//    above PROC_START_ADDR, then free the page-table pages themselves.
+//    A single `ptiter` pass scans each last-level page-table page's
+//    entries as it goes, so the cost is proportional to the page-table
+//    pages present, not to the size of the address space.
+
+void pagetable_free(x86_64_pagetable* pt) {
+    for (ptiter it(pt); !it.done(); it.next()) {
+        if (it.level() == 0 && it.last_va() > PROC_START_ADDR) {
+            x86_64_pagetable* l1 = it.kptr();
+            for (int i = 0; i != (1 << PAGEINDEXBITS); ++i) {
+                x86_64_pageentry_t pe = l1->entry[i];
+                if ((pe & (PTE_P | PTE_U)) == (PTE_P | PTE_U)
+                    && it.va() + i * PAGESIZE >= PROC_START_ADDR) {
+                    kfree(pa2kptr<void*>(pe & PTE_PAMASK));
+                }
+            }
+        }
+        kfree(it.kptr());
+    }
+    kfree(pt);
+}
+
+
+// proc_free(p)
+//    Release everything process `p` holds: close its file descriptors,
+//    free its address space, and mark its slot free. `p` must not be
+//    on a run queue or wait queue. The kernel runs on `kernel_pagetable`,
+//    so this is safe even when `p == current`.
+
+static int fd_close(proc* p, int fd);
+
+static void proc_free(proc* p) {
+    for (int fd = 0; fd != NFILEDESC; ++fd) {
+        if (p->fds_[fd].pipe_) {
+            fd_close(p, fd);
+        }
+    }
+    pagetable_free(p->pagetable);
+    p->pagetable = nullptr;
+    p->state = P_FREE;
+}
+
+
+// proc_prepare(p)
+//    Give free slot `p` a spawn skeleton, if it lacks one: a fresh page
+//    table, a zeroed stack page already mapped, and initial registers.
+//    Prepared free slots have `p->pagetable != nullptr`; `schedule`
+//    prepares a few while idle so `sys_spawn` needn't. Returns false if
+//    memory is exhausted.
+
+static bool proc_prepare(proc* p) {
+    assert(p->state == P_FREE);
+    if (p->pagetable) {
+        return true;
+    }
+    x86_64_pagetable* pt = kernel_pagetable_copy();
+    if (!pt) {
+        return false;
+    }
+    void* stack = kalloc_zeroed();
+    if (!stack
+        || vmiter(pt, MEMSIZE_VIRTUAL - PAGESIZE)
+               .try_map(stack, PTE_P | PTE_W | PTE_U | user_pte_xd) < 0) {
+        kfree(stack);
+        pagetable_free(pt);
+        return false;
+    }
+    init_process(p, 0);
+    p->pagetable = pt;
+    return true;
+}
+
+// proc_unprepare(p)
+//    Free free slot `p`'s spawn skeleton, if any.
+
+static void proc_unprepare(proc* p) {
+    assert(p->state == P_FREE);
+    if (p->pagetable) {
+        pagetable_free(p->pagetable);
+        p->pagetable = nullptr;
+    }
+}
+
+// prepare_spawn_slot()
+//    Prepare one more free slot, unless SPAWN_POOL_SIZE are prepared
+//    already. Returns true if it prepared a slot.
+
+#define SPAWN_POOL_SIZE 4
+
+static bool prepare_spawn_slot() {
+    proc* unprepared = nullptr;
+    int nprepared = 0;
+    for (pid_t pid = 1; pid != NPROC; ++pid) {
+        proc* p = &ptable[pid];
+        if (p->state == P_FREE) {
+            if (p->pagetable) {
+                ++nprepared;
+            } else if (!unprepared) {
+                unprepared = p;
+            }
+        }
+    }
+    return unprepared
+        && nprepared < SPAWN_POOL_SIZE
+        && proc_prepare(unprepared);
+}
+
+
+// proc_load(p, pgm)
+//    Load program `pgm` into prepared slot `p`: record where its code,
+//    data, and stack belong and set its %rip and %rsp. No program memory
+//    is allocated until it is touched; see `demand_page`.
+
+static void proc_load(proc* p, const program_image& pgm) {
+    for (int fd = 0; fd != NFILEDESC; ++fd) {
+        p->fds_[fd] = filedesc();
+    }
+    for (int i = 0; i != NPROCSEGS; ++i) {
+        p->segs_[i] = proc_segment();
+    }
+    // its PCID may hold entries from a previous process with the same PID
+    p->tlb_stale_ = ~0U;
+
+    // record segments; `demand_page` loads them on first access
+    int nsegs = 0;
+    for (auto seg = pgm.begin(); seg != pgm.end(); ++seg, ++nsegs) {
+        assert(nsegs < NPROCSEGS - 1);
+        assert(seg.va() >= PROC_START_ADDR
+               && seg.va() + seg.size() <= STACK_BOTTOM - PAGESIZE);
+        p->segs_[nsegs].va = seg.va();
+        p->segs_[nsegs].size = seg.size();
+        p->segs_[nsegs].program = pgm.program_number();
+        p->segs_[nsegs].data_offset = seg.data_offset();
+        p->segs_[nsegs].data_size = seg.data_size();
+        p->segs_[nsegs].writable = seg.writable();
+        p->segs_[nsegs].executable = seg.executable();
+    }
+
+    // mark entry point
+    p->regs.reg_rip = pgm.entry();
+    p->prio_ = 0;
+    p->stats_ = proc_stats();
+
+    // the stack's top page was mapped by `proc_prepare`; the rest of
+    // the stack region is mapped as the stack grows into it
+    p->segs_[nsegs].va = STACK_BOTTOM;
+    p->segs_[nsegs].size = STACK_MAXSIZE;
+    p->segs_[nsegs].stack = true;
+    p->regs.reg_rsp = MEMSIZE_VIRTUAL;
 }
 
 
 // process_setup(pid, program_name)
-//    Load application program `program_name` as process number `pid`.
-//    This loads the application's code and data into memory, sets its
-//    %rip and %rsp, gives it a stack page, and marks it as runnable.
+//    Load application program `program_name` as process number `pid`
+//    and mark it as runnable.
 
 void process_setup(pid_t pid, const char* program_name) {
-    init_process(&ptable[pid], 0);
+    proc* p = &ptable[pid];
+    bool ok = proc_prepare(p);
+    assert(ok);
+    proc_load(p, program_image(program_name));
+    wake(p);
+}
 
-    // We expect all process memory to reside between
-    // first_addr and last_addr.
-    uintptr_t first_addr = PROC_START_ADDR + (pid - 1) * PROC_SIZE;
-    uintptr_t last_addr = PROC_START_ADDR + pid * PROC_SIZE;
 
-    // initialize process page table
-    ptable[pid].pagetable = kernel_pagetable;
+// text_cache
+//    Pages of read-only program segments, shared by every process that
+//    runs the program. A page is filled from the program image once;
+//    later processes map the same physical page. Each entry holds a
+//    reference to its page, so cached text outlives the processes using
+//    it. The table (one page) is allocated on first use; when it is
+//    full, further text pages are private copies. Protected by
+//    `kernel_lock`.
+
+struct text_cache_entry {
+    int program;                        // `proc_segment::program` and
+    size_t data_offset;                 // `data_offset` of its segment
+    uintptr_t va;                       // page address
+    void* page;
+};
+static constexpr size_t text_cache_size = PAGESIZE / sizeof(text_cache_entry);
+static text_cache_entry* text_cache;
+
+
+// fill_page(p, kp, page)
+//    Copy the initial data of every `p` segment overlapping user page
+//    `page` into the zeroed page `kp`, decompressing it from the program
+//    archive.
+
+static void fill_page(proc* p, void* kp, uintptr_t page) {
+    for (auto& seg : p->segs_) {
+        uintptr_t lo = max(page, seg.va);
+        uintptr_t hi = min(page + PAGESIZE, seg.va + seg.data_size);
+        if (lo < hi) {
+            bool ok = program_image_read(seg.program,
+                                         seg.data_offset + (lo - seg.va),
+                                         reinterpret_cast<char*>(kp)
+                                         + (lo - page), hi - lo);
+            assert(ok);
+        }
+    }
+}
 
-    // obtain reference to the program image
-    program_image pgm(program_name);
+// text_page(p, seg, page)
+//    Return a new reference to read-only page `page` of `p`'s segment
+//    `seg`, from `text_cache` if possible. Returns nullptr on failure.
 
-    // allocate and map all memory
-    for (auto seg = pgm.begin(); seg != pgm.end(); ++seg) {
-        for (uintptr_t a = round_down(seg.va(), PAGESIZE);
-             a < seg.va() + seg.size();
-             a += PAGESIZE) {
-            assert(a >= first_addr && a < last_addr);
-            assert(physpages[a / PAGESIZE].refcount == 0);
-            ++physpages[a / PAGESIZE].refcount;
-            vmiter(ptable[pid].pagetable, a).map(a, PTE_P | PTE_W | PTE_U);
+static void* text_page(proc* p, const proc_segment& seg, uintptr_t page) {
+    if (!text_cache) {
+        text_cache = reinterpret_cast<text_cache_entry*>(kalloc(PAGESIZE));
+        if (text_cache) {
+            memset(text_cache, 0, PAGESIZE);
+        }
+    }
+    text_cache_entry* slot = nullptr;
+    for (size_t i = 0; text_cache && i != text_cache_size; ++i) {
+        auto& e = text_cache[i];
+        if (e.page
+            && e.program == seg.program
+            && e.data_offset == seg.data_offset
+            && e.va == page) {
+            ++physpages[kptr2pa(e.page) / PAGESIZE].refcount;
+            return e.page;
+        } else if (!e.page && !slot) {
+            slot = &e;
         }
     }
 
-    // copy instructions and data into place
-    for (auto seg = pgm.begin(); seg != pgm.end(); ++seg) {
-        memset((void*) seg.va(), 0, seg.size());
-        memcpy((void*) seg.va(), seg.data(), seg.data_size());
+    void* kp = kalloc_zeroed();
+    if (kp) {
+        fill_page(p, kp, page);
+        if (slot) {
+            *slot = {seg.program, seg.data_offset, page, kp};
+            ++physpages[kptr2pa(kp) / PAGESIZE].refcount;
+        }
     }
+    return kp;
+}
 
-    // mark entry point
-    ptable[pid].regs.reg_rip = pgm.entry();
 
-    // allocate stack
-    uintptr_t stack_addr = last_addr - PAGESIZE;
-    assert(physpages[stack_addr / PAGESIZE].refcount == 0);
-    ++physpages[stack_addr / PAGESIZE].refcount;
-    vmiter(ptable[pid].pagetable, stack_addr).map(stack_addr, PTE_P | PTE_W | PTE_U);
-    ptable[pid].regs.reg_rsp = stack_addr + PAGESIZE;
+// demand_page(p, va)
+//    Map the page containing `va` if it belongs to one of `p`'s
+//    lazily loaded segments and is not yet present. The page is zeroed,
+//    then filled with the initial data of every segment that overlaps it
+//    (segments may share a page). A page that only read-only segments
+//    overlap is mapped read-only from `text_cache`, so all processes
+//    running a program share one copy of its text. A page is executable
+//    only if an executable segment overlaps it. The stack segment
+//    only grows near the saved %rsp, so stray pointers into it still
+//    fault. Returns true if the page is now mapped.
+
+static bool demand_page(proc* p, uintptr_t va) {
+    uintptr_t page = round_down(va, PAGESIZE);
+    const proc_segment* text = nullptr;
+    bool found = false, writable = false, executable = false;
+    for (auto& seg : p->segs_) {
+        if (seg.size != 0
+            && page < seg.va + seg.size
+            && page + PAGESIZE > seg.va
+            && (!seg.stack || va + STACK_REDZONE >= p->regs.reg_rsp)) {
+            found = true;
+            writable = writable || seg.writable;
+            executable = executable || seg.executable;
+            text = text ? text : &seg;
+        }
+    }
+    vmiter it(p, page);
+    if (!found || it.present()) {
+        return false;
+    }
+
+    void* kp;
+    if (writable) {
+        kp = kalloc_zeroed();
+        if (kp) {
+            fill_page(p, kp, page);
+            ++p->stats_.npages;
+        }
+    } else {
+        kp = text_page(p, *text, page);
+    }
+    if (!kp) {
+        return false;
+    }
+    uint64_t perm = PTE_P | (writable ? PTE_W : 0) | PTE_U
+        | (executable ? 0 : user_pte_xd);
+    if (it.try_map(kp, perm) < 0) {
+        kfree(kp);
+        return false;
+    }
+    return true;
+}
+
+
+// copy_from_user(p, dst, va, sz), copy_to_user(p, va, src, sz)
+//    Copy `sz` bytes between kernel memory and `p`'s address space. The
+//    kernel runs on `kernel_pagetable`, so user addresses are translated
+//    page by page, faulting in demand-paged memory as needed. Returns
+//    false if any byte is not user-accessible (or, for `copy_to_user`,
+//    not writable); a failed copy may be partial. `copy_to_user` breaks
+//    copy-on-write sharing as needed.
+
+static bool cow_break(proc* p, vmiter& it);
+
+bool copy_from_user(proc* p, void* dst, uintptr_t va, size_t sz) {
+    char* d = reinterpret_cast<char*>(dst);
+    while (sz != 0) {
+        vmiter it(p, va);
+        if (!it.present() && demand_page(p, va)) {
+            it.find(va);
+        }
+        if (!it.user()) {
+            return false;
+        }
+        size_t n = min(sz, PAGESIZE - (va & PAGEOFFMASK));
+        memcpy(d, it.kptr<const char*>(), n);
+        d += n;
+        va += n;
+        sz -= n;
+    }
+    return true;
+}
 
-    // mark process as runnable
-    ptable[pid].state = P_RUNNABLE;
+bool copy_to_user(proc* p, uintptr_t va, const void* src, size_t sz) {
+    const char* s = reinterpret_cast<const char*>(src);
+    while (sz != 0) {
+        vmiter it(p, round_down(va, PAGESIZE));
+        if (!it.present() && demand_page(p, va)) {
+            it.find(round_down(va, PAGESIZE));
+        }
+        if (!it.user()) {
+            return false;
+        } else if (!it.writable()) {
+            if (!(it.perm() & PTE_COW) || !cow_break(p, it)) {
+                return false;
+            }
+            p->tlb_stale_ = ~0U;
+        }
+        size_t n = min(sz, PAGESIZE - (va & PAGEOFFMASK));
+        memcpy(pa2kptr<char*>(it.pa() + (va & PAGEOFFMASK)), s, n);
+        s += n;
+        va += n;
+        sz -= n;
+    }
+    return true;
 }
 
+// copy_string_from_user(p, dst, va, sz)
+//    Copy a NUL-terminated string of at most `sz - 1` characters from
+//    `p`'s address space into `dst`. Returns false if the string is
+//    inaccessible or too long.
+
+static bool copy_string_from_user(proc* p, char* dst, uintptr_t va,
+                                  size_t sz) {
+    for (size_t pos = 0; pos < sz; ) {
+        size_t n = min(sz - pos, PAGESIZE - ((va + pos) & PAGEOFFMASK));
+        if (!copy_from_user(p, dst + pos, va + pos, n)) {
+            return false;
+        } else if (memchr(dst + pos, '\0', n)) {
+            return true;
+        }
+        pos += n;
+    }
+    return false;
+}
 
 
 // exception(regs)
@@ -202,9 +814,22 @@ void process_setup(pid_t pid, const char* program_name) {
 //    k-exception.S). That code saves more registers on the kernel's stack,
 //    then calls exception().
 //
-//    Note that hardware interrupts are disabled when the kernel is running.
+//    Note that hardware interrupts are disabled when the kernel is running,
+//    except while `schedule()` idles; exceptions taken in kernel mode are
+//    handled by `kernel_exception`, which returns to the interrupted code.
+
+static void kernel_exception(regstate* regs);
+static void program_timer();
 
 void exception(regstate* regs) {
+    if ((regs->reg_cs & 3) == 0) {
+        kernel_exception(regs);
+        return;
+    }
+    kernel_lock.lock();
+    update_ticks();
+    trace(TRACE_EXCEPTION, regs->reg_intno, regs->reg_rip);
+
     // Copy the saved registers into the `current` process descriptor.
     current->regs = *regs;
     regs = &current->regs;
@@ -214,42 +839,71 @@ void exception(regstate* regs) {
     //log_printf("proc %d: exception %d at rip %p\n",
     //           current->pid, regs->reg_intno, regs->reg_rip);
 
-    // Show the current cursor location and memory state
-    // (unless this is a kernel fault).
-    console_show_cursor(cursorpos);
-    if (regs->reg_intno != INT_PF || (regs->reg_errcode & PTE_U)) {
-        memshow();
-    }
-
-    // If Control-C was typed, exit the virtual machine.
-    check_keyboard();
+    // Show the current cursor location and memory state, at most every
+    // HOUSEKEEPING_INTERVAL ticks.
+    housekeeping();
 
 
     // Actually handle the exception.
     switch (regs->reg_intno) {
 
     case INT_IRQ + IRQ_TIMER:
-        ++ticks;
+        // the timer is armed only while others wait for this CPU
+        this_cpu()->timer_deadline_ = 0;
         lapicstate::get().ack();
-        schedule();
-        break;                  /* will not be reached */
+        if (profiling) {
+            profile_sample(regs);
+        }
+        if (this_cpu()->resched_) {
+            schedule();
+        } else if (rdtsc() >= this_cpu()->slice_end_) {
+            // used its whole slice: demote
+            current->prio_ = min(current->prio_ + 1, NPRIO - 1);
+            schedule();
+        }
+        break;
+
+    case INT_IRQ + IRQ_KEYBOARD:
+        keyboard_intr();
+        lapicstate::get().ack();
+        break;
+
+    case INT_IRQ + IRQ_WAKEUP:
+        // returning to the process re-arms the timer if work arrived
+        // for this CPU
+        lapicstate::get().ack();
+        if (this_cpu()->resched_) {
+            schedule();
+        }
+        break;
 
     case INT_PF: {
         // Analyze faulting address and access type.
         uintptr_t addr = rdcr2();
+        ++current->stats_.npagefaults;
+        if (!(regs->reg_errcode & PFERR_PRESENT)
+            && demand_page(current, addr)) {
+            break;
+        }
+        if ((regs->reg_errcode & (PFERR_PRESENT | PFERR_WRITE))
+                == (PFERR_PRESENT | PFERR_WRITE)) {
+            // (The fault itself evicted `addr`'s stale TLB entry.)
+            vmiter it(current, round_down(addr, PAGESIZE));
+            if (it.user() && (it.perm() & PTE_COW) && cow_break(current, it)) {
+                break;
+            }
+        }
+
         const char* operation = regs->reg_errcode & PTE_W
                 ? "write" : "read";
         const char* problem = regs->reg_errcode & PTE_P
                 ? "protection problem" : "missing page";
 
-        if (!(regs->reg_errcode & PTE_U)) {
-            panic("Kernel page fault on %p (%s %s, rip=%p)!\n",
-                  addr, operation, problem, regs->reg_rip);
-        }
         error_printf(CPOS(24, 0), 0x0C00,
                      "Process %d page fault on %p (%s %s, rip=%p)!\n",
                      current->pid, addr, operation, problem, regs->reg_rip);
-        current->state = P_FAULTED;
+        // reclaim its memory and slot rather than keeping it forever
+        proc_free(current);
         break;
     }
 
@@ -268,6 +922,75 @@ void exception(regstate* regs) {
 }
 
 
+// kernel_exception(regs)
+//    Handle an exception taken in kernel mode. Interrupts arrive here
+//    while the kernel idles; anything else is a kernel bug.
+
+void kernel_exception(regstate* regs) {
+    switch (regs->reg_intno) {
+
+    case INT_IRQ + IRQ_TIMER:
+        this_cpu()->timer_deadline_ = 0;
+        lapicstate::get().ack();
+        if (profiling) {
+            profile_sample(regs);
+        }
+        break;
+
+    case INT_IRQ + IRQ_WAKEUP:
+        // `schedule` rechecks the run queues once this returns
+        lapicstate::get().ack();
+        break;
+
+    case INT_IRQ + IRQ_KEYBOARD:
+        // the idle CPU released `kernel_lock` before halting
+        kernel_lock.lock();
+        keyboard_intr();
+        kernel_lock.unlock();
+        lapicstate::get().ack();
+        break;
+
+    case INT_PF: {
+        uintptr_t addr = rdcr2();
+        const char* operation = regs->reg_errcode & PTE_W
+                ? "write" : "read";
+        const char* problem = regs->reg_errcode & PTE_P
+                ? "protection problem" : "missing page";
+        panic("Kernel page fault on %p (%s %s, rip=%p)!\n",
+              addr, operation, problem, regs->reg_rip);
+    }
+
+    default:
+        panic("Unexpected kernel exception %d!\n", regs->reg_intno);
+
+    }
+}
+
+
+// cow_break(p, it)
+//    Resolve a write fault on the copy-on-write page at `it` in `p`:
+//    copy the page unless this mapping holds the only reference. Returns
+//    false if out of memory.
+
+bool cow_break(proc* p, vmiter& it) {
+    uintptr_t pa = it.pa();
+    uint64_t perm = (it.perm() & ~PTE_COW) | PTE_W;
+    if (physpages[pa / PAGESIZE].refcount == 1) {
+        it.map(pa, perm);
+        return true;
+    }
+    void* kp = kalloc(PAGESIZE);
+    if (!kp) {
+        return false;
+    }
+    memcpy(kp, it.kptr(), PAGESIZE);
+    it.map(kptr2pa(kp), perm);
+    kfree(pa2kptr(pa));
+    ++p->stats_.npages;
+    return true;
+}
+
+
 // syscall(regs)
 //    System call handler.
 //
@@ -277,26 +1000,49 @@ void exception(regstate* regs) {
 //    Note that hardware interrupts are disabled when the kernel is running.
 
 int syscall_page_alloc(uintptr_t addr);
-pid_t syscall_spawn(const char* command);
-ssize_t syscall_pipewrite(const char* buf, size_t sz);
-ssize_t syscall_piperead(char* buf, size_t sz);
+[[noreturn]] void syscall_sleep(unsigned long nticks);
+pid_t syscall_fork();
+pid_t syscall_spawn(uintptr_t command_va);
+[[noreturn]] void syscall_exit(int status);
+int syscall_shm_create(size_t npages);
+int syscall_shm_map(int id, uintptr_t va);
+int syscall_futex_wait(uintptr_t va, uint32_t expected);
+int syscall_futex_wake(uintptr_t va, int n);
+ssize_t syscall_pipewrite(int fd, uintptr_t va, size_t sz);
+ssize_t syscall_piperead(int fd, uintptr_t va, size_t sz);
+int syscall_pipe(uintptr_t pfd_va);
+int syscall_close(int fd);
+static void fd_dup_table(proc* dst, const proc* src);
+ssize_t syscall_pipewrite_pages(int fd, uintptr_t va, size_t npages);
+ssize_t syscall_piperead_pages(int fd, uintptr_t va, size_t npages);
+ssize_t syscall_pipewritev(int fd, uintptr_t iov_va, int iovcnt);
+ssize_t syscall_pipereadv(int fd, uintptr_t iov_va, int iovcnt);
+int syscall_batch(uintptr_t va, int n);
+int syscall_getstats(pid_t pid, uintptr_t va);
+ssize_t syscall_disktransfer(bool write, uintptr_t va, size_t sz, off_t off);
+int syscall_disksync(uintptr_t va);
+ssize_t syscall_read(int fd, uintptr_t va, size_t sz);
+int syscall_lockstats(uintptr_t va, int n);
+int syscall_log(uintptr_t va, size_t sz);
 
 uintptr_t syscall(regstate* regs) {
-    // Copy the saved registers into the `current` process descriptor.
-    current->regs = *regs;
-    regs = &current->regs;
+    kernel_lock.lock();
+    update_ticks();
+    trace(TRACE_SYSCALL, regs->reg_rax, regs->reg_rdi);
+
+    // `syscall_entry` saved the registers directly into `current->regs`.
+    assert(regs == &current->regs);
+    if (regs->reg_rax < NSYSCALLS) {
+        ++current->stats_.nsyscalls[regs->reg_rax];
+    }
 
     // It can be useful to log events using `log_printf`.
     // Events logged this way are stored in the host's `log.txt` file.
     //log_printf("proc %d: syscall %d at rip %p\n",
     //           current->pid, regs->reg_rax, regs->reg_rip);
 
-    // Show the current cursor location and memory state
-    console_show_cursor(cursorpos);
-    memshow();
-
-    // If Control-C was typed, exit the virtual machine.
-    check_keyboard();
+    // Console chores are left to `housekeeping`, which the timer and
+    // other exceptions run; system calls take the fast path.
 
 
     // Actually handle the exception.
@@ -312,24 +1058,93 @@ uintptr_t syscall(regstate* regs) {
         current->regs.reg_rax = 0;
         schedule();             // does not return
 
+    case SYSCALL_SLEEP:
+        syscall_sleep(regs->reg_rdi);   // does not return
+
     case SYSCALL_PAGE_ALLOC:
         return syscall_page_alloc(regs->reg_rdi);
 
     case SYSCALL_GETSYSNAME: {
         const char* osname = "DemoOS 61.61";
-        char* buf = (char*) current->regs.reg_rdi;
-        strcpy(buf, osname);
+        if (!copy_to_user(current, regs->reg_rdi, osname, strlen(osname) + 1)) {
+            return -1;
+        }
         return 0;
     }
 
+    case SYSCALL_FORK:
+        return syscall_fork();
+
     case SYSCALL_SPAWN:
-        return syscall_spawn((const char*) regs->reg_rdi);
+        return syscall_spawn(regs->reg_rdi);
+
+    case SYSCALL_EXIT:
+        syscall_exit(regs->reg_rdi);    // does not return
+
+    case SYSCALL_SHM_CREATE:
+        return syscall_shm_create(regs->reg_rdi);
+
+    case SYSCALL_SHM_MAP:
+        return syscall_shm_map(regs->reg_rdi, regs->reg_rsi);
+
+    case SYSCALL_FUTEX_WAIT:
+        return syscall_futex_wait(regs->reg_rdi, regs->reg_rsi);
+
+    case SYSCALL_FUTEX_WAKE:
+        return syscall_futex_wake(regs->reg_rdi, regs->reg_rsi);
 
     case SYSCALL_PIPEWRITE:
-        return syscall_pipewrite((const char*) regs->reg_rdi, regs->reg_rsi);
+        return syscall_pipewrite(regs->reg_rdi, regs->reg_rsi, regs->reg_rdx);
 
     case SYSCALL_PIPEREAD:
-        return syscall_piperead((char*) regs->reg_rdi, regs->reg_rsi);
+        return syscall_piperead(regs->reg_rdi, regs->reg_rsi, regs->reg_rdx);
+
+    case SYSCALL_PIPE:
+        return syscall_pipe(regs->reg_rdi);
+
+    case SYSCALL_CLOSE:
+        return syscall_close(regs->reg_rdi);
+
+    case SYSCALL_PIPEWRITE_PAGES:
+        return syscall_pipewrite_pages(regs->reg_rdi, regs->reg_rsi,
+                                       regs->reg_rdx);
+
+    case SYSCALL_PIPEREAD_PAGES:
+        return syscall_piperead_pages(regs->reg_rdi, regs->reg_rsi,
+                                      regs->reg_rdx);
+
+    case SYSCALL_PIPEWRITEV:
+        return syscall_pipewritev(regs->reg_rdi, regs->reg_rsi, regs->reg_rdx);
+
+    case SYSCALL_PIPEREADV:
+        return syscall_pipereadv(regs->reg_rdi, regs->reg_rsi, regs->reg_rdx);
+
+    case SYSCALL_BATCH:
+        return syscall_batch(regs->reg_rdi, regs->reg_rsi);
+
+    case SYSCALL_GETSTATS:
+        return syscall_getstats(regs->reg_rdi, regs->reg_rsi);
+
+    case SYSCALL_DISKREAD:
+    case SYSCALL_DISKWRITE:
+        return syscall_disktransfer(regs->reg_rax == SYSCALL_DISKWRITE,
+                                    regs->reg_rdi, regs->reg_rsi,
+                                    regs->reg_rdx);
+
+    case SYSCALL_DISKSYNC:
+        return syscall_disksync(regs->reg_rdi);
+
+    case SYSCALL_READ:
+        return syscall_read(regs->reg_rdi, regs->reg_rsi, regs->reg_rdx);
+
+    case SYSCALL_LOCKSTATS:
+        return syscall_lockstats(regs->reg_rdi, regs->reg_rsi);
+
+    case SYSCALL_LOG:
+        return syscall_log(regs->reg_rdi, regs->reg_rsi);
+
+    case SYSCALL_POWEROFF:
+        poweroff();             // syncs the disk; does not return
 
     default:
         panic("Unexpected system call %ld!\n", regs->reg_rax);
@@ -342,102 +1157,1238 @@ uintptr_t syscall(regstate* regs) {
 
 // syscall_page_alloc(addr)
 //    Handles the SYSCALL_PAGE_ALLOC system call. This function
-//    should implement the specification for `sys_page_alloc`
-//    in `u-lib.hh` (but in the handout code, it does not).
+//    implements the specification for `sys_page_alloc` in `u-lib.hh`.
 
 int syscall_page_alloc(uintptr_t addr) {
-    assert(physpages[addr / PAGESIZE].refcount == 0);
-    ++physpages[addr / PAGESIZE].refcount;
-    memset((void*) addr, 0, PAGESIZE);
+    if ((addr & PAGEOFFMASK) != 0
+        || addr < PROC_START_ADDR
+        || addr >= MEMSIZE_VIRTUAL) {
+        return -1;
+    }
+    void* kp = kalloc_zeroed();
+    if (!kp) {
+        return -1;
+    }
+    vmiter it(current, addr);
+    void* oldkp = it.user() ? it.kptr() : nullptr;
+    if (it.try_map(kp, PTE_P | PTE_W | PTE_U) < 0) {
+        kfree(kp);
+        return -1;
+    }
+    if (oldkp) {
+        current->tlb_stale_ = ~0U;
+    }
+    kfree(oldkp);
+    ++current->stats_.npages;
     return 0;
 }
 
 
-// syscall_spawn(command)
-//    Handles the SYSCALL_SPAWN system call; see `sys_spawn` in `u-lib.hh`.
+// Shared memory segments
+//    A segment is `npages` zeroed pages, each holding one reference for
+//    the segment itself plus one per mapping. `syscall_shm_create`
+//    reclaims segments whose mappings are all gone. Protected by
+//    `kernel_lock`.
 
-pid_t syscall_spawn(const char* command) {
-    return -1;
-}
+#define NSHM            8
+#define SHM_MAXPAGES    8
 
+struct shm_segment {
+    void* pages[SHM_MAXPAGES];
+    size_t npages = 0;                  // 0 means the slot is free
+    bool mapped = false;                // true once mapped anywhere
+};
+static shm_segment shms[NSHM];
 
-// pipe buffer
+static void shm_free(shm_segment* shm) {
+    for (size_t i = 0; i != shm->npages; ++i) {
+        kfree(shm->pages[i]);
+    }
+    shm->npages = 0;
+    shm->mapped = false;
+}
 
-char pipebuf[1];
-size_t pipebuf_len = 0;
 
-// syscall_pipewrite(buf, sz)
-//    Handles the SYSCALL_PIPEWRITE system call; see `sys_pipewrite`
-//    in `u-lib.hh`.
+// syscall_shm_create(npages)
+//    Handles the SYSCALL_SHM_CREATE system call; see `sys_shm_create` in
+//    `u-lib.cc`.
 
-ssize_t syscall_pipewrite(const char* buf, size_t sz) {
-    if (sz == 0) {
-        // nothing to write
-        return 0;
-    } else if (pipebuf_len == 1) {
-        // kernel buffer full, try again
+int syscall_shm_create(size_t npages) {
+    if (npages == 0 || npages > SHM_MAXPAGES) {
         return -1;
-    } else {
-        // write one character
-        pipebuf[0] = buf[0];
-        pipebuf_len = 1;
-        return 1;
     }
-}
+    shm_segment* shm = nullptr;
+    for (int id = 0; id != NSHM; ++id) {
+        shm_segment* s = &shms[id];
+        if (s->npages != 0
+            && s->mapped
+            && physpages[kptr2pa(s->pages[0]) / PAGESIZE].refcount == 1) {
+            shm_free(s);
+        }
+        if (s->npages == 0 && !shm) {
+            shm = s;
+        }
+    }
+    if (!shm) {
+        return -1;
+    }
+    for (; shm->npages != npages; ++shm->npages) {
+        shm->pages[shm->npages] = kalloc_zeroed();
+        if (!shm->pages[shm->npages]) {
+            shm_free(shm);
+            return -1;
+        }
+    }
+    return shm - shms;
+}
+
+
+// syscall_shm_map(id, va)
+//    Handles the SYSCALL_SHM_MAP system call; see `sys_shm_map` in
+//    `u-lib.cc`. Like `sys_page_alloc`, replaces existing mappings.
+
+int syscall_shm_map(int id, uintptr_t va) {
+    if (id < 0 || id >= NSHM || shms[id].npages == 0) {
+        return -1;
+    }
+    shm_segment* shm = &shms[id];
+    if ((va & PAGEOFFMASK) != 0
+        || va < PROC_START_ADDR
+        || va > MEMSIZE_VIRTUAL - shm->npages * PAGESIZE) {
+        return -1;
+    }
+    vmiter it(current, va);
+    for (size_t i = 0; i != shm->npages; ++i, it += PAGESIZE) {
+        void* oldkp = it.user() ? it.kptr() : nullptr;
+        if (it.try_map(shm->pages[i], PTE_P | PTE_W | PTE_U | PTE_SHARED)
+            < 0) {
+            return -1;
+        }
+        ++physpages[kptr2pa(shm->pages[i]) / PAGESIZE].refcount;
+        if (oldkp) {
+            current->tlb_stale_ = ~0U;
+        }
+        kfree(oldkp);
+    }
+    shm->mapped = true;
+    return 0;
+}
+
+
+// Futexes
+//    Processes blocked in `sys_futex_wait` wait in `futex_queues`, hashed
+//    by the physical address of their futex word, so processes sharing
+//    memory find each other whatever addresses they map it at.
+//    Protected by `kernel_lock`.
+
+#define NFUTEXQUEUES    32
+
+static wait_queue futex_queues[NFUTEXQUEUES];
+
+static wait_queue& futex_queue(uintptr_t pa) {
+    return futex_queues[(pa >> 2) % NFUTEXQUEUES];
+}
+
+// futex_pa(va, value)
+//    Return the physical address of `current`'s futex word at `va` and
+//    store its value in `*value`, or return -1 if `va` is misaligned or
+//    inaccessible.
+
+static uintptr_t futex_pa(uintptr_t va, uint32_t* value) {
+    if ((va & 3) != 0 || !copy_from_user(current, value, va, 4)) {
+        return -1;
+    }
+    return vmiter(current, va).pa();
+}
+
+
+// syscall_futex_wait(va, expected)
+//    Handles the SYSCALL_FUTEX_WAIT system call; see `sys_futex_wait` in
+//    `u-lib.cc`. The check and the block are atomic under `kernel_lock`,
+//    so a wake after the caller changes the word cannot be lost.
+
+int syscall_futex_wait(uintptr_t va, uint32_t expected) {
+    uint32_t value;
+    uintptr_t pa = futex_pa(va, &value);
+    if (pa == uintptr_t(-1)) {
+        return -1;
+    } else if (value != expected) {
+        return 0;
+    }
+    // unlike `block_syscall`, return once woken rather than retrying
+    current->regs.reg_rax = 0;
+    current->futex_pa_ = pa;
+    current->state = P_BLOCKED;
+    futex_queue(pa).q_.push_back(current);
+    schedule();
+}
 
-// syscall_piperead(buf, sz)
+
+// syscall_futex_wake(va, n)
+//    Handles the SYSCALL_FUTEX_WAKE system call; see `sys_futex_wake` in
+//    `u-lib.cc`.
+
+int syscall_futex_wake(uintptr_t va, int n) {
+    uint32_t value;
+    uintptr_t pa = futex_pa(va, &value);
+    if (pa == uintptr_t(-1)) {
+        return -1;
+    }
+    wait_queue& wq = futex_queue(pa);
+    int nwoken = 0;
+    for (proc* p = wq.q_.front(); p && nwoken < n; ) {
+        proc* next = wq.q_.next(p);
+        if (p->futex_pa_ == pa) {
+            wq.q_.erase(p);
+            wake(p);
+            ++nwoken;
+        }
+        p = next;
+    }
+    return nwoken;
+}
+
+
+// syscall_getstats(pid, va)
+//    Handles the SYSCALL_GETSTATS system call; see `sys_getstats` in
+//    `u-lib.cc`. A running process's `cpu_cycles` include its current
+//    slice so far.
+
+int syscall_getstats(pid_t pid, uintptr_t va) {
+    if (pid <= 0 || pid >= NPROC || ptable[pid].state == P_FREE) {
+        return -1;
+    }
+    proc* p = &ptable[pid];
+    proc_stats st = p->stats_;
+    for (int i = 0; i != MAXCPU; ++i) {
+        if (cpus[i] && cpus[i]->current_ == p) {
+            st.cpu_cycles += rdtsc() - cpus[i]->run_tsc_;
+        }
+    }
+    return copy_to_user(current, va, &st, sizeof(st)) ? 0 : -1;
+}
+
+
+// syscall_disktransfer(write, va, sz, off)
+//    Handles the SYSCALL_DISKREAD and SYSCALL_DISKWRITE system calls; see
+//    `sys_diskread` in `u-lib.cc`. Data moves block by block through
+//    `disk_cache`; a write that covers a whole block skips reading it.
+
+ssize_t syscall_disktransfer(bool write, uintptr_t va, size_t sz, off_t off) {
+    constexpr size_t bsz = bufcache::blocksize;
+    if (!disk_cache.ready() || off < 0) {
+        return -1;
+    }
+    size_t disksize = disk_cache.nblocks() * bsz;
+    if (size_t(off) >= disksize) {
+        return 0;
+    }
+    sz = min(sz, disksize - off);
+    size_t pos = 0;
+    while (pos != sz) {
+        size_t bn = (off + pos) / bsz, boff = (off + pos) % bsz;
+        size_t n = min(sz - pos, bsz - boff);
+        bool fill = !write || n != bsz;
+        bcentry* e = disk_cache.get(bn, fill);
+        bool ok = e && (write
+                        ? copy_from_user(current, e->buf_ + boff, va + pos, n)
+                        : copy_to_user(current, va + pos, e->buf_ + boff, n));
+        if (!ok) {
+            // A failed write may have changed part of the buffer. A clean
+            // entry's block is intact on disk (or was never read), so
+            // forget the entry; a dirty one stays dirty and is written
+            // back with whatever the copy left in it.
+            if (e && write && !e->dirty_) {
+                disk_cache.discard(e);
+            }
+            return pos ? ssize_t(pos) : -1;
+        }
+        if (write) {
+            disk_cache.mark_dirty(e);
+        }
+        pos += n;
+    }
+    return pos;
+}
+
+
+// syscall_disksync(va)
+//    Handles the SYSCALL_DISKSYNC system call; see `sys_disksync` in
+//    `u-lib.cc`.
+
+int syscall_disksync(uintptr_t va) {
+    int r = disk_cache.sync();
+    if (va && !copy_to_user(current, va, &disk_cache.stats_,
+                            sizeof(disk_stats))) {
+        return -1;
+    }
+    return r;
+}
+
+
+// syscall_lockstats(va, n)
+//    Handles the SYSCALL_LOCKSTATS system call; see `sys_lockstats` in
+//    `u-lib.cc`.
+
+int syscall_lockstats(uintptr_t va, int n) {
+#if LOCK_STATS
+    if (n < 0) {
+        return -1;
+    }
+    // one record at a time keeps the kernel stack small
+    lock_stat_record r;
+    int nlocks = lock_stats::snapshot(&r, 0, 0);
+    for (int i = 0; i < min(n, min(nlocks, LOCKSTATS_MAX)); ++i) {
+        lock_stats::snapshot(&r, i, 1);
+        if (!copy_to_user(current, va + i * sizeof(r), &r, sizeof(r))) {
+            return -1;
+        }
+    }
+    return nlocks;
+#else
+    return -1;
+#endif
+}
+
+
+// syscall_log(va, sz)
+//    Handles the SYSCALL_LOG system call; see `sys_log` in `u-lib.cc`.
+
+int syscall_log(uintptr_t va, size_t sz) {
+    char buf[129];
+    while (sz > 0) {
+        size_t n = min(sz, sizeof(buf) - 1);
+        if (!copy_from_user(current, buf, va, n)) {
+            return -1;
+        }
+        buf[n] = '\0';
+        log_printf("%s", buf);
+        va += n;
+        sz -= n;
+    }
+    return 0;
+}
+
+
+// syscall_sleep(nticks)
+//    Handles the SYSCALL_SLEEP system call; see `sys_sleep` in `u-lib.cc`.
+//    `current` blocks in `sleepers` until `update_ticks` wakes it. The
+//    boot CPU's timer tracks the earliest sleeper, so another CPU adding
+//    an earlier one makes the boot CPU re-arm.
+
+void syscall_sleep(unsigned long nticks) {
+    current->regs.reg_rax = 0;
+    if (nticks != 0) {
+        unsigned long now = ticks;
+        unsigned long old_event = sleepers.next_event();
+        current->wakeup_tick_ = now + min(nticks, ~0UL - now);
+        current->state = P_BLOCKED;
+        sleepers.add(current);
+        cpustate* boot = cpus[0];
+        if (boot != this_cpu()
+            && (old_event == 0 || sleepers.next_event() < old_event)) {
+            lapicstate::get().ipi(boot->lapic_id_, INT_IRQ + IRQ_WAKEUP);
+        }
+    }
+    schedule();
+}
+
+
+// syscall_fork()
+//    Handles the SYSCALL_FORK system call; see `sys_fork` in `u-lib.hh`.
+//    The child shares all of the parent's user pages. Writable pages
+//    become read-only copy-on-write in both processes, and are copied by
+//    the page fault handler when either process writes them. Pages the
+//    parent never touched are demand-loaded by the child as well.
+
+pid_t syscall_fork() {
+    pid_t pid = 1;
+    while (pid < NPROC && ptable[pid].state != P_FREE) {
+        ++pid;
+    }
+    if (pid == NPROC) {
+        return -1;
+    }
+    proc_unprepare(&ptable[pid]);
+    x86_64_pagetable* pt = kernel_pagetable_copy();
+    if (!pt) {
+        return -1;
+    }
+
+    vmiter cit(pt, PROC_START_ADDR);
+    for (vmiter it(current, PROC_START_ADDR);
+         it.va() < MEMSIZE_VIRTUAL;
+         it.next()) {
+        if (!it.user()) {
+            continue;
+        }
+        uint64_t perm = it.perm();
+        if ((perm & (PTE_W | PTE_COW)) && !(perm & PTE_SHARED)) {
+            perm = (perm & ~PTE_W) | PTE_COW;
+            it.map(it.pa(), perm);
+            current->tlb_stale_ = ~0U;
+        }
+        if (cit.find(it.va()).try_map(it.pa(), perm) < 0) {
+            pagetable_free(pt);
+            return -1;
+        }
+        ++physpages[it.pa() / PAGESIZE].refcount;
+    }
+
+    proc* child = &ptable[pid];
+    child->pagetable = pt;
+    child->tlb_stale_ = ~0U;
+    child->homecpu_ = this_cpu()->cpuindex_;
+    child->regs = current->regs;
+    child->prio_ = current->prio_;
+    child->stats_ = proc_stats();
+    child->regs.reg_rax = 0;
+    for (int i = 0; i != NPROCSEGS; ++i) {
+        child->segs_[i] = current->segs_[i];
+    }
+    fd_dup_table(child, current);
+    wake(child);
+    return pid;
+}
+
+
+// syscall_spawn(command_va)
+//    Handles the SYSCALL_SPAWN system call; see `sys_spawn` in `u-lib.hh`.
+//    Uses a prepared free slot if there is one, so the common case only
+//    records the program's segments.
+
+pid_t syscall_spawn(uintptr_t command_va) {
+    char command[32];
+    if (!copy_string_from_user(current, command, command_va,
+                               sizeof(command))) {
+        return -1;
+    }
+    program_image pgm(command);
+    if (pgm.empty()) {
+        return -1;
+    }
+
+    proc* p = nullptr;
+    for (pid_t pid = 1; pid != NPROC; ++pid) {
+        if (ptable[pid].state == P_FREE
+            && (!p || ptable[pid].pagetable)) {
+            p = &ptable[pid];
+            if (p->pagetable) {
+                break;
+            }
+        }
+    }
+    if (!p || !proc_prepare(p)) {
+        return -1;
+    }
+    proc_load(p, pgm);
+    p->homecpu_ = this_cpu()->cpuindex_;
+    wake(p);
+    return p->pid;
+}
+
+
+// syscall_exit(status)
+//    Handles the SYSCALL_EXIT system call; see `sys_exit` in `u-lib.hh`.
+
+void syscall_exit(int) {
+    proc_free(current);
+    schedule();
+}
+
+// pipes
+//    A pipe is a ring buffer of `PIPE_BUFSIZE` bytes: `len` bytes of
+//    data start at `buf[head]` and may wrap around the end of the buffer.
+//    Reads and writes move as many bytes as possible in at most two
+//    `memcpy` calls.
+//
+//    Pipe objects come from `pipe_cache`. Each end is counted by the file
+//    descriptors that refer to it; reads return 0 once no writers remain,
+//    and the pipe is freed when both counts reach zero.
+//
+//    Whole-page transfers (`sys_pipewrite_pages`) bypass the ring: the
+//    pipe queues up to `PIPE_NPAGES` physical pages, which the reader maps
+//    into its address space. Page and byte data are queued separately.
+
+#define PIPE_BUFSIZE PAGESIZE
+#define PIPE_NPAGES 16
+
+struct pipe {
+    char* buf = nullptr;        // `PIPE_BUFSIZE` bytes
+    size_t head = 0;            // index of first unread byte
+    size_t len = 0;             // number of unread bytes
+    unsigned nreaders = 0;      // open read-end descriptors
+    unsigned nwriters = 0;      // open write-end descriptors
+    uintptr_t pages[PIPE_NPAGES];   // queued physical pages (page mode)
+    size_t page_head = 0;       // index of first queued page
+    size_t page_len = 0;        // number of queued pages
+    wait_queue readers;         // processes waiting for data
+    wait_queue writers;         // processes waiting for space
+};
+
+static slab_cache<pipe> pipe_cache("pipe");
+
+// proc_fd(p, fd)
+//    Return `p`'s descriptor `fd`, or `nullptr` if `fd` is not open.
+
+static filedesc* proc_fd(proc* p, int fd) {
+    if (fd < 0 || fd >= NFILEDESC || !p->fds_[fd].pipe_) {
+        return nullptr;
+    }
+    return &p->fds_[fd];
+}
+
+// pipe_copy_in(pp, va, n), pipe_copy_out(pp, va, n)
+//    Move `n` bytes between `current`'s memory at `va` and `pp`'s ring,
+//    which must have room for (or hold) them. Return false, leaving the
+//    ring unchanged, if the user range is inaccessible.
+
+static bool pipe_copy_in(pipe* pp, uintptr_t va, size_t n) {
+    size_t tail = (pp->head + pp->len) % PIPE_BUFSIZE;
+    size_t n1 = min(n, PIPE_BUFSIZE - tail);
+    if (!copy_from_user(current, &pp->buf[tail], va, n1)
+        || !copy_from_user(current, &pp->buf[0], va + n1, n - n1)) {
+        return false;
+    }
+    pp->len += n;
+    current->stats_.pipe_bytes_written += n;
+    return true;
+}
+
+static bool pipe_copy_out(pipe* pp, uintptr_t va, size_t n) {
+    size_t n1 = min(n, PIPE_BUFSIZE - pp->head);
+    if (!copy_to_user(current, va, &pp->buf[pp->head], n1)
+        || !copy_to_user(current, va + n1, &pp->buf[0], n - n1)) {
+        return false;
+    }
+    pp->head = (pp->head + n) % PIPE_BUFSIZE;
+    pp->len -= n;
+    current->stats_.pipe_bytes_read += n;
+    return true;
+}
+
+// pipe_open(p, pfd)
+//    Create a pipe and install its ends in the two lowest free descriptors
+//    of `p`: the read end in `pfd[0]`, the write end in `pfd[1]`.
+//    Returns 0 on success and -1 on failure.
+
+int pipe_open(proc* p, int* pfd) {
+    int rfd = 0;
+    while (rfd < NFILEDESC && p->fds_[rfd].pipe_) {
+        ++rfd;
+    }
+    int wfd = rfd + 1;
+    while (wfd < NFILEDESC && p->fds_[wfd].pipe_) {
+        ++wfd;
+    }
+    if (wfd >= NFILEDESC) {
+        return -1;
+    }
+
+    pipe* pp = pipe_cache.make();
+    if (!pp) {
+        return -1;
+    }
+    pp->buf = reinterpret_cast<char*>(kalloc(PIPE_BUFSIZE));
+    if (!pp->buf) {
+        pipe_cache.destroy(pp);
+        return -1;
+    }
+    p->fds_[rfd].pipe_ = pp;
+    p->fds_[rfd].writable_ = false;
+    p->fds_[wfd].pipe_ = pp;
+    p->fds_[wfd].writable_ = true;
+    pp->nreaders = pp->nwriters = 1;
+    pfd[0] = rfd;
+    pfd[1] = wfd;
+    return 0;
+}
+
+// fd_close(p, fd)
+//    Close `p`'s descriptor `fd`. Returns 0 on success and -1 if `fd`
+//    is not open.
+
+static int fd_close(proc* p, int fd) {
+    filedesc* f = proc_fd(p, fd);
+    if (!f) {
+        return -1;
+    }
+    pipe* pp = f->pipe_;
+    if (f->writable_) {
+        --pp->nwriters;
+        pp->readers.wake_all();
+    } else {
+        --pp->nreaders;
+        pp->writers.wake_all();
+    }
+    *f = filedesc();
+    if (pp->nreaders == 0 && pp->nwriters == 0) {
+        for (size_t i = 0; i != pp->page_len; ++i) {
+            kfree(pa2kptr(pp->pages[(pp->page_head + i) % PIPE_NPAGES]));
+        }
+        kfree(pp->buf);
+        pipe_cache.destroy(pp);
+    }
+    return 0;
+}
+
+// fd_dup_table(dst, src)
+//    Make `dst`'s descriptor table a copy of `src`'s.
+
+void fd_dup_table(proc* dst, const proc* src) {
+    for (int fd = 0; fd != NFILEDESC; ++fd) {
+        dst->fds_[fd] = src->fds_[fd];
+        if (pipe* pp = dst->fds_[fd].pipe_) {
+            ++(dst->fds_[fd].writable_ ? pp->nwriters : pp->nreaders);
+        }
+    }
+}
+
+// pipe_connect(writer, reader)
+//    Create a pipe whose write end is `writer`'s fd 1 and whose read end
+//    is `reader`'s fd 0. Used to set up pipelines at boot.
+
+void pipe_connect(pid_t writer, pid_t reader) {
+    proc* w = &ptable[writer];
+    int pfd[2];
+    int r = pipe_open(w, pfd);
+    assert(r == 0 && pfd[0] == 0 && pfd[1] == 1);
+    ptable[reader].fds_[0] = w->fds_[0];
+    w->fds_[0] = filedesc();
+}
+
+// syscall_pipe(pfd_va)
+//    Handles the SYSCALL_PIPE system call; see `sys_pipe` in `u-lib.hh`.
+
+int syscall_pipe(uintptr_t pfd_va) {
+    int pfd[2];
+    if (pipe_open(current, pfd) < 0) {
+        return -1;
+    }
+    if (!copy_to_user(current, pfd_va, pfd, sizeof(pfd))) {
+        fd_close(current, pfd[0]);
+        fd_close(current, pfd[1]);
+        return -1;
+    }
+    return 0;
+}
+
+// syscall_close(fd)
+//    Handles the SYSCALL_CLOSE system call; see `sys_close` in `u-lib.hh`.
+
+int syscall_close(int fd) {
+    return fd_close(current, fd);
+}
+
+// syscall_pipewrite(fd, va, sz)
+//    Handles the SYSCALL_PIPEWRITE system call; see `sys_pipewrite`
+//    in `u-lib.hh`.
+
+ssize_t syscall_pipewrite(int fd, uintptr_t va, size_t sz) {
+    filedesc* f = proc_fd(current, fd);
+    if (!f || !f->writable_ || f->pipe_->nreaders == 0) {
+        return -1;
+    }
+    pipe* pp = f->pipe_;
+    if (sz == 0) {
+        // nothing to write
+        return 0;
+    } else if (pp->len == PIPE_BUFSIZE) {
+        // kernel buffer full, wait for a reader
+        block_syscall(pp->writers);
+    }
+
+    size_t n = min(sz, PIPE_BUFSIZE - pp->len);
+    if (!pipe_copy_in(pp, va, n)) {
+        return -1;
+    }
+    pp->readers.wake_all();
+    return n;
+}
+
+// syscall_piperead(fd, va, sz)
 //    Handles the SYSCALL_PIPEREAD system call; see `sys_piperead`
 //    in `u-lib.hh`.
 
-ssize_t syscall_piperead(char* buf, size_t sz) {
+ssize_t syscall_piperead(int fd, uintptr_t va, size_t sz) {
+    filedesc* f = proc_fd(current, fd);
+    if (!f || f->writable_) {
+        return -1;
+    }
+    pipe* pp = f->pipe_;
     if (sz == 0) {
         // no room to read
         return 0;
-    } else if (pipebuf_len == 0) {
-        // kernel buffer empty, try again
+    } else if (pp->len == 0 && pp->nwriters == 0) {
+        // end of file
+        return 0;
+    } else if (pp->len == 0) {
+        // kernel buffer empty, wait for a writer
+        block_syscall(pp->readers);
+    }
+
+    size_t n = min(sz, pp->len);
+    if (!pipe_copy_out(pp, va, n)) {
         return -1;
+    }
+    pp->writers.wake_all();
+    return n;
+}
+
+
+// Keyboard input
+//    `keyboard_intr` runs on each keyboard interrupt and moves what was
+//    typed into `kbd_buf`, a ring of KBD_BUFSIZE characters; anything
+//    typed while it is full is dropped. Readers block in `kbd_readers`.
+//    Until some process reads the keyboard, the control keys of
+//    `check_keyboard` keep their meaning; afterwards only Control-C does.
+//    Protected by `kernel_lock`.
+
+#define KBD_BUFSIZE 256
+static char kbd_buf[KBD_BUFSIZE];
+static unsigned kbd_head;               // characters consumed
+static unsigned kbd_tail;               // characters typed and kept
+static bool kbd_claimed;                // a process has read the keyboard
+static wait_queue kbd_readers;
+
+void keyboard_intr() {
+    int c;
+    bool any = false;
+    while ((c = keyboard_readc()) >= 0) {
+        if (c == 0) {
+            continue;                   // a modifier key
+        }
+        if (c == 0x03 || !kbd_claimed) {
+            keyboard_command(c);
+        }
+        if (kbd_tail - kbd_head < KBD_BUFSIZE) {
+            kbd_buf[kbd_tail % KBD_BUFSIZE] = c;
+            ++kbd_tail;
+            any = true;
+        }
+    }
+    if (any) {
+        kbd_readers.wake_all();
+    }
+}
+
+// syscall_read(fd, va, sz)
+//    Handles the SYSCALL_READ system call; see `sys_read` in `u-lib.cc`.
+//    Descriptor 0 reads the keyboard unless a pipe is open there.
+
+ssize_t syscall_read(int fd, uintptr_t va, size_t sz) {
+    if (fd != 0 || current->fds_[0].pipe_) {
+        return syscall_piperead(fd, va, sz);
+    }
+    kbd_claimed = true;
+    if (sz == 0) {
+        return 0;
+    } else if (kbd_head == kbd_tail) {
+        block_syscall(kbd_readers);
+    }
+    char buf[KBD_BUFSIZE];
+    size_t n = min(sz, size_t(kbd_tail - kbd_head));
+    for (size_t i = 0; i != n; ++i) {
+        buf[i] = kbd_buf[(kbd_head + i) % KBD_BUFSIZE];
+    }
+    if (!copy_to_user(current, va, buf, n)) {
+        return -1;
+    }
+    kbd_head += n;
+    return n;
+}
+
+
+// syscall_pipewritev(fd, iov_va, iovcnt), syscall_pipereadv(...)
+//    Handle the SYSCALL_PIPEWRITEV and SYSCALL_PIPEREADV system calls;
+//    see `sys_pipewritev` in `u-lib.cc`. They block like the scalar
+//    versions, then move as much as fits through all the buffers.
+
+static bool copy_iovecs(iovec* iov, uintptr_t iov_va, int iovcnt,
+                        size_t* total) {
+    if (iovcnt < 0 || iovcnt > IOV_MAX
+        || !copy_from_user(current, iov, iov_va, iovcnt * sizeof(iovec))) {
+        return false;
+    }
+    *total = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        *total += iov[i].iov_len;
+    }
+    return true;
+}
+
+ssize_t syscall_pipewritev(int fd, uintptr_t iov_va, int iovcnt) {
+    filedesc* f = proc_fd(current, fd);
+    iovec iov[IOV_MAX];
+    size_t total;
+    if (!f || !f->writable_ || f->pipe_->nreaders == 0
+        || !copy_iovecs(iov, iov_va, iovcnt, &total)) {
+        return -1;
+    }
+    pipe* pp = f->pipe_;
+    if (total == 0) {
+        return 0;
+    } else if (pp->len == PIPE_BUFSIZE) {
+        block_syscall(pp->writers);
+    }
+
+    size_t written = 0;
+    for (int i = 0; i != iovcnt && pp->len != PIPE_BUFSIZE; ++i) {
+        size_t n = min(iov[i].iov_len, PIPE_BUFSIZE - pp->len);
+        if (!pipe_copy_in(pp, (uintptr_t) iov[i].iov_base, n)) {
+            break;
+        }
+        written += n;
+    }
+    if (written != 0) {
+        pp->readers.wake_all();
+    }
+    return written != 0 ? ssize_t(written) : -1;
+}
+
+ssize_t syscall_pipereadv(int fd, uintptr_t iov_va, int iovcnt) {
+    filedesc* f = proc_fd(current, fd);
+    iovec iov[IOV_MAX];
+    size_t total;
+    if (!f || f->writable_ || !copy_iovecs(iov, iov_va, iovcnt, &total)) {
+        return -1;
+    }
+    pipe* pp = f->pipe_;
+    if (total == 0 || (pp->len == 0 && pp->nwriters == 0)) {
+        return 0;
+    } else if (pp->len == 0) {
+        block_syscall(pp->readers);
+    }
+
+    size_t nread = 0;
+    for (int i = 0; i != iovcnt && pp->len != 0; ++i) {
+        size_t n = min(iov[i].iov_len, pp->len);
+        if (!pipe_copy_out(pp, (uintptr_t) iov[i].iov_base, n)) {
+            break;
+        }
+        nread += n;
+    }
+    if (nread != 0) {
+        pp->writers.wake_all();
+    }
+    return nread != 0 ? ssize_t(nread) : -1;
+}
+
+
+// syscall_batch(va, n)
+//    Handles the SYSCALL_BATCH system call; see `sys_batch` in
+//    `u-lib.cc`. Only calls that complete without blocking or switching
+//    processes may be batched; others get result -1. The batch stops
+//    before a pipe transfer that would block.
+
+static bool batch_would_block(const syscall_record& r) {
+    filedesc* f = proc_fd(current, r.args[0]);
+    if (!f) {
+        return false;
+    }
+    pipe* pp = f->pipe_;
+    if (r.nr == SYSCALL_PIPEWRITE || r.nr == SYSCALL_PIPEWRITEV) {
+        return f->writable_ && pp->nreaders != 0
+            && pp->len == PIPE_BUFSIZE;
     } else {
-        // read one character
-        buf[0] = pipebuf[0];
-        pipebuf_len = 0;
-        return 1;
+        return !f->writable_ && pp->nwriters != 0 && pp->len == 0;
+    }
+}
+
+// batch_run(r)
+//    Run batched call `r`, setting `r.result`. Returns false without
+//    running it if it would block.
+
+static bool batch_run(syscall_record& r) {
+    uint64_t* a = r.args;
+    switch (r.nr) {
+    case SYSCALL_GETPID:
+        r.result = current->pid;
+        break;
+    case SYSCALL_PAGE_ALLOC:
+        r.result = syscall_page_alloc(a[0]);
+        break;
+    case SYSCALL_SPAWN:
+        r.result = syscall_spawn(a[0]);
+        break;
+    case SYSCALL_PIPE:
+        r.result = syscall_pipe(a[0]);
+        break;
+    case SYSCALL_CLOSE:
+        r.result = syscall_close(a[0]);
+        break;
+    case SYSCALL_SHM_CREATE:
+        r.result = syscall_shm_create(a[0]);
+        break;
+    case SYSCALL_SHM_MAP:
+        r.result = syscall_shm_map(a[0], a[1]);
+        break;
+    case SYSCALL_FUTEX_WAKE:
+        r.result = syscall_futex_wake(a[0], a[1]);
+        break;
+    case SYSCALL_PIPEWRITE:
+    case SYSCALL_PIPEREAD:
+    case SYSCALL_PIPEWRITEV:
+    case SYSCALL_PIPEREADV:
+        if (batch_would_block(r)) {
+            return false;
+        } else if (r.nr == SYSCALL_PIPEWRITE) {
+            r.result = syscall_pipewrite(a[0], a[1], a[2]);
+        } else if (r.nr == SYSCALL_PIPEREAD) {
+            r.result = syscall_piperead(a[0], a[1], a[2]);
+        } else if (r.nr == SYSCALL_PIPEWRITEV) {
+            r.result = syscall_pipewritev(a[0], a[1], a[2]);
+        } else {
+            r.result = syscall_pipereadv(a[0], a[1], a[2]);
+        }
+        break;
+    default:
+        r.result = -1;
+        break;
+    }
+    return true;
+}
+
+int syscall_batch(uintptr_t va, int n) {
+    if (n < 0 || n > BATCH_MAX) {
+        return -1;
+    }
+    // records are copied in small chunks to bound kernel stack use
+    syscall_record chunk[8];
+    int i = 0;
+    while (i != n) {
+        int m = min(n - i, int(arraysize(chunk)));
+        uintptr_t cva = va + i * sizeof(syscall_record);
+        if (!copy_from_user(current, chunk, cva, m * sizeof(syscall_record))) {
+            return -1;
+        }
+        int j = 0;
+        while (j != m && batch_run(chunk[j])) {
+            ++j;
+        }
+        if (!copy_to_user(current, cva, chunk, j * sizeof(syscall_record))) {
+            return -1;
+        }
+        i += j;
+        if (j != m) {
+            break;
+        }
+    }
+    return i;
+}
+
+
+// syscall_pipewrite_pages(fd, va, npages)
+//    Handles the SYSCALL_PIPEWRITE_PAGES system call; see
+//    `sys_pipewrite_pages` in `u-lib.hh`.
+//
+//    Each source page is shared with the pipe rather than copied: the
+//    page's refcount goes up and the writer's mapping becomes
+//    copy-on-write, so later writes by either side copy.
+
+ssize_t syscall_pipewrite_pages(int fd, uintptr_t va, size_t npages) {
+    filedesc* f = proc_fd(current, fd);
+    if (!f || !f->writable_ || f->pipe_->nreaders == 0
+        || (va & PAGEOFFMASK) != 0) {
+        return -1;
+    }
+    pipe* pp = f->pipe_;
+    if (npages == 0) {
+        return 0;
+    } else if (pp->page_len == PIPE_NPAGES) {
+        block_syscall(pp->writers);
+    }
+
+    size_t n = 0;
+    for (; n != npages && pp->page_len != PIPE_NPAGES; ++n, va += PAGESIZE) {
+        vmiter it(current, va);
+        if (va < PROC_START_ADDR || !it.user()) {
+            break;
+        }
+        uintptr_t pa = it.pa();
+        ++physpages[pa / PAGESIZE].refcount;
+        if (it.writable()) {
+            it.map(pa, (it.perm() & ~PTE_W) | PTE_COW);
+            current->tlb_stale_ = ~0U;
+        }
+        pp->pages[(pp->page_head + pp->page_len) % PIPE_NPAGES] = pa;
+        ++pp->page_len;
+    }
+    if (n != 0) {
+        pp->readers.wake_all();
+        current->stats_.pipe_bytes_written += n * PAGESIZE;
+    }
+    return n != 0 ? ssize_t(n) : -1;
+}
+
+// syscall_piperead_pages(fd, va, npages)
+//    Handles the SYSCALL_PIPEREAD_PAGES system call; see
+//    `sys_piperead_pages` in `u-lib.hh`. Queued pages replace the
+//    reader's mappings at `va` (copy-on-write).
+
+ssize_t syscall_piperead_pages(int fd, uintptr_t va, size_t npages) {
+    filedesc* f = proc_fd(current, fd);
+    if (!f || f->writable_ || (va & PAGEOFFMASK) != 0) {
+        return -1;
+    }
+    pipe* pp = f->pipe_;
+    if (npages == 0) {
+        return 0;
+    } else if (pp->page_len == 0 && pp->nwriters == 0) {
+        return 0;
+    } else if (pp->page_len == 0) {
+        block_syscall(pp->readers);
+    }
+
+    size_t n = 0;
+    for (; n != npages && pp->page_len != 0; ++n, va += PAGESIZE) {
+        if (va < PROC_START_ADDR || va >= MEMSIZE_VIRTUAL) {
+            break;
+        }
+        vmiter it(current, va);
+        uintptr_t pa = pp->pages[pp->page_head];
+        void* oldkp = it.user() ? it.kptr() : nullptr;
+        if (it.try_map(pa, PTE_P | PTE_U | PTE_COW) < 0) {
+            break;
+        }
+        if (oldkp) {
+            current->tlb_stale_ = ~0U;
+        }
+        kfree(oldkp);
+        pp->page_head = (pp->page_head + 1) % PIPE_NPAGES;
+        --pp->page_len;
+    }
+    if (n != 0) {
+        pp->writers.wake_all();
+        current->stats_.pipe_bytes_read += n * PAGESIZE;
+    }
+    return n != 0 ? ssize_t(n) : -1;
+}
+
+
+// wake(p)
+//    Mark `p` as runnable and queue it on its home CPU, which is the CPU
+//    it last ran on (so its cache and TLB state may still be warm).
+//    Timers are off when there is nothing to preempt, so another CPU
+//    gets an IPI if it is idle or if `p` is the first process waiting
+//    for its running process's slice to end. If the home CPU is busy, an
+//    idle CPU is also woken so it can steal `p`.
+
+void wake(proc* p) {
+    if (p->state == P_BLOCKED && p->prio_ > 0) {
+        // gave up the CPU before its slice ended
+        --p->prio_;
+    }
+    p->state = P_RUNNABLE;
+    if (p->runq_links_.is_linked()) {
+        return;
+    }
+    cpustate* self = this_cpu();
+    cpustate* c = cpus[p->homecpu_];
+    trace(TRACE_WAKE, p->pid, p->homecpu_);
+    c->runq_.push_back(p);
+    bool preempt = c->current_ && p->prio_ < c->current_->prio_
+        && !c->resched_;
+    if (preempt) {
+        c->resched_ = true;
+    }
+    if (c != self && (c->idle_ || c->runq_.n_ == 1 || preempt)) {
+        lapicstate::get().ipi(c->lapic_id_, INT_IRQ + IRQ_WAKEUP);
+    }
+    if (!c->idle_) {
+        for (int i = 0; i != MAXCPU; ++i) {
+            if (cpus[i] && cpus[i] != self && cpus[i]->idle_) {
+                lapicstate::get().ipi(cpus[i]->lapic_id_,
+                                      INT_IRQ + IRQ_WAKEUP);
+                break;
+            }
+        }
+    }
+}
+
+
+// wait_queue::wake_all()
+//    Wake every process blocked on this queue.
+
+void wait_queue::wake_all() {
+    while (proc* p = q_.pop_front()) {
+        wake(p);
+    }
+}
+
+// block_syscall(wq)
+//    Block `current` on `wq`. Backing `%rip` up over the 2-byte `syscall`
+//    instruction makes the process retry the call once it is woken;
+//    `%rax` and the argument registers still hold their entry values.
+
+void block_syscall(wait_queue& wq) {
+    assert(current->regs.reg_intno == -1U);
+    current->regs.reg_rip -= 2;
+    current->state = P_BLOCKED;
+    wq.q_.push_back(current);
+    schedule();
+}
+
+
+// run_queue::pop_front(), run_queue::pop_back()
+//    Every SCHED_BOOST_TICKS ticks `pop_front` moves every queued
+//    process to level 0, so no runnable process starves for longer.
+
+#define SCHED_BOOST_TICKS (HZ / 2)
+
+proc* run_queue::pop_front() {
+    if (ticks >= boost_tick_) {
+        for (int level = 1; level != NPRIO; ++level) {
+            while (proc* p = q_[level].pop_front()) {
+                p->prio_ = 0;
+                q_[0].push_back(p);
+            }
+        }
+        boost_tick_ = ticks + SCHED_BOOST_TICKS;
+    }
+    for (int level = 0; level != NPRIO; ++level) {
+        if (proc* p = q_[level].pop_front()) {
+            --n_;
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+proc* run_queue::pop_back() {
+    for (int level = NPRIO - 1; level >= 0; --level) {
+        if (proc* p = q_[level].pop_back()) {
+            --n_;
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+
+// steal_work(c)
+//    Move half the processes (rounded up) from the back of the longest
+//    other run queue to CPU `c`'s queue. Returns false if every other
+//    queue is empty.
+
+static bool steal_work(cpustate* c) {
+    cpustate* victim = nullptr;
+    for (int i = 0; i != MAXCPU; ++i) {
+        if (cpus[i] && cpus[i] != c
+            && cpus[i]->runq_.n_ > (victim ? victim->runq_.n_ : 0)) {
+            victim = cpus[i];
+        }
     }
+    if (!victim) {
+        return false;
+    }
+    for (int n = (victim->runq_.n_ + 1) / 2; n != 0; --n) {
+        proc* p = victim->runq_.pop_back();
+        p->homecpu_ = c->cpuindex_;
+        c->runq_.push_back(p);
+    }
+    ++c->nsteals_;
+    return true;
 }
 
 
 // schedule
-//    Pick the next process to run and then run it.
-//    If there are no runnable processes, spins forever.
+//    Pick the next process to run on this CPU and then run it. If
+//    `current` is still runnable, it goes to the back of this CPU's run
+//    queue first. An empty queue steals from the busiest peer; if there
+//    is nothing to steal, halts until an interrupt arrives.
+//
+//    Priorities follow a multi-level feedback queue (see `run_queue`). A
+//    process runs for `sched_slice_ticks[prio_]` ticks; using the whole
+//    slice demotes it a level, while blocking before the slice ends
+//    promotes it a level when it wakes (`wake`). A wakeup at a higher
+//    level than the running process preempts it at once. Interactive
+//    processes, which mostly wait on pipes, thus stay near level 0;
+//    CPU hogs sink and get longer slices, so they switch less often.
+//    The caller must hold `kernel_lock`; it is released while idle.
+
+static const unsigned sched_slice_ticks[NPRIO] = { 1, 2, 4 };
 
 void schedule() {
-    pid_t pid = current->pid;
-    for (unsigned spins = 1; true; ++spins) {
-        pid = (pid + 1) % NPROC;
-        if (ptable[pid].state == P_RUNNABLE) {
-            run(&ptable[pid]);
-        }
+    cpustate* c = this_cpu();
+    c->resched_ = false;
+    if (current) {
+        current->stats_.cpu_cycles += rdtsc() - c->run_tsc_;
+    }
+    if (current
+        && current->state == P_RUNNABLE
+        && !current->runq_links_.is_linked()) {
+        c->runq_.push_back(current);
+    }
+    trace(TRACE_SCHEDULE, c->runq_.n_);
+    // Once this CPU lets go of the kernel lock, another CPU may run (or
+    // wake and run) the old `current`.
+    current = nullptr;
 
-        // If Control-C was typed, exit the virtual machine.
-        check_keyboard();
+    while (true) {
+        proc* p = c->runq_.pop_front();
+        if (!p && steal_work(c)) {
+            p = c->runq_.pop_front();
+        }
+        if (p) {
+            if (p->state == P_RUNNABLE) {
+                ++c->nswitches_;
+                c->slice_end_ = rdtsc()
+                    + tsc_per_tick * sched_slice_ticks[p->prio_];
+                run(p);
+            }
+            continue;
+        }
 
-        // If spinning forever, show the memviewer.
-        if (spins % (1 << 12) == 0) {
-            memshow();
+        // The boot CPU owns the console.
+        if (c->cpuindex_ == 0) {
+            housekeeping();
+        }
+        // Prepare a free slot for `sys_spawn`, then recheck for work.
+        if (prepare_spawn_slot()) {
+            continue;
         }
+        // From here on, `wake` sends this CPU an IPI for new work.
+        c->idle_ = true;
+        program_timer();
+        kernel_lock.unlock();
+        log_flush();
+
+        // Use idle time to zero pages for `kalloc_zeroed`, one page per
+        // pass so the run queue is rechecked in between. Otherwise wait
+        // for an interrupt. `sti` takes effect only after the next
+        // instruction, so no interrupt can slip in before `hlt`.
+        if (!refill_zeroed_pool()) {
+            uint64_t t0 = rdtsc();
+            asm volatile("sti; hlt; cli" : : : "memory");
+            c->idle_tsc_ += rdtsc() - t0;
+        }
+        kernel_lock.lock();
+        c->idle_ = false;
+        update_ticks();
     }
 }
 
 
 // run(p)
 //    Run process `p`. This involves setting `current = p` and calling
-//    `exception_return` to restore its page table and registers.
+//    `exception_return` to restore its registers.
 
 void run(proc* p) {
     assert(p->state == P_RUNNABLE);
+    if (p->runq_links_.is_linked()) {
+        cpus[p->homecpu_]->runq_.erase(p);
+    }
+    p->homecpu_ = this_cpu()->cpuindex_;
+    if (current != p) {
+        this_cpu()->run_tsc_ = rdtsc();
+    }
     current = p;
+    trace(TRACE_RUN, this_cpu()->slice_end_);
 
     // Check the process's current pagetable.
     check_pagetable(p->pagetable);
+    resume_prepare(p);
 
     // This function is defined in k-exception.S. It restores the process's
     // registers then jumps back to user mode.
@@ -449,6 +2400,103 @@ void run(proc* p) {
 }
 
 
+// load_process_pagetable(p)
+//    Switch to `p`'s page table. With PCIDs, each process has its own
+//    tagged TLB entries, so the switch flushes only if the kernel changed
+//    or removed one of `p`'s mappings since `p` last ran on this CPU.
+//    Each CPU has its own TLB, so `p->tlb_stale_` has a bit per CPU.
+
+void load_process_pagetable(proc* p) {
+    uint32_t cpubit = 1U << this_cpu()->cpuindex_;
+    uint64_t cr3 = kptr2pa(p->pagetable);
+    if (cr3_noflush) {
+        cr3 |= p->pid | (p->tlb_stale_ & cpubit ? 0 : cr3_noflush);
+    }
+    p->tlb_stale_ &= ~cpubit;
+    wrcr3(cr3);
+}
+
+
+// resume_prepare(p)
+//    Final kernel work before returning to `p` in user mode: load `p`'s
+//    page table and release the kernel lock. `p` is `current`, and no
+//    other CPU touches a running process's registers or page table.
+
+void resume_prepare(proc* p) {
+    load_process_pagetable(p);
+    program_timer();
+    kernel_lock.unlock();
+}
+
+
+// program_timer()
+//    Arm this CPU's timer for its next deadline. A running process needs
+//    a timer only if other processes wait for this CPU; then the timer
+//    ends its slice, or fires at once if a higher-priority process
+//    woke (`cpustate::resched_`). The boot CPU also wakes for the earliest sleeper
+//    and, while the memory viewer is showing, for the next housekeeping
+//    pass. Otherwise no ticks are taken at all, unless the profiler
+//    needs samples (`k-profile.hh`).
+
+static void program_timer() {
+    cpustate* c = this_cpu();
+    uint64_t deadline = 0;
+    if (c->current_ && c->runq_.n_ > 0) {
+        deadline = c->resched_ ? rdtsc() : c->slice_end_;
+    }
+    if (c->cpuindex_ == 0) {
+        unsigned long t = sleepers.next_event();
+        if (show_memory) {
+            unsigned long hk = housekeeping_tick + HOUSEKEEPING_INTERVAL;
+            t = t ? min(t, hk) : hk;
+        }
+        if (t != 0) {
+            uint64_t tsc = tsc_boot + (t - 1) * tsc_per_tick;
+            deadline = deadline ? min(deadline, tsc) : tsc;
+        }
+    }
+    if (profiling) {
+        uint64_t sample = rdtsc() + tsc_per_tick / PROFILE_RATE;
+        deadline = deadline ? min(deadline, sample) : sample;
+    }
+    if (deadline != c->timer_deadline_) {
+        set_timer(deadline);
+        c->timer_deadline_ = deadline;
+    }
+}
+
+
+// update_ticks()
+//    `ticks` counts ticks of the TSC clock since boot, starting at 1.
+//    It never moves backwards, even if CPUs' TSCs disagree slightly.
+
+void update_ticks() {
+    unsigned long t = (rdtsc() - tsc_boot) / tsc_per_tick + 1;
+    if (t > ticks) {
+        ticks = t;
+    }
+    sleepers.advance(ticks);
+}
+
+
+// housekeeping()
+//    Show the console cursor, redraw the memory viewer, and drain the
+//    log. These chores do port I/O and walk every page table, so the
+//    boot CPU does them at most every HOUSEKEEPING_INTERVAL ticks, not on
+//    every kernel entry. (Keys arrive by interrupt; see `keyboard_intr`.)
+
+void housekeeping() {
+    if (this_cpu()->cpuindex_ != 0
+        || ticks - housekeeping_tick < HOUSEKEEPING_INTERVAL) {
+        return;
+    }
+    housekeeping_tick = ticks;
+    console_show_cursor(cursorpos);
+    memshow();
+    log_flush();
+}
+
+
 // memshow()
 //    Draw a picture of memory (physical and virtual) on the CGA console.
 //    Switches to a new process's virtual memory map every 0.25 sec.
@@ -2,12 +2,14 @@
 #define WEENSYOS_KERNEL_HH
 #include "x86-64.h"
 #include "lib.hh"
+#include "k-list.hh"
+#include "k-lock.hh"
+#include "elf.h"
 #if WEENSYOS_PROCESS
 #error "kernel.hh should not be used by process code."
 #endif
-struct elf_header;
-struct elf_program;
 struct program_image_segment;
+struct trace_record;
 
 
 // kernel.hh
@@ -21,6 +23,30 @@ struct program_image_segment;
 #define P_BLOCKED   2                   // blocked process
 #define P_FAULTED   3                   // faulted process
 
+// File descriptors
+#define NFILEDESC   8                   // descriptors per process
+struct pipe;
+struct filedesc {
+    pipe* pipe_ = nullptr;              // open pipe, or `nullptr` if closed
+    bool writable_ = false;             // true iff this is the write end
+};
+
+// Lazily loaded memory regions
+//    `process_setup` records each program segment (and the stack) as a
+//    `proc_segment`; pages are allocated and filled on first access.
+#define NPROCSEGS   4                   // segments per process
+struct proc_segment {
+    uintptr_t va = 0;                   // first address
+    size_t size = 0;                    // size, including zero fill
+    int program = -1;                   // program image with initial
+    size_t data_offset = 0;             // contents at this offset
+    size_t data_size = 0;               // bytes copied from the image
+    bool writable = true;               // false for program text; see
+                                        // `demand_page`
+    bool executable = false;            // mapped without `PTE_XD`
+    bool stack = false;                 // grows down near %rsp
+};
+
 // Process descriptor type
 struct proc {
     x86_64_pagetable* pagetable;        // process's page table
@@ -28,29 +54,175 @@ struct proc {
     int state;                          // process state (see above)
     regstate regs;                      // process's current registers
     // The first 4 members of `proc` must not change, but you can add more.
+
+    list_links runq_links_;             // links in a CPU's `run_queue`
+    list_links wait_links_;             // links in a `wait_queue`
+    list_links timer_links_;            // links in `sleepers` (k-timer.hh)
+    unsigned long wakeup_tick_;         // when a sleeping process wakes
+    uintptr_t futex_pa_;                // futex word it waits on
+    filedesc fds_[NFILEDESC];           // open file descriptors
+    proc_segment segs_[NPROCSEGS];      // demand-paged regions
+    uint32_t tlb_stale_;                // CPUs whose TLBs may hold stale
+                                        // entries for this page table
+    int homecpu_;                       // CPU whose run queue it joins
+    int prio_;                          // scheduling level (0 is highest)
+    proc_stats stats_;                  // resource usage (`sys_getstats`)
 };
 
-// Process table
-#define NPROC 16                // maximum number of processes
+// Process table (`NPROC` is in lib.hh)
 extern proc ptable[NPROC];
 
+// run_queue
+//    One CPU's runnable processes, not including running processes, as a
+//    multi-level feedback queue with one list per priority level
+//    (`proc::prio_`). `pop_front` returns the oldest process at the
+//    highest nonempty level; `pop_back` returns the newest at the lowest,
+//    so stealing takes CPU hogs first. See `schedule` for how levels
+//    change. Protected by `kernel_lock`.
+#define NPRIO 3
+struct run_queue {
+    list<proc, &proc::runq_links_> q_[NPRIO];
+    int n_ = 0;                         // number of queued processes
+    unsigned long boost_tick_ = 0;      // when `pop_front` next boosts
+
+    void push_back(proc* p) {
+        q_[p->prio_].push_back(p);
+        ++n_;
+    }
+    proc* pop_front();
+    proc* pop_back();
+    void erase(proc* p) {
+        q_[p->prio_].erase(p);
+        --n_;
+    }
+};
+
+// Big kernel lock: held whenever a CPU runs kernel code on behalf of a
+// process or touches process, pipe, or scheduler state. User code runs
+// in parallel on all CPUs. The physical allocator has its own lock.
+extern spinlock kernel_lock;
+
+
+// wake(p)
+//    Mark `p` as runnable and add it to its home CPU's run queue.
+void wake(proc* p);
+
+// schedule()
+//    Run the next runnable process on this CPU. Must hold `kernel_lock`.
+[[noreturn]] void schedule();
+
+// copy_from_user(p, dst, va, sz), copy_to_user(p, va, src, sz)
+//    Copy data between the kernel and process `p`'s address space.
+//    Return false if the user range is not accessible.
+bool copy_from_user(proc* p, void* dst, uintptr_t va, size_t sz);
+bool copy_to_user(proc* p, uintptr_t va, const void* src, size_t sz);
 
+// wait_queue
+//    A set of processes blocked until some event happens.
+struct wait_queue {
+    list<proc, &proc::wait_links_> q_;
+
+    // Wake all processes waiting on this queue
+    void wake_all();
+};
+
+// block_syscall(wq)
+//    Block `current` on `wq` and run something else. When woken,
+//    `current` re-executes the system call it was in, so the caller
+//    must not have changed any state the retry depends on.
+[[noreturn]] void block_syscall(wait_queue& wq);
+
+
+// Where the boot loader records its start time (low 32 bits of the TSC)
+#define BOOT_TSC_ADDR           0x500
 // Kernel start address
 #define KERNEL_START_ADDR       0x40000
 // Top of the kernel stack
 #define KERNEL_STACK_TOP        0x80000
+// Bottom of the application processors' kernel stacks
+// (KERNEL_START_ADDR - (MAXCPU - 1) * PAGESIZE)
+#define AP_STACKS_ADDR          0x39000
 
 // First application-accessible address
 #define PROC_START_ADDR         0x100000
 
-// Physical memory size
-#define MEMSIZE_PHYSICAL        0x200000
-// Number of physical pages
-#define NPAGES                  (MEMSIZE_PHYSICAL / PAGESIZE)
+// Copy-on-write marker for read-only user mappings of shared pages
+#define PTE_COW                 PTE_OS1
+// Shared-memory mapping; stays shared and writable across `fork`
+#define PTE_SHARED              PTE_OS2
+
+// Physical memory size, discovered at boot (see `init_kernel_memory`);
+// between MEMSIZE_PHYSICAL_MIN and MEMSIZE_PHYSICAL_MAX
+extern uintptr_t memsize_physical;
+#define MEMSIZE_PHYSICAL_MIN    0x200000
+#define MEMSIZE_PHYSICAL_MAX    0x40000000
+// Physical address of the `physpages` array
+#define PHYSPAGES_ADDR          0x100000
 
 // Virtual memory size
 #define MEMSIZE_VIRTUAL         0x300000
 
+// User stacks end at MEMSIZE_VIRTUAL and grow down on demand to at most
+// STACK_MAXSIZE bytes. The page below STACK_BOTTOM is a guard page that
+// is never mapped.
+#define STACK_MAXSIZE           0x10000
+#define STACK_BOTTOM            (MEMSIZE_VIRTUAL - STACK_MAXSIZE)
+// A stack fault more than this far below %rsp is a wild access
+#define STACK_REDZONE           128
+
+
+// Per-CPU state
+//    Each CPU's `cpustate` lives at the bottom of its one-page kernel
+//    stack, so `this_cpu()` can find it by rounding down `%rsp`.
+#define MAXCPU 8                        // maximum number of CPUs
+
+struct cpustate {
+    proc* current_;                     // running process (must be first;
+                                        // see `k-exception.S`)
+    int cpuindex_;                      // index (0 is the boot CPU)
+    uint32_t lapic_id_;                 // local APIC ID
+    uint64_t gdt_segments_[7];          // this CPU's segment descriptors
+    x86_64_taskstate taskstate_;        // this CPU's task state segment
+
+    run_queue runq_;                    // processes waiting for this CPU
+    bool idle_;                         // halted or about to halt
+    uint64_t slice_end_;                // TSC when `current_`'s slice ends
+    bool resched_;                      // a higher level woke; preempt
+    uint64_t run_tsc_;                  // TSC when `current_` started
+    uint64_t timer_deadline_;           // TSC the timer is armed for, or 0
+    unsigned long nswitches_;           // processes run by `schedule`
+    unsigned long nsteals_;             // successful steals from peers
+    std::atomic<uint64_t> idle_tsc_;    // TSC cycles spent halted
+    trace_record* trace_;               // event trace ring (`k-trace.hh`)
+    unsigned long trace_pos_;           // number of events traced
+};
+
+extern std::atomic<int> ncpu;           // number of CPUs running
+extern cpustate* cpus[MAXCPU];          // running CPUs, by index
+
+// cpu_stack_top(cpuindex)
+//    Return the top of CPU `cpuindex`'s kernel stack. The boot CPU uses
+//    the page below KERNEL_STACK_TOP; other CPUs use the pages just below
+//    KERNEL_START_ADDR, down to AP_STACKS_ADDR.
+inline uintptr_t cpu_stack_top(int cpuindex) {
+    if (cpuindex == 0) {
+        return KERNEL_STACK_TOP;
+    } else {
+        return KERNEL_START_ADDR - (cpuindex - 1) * PAGESIZE;
+    }
+}
+
+// this_cpu()
+//    Return the current CPU's state.
+__always_inline cpustate* this_cpu() {
+    uintptr_t rsp;
+    asm volatile("movq %%rsp, %0" : "=r" (rsp));
+    return reinterpret_cast<cpustate*>(round_down(rsp - 1, PAGESIZE));
+}
+
+// The process running on this CPU
+#define current (this_cpu()->current_)
+
 // physpages
 //    Status of physical memory.
 //
@@ -59,15 +231,25 @@ extern proc ptable[NPROC];
 //    `[I*PAGESIZE,(I+1)*PAGESIZE)`). `physpages[I].refcount` represents the
 //    number of times physical page `I` is used.
 //
+//    The array has `nphyspages` entries, one per page of `memsize_physical`.
+//    `init_kalloc` places it at `PHYSPAGES_ADDR`; those pages are not
+//    allocatable.
+//
 //    The memory viewer relies on `refcount == 0` indicating free pages.
+//    The remaining members are buddy-allocator bookkeeping (see `kalloc`).
 struct physpageinfo {
-    uint8_t refcount = 0;
+    uint32_t refcount = 0;
+    int8_t free_order = -1;             // order of free block starting here
+    int8_t alloc_order = 0;             // order of allocated block
+    physpageinfo* free_next = nullptr;  // free-list links (if `free_order >= 0`)
+    physpageinfo* free_prev = nullptr;
 
     bool used() const {
         return this->refcount != 0;
     }
 };
-extern physpageinfo physpages[NPAGES];
+extern physpageinfo* physpages;
+extern size_t nphyspages;
 
 
 // Segment selectors
@@ -84,6 +266,7 @@ extern physpageinfo physpages[NPAGES];
 #define IRQ_TIMER               0
 #define IRQ_KEYBOARD            1
 #define IRQ_ERROR               19
+#define IRQ_WAKEUP              30      // IPI: run queue got work
 #define IRQ_SPURIOUS            31
 
 
@@ -93,19 +276,60 @@ extern physpageinfo physpages[NPAGES];
 //    and writable to both kernel and application code.
 void init_hardware();
 
-// init_timer(rate)
-//    Set the timer interrupt to fire `rate` times a second. Disables the
-//    timer interrupt if `rate <= 0`.
-void init_timer(int rate);
+// init_timer()
+//    Calibrate the TSC against the boot CPU's LAPIC timer and start the
+//    `ticks` clock. Each CPU's timer runs in one-shot mode, armed only
+//    when there is a deadline (see `set_timer`).
+void init_timer();
+
+// TSC value at boot and TSC cycles per tick (`1/HZ` second)
+extern uint64_t tsc_boot;
+extern uint64_t tsc_per_tick;
+
+// set_timer(deadline)
+//    Arm this CPU's one-shot timer to interrupt at TSC value `deadline`,
+//    or disarm it if `deadline == 0`.
+void set_timer(uint64_t deadline);
+
+// update_ticks()
+//    Advance `ticks` to the current TSC time and wake expired sleepers.
+//    Ticks are not counted by interrupts, so `ticks` moves whenever the
+//    kernel runs. Must hold `kernel_lock`.
+void update_ticks();
+
+
+// Largest buddy block is `1 << KALLOC_MAX_ORDER` pages (2 MiB)
+#define KALLOC_MAX_ORDER        9
 
+// init_kalloc
+//    Initialize the physical page allocator from `physpages[]`.
+void init_kalloc();
 
 void* kalloc(size_t sz);
 void kfree(void* ptr);
 
+// kalloc_zeroed
+//    Allocate and return a zero-filled page, usually from a pool
+//    prepared while the CPU was idle. Free it with `kfree`.
+void* kalloc_zeroed();
+
+// kalloc_pagetable
+//    Allocate and return a new, empty page table.
+x86_64_pagetable* kalloc_pagetable();
+
+// kalloc_pages(order), kfree_pages(ptr, order)
+//    Allocate/free `1 << order` contiguous, naturally-aligned pages.
+void* kalloc_pages(int order);
+void kfree_pages(void* ptr, int order);
+
 
 // kernel page table (used for virtual memory)
 extern x86_64_pagetable kernel_pagetable[];
 
+// `CR3_NOFLUSH` if the CPU supports PCIDs, 0 otherwise. The kernel page
+// table uses PCID 0 and each process uses its PID as its PCID.
+extern uint64_t cr3_noflush;
+
 // reserved_physical_address(pa)
 //    Returns non-zero iff `pa` is a reserved physical address.
 bool reserved_physical_address(uintptr_t pa);
@@ -133,16 +357,38 @@ void check_page_table_mappings(x86_64_pagetable* pagetable);
 //    in `k-exception.S`; “called” only by hardware.
 void exception_entry();
 
-// syscall_entry
-//    Entry point for system calls (the `syscall` instruction). Defined in
+// syscall_entries
+//    Entry points for system calls (the `syscall` instruction), one per
+//    CPU, since `syscall` does not switch stacks. Defined in
 //    `k-exception.S`; “called” only by hardware.
-void syscall_entry();
+extern uintptr_t syscall_entries[MAXCPU];
+
+// ap_entry
+//    Real-mode entry point for application processors started by a
+//    startup IPI. Page-aligned, below 1 MiB. Defined in `k-exception.S`.
+void ap_entry();
+
+// start_aps()
+//    Start the application processors. Each runs `schedule()` once it
+//    has initialized itself.
+void start_aps();
 
 // exception_return
-//    Return from an exception to user mode: load the page table
-//    and registers and start the process back up. Defined in k-exception.S.
+//    Return from an exception to user mode: load the registers and start
+//    the process back up. The caller must have loaded `p`'s page table
+//    with `resume_prepare(p)`. Defined in k-exception.S.
 [[noreturn]] void exception_return(proc* p);
 
+// load_process_pagetable(p)
+//    Load `p`'s page table into %cr3. If PCIDs are enabled, `p`'s cached
+//    translations survive unless `p->tlb_stale_` marks this CPU.
+void load_process_pagetable(proc* p);
+
+// resume_prepare(p)
+//    Load `p`'s page table and release `kernel_lock` before returning to
+//    user mode. Called by `run` and the system call return path.
+void resume_prepare(proc* p);
+
 
 // console_show_cursor(cpos)
 //    Move the console cursor to position `cpos`, which should be between 0
@@ -154,6 +400,12 @@ void console_show_cursor(int cpos);
 //    space for `vmp`.
 void console_memviewer(proc* vmp);
 
+// memusage_note_pages(pa, sz), memusage_note_pagetable(pt)
+//    Tell the memory viewer that the allocation state of physical pages
+//    `[pa, pa + sz)` changed, or that page table `pt` was modified.
+void memusage_note_pages(uintptr_t pa, size_t sz);
+void memusage_note_pagetable(x86_64_pagetable* pt);
+
 
 // keyboard_readc
 //    Read a character from the keyboard. Returns -1 if there is no character
@@ -181,6 +433,16 @@ int keyboard_readc();
 //    Returns key typed or -1 for no key.
 int check_keyboard();
 
+// keyboard_command(c)
+//    Act on `c` as `check_keyboard` would, if it is a control key.
+void keyboard_command(int c);
+
+// keyboard_intr()
+//    Handle IRQ_KEYBOARD: move typed characters into the input buffer
+//    read by `sys_read(0, ...)`, acting on control keys, and wake blocked
+//    readers. Must hold `kernel_lock`.
+void keyboard_intr();
+
 
 // init_process(p, flags)
 //    Initialize special-purpose registers for process `p`. Constants for
@@ -194,6 +456,20 @@ void init_process(proc* p, int flags);
 // program_image
 //    Represents a program image. Use it to iterate over the loadable
 //    memory segments of a program.
+//
+//    Program images are embedded in the kernel as one compressed archive
+//    (see `lz4archive_header` in `elf.h`). A `program_image` holds copies
+//    of its ELF program headers; segment contents stay compressed until
+//    `program_image_read` fetches them. `init_program_images`, called
+//    once `kalloc` works, checks the archive at boot.
+
+void init_program_images();
+
+// program_image_read(program_number, off, dst, sz)
+//    Copy the `sz` bytes at offset `off` of program image `program_number`
+//    to `dst`, decompressing only the chunks they lie in. Returns false if
+//    the range is outside the image.
+bool program_image_read(int program_number, size_t off, void* dst, size_t sz);
 
 struct program_image {
     // Load a program image by number or name.
@@ -212,8 +488,16 @@ struct program_image {
     // Return the user virtual address of the entry point instruction.
     uintptr_t entry() const;
 
+    // Return the program number, or -1 if this image is empty.
+    int program_number() const {
+        return number_;
+    }
+
   private:
-    elf_header* elf_;
+    int number_ = -1;
+    int nph_ = 0;                       // loadable segments
+    uintptr_t entry_ = 0;
+    elf_program ph_[NPROCSEGS - 1];
 };
 
 struct program_image_segment {
@@ -221,15 +505,18 @@ struct program_image_segment {
     uintptr_t va() const;
     // Return the size of the segment, including zero-initialized space.
     size_t size() const;
-    // Return a pointer to the first byte of data in this segment.
-    const char* data() const;
-    // Return the number of data bytes that should be copied from `data()`.
+    // Return the offset of the segment's data in the program image (see
+    // `program_image_read`).
+    size_t data_offset() const;
+    // Return the number of data bytes that should be copied from the image.
     // Always `data_size() <= size()`; bytes between `data_size()` and
     // `size()` should be zero-initialized.
     size_t data_size() const;
 
     // Return true iff the segment is writable.
     bool writable() const;
+    // Return true iff the segment is executable.
+    bool executable() const;
 
     // Compare segment iterators.
     bool operator==(const program_image_segment& x) const;
@@ -240,11 +527,9 @@ struct program_image_segment {
     void operator++(int);             // move to next segment
 
   private:
-    elf_program* ph_;
-    elf_header* elf_;
+    const elf_program* ph_;
 
-    program_image_segment(elf_program* ph, elf_header* elf);
-    inline void fix();
+    program_image_segment(const elf_program* ph);
     friend class program_image;
 };
 
@@ -265,9 +550,29 @@ struct program_image_segment {
 // log_printf, log_vprintf
 //    Print debugging messages to the host's `log.txt` file. We run QEMU
 //    so that messages written to the QEMU "parallel port" end up in `log.txt`.
+//    Messages are buffered in memory until `log_flush` runs.
 __noinline void log_printf(const char* format, ...);
 __noinline void log_vprintf(const char* format, va_list val);
 
+// log_print(format, args...)
+//    Type-safe `log_printf`; `format` is checked and split at compile
+//    time, as for `console_print` (see `lib.hh`).
+#define log_print(format, ...)                                          \
+    log_print_impl([] () { return format; }, ##__VA_ARGS__)
+void log_print_using(void (*fn)(printer&, void*), void* arg);
+
+template <typename F, typename... Args>
+inline void log_print_impl(F f, const Args&... args) {
+    auto emit = [&] (printer& p) {
+        print_format<F, 0>(p, 0, f, args...);
+    };
+    log_print_using(print_thunk<decltype(emit)>, &emit);
+}
+
+// log_flush
+//    Write buffered `log_printf` messages to the log port.
+void log_flush();
+
 // log_backtrace
 //    Print a backtrace to the host's `log.txt` file, either for the current
 //    stack or for a given stack range.
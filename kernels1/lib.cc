@@ -15,40 +15,96 @@ extern "C" {
 // strncmp, strchr, strtoul, strtol
 //    We must provide our own implementations.
 
+// memcpy, memmove, and memset move 8-byte words with `rep movsq` and
+// `rep stosq`, after aligning the destination with a few single-byte
+// moves. Short operations use `rep movsb`/`rep stosb` directly. These
+// rely on the direction flag being clear, as the ABI requires (the
+// kernel's entry points clear it).
+
 void* memcpy(void* dst, const void* src, size_t n) {
+    char* d = (char*) dst;
     const char* s = (const char*) src;
-    for (char* d = (char*) dst; n > 0; --n, ++s, ++d) {
-        *d = *s;
+    if (n >= 32) {
+        size_t head = -reinterpret_cast<uintptr_t>(d) & 7;
+        size_t words = (n - head) / 8;
+        n = (n - head) & 7;
+        asm volatile("rep movsb" : "+D" (d), "+S" (s), "+c" (head)
+                     : : "memory");
+        asm volatile("rep movsq" : "+D" (d), "+S" (s), "+c" (words)
+                     : : "memory");
     }
+    asm volatile("rep movsb" : "+D" (d), "+S" (s), "+c" (n) : : "memory");
     return dst;
 }
 
 void* memmove(void* dst, const void* src, size_t n) {
     const char* s = (const char*) src;
     char* d = (char*) dst;
-    if (s < d && s + n > d) {
-        s += n, d += n;
-        while (n-- > 0) {
-            *--d = *--s;
-        }
-    } else {
-        while (n-- > 0) {
-            *d++ = *s++;
-        }
+    if (!(s < d && s + n > d)) {
+        return memcpy(dst, src, n);
+    }
+    // overlapping with `src` below `dst`: copy backwards, highest first
+    s += n, d += n;
+    while (n != 0 && (reinterpret_cast<uintptr_t>(d) & 7) != 0) {
+        *--d = *--s;
+        --n;
+    }
+    if (n >= 8) {
+        size_t words = n / 8;
+        d -= 8, s -= 8;
+        asm volatile("std; rep movsq; cld"
+                     : "+D" (d), "+S" (s), "+c" (words) : : "memory", "cc");
+        d += 8, s += 8;
+        n &= 7;
+    }
+    while (n-- > 0) {
+        *--d = *--s;
     }
     return dst;
 }
 
 void* memset(void* v, int c, size_t n) {
-    for (char* p = (char*) v; n > 0; ++p, --n) {
-        *p = c;
+    char* p = (char*) v;
+    if (n >= 32) {
+        uint64_t pattern = uint64_t(uint8_t(c)) * 0x0101010101010101UL;
+        size_t head = -reinterpret_cast<uintptr_t>(p) & 7;
+        size_t words = (n - head) / 8;
+        n = (n - head) & 7;
+        asm volatile("rep stosb" : "+D" (p), "+c" (head) : "a" (c)
+                     : "memory");
+        asm volatile("rep stosq" : "+D" (p), "+c" (words) : "a" (pattern)
+                     : "memory");
     }
+    asm volatile("rep stosb" : "+D" (p), "+c" (n) : "a" (c) : "memory");
     return v;
 }
 
+// memcmp, memchr, strlen, and strchr scan a word (8 bytes) at a time
+// using the "has zero byte" trick: `(w - 0x01...01) & ~w & 0x80...80` is
+// nonzero iff some byte of `w` is zero. Words are read only at aligned
+// addresses (or within the caller's buffer), so a scan never touches a
+// page the byte-at-a-time loop wouldn't; reading past a terminator
+// within the same word is still invisible to the address sanitizer's
+// model, so these functions opt out of it.
+
+typedef uint64_t __attribute__((may_alias)) swar_word;
+typedef uint64_t __attribute__((may_alias, aligned(1))) swar_uword;
+static constexpr uint64_t swar_ones = 0x0101010101010101UL;
+static constexpr uint64_t swar_highs = 0x8080808080808080UL;
+
+static inline bool swar_haszero(uint64_t w) {
+    return ((w - swar_ones) & ~w & swar_highs) != 0;
+}
+
+__no_asan
 int memcmp(const void* a, const void* b, size_t n) {
     const uint8_t* sa = reinterpret_cast<const uint8_t*>(a);
     const uint8_t* sb = reinterpret_cast<const uint8_t*>(b);
+    while (n >= 8
+           && *reinterpret_cast<const swar_uword*>(sa)
+              == *reinterpret_cast<const swar_uword*>(sb)) {
+        sa += 8, sb += 8, n -= 8;
+    }
     for (; n > 0; ++sa, ++sb, --n) {
         if (*sa != *sb) {
             return (*sa > *sb) - (*sa < *sb);
@@ -57,22 +113,43 @@ int memcmp(const void* a, const void* b, size_t n) {
     return 0;
 }
 
+__no_asan
 void* memchr(const void* s, int c, size_t n) {
-    const unsigned char* ss;
-    for (ss = (const unsigned char*) s; n != 0; ++ss, --n) {
-        if (*ss == (unsigned char) c) {
+    const unsigned char* ss = (const unsigned char*) s;
+    unsigned char ch = c;
+    for (; n != 0 && (reinterpret_cast<uintptr_t>(ss) & 7) != 0; ++ss, --n) {
+        if (*ss == ch) {
+            return (void*) ss;
+        }
+    }
+    uint64_t pattern = ch * swar_ones;
+    while (n >= 8
+           && !swar_haszero(*reinterpret_cast<const swar_word*>(ss) ^ pattern)) {
+        ss += 8, n -= 8;
+    }
+    for (; n != 0; ++ss, --n) {
+        if (*ss == ch) {
             return (void*) ss;
         }
     }
     return nullptr;
 }
 
+__no_asan
 size_t strlen(const char* s) {
-    size_t n;
-    for (n = 0; *s != '\0'; ++s) {
-        ++n;
+    const char* p = s;
+    for (; (reinterpret_cast<uintptr_t>(p) & 7) != 0; ++p) {
+        if (*p == '\0') {
+            return p - s;
+        }
     }
-    return n;
+    while (!swar_haszero(*reinterpret_cast<const swar_word*>(p))) {
+        p += 8;
+    }
+    while (*p != '\0') {
+        ++p;
+    }
+    return p - s;
 }
 
 size_t strnlen(const char* s, size_t maxlen) {
@@ -146,15 +223,28 @@ int strncasecmp(const char* a, const char* b, size_t n) {
     }
 }
 
+__no_asan
 char* strchr(const char* s, int c) {
-    while (*s && *s != (char) c) {
-        ++s;
+    char ch = c;
+    for (; (reinterpret_cast<uintptr_t>(s) & 7) != 0; ++s) {
+        if (*s == ch) {
+            return (char*) s;
+        } else if (*s == '\0') {
+            return nullptr;
+        }
     }
-    if (*s == (char) c) {
-        return (char*) s;
-    } else {
-        return nullptr;
+    uint64_t pattern = uint8_t(ch) * swar_ones;
+    while (true) {
+        uint64_t w = *reinterpret_cast<const swar_word*>(s);
+        if (swar_haszero(w) || swar_haszero(w ^ pattern)) {
+            break;
+        }
+        s += 8;
     }
+    while (*s != ch && *s != '\0') {
+        ++s;
+    }
+    return *s == ch ? (char*) s : nullptr;
 }
 
 unsigned long strtoul(const char* s, char** endptr, int base) {
@@ -229,6 +319,71 @@ long strtol(const char* s, char** endptr, int base) {
 } // extern "C"
 
 
+// check_memfuncs()
+//    Compare `memcpy`, `memmove`, and `memset` against byte-at-a-time
+//    reference loops over many alignments, lengths, and overlaps.
+//    Panics on mismatch.
+
+static unsigned char memtest_buf[2][320];
+
+static void memtest_fill() {
+    for (size_t i = 0; i != sizeof(memtest_buf[0]); ++i) {
+        memtest_buf[0][i] = memtest_buf[1][i] = i * 7 + 3;
+    }
+}
+
+static void memtest_check(const char* func, size_t a, size_t b, size_t n) {
+    for (size_t i = 0; i != sizeof(memtest_buf[0]); ++i) {
+        if (memtest_buf[0][i] != memtest_buf[1][i]) {
+            panic("%s self-test failed (%zu, %zu, %zu) at byte %zu\n",
+                  func, a, b, n, i);
+        }
+    }
+}
+
+void check_memfuncs() {
+    static const size_t lengths[] = {
+        0, 1, 2, 7, 8, 9, 15, 16, 31, 32, 33, 63, 64, 65, 100, 255, 256
+    };
+    for (size_t n : lengths) {
+        for (size_t a = 0; a != 9; ++a) {
+            for (size_t b = 0; b != 9; ++b) {
+                // memcpy from the upper half into the lower half
+                memtest_fill();
+                memcpy(&memtest_buf[0][a], &memtest_buf[0][b + 40], n);
+                for (size_t i = 0; i != n; ++i) {
+                    memtest_buf[1][a + i] = memtest_buf[1][b + 40 + i];
+                }
+                memtest_check("memcpy", a, b, n);
+
+                // memmove within one buffer, both directions
+                memtest_fill();
+                memmove(&memtest_buf[0][a + 20], &memtest_buf[0][b + 20 + a], n);
+                for (size_t i = 0; i != n; ++i) {
+                    memtest_buf[1][a + 20 + i] = memtest_buf[1][b + 20 + a + i];
+                }
+                memtest_check("memmove", a, b, n);
+
+                memtest_fill();
+                memmove(&memtest_buf[0][b + 20 + a], &memtest_buf[0][a + 20], n);
+                for (size_t i = n; i != 0; --i) {
+                    memtest_buf[1][b + 20 + a + i - 1] = memtest_buf[1][a + 20 + i - 1];
+                }
+                memtest_check("memmove", b, a, n);
+            }
+
+            // memset
+            memtest_fill();
+            memset(&memtest_buf[0][a], 0x80 + a, n);
+            for (size_t i = 0; i != n; ++i) {
+                memtest_buf[1][a + i] = 0x80 + a;
+            }
+            memtest_check("memset", a, 0, n);
+        }
+    }
+}
+
+
 // rand, srand
 
 static int rand_seed_set;
@@ -274,27 +429,73 @@ constexpr char printfmt<long>::spec[];
 constexpr char printfmt<unsigned long>::spec[];
 
 
+// printer::write(s, n, color)
+//    Print `n` characters from `s`, one `putc` at a time.
+
+void printer::write(const char* s, size_t n, int color) {
+    for (; n > 0; ++s, --n) {
+        putc(*s, color);
+    }
+}
+
+
 // printer::vprintf
 //    Format and print a string into a generic printer object.
 
+// fill_numbuf(numbuf_end, val, base)
+//    Write `val` in `base` (10, or 16 or -16 for upper- or lowercase hex)
+//    into the buffer ending at `numbuf_end`; return the first digit.
+//    Decimal conversion emits two digits per division, using a table of
+//    the digit pairs 00-99; hexadecimal needs only shifts and masks.
+
+static const char decimal_pairs[] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
 static char* fill_numbuf(char* numbuf_end, unsigned long val, int base) {
     static const char upper_digits[] = "0123456789ABCDEF";
     static const char lower_digits[] = "0123456789abcdef";
 
-    const char* digits = upper_digits;
-    if (base < 0) {
-        digits = lower_digits;
-        base = -base;
+    *--numbuf_end = '\0';
+    if (base == 10) {
+        while (val >= 100) {
+            unsigned pair = val % 100;
+            val /= 100;
+            *--numbuf_end = decimal_pairs[2 * pair + 1];
+            *--numbuf_end = decimal_pairs[2 * pair];
+        }
+        if (val >= 10) {
+            *--numbuf_end = decimal_pairs[2 * val + 1];
+            *--numbuf_end = decimal_pairs[2 * val];
+        } else {
+            *--numbuf_end = '0' + val;
+        }
+        return numbuf_end;
     }
 
-    *--numbuf_end = '\0';
+    const char* digits = base < 0 ? lower_digits : upper_digits;
     do {
-        *--numbuf_end = digits[val % base];
-        val /= base;
+        *--numbuf_end = digits[val & 15];
+        val >>= 4;
     } while (val != 0);
     return numbuf_end;
 }
 
+// printer::print_number(val, negative, base, color)
+//    Print `val` with no padding; used by `print_value`.
+
+void printer::print_number(unsigned long val, bool negative, int base,
+                           int color) {
+    char numbuf[24];
+    char* data = fill_numbuf(numbuf + sizeof(numbuf), val, base);
+    if (negative) {
+        *--data = '-';
+    }
+    write(data, numbuf + sizeof(numbuf) - 1 - data, color);
+}
+
 #define FLAG_ALT                (1<<0)
 #define FLAG_ZERO               (1<<1)
 #define FLAG_LEFTJUSTIFY        (1<<2)
@@ -313,7 +514,13 @@ void printer::vprintf(int color, const char* format, va_list val) {
 
     for (; *format; ++format) {
         if (*format != '%') {
-            putc(*format, color);
+            // print the literal text up to the next conversion at once
+            const char* end = format + 1;
+            while (*end && *end != '%') {
+                ++end;
+            }
+            write(format, end - format, color);
+            format = end - 1;
             continue;
         }
 
@@ -464,15 +671,13 @@ void printer::vprintf(int color, const char* format, va_list val) {
         for (; !(flags & FLAG_LEFTJUSTIFY) && width > 0; --width) {
             putc(' ', color);
         }
-        for (; *prefix; ++prefix) {
-            putc(*prefix, color);
+        if (*prefix) {
+            write(prefix, strlen(prefix), color);
         }
         for (; zeros > 0; --zeros) {
             putc('0', color);
         }
-        for (; datalen > 0; ++data, --datalen) {
-            putc(*data, color);
-        }
+        write(data, datalen, color);
         for (; width > 0; --width) {
             putc(' ', color);
         }
@@ -496,6 +701,12 @@ struct string_printer : public printer {
         }
         ++n_;
     }
+    void write(const char* s, size_t n, int) override {
+        size_t k = min(n, size_t(end_ - s_));
+        memcpy(s_, s, k);
+        s_ += k;
+        n_ += n;
+    }
 };
 
 ssize_t vsnprintf(char* s, size_t size, const char* format, va_list val) {
@@ -532,74 +743,214 @@ void console_clear() {
 // console_puts
 //    Put a string to the console, starting at the given cursor position.
 
+// console_printer prints at a fixed position, wrapping from the bottom
+// of the screen to the top. Printing at the cursor, which scrolls, goes
+// through a `console_batch` instead.
 struct console_printer : public printer {
     uint16_t* cell_;
-    bool scroll_;
-    console_printer(int cpos, bool scroll);
+    console_printer(int cpos);
     inline void putc(unsigned char c, int color) override;
-    void scroll();
-    void move_cursor();
+    void write(const char* s, size_t n, int color) override;
 };
 
 __noinline
-console_printer::console_printer(int cpos, bool scroll)
-    : cell_(console), scroll_(scroll) {
-    if (cpos < 0) {
-        cell_ += cursorpos;
-    } else if (cpos <= CONSOLE_ROWS * CONSOLE_COLUMNS) {
+console_printer::console_printer(int cpos)
+    : cell_(console) {
+    if (cpos <= CONSOLE_ROWS * CONSOLE_COLUMNS) {
         cell_ += cpos;
     }
 }
 
-__noinline
-void console_printer::scroll() {
-    assert(cell_ >= console + CONSOLE_ROWS * CONSOLE_COLUMNS);
-    if (scroll_) {
-        memmove(console, console + CONSOLE_COLUMNS,
-                (CONSOLE_ROWS - 1) * CONSOLE_COLUMNS * sizeof(*console));
-        memset(console + (CONSOLE_ROWS - 1) * CONSOLE_COLUMNS,
-               0, CONSOLE_COLUMNS * sizeof(*console));
-        cell_ -= CONSOLE_COLUMNS;
-    } else {
+inline void console_printer::putc(unsigned char c, int color) {
+    if (cell_ >= console + CONSOLE_ROWS * CONSOLE_COLUMNS) {
         cell_ = console;
     }
+    if (c == '\n') {
+        int pos = (cell_ - console) % 80;
+        while (pos != 80) {
+            *cell_++ = ' ' | color;
+            ++pos;
+        }
+    } else {
+        *cell_++ = c | color;
+    }
+}
+
+// console_printer::write(s, n, color)
+//    Store each run of characters up to a newline or the end of the
+//    screen straight into console cells.
+
+void console_printer::write(const char* s, size_t n, int color) {
+    uint16_t* console_end = console + CONSOLE_ROWS * CONSOLE_COLUMNS;
+    while (n > 0) {
+        if (cell_ >= console_end) {
+            cell_ = console;
+        }
+        size_t k = 0, room = console_end - cell_;
+        while (k != n && k != room && s[k] != '\n') {
+            cell_[k] = (unsigned char) s[k] | color;
+            ++k;
+        }
+        cell_ += k;
+        s += k;
+        n -= k;
+        if (n > 0 && *s == '\n') {
+            putc('\n', color);
+            ++s;
+            --n;
+        }
+    }
+}
+
+
+// console_batch
+//    Cells waiting to be printed at the cursor. A newline is kept as a
+//    '\n' cell and padded to the end of its row by `flush`.
+//
+//    `flush` first works out how far the whole batch runs past the bottom
+//    of the screen, then scrolls by that many rows with one `memmove` and
+//    stores the cells that stay visible. Lines that would scroll off
+//    before the flush ends are never stored at all, so printing many
+//    lines costs one block move rather than one per line.
+
+struct console_batch : public printer {
+    uint16_t* buf_;
+    size_t n_ = 0;
+    size_t cap_;
+    console_batch(uint16_t* buf, size_t cap)
+        : buf_(buf), cap_(cap) {
+    }
+    void putc(unsigned char c, int color) override {
+        if (n_ == cap_) {
+            flush();
+        }
+        buf_[n_++] = c | color;
+    }
+    void write(const char* s, size_t n, int color) override;
+    void flush();
+};
+
+void console_batch::write(const char* s, size_t n, int color) {
+    while (n > 0) {
+        if (n_ == cap_) {
+            flush();
+        }
+        size_t k = min(n, cap_ - n_);
+        for (size_t i = 0; i != k; ++i) {
+            buf_[n_ + i] = (unsigned char) s[i] | color;
+        }
+        n_ += k;
+        s += k;
+        n -= k;
+    }
 }
 
 __noinline
-void console_printer::move_cursor() {
-    cursorpos = cell_ - console;
+void console_batch::flush() {
+    constexpr int screen = CONSOLE_ROWS * CONSOLE_COLUMNS;
+    int start = cursorpos;
+    if (start < 0 || start > screen) {
+        start = 0;
+    }
+
+    // where the batch ends without scrolling, and how far to scroll
+    size_t end = start;
+    for (size_t i = 0; i != n_; ++i) {
+        if ((buf_[i] & 0xFF) == '\n') {
+            end += CONSOLE_COLUMNS - end % CONSOLE_COLUMNS;
+        } else {
+            ++end;
+        }
+    }
+    size_t shift = 0;
+    if (end > size_t(screen)) {
+        shift = round_up(end - screen, CONSOLE_COLUMNS);
+        if (shift < size_t(start)) {
+            memmove(console, console + shift,
+                    (start - shift) * sizeof(*console));
+        }
+        memset(console + (end - shift), 0,
+               (screen - (end - shift)) * sizeof(*console));
+    }
+
+    // store the cells that remain on screen
+    size_t v = start;
+    for (size_t i = 0; i != n_; ++i) {
+        uint16_t cell = buf_[i];
+        if ((cell & 0xFF) == '\n') {
+            size_t next = v + CONSOLE_COLUMNS - v % CONSOLE_COLUMNS;
+            cell = ' ' | (cell & 0xFF00);
+            for (size_t w = max(v, shift); w < next; ++w) {
+                console[w - shift] = cell;
+            }
+            v = next;
+        } else {
+            if (v >= shift) {
+                console[v - shift] = cell;
+            }
+            ++v;
+        }
+    }
+    n_ = 0;
+
+    cursorpos = end - shift;
 #if WEENSYOS_KERNEL
     extern void console_show_cursor(int);
     console_show_cursor(cursorpos);
 #endif
 }
 
-inline void console_printer::putc(unsigned char c, int color) {
-    while (cell_ >= console + CONSOLE_ROWS * CONSOLE_COLUMNS) {
-        scroll();
+
+// Cursor printing in the kernel and in unbuffered processes batches one
+// call's output in a small buffer on the stack (per CPU, in the kernel).
+// A process that calls `console_set_buffered(true)` keeps its output in
+// `process_batch` until `console_flush`, which u-lib also calls before
+// every system call that can block or not return.
+
+static constexpr size_t call_batch_cells = 2 * CONSOLE_COLUMNS;
+
+#if !WEENSYOS_KERNEL
+static uint16_t process_batch_buf[CONSOLE_ROWS * CONSOLE_COLUMNS];
+static console_batch process_batch(process_batch_buf,
+                                   arraysize(process_batch_buf));
+static bool process_batch_on;
+
+void console_flush() {
+    if (process_batch.n_ != 0) {
+        process_batch.flush();
     }
-    if (c == '\n') {
-        int pos = (cell_ - console) % 80;
-        while (pos != 80) {
-            *cell_++ = ' ' | color;
-            ++pos;
-        }
-    } else {
-        *cell_++ = c | color;
+}
+
+void console_set_buffered(bool on) {
+    console_flush();
+    process_batch_on = on;
+}
+#endif
+
+template <typename F>
+static int console_print_cursor(F fn) {
+#if !WEENSYOS_KERNEL
+    if (process_batch_on) {
+        fn(process_batch);
+        return cursorpos;
     }
+#endif
+    uint16_t buf[call_batch_cells];
+    console_batch cb(buf, arraysize(buf));
+    fn(cb);
+    cb.flush();
+    return cursorpos;
 }
 
 __noinline
 int console_puts(int cpos, int color, const char* s, size_t len) {
-    console_printer cp(cpos, cpos < 0);
-    while (len > 0) {
-        cp.putc(*s, color);
-        ++s;
-        --len;
-    }
     if (cpos < 0) {
-        cp.move_cursor();
+        return console_print_cursor([&] (printer& p) {
+            p.write(s, len, color);
+        });
     }
+    console_printer cp(cpos);
+    cp.write(s, len, color);
     return cp.cell_ - console;
 }
 
@@ -609,11 +960,25 @@ int console_puts(int cpos, int color, const char* s, size_t len) {
 
 __noinline
 int console_vprintf(int cpos, int color, const char* format, va_list val) {
-    console_printer cp(cpos, cpos < 0);
+    if (cpos < 0) {
+        return console_print_cursor([&] (printer& p) {
+            p.vprintf(color, format, val);
+        });
+    }
+    console_printer cp(cpos);
     cp.vprintf(color, format, val);
+    return cp.cell_ - console;
+}
+
+__noinline
+int console_print_using(int cpos, void (*fn)(printer&, void*), void* arg) {
     if (cpos < 0) {
-        cp.move_cursor();
+        return console_print_cursor([&] (printer& p) {
+            fn(p, arg);
+        });
     }
+    console_printer cp(cpos);
+    fn(cp, arg);
     return cp.cell_ - console;
 }
 
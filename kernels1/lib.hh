@@ -46,6 +46,10 @@ int rand();
 void srand(unsigned seed);
 int rand(int min, int max);
 
+// check_memfuncs()
+//    Self-test `memcpy`, `memmove`, and `memset`; panics on failure.
+void check_memfuncs();
+
 
 // Return the offset of `member` relative to the beginning of a struct type
 #ifndef offsetof
@@ -213,6 +217,79 @@ inline uint32_t crc32c(const void* buf, size_t sz) {
 #define SYSCALL_SPAWN           6
 #define SYSCALL_PIPEWRITE       7
 #define SYSCALL_PIPEREAD        8
+#define SYSCALL_PIPE            9
+#define SYSCALL_CLOSE           10
+#define SYSCALL_PIPEWRITE_PAGES 11
+#define SYSCALL_PIPEREAD_PAGES  12
+#define SYSCALL_FORK            13
+#define SYSCALL_SLEEP           14
+#define SYSCALL_EXIT            15
+#define SYSCALL_SHM_CREATE      16
+#define SYSCALL_SHM_MAP         17
+#define SYSCALL_FUTEX_WAIT      18
+#define SYSCALL_FUTEX_WAKE      19
+#define SYSCALL_PIPEWRITEV      20
+#define SYSCALL_PIPEREADV       21
+#define SYSCALL_BATCH           22
+#define SYSCALL_GETSTATS        23
+#define SYSCALL_DISKREAD        24
+#define SYSCALL_DISKWRITE       25
+#define SYSCALL_DISKSYNC        26
+#define SYSCALL_READ            27
+#define SYSCALL_LOCKSTATS       28
+#define SYSCALL_LOG             29
+#define SYSCALL_POWEROFF        30
+#define NSYSCALLS               31      // one more than the last number
+
+// One buffer of a vectored transfer (`sys_pipewritev`, `sys_pipereadv`)
+struct iovec {
+    void* iov_base;
+    size_t iov_len;
+};
+#define IOV_MAX 16
+
+// One system call in a `sys_batch` submission
+struct syscall_record {
+    uint64_t nr;                // SYSCALL_XXX
+    uint64_t args[3];           // arguments, as for `make_syscall`
+    int64_t result;             // return value, set by the kernel
+};
+#define BATCH_MAX 32
+
+// maximum number of processes; process IDs are less than this
+#define NPROC 16
+
+// Per-process resource usage, returned by `sys_getstats`
+struct proc_stats {
+    uint64_t cpu_cycles;        // TSC cycles spent running (user + kernel)
+    uint64_t nsyscalls[NSYSCALLS];      // system calls, by number
+    uint64_t npagefaults;       // page faults, including demand paging
+    uint64_t npages;            // private pages allocated
+    uint64_t pipe_bytes_written;
+    uint64_t pipe_bytes_read;
+};
+
+// Data disk and buffer cache counters, returned by `sys_disksync`
+struct disk_stats {
+    uint64_t nblocks;           // disk size in 4 KiB blocks
+    uint64_t nentries;          // blocks the cache holds
+    uint64_t nhits;             // block lookups found in the cache
+    uint64_t nmisses;           // lookups that took an entry
+    uint64_t nreads;            // blocks read from disk
+    uint64_t nwritebacks;       // dirty blocks written to disk
+    uint64_t nsyncs;            // `sys_disksync` calls
+};
+
+// One kernel lock's counters, returned by `sys_lockstats`
+struct lock_stat_record {
+    char name[24];
+    uint64_t nacquires;
+    uint64_t ncontended;        // acquisitions that had to wait
+    uint64_t nspins;            // wait-loop iterations, in all
+    uint64_t hold_cycles;       // TSC cycles held, in all
+    uint64_t max_hold_cycles;   // longest single hold
+};
+#define LOCKSTATS_MAX 32
 
 
 // Timing
@@ -288,7 +365,13 @@ void console_printf(const char* format, ...);
 
 struct printer {
     virtual void putc(unsigned char c, int color) = 0;
+    // Print `n` characters from `s`. The default calls `putc` for each;
+    // printers that can copy runs at once should override it.
+    virtual void write(const char* s, size_t n, int color);
     void vprintf(int color, const char* format, va_list val);
+    // Print `val` (negated if `negative`) in base 10 or 16 (-16 for
+    // lowercase), with no padding
+    void print_number(unsigned long val, bool negative, int base, int color);
 };
 
 
@@ -327,6 +410,174 @@ template <typename T> struct printfmt<T*>   { static constexpr char spec[] = "p"
 template <typename T> constexpr char printfmt<T*>::spec[];
 
 
+// console_print(color, format, args...)
+// console_print_at(cpos, color, format, args...)
+//    Type-safe console printing. `format` must be a string literal. Each
+//    `{}` in it prints the next argument according to its type, as its
+//    `printfmt<T>` specifier would (strings print as strings); `{x}`
+//    prints an integer in lowercase hex. `{{` and `}}` print braces.
+//
+//    The format is checked against the arguments and split into literal
+//    runs at compile time, so nothing is parsed at runtime and argument
+//    mismatches fail to compile:
+//
+//        console_print(0x0F00, "pid {} faulted at {x}\n", pid, addr);
+//
+//    `console_print_at` prints at `cpos` and returns the final position.
+#define console_print(color, format, ...)                               \
+    console_print_impl(-1, (color), [] () { return format; }, ##__VA_ARGS__)
+#define console_print_at(cpos, color, format, ...)                      \
+    console_print_impl((cpos), (color), [] () { return format; }, ##__VA_ARGS__)
+
+// console_print_using(cpos, fn, arg)
+//    Call `fn(p, arg)` with a printer `p` that writes to the console at
+//    `cpos` (or the cursor, if `cpos < 0`). Returns the final position.
+int console_print_using(int cpos, void (*fn)(printer&, void*), void* arg);
+
+
+// print_parse(format, pos)
+//    Return the literal run starting at `format[pos]` and the placeholder
+//    or brace escape that ends it. Evaluated only at compile time; a
+//    malformed format reaches `print_format_error`, which is not
+//    constexpr, and so fails to compile.
+
+struct print_segment {
+    size_t len;                         // literal characters to print
+    size_t skip;                        // then skip this many
+    char conv;                          // 0 (end of format), 'e' (escape:
+                                        // `len` includes one brace), 'v'
+                                        // (`{}`), or 'x' (`{x}`)
+};
+
+void print_format_error(const char* msg);
+
+constexpr print_segment print_parse(const char* format, size_t pos) {
+    size_t i = pos;
+    while (format[i] && format[i] != '{' && format[i] != '}') {
+        ++i;
+    }
+    if (!format[i]) {
+        return {i - pos, 0, 0};
+    } else if (format[i + 1] == format[i]) {
+        return {i + 1 - pos, 1, 'e'};
+    } else if (format[i] == '}') {
+        print_format_error("unmatched `}` in format");
+    } else if (format[i + 1] == '}') {
+        return {i - pos, 2, 'v'};
+    } else if (format[i + 1] == 'x' && format[i + 2] == '}') {
+        return {i - pos, 3, 'x'};
+    }
+    print_format_error("bad placeholder in format");
+    return {0, 0, 0};
+}
+
+
+// print_value(p, color, x, hex)
+//    Per-type emitters for `console_print` and `log_print`.
+
+inline void print_value(printer& p, int color, unsigned long x, bool hex) {
+    p.print_number(x, false, hex ? -16 : 10, color);
+}
+inline void print_value(printer& p, int color, long x, bool hex) {
+    if (hex) {
+        p.print_number(x, false, -16, color);
+    } else {
+        p.print_number(x < 0 ? -x : x, x < 0, 10, color);
+    }
+}
+inline void print_value(printer& p, int color, unsigned x, bool hex) {
+    print_value(p, color, (unsigned long) x, hex);
+}
+inline void print_value(printer& p, int color, int x, bool hex) {
+    if (hex) {
+        print_value(p, color, (unsigned) x, true);
+    } else {
+        print_value(p, color, (long) x, false);
+    }
+}
+inline void print_value(printer& p, int color, unsigned short x, bool hex) {
+    print_value(p, color, (unsigned long) x, hex);
+}
+inline void print_value(printer& p, int color, short x, bool hex) {
+    print_value(p, color, hex ? (int) (unsigned short) x : (int) x, hex);
+}
+inline void print_value(printer& p, int color, unsigned char x, bool hex) {
+    print_value(p, color, (unsigned long) x, hex);
+}
+inline void print_value(printer& p, int color, signed char x, bool hex) {
+    print_value(p, color, hex ? (int) (unsigned char) x : (int) x, hex);
+}
+inline void print_value(printer& p, int color, bool x, bool hex) {
+    print_value(p, color, (unsigned long) x, hex);
+}
+inline void print_value(printer& p, int color, char x, bool hex) {
+    if (hex) {
+        print_value(p, color, (unsigned char) x, true);
+    } else {
+        p.putc(x, color);
+    }
+}
+inline void print_value(printer& p, int color, const char* x, bool) {
+    p.write(x, strlen(x), color);
+}
+template <typename T>
+inline void print_value(printer& p, int color, const T* x, bool) {
+    p.write("0x", 2, color);
+    p.print_number((uintptr_t) x, false, -16, color);
+}
+
+
+// print_format<F, pos>(p, color, f, args...)
+//    Print the format returned by `f()`, starting at position `pos`,
+//    with arguments `args`.
+
+template <typename F, size_t pos>
+inline void print_format(printer& p, int color, F f) {
+    constexpr print_segment seg = print_parse(f(), pos);
+    static_assert(seg.conv == 0 || seg.conv == 'e',
+                  "too few arguments for format");
+    if (seg.len) {
+        p.write(f() + pos, seg.len, color);
+    }
+    if constexpr (seg.conv == 'e') {
+        print_format<F, pos + seg.len + seg.skip>(p, color, f);
+    }
+}
+
+template <typename F, size_t pos, typename T, typename... Rest>
+inline void print_format(printer& p, int color, F f,
+                         const T& x, const Rest&... rest) {
+    constexpr print_segment seg = print_parse(f(), pos);
+    static_assert(seg.conv != 0, "too many arguments for format");
+    if (seg.len) {
+        p.write(f() + pos, seg.len, color);
+    }
+    if constexpr (seg.conv == 'e') {
+        print_format<F, pos + seg.len + seg.skip>(p, color, f, x, rest...);
+    } else {
+        print_value(p, color, x, seg.conv == 'x');
+        print_format<F, pos + seg.len + seg.skip>(p, color, f, rest...);
+    }
+}
+
+// print_thunk<E>(p, arg)
+//    Call the emitter `*arg` on `p`. Lets `console_print_impl` pass a
+//    capturing lambda through a plain function pointer.
+
+template <typename E>
+void print_thunk(printer& p, void* arg) {
+    (*static_cast<E*>(arg))(p);
+}
+
+template <typename F, typename... Args>
+inline int console_print_impl(int cpos, int color, F f, const Args&... args) {
+    auto emit = [&] (printer& p) {
+        print_format<F, 0>(p, color, f, args...);
+    };
+    return console_print_using(cpos, print_thunk<decltype(emit)>, &emit);
+}
+
+
 // Assertions
 
 // assert(x)
@@ -0,0 +1,143 @@
+#include "u-lib.hh"
+
+// p-bench: kernel self-benchmark. Times system call round trips, page
+// allocation, pipe throughput, spawn and exit, and context-switch
+// ping-pong with `rdtsc`, writes each result to the kernel log as a
+// `key=value` line, and powers the machine off. Run with
+// `make run-console-bench` (or `make run-bench`) and compare `log.txt`
+// from run to run; every line starts with `bench.` and the last is
+// `bench.done=1`.
+
+extern uint8_t end[];
+
+static constexpr int syscall_iters = 50000;
+static constexpr int page_iters = 5000;
+static constexpr size_t pipe_bytes = 8 << 20;
+static constexpr int spawn_iters = 500;
+static constexpr int pingpong_iters = 5000;
+
+static uint64_t tsc_per_sec;
+static char pipebuf[4096];
+
+// result(key, value)
+//    Log `bench.KEY=VALUE`.
+
+static void result(const char* key, uint64_t value) {
+    char buf[80];
+    ssize_t n = snprintf(buf, sizeof(buf), "bench.%s=%lu\n", key, value);
+    sys_log(buf, min(n, ssize_t(sizeof(buf) - 1)));
+    console_printf("%s", buf);
+}
+
+static uint64_t per(uint64_t cycles, uint64_t n) {
+    return cycles / max(n, uint64_t(1));
+}
+
+static void bench_syscall() {
+    uint64_t t0 = rdtsc();
+    for (int i = 0; i != syscall_iters; ++i) {
+        sys_getpid();
+    }
+    result("syscall.getpid_cycles", per(rdtsc() - t0, syscall_iters));
+}
+
+static void bench_page_alloc() {
+    // each allocation at the same address frees the previous page
+    void* addr = reinterpret_cast<void*>(round_up(uintptr_t(end), PAGESIZE));
+    uint64_t t0 = rdtsc();
+    for (int i = 0; i != page_iters; ++i) {
+        assert(sys_page_alloc(addr) == 0);
+    }
+    result("page_alloc.cycles", per(rdtsc() - t0, page_iters));
+}
+
+static void bench_pipe() {
+    int pfd[2];
+    assert(sys_pipe(pfd) == 0);
+    pid_t child = sys_fork();
+    assert(child >= 0);
+    if (child == 0) {
+        sys_close(pfd[0]);
+        for (size_t off = 0; off < pipe_bytes; ) {
+            ssize_t n = sys_pipewrite(pfd[1], pipebuf, sizeof(pipebuf));
+            assert(n > 0);
+            off += n;
+        }
+        sys_exit(0);
+    }
+    sys_close(pfd[1]);
+    size_t nread = 0;
+    uint64_t t0 = rdtsc();
+    ssize_t n;
+    while ((n = sys_piperead(pfd[0], pipebuf, sizeof(pipebuf))) > 0) {
+        nread += n;
+    }
+    uint64_t elapsed = max(rdtsc() - t0, uint64_t(1));
+    sys_close(pfd[0]);
+    assert(nread == pipe_bytes);
+    result("pipe.kib_per_sec", nread * tsc_per_sec / elapsed / 1024);
+}
+
+static void bench_spawn() {
+    uint64_t t0 = rdtsc();
+    int nretries = 0;
+    for (int i = 0; i != spawn_iters; ) {
+        if (sys_spawn("bench") > 0) {
+            ++i;
+        } else {
+            // every slot is taken; let the children exit
+            ++nretries;
+            sys_yield();
+        }
+    }
+    result("spawn.cycles", per(rdtsc() - t0, spawn_iters));
+    result("spawn.retries", nretries);
+}
+
+static void bench_pingpong() {
+    int ping[2], pong[2];
+    assert(sys_pipe(ping) == 0 && sys_pipe(pong) == 0);
+    pid_t child = sys_fork();
+    assert(child >= 0);
+    char c = 0;
+    if (child == 0) {
+        sys_close(ping[1]);
+        sys_close(pong[0]);
+        while (sys_piperead(ping[0], &c, 1) == 1) {
+            sys_pipewrite(pong[1], &c, 1);
+        }
+        sys_exit(0);
+    }
+    sys_close(ping[0]);
+    sys_close(pong[1]);
+    uint64_t t0 = rdtsc();
+    for (int i = 0; i != pingpong_iters; ++i) {
+        assert(sys_pipewrite(ping[1], &c, 1) == 1);
+        assert(sys_piperead(pong[0], &c, 1) == 1);
+    }
+    result("pingpong.roundtrip_cycles", per(rdtsc() - t0, pingpong_iters));
+    sys_close(ping[1]);
+    sys_close(pong[0]);
+}
+
+void process_main() {
+    if (sys_getpid() != 1) {
+        // spawned by `bench_spawn`
+        sys_exit(0);
+    }
+
+    // calibrate the TSC against the timer
+    uint64_t c0 = rdtsc();
+    sys_sleep(HZ / 10);
+    tsc_per_sec = (rdtsc() - c0) * 10;
+    result("tsc_per_sec", tsc_per_sec);
+
+    bench_syscall();
+    bench_page_alloc();
+    bench_pipe();
+    bench_pingpong();
+    bench_spawn();                      // last: it fills the process table
+
+    result("done", 1);
+    sys_poweroff();
+}
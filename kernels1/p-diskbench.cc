@@ -0,0 +1,80 @@
+#include "u-lib.hh"
+
+// p-diskbench: exercise the data disk and the kernel's buffer cache.
+// Writes a pattern over `bench_size` bytes, many times what the cache
+// holds, reads it back and checks it, then rereads a region that fits in
+// the cache to show hits. Reports throughput and cache counters. Run
+// with `make run-diskbench`.
+
+static constexpr size_t bench_size = 16 << 20;
+static constexpr size_t chunk = 64 << 10;
+static constexpr size_t hot_size = 128 << 10;   // less than the cache
+static constexpr int hot_passes = 20;
+
+static uint64_t buf[chunk / sizeof(uint64_t)];
+
+static uint64_t pattern(size_t off) {
+    return (off * 0x9E3779B97F4A7C15UL) ^ 0x6161616161616161UL;
+}
+
+static uint64_t tsc_per_sec;
+
+static void report(const char* what, size_t bytes, uint64_t elapsed) {
+    elapsed = max(elapsed, uint64_t(1));
+    console_printf("%-12s %6lu KiB/s\n", what,
+                   bytes * tsc_per_sec / elapsed / 1024);
+}
+
+void process_main() {
+    disk_stats st0, st1, st2, st3;
+    if (sys_disksync(&st0) < 0) {
+        console_printf(0x0C00, "diskbench: no data disk\n");
+        sys_exit(1);
+    }
+    uint64_t c0 = rdtsc();
+    sys_sleep(HZ / 10);
+    tsc_per_sec = (rdtsc() - c0) * 10;
+
+    size_t size = min(bench_size, size_t(st0.nblocks * PAGESIZE));
+    console_printf(0x0F00, "diskbench: %lu KiB, cache of %lu blocks\n",
+                   size / 1024, st0.nentries);
+
+    // write, then sync so the write-back is timed too
+    uint64_t t0 = rdtsc();
+    for (size_t off = 0; off < size; off += chunk) {
+        for (size_t i = 0; i != chunk / sizeof(uint64_t); ++i) {
+            buf[i] = pattern(off + i * sizeof(uint64_t));
+        }
+        assert(sys_diskwrite(buf, chunk, off) == ssize_t(chunk));
+    }
+    assert(sys_disksync(&st1) == 0);
+    report("write+sync", size, rdtsc() - t0);
+
+    // read back and check, all misses
+    t0 = rdtsc();
+    for (size_t off = 0; off < size; off += chunk) {
+        assert(sys_diskread(buf, chunk, off) == ssize_t(chunk));
+        for (size_t i = 0; i != chunk / sizeof(uint64_t); ++i) {
+            assert_eq(buf[i], pattern(off + i * sizeof(uint64_t)));
+        }
+    }
+    sys_disksync(&st2);
+    report("cold read", size, rdtsc() - t0);
+
+    // reread a region that fits: all hits after the first pass
+    t0 = rdtsc();
+    for (int pass = 0; pass != hot_passes; ++pass) {
+        for (size_t off = 0; off < hot_size; off += chunk) {
+            assert(sys_diskread(buf, chunk, off) == ssize_t(chunk));
+        }
+    }
+    sys_disksync(&st3);
+    report("hot read", hot_size * hot_passes, rdtsc() - t0);
+
+    console_printf("write: %lu writebacks; cold: %lu reads, %lu hits; "
+                   "hot: %lu reads, %lu hits\n",
+                   st1.nwritebacks - st0.nwritebacks,
+                   st2.nreads - st1.nreads, st2.nhits - st1.nhits,
+                   st3.nreads - st2.nreads, st3.nhits - st2.nhits);
+    sys_exit(0);
+}
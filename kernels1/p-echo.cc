@@ -0,0 +1,36 @@
+#include "u-lib.hh"
+
+// p-echo: read lines from the keyboard with `sys_read(0, ...)` and echo
+// them back, as a test of interrupt-driven keyboard input. The process
+// sleeps in the kernel between keys rather than polling. Backspace edits
+// the line; Control-C still exits the VM. Run with `make run-echo`.
+
+void process_main() {
+    char line[80];
+    size_t len = 0;
+    console_printf(0x0F00, "echo> ");
+    while (true) {
+        char buf[16];
+        ssize_t n = sys_read(0, buf, sizeof(buf));
+        assert(n > 0);
+        for (ssize_t i = 0; i != n; ++i) {
+            char c = buf[i];
+            if (c == '\n' || c == '\r') {
+                line[len] = '\0';
+                console_printf(0x0700, "\n%s\n", line);
+                console_printf(0x0F00, "echo> ");
+                len = 0;
+            } else if (c == '\b') {
+                if (len > 0) {
+                    --len;
+                    --cursorpos;
+                    console_printf(0x0700, " ");
+                    --cursorpos;
+                }
+            } else if (c >= ' ' && c < 0x7F && len + 1 < sizeof(line)) {
+                line[len++] = c;
+                console_printf(0x0700, "%c", c);
+            }
+        }
+    }
+}
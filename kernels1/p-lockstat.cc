@@ -0,0 +1,56 @@
+#include "u-lib.hh"
+
+// p-lockstat: show the kernel's hottest locks. Spawns a few copies of
+// itself that make system calls as fast as they can, to give the locks
+// some traffic, then prints each lock's counters sorted by total cycles
+// held. Needs a kernel built with lock statistics: run with
+// `make LOCKSTATS=1 run-lockstat` (and `NCPU=4` to see contention).
+
+static constexpr int nchildren = 3;
+static constexpr unsigned long run_ticks = HZ;
+
+static lock_stat_record recs[LOCKSTATS_MAX];
+
+void process_main() {
+    if (sys_getpid() != 1) {
+        // a child: make system calls for a while
+        char buf[32];
+        for (int i = 0; i != 20000; ++i) {
+            sys_getsysname(buf);
+            if (i % 64 == 0) {
+                sys_yield();
+            }
+        }
+        sys_exit(0);
+    }
+
+    if (sys_lockstats(recs, 0) < 0) {
+        console_printf(0x0C00, "lockstat: kernel built without LOCKSTATS=1\n");
+        sys_exit(1);
+    }
+    for (int i = 0; i != nchildren; ++i) {
+        sys_spawn("lockstat");
+    }
+    sys_sleep(run_ticks);
+
+    int n = min(sys_lockstats(recs, LOCKSTATS_MAX), LOCKSTATS_MAX);
+    // sort by cycles held, most first
+    for (int i = 1; i < n; ++i) {
+        for (int j = i; j > 0
+                 && recs[j].hold_cycles > recs[j - 1].hold_cycles; --j) {
+            lock_stat_record tmp = recs[j];
+            recs[j] = recs[j - 1];
+            recs[j - 1] = tmp;
+        }
+    }
+
+    console_printf(0x0F00, "%-16s %10s %9s %10s %12s %10s\n", "lock",
+                   "acquires", "contended", "spins", "held", "max held");
+    for (int i = 0; i != n; ++i) {
+        const lock_stat_record& r = recs[i];
+        console_printf("%-16s %10lu %9lu %10lu %12lu %10lu\n", r.name,
+                       r.nacquires, r.ncontended, r.nspins,
+                       r.hold_cycles, r.max_hold_cycles);
+    }
+    sys_exit(0);
+}
@@ -9,7 +9,7 @@ void process_main() {
         // Read a message
         while (memchr(buf, '\n', buflen) == NULL) {
             ++nreads;
-            ssize_t r = sys_piperead(&buf[buflen], sizeof(buf) - buflen);
+            ssize_t r = sys_piperead(0, &buf[buflen], sizeof(buf) - buflen);
             if (r == 0) {
                 panic("pipe closed for reading!\n");
             } else if (r > 0) {
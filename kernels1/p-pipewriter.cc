@@ -16,7 +16,7 @@ void process_main() {
         size_t len = strlen(message);
         while (pos < len) {
             ++nwrites;
-            ssize_t w = sys_pipewrite(&message[pos], len - pos);
+            ssize_t w = sys_pipewrite(1, &message[pos], len - pos);
             if (w == 0) {
                 panic("pipe closed for writing!\n");
             } else if (w > 0) {
@@ -29,9 +29,6 @@ void process_main() {
                        nwrites, message);
 
         // Wait 1-3 seconds.
-        unsigned long wait_until = ticks + rand(HZ, 3 * HZ - 1);
-        while (ticks < wait_until) {
-            sys_yield();
-        }
+        sys_sleep(rand(HZ, 3 * HZ - 1));
     }
 }
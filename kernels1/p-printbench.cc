@@ -0,0 +1,55 @@
+#include "u-lib.hh"
+
+// p-printbench: measure formatted printing. Prints a million lines to a
+// string with `snprintf` (the formatter alone), then to fixed console
+// rows with `console_printf` and with the type-safe `console_print`.
+// (`console_print` has no field widths, so its lines are a bit
+// shorter.) Run with `make run-printbench`.
+
+static constexpr int bench_lines = 1000000;
+static constexpr int bench_rows = 8;    // console rows the lines cycle over
+
+// report(name, cycles)
+//    Print average cycles per line.
+
+static void report(const char* name, uint64_t cycles) {
+    console_printf("%-8s %lu cycles/line\n", name, cycles / bench_lines);
+}
+
+void process_main() {
+    pid_t pid = sys_getpid();
+    console_printf(0x0F00, "printbench: %d lines each\n", bench_lines);
+    int row = CONSOLE_ROWS - bench_rows;
+    char buf[100];
+
+    uint64_t t0 = rdtsc();
+    for (int i = 0; i != bench_lines; ++i) {
+        snprintf(buf, sizeof(buf), "line %7d: pid %d at %p, %s\n",
+                 i, pid, buf, "some formatted text");
+    }
+    uint64_t t1 = rdtsc();
+    report("snprintf", t1 - t0);
+
+    t0 = rdtsc();
+    for (int i = 0; i != bench_lines; ++i) {
+        console_printf(CPOS(row + i % bench_rows, 0), 0x0700,
+                       "line %7d: pid %d at %p, %s\n",
+                       i, pid, buf, "some formatted text");
+    }
+    t1 = rdtsc();
+    report("console", t1 - t0);
+
+    // `console_print` splits its format at compile time
+    t0 = rdtsc();
+    for (int i = 0; i != bench_lines; ++i) {
+        console_print_at(CPOS(row + i % bench_rows, 0), 0x0700,
+                         "line {}: pid {} at {}, {}\n",
+                         i, pid, (void*) buf, "some formatted text");
+    }
+    t1 = rdtsc();
+    report("print", t1 - t0);
+
+    while (true) {
+        sys_sleep(HZ);
+    }
+}
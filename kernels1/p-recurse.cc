@@ -13,6 +13,8 @@ void process_main() {
     for (unsigned i = 0; i < 10; ++i) {
         console_printf(0x0E00, "f(%u) == %u\n", i, f(i));
     }
+    // deep enough to grow the stack over several pages
+    console_printf(0x0E00, "f(%u) == %u\n", 1500, f(1500));
     console_printf(0x0E00, "Goodbye now!\n");
 
     while (true) {
@@ -0,0 +1,58 @@
+#include "u-lib.hh"
+
+// p-shmring: stream bytes from a parent to its forked child through an
+// `spsc_ring` in shared memory, and report cycles per byte. After setup
+// neither side makes a system call, except to sleep in a futex when the
+// ring is full or empty. Run with `make run-shmring`.
+
+static constexpr uintptr_t ring_addr = 0x200000;
+static constexpr size_t ring_pages = 4;
+static constexpr size_t stream_size = 8 << 20;
+static constexpr size_t chunk_size = 512;
+
+void process_main() {
+    int id = sys_shm_create(ring_pages);
+    assert(id >= 0);
+    int r = sys_shm_map(id, (void*) ring_addr);
+    assert(r == 0);
+    spsc_ring* ring = spsc_ring::init((void*) ring_addr,
+                                      ring_pages * PAGESIZE);
+
+    pid_t child = sys_fork();
+    assert(child >= 0);
+    char buf[chunk_size];
+
+    if (child == 0) {
+        // consumer: check that bytes arrive in order
+        uint64_t t0 = rdtsc();
+        size_t pos = 0;
+        while (pos != stream_size) {
+            size_t n = ring->read_wait(buf,
+                                       min(chunk_size, stream_size - pos));
+            for (size_t i = 0; i != n; ++i, ++pos) {
+                assert(buf[i] == char(pos % 251));
+            }
+        }
+        uint64_t cycles = rdtsc() - t0;
+        console_printf(0x0F00, "shmring: %zu bytes, %lu.%02lu cycles/byte\n",
+                       stream_size, cycles / stream_size,
+                       cycles * 100 / stream_size % 100);
+        sys_exit(0);
+    }
+
+    // producer
+    for (size_t pos = 0; pos != stream_size; ) {
+        size_t n = min(chunk_size, stream_size - pos);
+        for (size_t i = 0; i != n; ++i) {
+            buf[i] = char((pos + i) % 251);
+        }
+        for (size_t off = 0; off != n; ) {
+            off += ring->write_wait(buf + off, n - off);
+        }
+        pos += n;
+    }
+
+    while (true) {
+        sys_yield();
+    }
+}
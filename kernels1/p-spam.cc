@@ -0,0 +1,41 @@
+#include "u-lib.hh"
+
+// p-spam: measure console printing throughput. Prints `bench_lines`
+// scrolling lines with one `console_printf` per line, first unbuffered
+// (each call scrolls the screen and returns) and then with
+// `console_set_buffered(true)`, flushing every `flush_lines` lines, and
+// reports lines per second for each. Run with `make run-spam`.
+
+static constexpr int bench_lines = 20000;
+static constexpr int flush_lines = 100;
+
+static uint64_t tsc_per_sec;
+
+static uint64_t spam(const char* mode, bool buffered) {
+    console_set_buffered(buffered);
+    uint64_t t0 = rdtsc();
+    for (int i = 0; i != bench_lines; ++i) {
+        console_printf(0x0700, "spam %s: line %d of %d\n",
+                       mode, i + 1, bench_lines);
+        if (buffered && (i + 1) % flush_lines == 0) {
+            console_flush();
+        }
+    }
+    console_set_buffered(false);
+    uint64_t elapsed = max(rdtsc() - t0, uint64_t(1));
+    return bench_lines * tsc_per_sec / elapsed;
+}
+
+void process_main() {
+    // calibrate the TSC against the timer
+    uint64_t c0 = rdtsc();
+    sys_sleep(HZ / 10);
+    tsc_per_sec = (rdtsc() - c0) * 10;
+
+    uint64_t direct = spam("direct", false);
+    uint64_t buffered = spam("buffered", true);
+    console_printf(0x0F00, "spam: %d lines; direct %lu lines/sec, "
+                   "buffered %lu lines/sec\n",
+                   bench_lines, direct, buffered);
+    sys_exit(0);
+}
@@ -0,0 +1,47 @@
+#include "u-lib.hh"
+
+// p-spawnbench: measure `sys_spawn`. Process 1 spawns copies of this
+// program, each of which exits at once, and reports spawns per second
+// and the average cycles spent inside `sys_spawn`. Run with
+// `make run-spawnbench`.
+
+static constexpr int bench_spawns = 2000;
+
+void process_main() {
+    if (sys_getpid() != 1) {
+        sys_exit(0);
+    }
+
+    // calibrate the TSC against the timer
+    uint64_t c0 = rdtsc();
+    sys_sleep(HZ / 10);
+    uint64_t tsc_per_sec = (rdtsc() - c0) * 10;
+
+    console_printf(0x0F00, "spawnbench: %d spawns\n", bench_spawns);
+    uint64_t spawn_cycles = 0;
+    int nretries = 0;
+    uint64_t t0 = rdtsc();
+    for (int i = 0; i != bench_spawns; ) {
+        uint64_t s0 = rdtsc();
+        pid_t child = sys_spawn("spawnbench");
+        uint64_t s1 = rdtsc();
+        if (child > 0) {
+            spawn_cycles += s1 - s0;
+            ++i;
+        } else {
+            // every slot is taken; let the children exit
+            ++nretries;
+            sys_yield();
+        }
+    }
+    uint64_t elapsed = rdtsc() - t0;
+
+    console_printf("%lu spawns/sec, %lu cycles/spawn, %d retries\n",
+                   bench_spawns * tsc_per_sec / max(elapsed, uint64_t(1)),
+                   spawn_cycles / bench_spawns, nretries);
+    assert(sys_spawn("nonexistent") == -1);
+
+    while (true) {
+        sys_yield();
+    }
+}
@@ -0,0 +1,100 @@
+#include "u-lib.hh"
+
+// p-strbench: compare the word-at-a-time string functions in lib.cc
+// against simple byte-at-a-time loops. Run with `make run-strbench`.
+
+static constexpr size_t bench_size = 4000;
+static constexpr int bench_rounds = 64;
+static char bench_buf[2][bench_size + 16];
+
+// Byte-at-a-time reference versions. `volatile` keeps the compiler from
+// recognizing the loops and replacing them with library calls.
+
+static size_t ref_strlen(const char* s) {
+    const volatile char* p = s;
+    while (*p != '\0') {
+        ++p;
+    }
+    return p - s;
+}
+
+static const char* ref_strchr(const char* s, int c) {
+    const volatile char* p = s;
+    while (*p != '\0' && *p != (char) c) {
+        ++p;
+    }
+    return *p == (char) c ? (const char*) p : nullptr;
+}
+
+static const void* ref_memchr(const void* s, int c, size_t n) {
+    const volatile unsigned char* p = (const unsigned char*) s;
+    for (; n != 0; ++p, --n) {
+        if (*p == (unsigned char) c) {
+            return (const void*) p;
+        }
+    }
+    return nullptr;
+}
+
+static int ref_memcmp(const void* a, const void* b, size_t n) {
+    const volatile unsigned char* pa = (const unsigned char*) a;
+    const volatile unsigned char* pb = (const unsigned char*) b;
+    for (; n != 0; ++pa, ++pb, --n) {
+        if (*pa != *pb) {
+            return (*pa > *pb) - (*pa < *pb);
+        }
+    }
+    return 0;
+}
+
+
+// report(name, ref_cycles, fast_cycles)
+//    Print cycles per byte (to two decimal places) for both versions.
+
+static void report(const char* name, uint64_t ref_cycles,
+                   uint64_t fast_cycles) {
+    uint64_t nbytes = uint64_t(bench_size) * bench_rounds;
+    uint64_t ref_cpb = ref_cycles * 100 / nbytes;
+    uint64_t fast_cpb = fast_cycles * 100 / nbytes;
+    console_printf("%-8s byte %lu.%02lu c/B  word %lu.%02lu c/B\n", name,
+                   ref_cpb / 100, ref_cpb % 100,
+                   fast_cpb / 100, fast_cpb % 100);
+}
+
+#define BENCH(name, refexpr, fastexpr) do {                \
+        uint64_t t0 = rdtsc();                              \
+        for (int round = 0; round != bench_rounds; ++round) { \
+            assert(refexpr);                                \
+        }                                                   \
+        uint64_t t1 = rdtsc();                              \
+        for (int round = 0; round != bench_rounds; ++round) { \
+            assert(fastexpr);                               \
+        }                                                   \
+        uint64_t t2 = rdtsc();                              \
+        report(name, t1 - t0, t2 - t1);                     \
+    } while (false)
+
+void process_main() {
+    // Start one byte past alignment so the unaligned head is exercised.
+    char* a = bench_buf[0] + 1;
+    char* b = bench_buf[1] + 1;
+    memset(a, 'x', bench_size);
+    memset(b, 'x', bench_size);
+    a[bench_size - 1] = b[bench_size - 1] = 'y';
+    a[bench_size] = b[bench_size] = '\0';
+
+    console_printf(0x0F00, "strbench: %zu bytes x %d rounds\n",
+                   bench_size, bench_rounds);
+    BENCH("strlen", ref_strlen(a) == bench_size,
+          strlen(a) == bench_size);
+    BENCH("strchr", ref_strchr(a, 'y') == a + bench_size - 1,
+          strchr(a, 'y') == a + bench_size - 1);
+    BENCH("memchr", ref_memchr(a, 'y', bench_size) == a + bench_size - 1,
+          memchr(a, 'y', bench_size) == a + bench_size - 1);
+    BENCH("memcmp", ref_memcmp(a, b, bench_size) == 0,
+          memcmp(a, b, bench_size) == 0);
+
+    while (true) {
+        sys_yield();
+    }
+}
@@ -0,0 +1,50 @@
+#include "u-lib.hh"
+
+// p-syscallbench: measure system call round-trip cost. `sys_getpid`
+// does almost no work in the kernel, so its cost is the entry/exit path
+// itself; `sys_yield` adds a trip through the scheduler; `sys_batch`
+// runs `BATCH_MAX` getpids per entry. Run with `make run-syscallbench`.
+
+static constexpr int bench_calls = 20000;
+
+// report(name, cycles)
+//    Print average cycles per call.
+
+static void report(const char* name, uint64_t cycles) {
+    console_printf("%-8s %lu cycles/call\n", name, cycles / bench_calls);
+}
+
+void process_main() {
+    pid_t pid = sys_getpid();
+    console_printf(0x0F00, "syscallbench: %d calls each\n", bench_calls);
+
+    uint64_t t0 = rdtsc();
+    for (int i = 0; i != bench_calls; ++i) {
+        assert(sys_getpid() == pid);
+    }
+    uint64_t t1 = rdtsc();
+    report("getpid", t1 - t0);
+
+    t0 = rdtsc();
+    for (int i = 0; i != bench_calls; ++i) {
+        sys_yield();
+    }
+    t1 = rdtsc();
+    report("yield", t1 - t0);
+
+    static syscall_record recs[BATCH_MAX];
+    for (auto& r : recs) {
+        r.nr = SYSCALL_GETPID;
+    }
+    t0 = rdtsc();
+    for (int i = 0; i < bench_calls; i += BATCH_MAX) {
+        assert(sys_batch(recs, BATCH_MAX) == BATCH_MAX);
+        assert(recs[BATCH_MAX - 1].result == pid);
+    }
+    t1 = rdtsc();
+    report("batched", t1 - t0);
+
+    while (true) {
+        sys_sleep(HZ);
+    }
+}
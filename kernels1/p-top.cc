@@ -0,0 +1,46 @@
+#include "u-lib.hh"
+
+// p-top: show each process's resource usage on the console once a
+// second, using `sys_getstats`. Starts alice and eve so there is
+// something to watch. Run with `make run-top`.
+
+static constexpr int top_row = 1;       // first console row used
+
+static proc_stats last[NPROC];
+
+void process_main() {
+    sys_spawn("alice");
+    sys_spawn("eve");
+
+    uint64_t last_tsc = rdtsc();
+    while (true) {
+        sys_sleep(HZ);
+        uint64_t now = rdtsc();
+        uint64_t elapsed = max(now - last_tsc, uint64_t(1));
+        last_tsc = now;
+
+        int row = top_row;
+        console_printf(CPOS(row, 0), 0x0F00,
+                       " PID  CPU%%  SYSCALL/s  FAULTS   PAGES   PIPE-W   PIPE-R\n");
+        ++row;
+        for (pid_t pid = 1; pid != NPROC; ++pid) {
+            proc_stats st;
+            if (sys_getstats(pid, &st) < 0) {
+                last[pid] = proc_stats();
+                continue;
+            }
+            uint64_t nsyscalls = 0;
+            for (int i = 0; i != NSYSCALLS; ++i) {
+                nsyscalls += st.nsyscalls[i] - last[pid].nsyscalls[i];
+            }
+            uint64_t cpu = (st.cpu_cycles - last[pid].cpu_cycles) * 100
+                / elapsed;
+            console_printf(CPOS(row, 0), 0x0700,
+                           "%4d %4lu%% %10lu %7lu %7lu %8lu %8lu\n",
+                           pid, cpu, nsyscalls, st.npagefaults, st.npages,
+                           st.pipe_bytes_written, st.pipe_bytes_read);
+            last[pid] = st;
+            ++row;
+        }
+    }
+}
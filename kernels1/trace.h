@@ -0,0 +1,39 @@
+#ifndef WEENSYOS_TRACE_H
+#define WEENSYOS_TRACE_H
+#if defined(WEENSYOS_KERNEL) || defined(WEENSYOS_PROCESS)
+#include "types.h"
+#else
+#include <inttypes.h>
+#endif
+
+// trace.h
+//
+//    Kernel event trace records, shared by the kernel (`k-trace.cc`) and
+//    the host decoder (`build/decodetrace.cc`).
+//
+//    Each CPU keeps a ring of the last TRACE_NRECORDS events. Pressing
+//    't' dumps the rings to `log.txt`, one record per line:
+//
+//        trace <cpu> <tsc> <event> <pid> <arg0> <arg1>
+//
+//    with every field but <cpu> in hex. `obj/decodetrace log.txt` merges
+//    the CPUs' records into one timeline.
+
+#define TRACE_NRECORDS  128             // records per CPU (one page)
+
+// Event IDs
+#define TRACE_SYSCALL   1               // arg0 = number, arg1 = first argument
+#define TRACE_EXCEPTION 2               // arg0 = vector, arg1 = %rip
+#define TRACE_SCHEDULE  3               // arg0 = run queue length
+#define TRACE_RUN       4               // arg0 = TSC when the slice ends
+#define TRACE_WAKE      5               // arg0 = woken pid, arg1 = its CPU
+
+struct trace_record {
+    uint64_t tsc;                       // `rdtsc()` at the event
+    uint32_t event;                     // TRACE_ constant
+    int32_t pid;                        // process running (or 0)
+    uint64_t arg0;
+    uint64_t arg1;
+};
+
+#endif
@@ -10,9 +10,18 @@ __noinline pid_t sys_getpid() {
 //    Yield control of the CPU to the kernel. The kernel will pick another
 //    process to run, if possible.
 __noinline int sys_yield() {
+    console_flush();
     return make_syscall(SYSCALL_YIELD);
 }
 
+// sys_sleep(nticks)
+//    Block for `nticks` timer ticks (`HZ` ticks make a second). A sleeping
+//    process uses no CPU time. Returns 0.
+__noinline int sys_sleep(unsigned long nticks) {
+    console_flush();
+    return make_syscall(SYSCALL_SLEEP, nticks);
+}
+
 // sys_page_alloc(addr)
 //    Allocate a page of memory at address `addr`. The newly-allocated
 //    memory is initialized to 0. Any memory previously located at `addr`
@@ -31,30 +40,219 @@ __noinline int sys_getsysname(char* buf) {
     return make_syscall(SYSCALL_GETSYSNAME, (uintptr_t) buf);
 }
 
+// sys_fork()
+//    Fork the current process. On success, returns the child's PID to
+//    the parent and 0 to the child. Returns -1 on failure (too many
+//    processes or out of memory). Parent and child share memory
+//    copy-on-write.
+__noinline pid_t sys_fork() {
+    return make_syscall(SYSCALL_FORK);
+}
+
 // sys_spawn(commandname)
-//    Start a new process running `command` and return its PID.
+//    Start a new process running `command` and return its PID, or -1 if
+//    there is no such program or no free process slot.
 __noinline pid_t sys_spawn(const char* command) {
     return make_syscall(SYSCALL_SPAWN, (uintptr_t) command);
 }
 
-// sys_pipewrite(buf, sz)
-//    Write data to pipe from `buf`. Writes at most `sz` bytes.
-//    Returns number of bytes written or -1 on error.
-__noinline ssize_t sys_pipewrite(const void* buf, size_t sz) {
-    return make_syscall(SYSCALL_PIPEWRITE, (uintptr_t) buf, sz);
+// sys_pipe(pfd)
+//    Create a pipe. Stores a read descriptor in `pfd[0]` and a write
+//    descriptor in `pfd[1]`. Returns 0 on success or -1 on error.
+__noinline int sys_pipe(int* pfd) {
+    return make_syscall(SYSCALL_PIPE, (uintptr_t) pfd);
+}
+
+// sys_pipewrite(fd, buf, sz)
+//    Write data to the pipe open for writing on `fd` from `buf`. Writes at
+//    most `sz` bytes, blocking until there is room for at least one.
+//    Returns number of bytes written or -1 on error (including no
+//    remaining readers).
+__noinline ssize_t sys_pipewrite(int fd, const void* buf, size_t sz) {
+    console_flush();
+    return make_syscall(SYSCALL_PIPEWRITE, fd, (uintptr_t) buf, sz);
+}
+
+// sys_piperead(fd, buf, sz)
+//    Read data from the pipe open for reading on `fd` into `buf`. Reads at
+//    most `sz` bytes, blocking until at least one is available. Returns
+//    number of bytes read, 0 at end of file (no remaining writers), or -1
+//    on error.
+__noinline ssize_t sys_piperead(int fd, void* buf, size_t sz) {
+    console_flush();
+    return make_syscall(SYSCALL_PIPEREAD, fd, (uintptr_t) buf, sz);
+}
+
+// sys_read(fd, buf, sz)
+//    Read from `fd` into `buf`. Descriptor 0 is the keyboard unless a
+//    pipe is open there: reads block until at least one character has
+//    been typed, then return up to `sz` of those typed so far. Other
+//    descriptors behave as for `sys_piperead`. Returns the number of
+//    bytes read or -1 on error.
+__noinline ssize_t sys_read(int fd, void* buf, size_t sz) {
+    console_flush();
+    return make_syscall(SYSCALL_READ, fd, (uintptr_t) buf, sz);
+}
+
+// sys_readc()
+//    Read one character from the keyboard, blocking until one is typed.
+//    Returns the character (arrows and other special keys are 0300-0311;
+//    see `keyboard_readc` in kernel.hh) or -1 on error.
+int sys_readc() {
+    unsigned char c = 0;
+    ssize_t n = sys_read(0, &c, 1);
+    clobber_memory(&c);         // the kernel wrote it behind GCC's back
+    return n == 1 ? c : -1;
+}
+
+// sys_pipewrite_pages(fd, buf, npages)
+//    Queue the `npages` whole pages starting at `buf` on the pipe open for
+//    writing on `fd`. `buf` must be page-aligned. Where possible the pages
+//    are shared with the reader rather than copied; the caller's mapping
+//    becomes copy-on-write. Blocks until at least one page can be queued.
+//    Returns the number of pages queued or -1 on error.
+__noinline ssize_t sys_pipewrite_pages(int fd, const void* buf, size_t npages) {
+    console_flush();
+    return make_syscall(SYSCALL_PIPEWRITE_PAGES, fd, (uintptr_t) buf, npages);
+}
+
+// sys_piperead_pages(fd, buf, npages)
+//    Receive up to `npages` pages sent with `sys_pipewrite_pages` on the
+//    pipe open for reading on `fd`, placing them at page-aligned `buf`.
+//    Pages are queued separately from `sys_pipewrite` data. Blocks until
+//    at least one page is available. Returns the number of pages
+//    received, 0 at end of file, or -1 on error.
+__noinline ssize_t sys_piperead_pages(int fd, void* buf, size_t npages) {
+    console_flush();
+    return make_syscall(SYSCALL_PIPEREAD_PAGES, fd, (uintptr_t) buf, npages);
+}
+
+// sys_close(fd)
+//    Close file descriptor `fd`. Returns 0 on success or -1 on error.
+__noinline int sys_close(int fd) {
+    return make_syscall(SYSCALL_CLOSE, fd);
+}
+
+
+// sys_pipewritev(fd, iov, iovcnt), sys_pipereadv(fd, iov, iovcnt)
+//    Like `sys_pipewrite` and `sys_piperead`, but gather from (scatter
+//    into) the `iovcnt` buffers in `iov`, at most `IOV_MAX`, in one
+//    call. Return the total number of bytes moved, or -1 on error.
+__noinline ssize_t sys_pipewritev(int fd, const iovec* iov, int iovcnt) {
+    console_flush();
+    return make_syscall(SYSCALL_PIPEWRITEV, fd, (uintptr_t) iov, iovcnt);
+}
+
+__noinline ssize_t sys_pipereadv(int fd, const iovec* iov, int iovcnt) {
+    console_flush();
+    return make_syscall(SYSCALL_PIPEREADV, fd, (uintptr_t) iov, iovcnt);
+}
+
+// sys_batch(recs, n)
+//    Run the `n` system calls in `recs` (at most `BATCH_MAX`) in order
+//    with a single kernel entry, storing each return value in its
+//    `result`. Calls that could block or switch processes (yield,
+//    sleep, fork, exit, futex wait, page transfers) get -1. The batch
+//    stops before a pipe transfer that would block. Returns the number
+//    of records run, or -1 if `recs` is inaccessible.
+__noinline int sys_batch(syscall_record* recs, int n) {
+    return make_syscall(SYSCALL_BATCH, (uintptr_t) recs, n);
+}
+
+// sys_getstats(pid, stats)
+//    Store process `pid`'s resource usage in `*stats`. Returns 0 on
+//    success and -1 if there is no such process.
+__noinline int sys_getstats(pid_t pid, proc_stats* stats) {
+    return make_syscall(SYSCALL_GETSTATS, pid, (uintptr_t) stats);
+}
+
+// sys_diskread(buf, sz, off), sys_diskwrite(buf, sz, off)
+//    Read (write) `sz` bytes at byte offset `off` of the data disk,
+//    through the kernel's buffer cache. Writes reach the disk when their
+//    blocks are evicted or at `sys_disksync`. Return the number of bytes
+//    moved, which is less than `sz` only at the end of the disk, or -1
+//    on error (including no disk).
+__noinline ssize_t sys_diskread(void* buf, size_t sz, off_t off) {
+    return make_syscall(SYSCALL_DISKREAD, (uintptr_t) buf, sz, off);
+}
+
+__noinline ssize_t sys_diskwrite(const void* buf, size_t sz, off_t off) {
+    return make_syscall(SYSCALL_DISKWRITE, (uintptr_t) buf, sz, off);
+}
+
+// sys_disksync(stats)
+//    Write all dirty cached blocks to the data disk. If `stats` is not
+//    null, also store the cache's counters there. Returns 0 or -1.
+__noinline int sys_disksync(disk_stats* stats) {
+    return make_syscall(SYSCALL_DISKSYNC, (uintptr_t) stats);
+}
+
+// sys_lockstats(recs, n)
+//    Store the contention counters of up to `n` kernel locks in `recs`
+//    and return the number of locks the kernel has counters for (at
+//    most `LOCKSTATS_MAX` are ever stored). Returns -1 if the kernel was
+//    built without `LOCKSTATS=1`.
+__noinline int sys_lockstats(lock_stat_record* recs, int n) {
+    return make_syscall(SYSCALL_LOCKSTATS, (uintptr_t) recs, n);
+}
+
+// sys_log(s, len)
+//    Append the `len` characters at `s` to the kernel's log (`log.txt`
+//    on the host). Returns 0 or -1.
+__noinline int sys_log(const char* s, size_t len) {
+    return make_syscall(SYSCALL_LOG, (uintptr_t) s, len);
+}
+
+// sys_shm_create(npages)
+//    Create a shared memory segment of `npages` zeroed pages (at most 8).
+//    Returns its ID, which any process may pass to `sys_shm_map`, or -1.
+__noinline int sys_shm_create(size_t npages) {
+    return make_syscall(SYSCALL_SHM_CREATE, npages);
+}
+
+// sys_shm_map(id, addr)
+//    Map shared memory segment `id` at page-aligned address `addr`,
+//    replacing anything mapped there. The mapping stays shared with
+//    children after `sys_fork`. Returns 0 on success and -1 on error; a
+//    failed call may leave a prefix of the segment mapped.
+__noinline int sys_shm_map(int id, void* addr) {
+    return make_syscall(SYSCALL_SHM_MAP, id, (uintptr_t) addr);
+}
+
+// sys_futex_wait(addr, expected)
+//    If `*addr == expected`, block until another process calls
+//    `sys_futex_wake` on the same word (through any mapping of it).
+//    Returns 0 once woken or if `*addr != expected`, -1 if `addr` is
+//    misaligned or inaccessible. Callers should recheck their condition.
+__noinline int sys_futex_wait(std::atomic<uint32_t>* addr,
+                              uint32_t expected) {
+    console_flush();
+    return make_syscall(SYSCALL_FUTEX_WAIT, (uintptr_t) addr, expected);
 }
 
-// sys_piperead(buf, sz)
-//    Read data from pipe into `buf`. Reads at most `sz` bytes.
-//    Returns number of bytes read or -1 on error.
-__noinline ssize_t sys_piperead(void* buf, size_t sz) {
-    return make_syscall(SYSCALL_PIPEREAD, (uintptr_t) buf, sz);
+// sys_futex_wake(addr, n)
+//    Wake up to `n` processes blocked in `sys_futex_wait` on `addr`.
+//    Returns the number woken, or -1 on error.
+__noinline int sys_futex_wake(std::atomic<uint32_t>* addr, int n) {
+    return make_syscall(SYSCALL_FUTEX_WAKE, (uintptr_t) addr, n);
 }
 
+// sys_exit(status)
+//    Exit this process, closing its file descriptors and freeing its
+//    memory and process slot.
+[[noreturn]] __noinline void sys_exit(int status) {
+    console_flush();
+    make_syscall(SYSCALL_EXIT, status);
+
+    // should never get here
+    while (true) {
+    }
+}
 
 // sys_panic(msg)
 //    Panic.
 [[noreturn]] __noinline void sys_panic(const char* msg) {
+    console_flush();
     make_syscall(SYSCALL_PANIC, (uintptr_t) msg);
 
     // should never get here
@@ -63,6 +261,18 @@ __noinline ssize_t sys_piperead(void* buf, size_t sz) {
 }
 
 
+// sys_poweroff()
+//    Turn off the virtual machine, after writing out the kernel's log.
+[[noreturn]] __noinline void sys_poweroff() {
+    console_flush();
+    make_syscall(SYSCALL_POWEROFF);
+
+    // should never get here
+    while (true) {
+    }
+}
+
+
 // panic, assert_fail
 //     Call the SYSCALL_PANIC system call so the kernel loops until Control-C.
 
@@ -86,6 +296,7 @@ int error_vprintf(int cpos, int color, const char* format, va_list val) {
 
 void assert_fail(const char* file, int line, const char* msg,
                  const char* description) {
+    console_flush();
     cursorpos = CPOS(23, 0);
     if (description) {
         error_printf("%s:%d: %s\n", file, line, description);
@@ -93,3 +304,107 @@ void assert_fail(const char* file, int line, const char* msg,
     error_printf("%s:%d: user assertion '%s' failed\n", file, line, msg);
     sys_panic(nullptr);
 }
+
+
+// spsc_ring
+//    The positions only grow, so `tail_ - head_` is the number of bytes
+//    buffered. The writer publishes data with a release store to `tail_`
+//    and the reader frees space with a release store to `head_`.
+
+spsc_ring* spsc_ring::init(void* mem, size_t sz) {
+    assert(sz > sizeof(spsc_ring));
+    spsc_ring* r = new (mem) spsc_ring;
+    r->head_.store(0, std::memory_order_relaxed);
+    r->tail_.store(0, std::memory_order_relaxed);
+    r->capacity_ = sz - sizeof(spsc_ring);
+    r->reader_waiting_.store(0, std::memory_order_relaxed);
+    r->writer_waiting_.store(0, std::memory_order_relaxed);
+    return r;
+}
+
+size_t spsc_ring::write(const void* buf, size_t sz) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_acquire);
+    sz = min(sz, capacity_ - (tail - head));
+    size_t pos = tail % capacity_;
+    size_t n1 = min(sz, capacity_ - pos);
+    memcpy(data() + pos, buf, n1);
+    memcpy(data(), reinterpret_cast<const char*>(buf) + n1, sz - n1);
+    tail_.store(tail + sz, std::memory_order_release);
+    return sz;
+}
+
+size_t spsc_ring::read(void* buf, size_t sz) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    sz = min(sz, tail - head);
+    size_t pos = head % capacity_;
+    size_t n1 = min(sz, capacity_ - pos);
+    memcpy(buf, data() + pos, n1);
+    memcpy(reinterpret_cast<char*>(buf) + n1, data(), sz - n1);
+    head_.store(head + sz, std::memory_order_release);
+    return sz;
+}
+
+// The blocking versions use a waiting flag per side. A blocked side sets
+// its flag, then rechecks the ring; the other side publishes its update,
+// then checks the flag. Sequential consistency means at least one sees
+// the other, and `sys_futex_wait` returns at once if the flag was
+// cleared in between, so no wakeup is lost.
+
+static void wake_waiter(std::atomic<uint32_t>& waiting) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed) && waiting.exchange(0)) {
+        sys_futex_wake(&waiting, 1);
+    }
+}
+
+size_t spsc_ring::write_wait(const void* buf, size_t sz) {
+    while (true) {
+        if (size_t n = write(buf, sz)) {
+            wake_waiter(reader_waiting_);
+            return n;
+        }
+        writer_waiting_.store(1);
+        if (tail_.load(std::memory_order_relaxed) - head_.load()
+            == capacity_) {
+            sys_futex_wait(&writer_waiting_, 1);
+        }
+    }
+}
+
+size_t spsc_ring::read_wait(void* buf, size_t sz) {
+    while (true) {
+        if (size_t n = read(buf, sz)) {
+            wake_waiter(writer_waiting_);
+            return n;
+        }
+        reader_waiting_.store(1);
+        if (tail_.load() == head_.load(std::memory_order_relaxed)) {
+            sys_futex_wait(&reader_waiting_, 1);
+        }
+    }
+}
+
+
+// futex_mutex
+
+void futex_mutex::lock() {
+    uint32_t s = 0;
+    if (state_.compare_exchange_strong(s, 1, std::memory_order_acquire)) {
+        return;
+    }
+    if (s != 2) {
+        s = state_.exchange(2, std::memory_order_acquire);
+    }
+    while (s != 0) {
+        sys_futex_wait(&state_, 2);
+        s = state_.exchange(2, std::memory_order_acquire);
+    }
+}
+
+void futex_mutex::unlock() {
+    if (state_.exchange(0, std::memory_order_release) == 2) {
+        sys_futex_wake(&state_, 1);
+    }
+}
@@ -80,13 +80,97 @@ __always_inline void access_memory(const void* ptr) {
 
 pid_t sys_getpid();
 int sys_yield();
+int sys_sleep(unsigned long nticks);
 int sys_page_alloc(void* addr);
 int sys_getsysname(char* buf);
 
+pid_t sys_fork();
 pid_t sys_spawn(const char* command);
-ssize_t sys_pipewrite(const void* buf, size_t sz);
-ssize_t sys_piperead(void* buf, size_t sz);
-
+int sys_pipe(int* pfd);
+ssize_t sys_pipewrite(int fd, const void* buf, size_t sz);
+ssize_t sys_piperead(int fd, void* buf, size_t sz);
+ssize_t sys_read(int fd, void* buf, size_t sz);
+int sys_readc();
+int sys_close(int fd);
+ssize_t sys_pipewrite_pages(int fd, const void* buf, size_t npages);
+ssize_t sys_piperead_pages(int fd, void* buf, size_t npages);
+int sys_shm_create(size_t npages);
+int sys_shm_map(int id, void* addr);
+int sys_futex_wait(std::atomic<uint32_t>* addr, uint32_t expected);
+int sys_futex_wake(std::atomic<uint32_t>* addr, int n);
+ssize_t sys_pipewritev(int fd, const iovec* iov, int iovcnt);
+ssize_t sys_pipereadv(int fd, const iovec* iov, int iovcnt);
+int sys_batch(syscall_record* recs, int n);
+int sys_getstats(pid_t pid, proc_stats* stats);
+ssize_t sys_diskread(void* buf, size_t sz, off_t off);
+ssize_t sys_diskwrite(const void* buf, size_t sz, off_t off);
+int sys_disksync(disk_stats* stats);
+int sys_lockstats(lock_stat_record* recs, int n);
+int sys_log(const char* s, size_t len);
+
+[[noreturn]] void sys_exit(int status);
 [[noreturn]] void sys_panic(const char* msg);
+[[noreturn]] void sys_poweroff();
+
+
+// console_set_buffered(on), console_flush()
+//    With buffering on, printing at the cursor collects cells in a
+//    per-process buffer rather than writing the screen, and the buffer is
+//    laid out from `cursorpos` at the next flush: at `console_flush`, when
+//    it fills, and before every system call that can block or not
+//    return (`sys_yield`, `sys_sleep`, `sys_read`, the pipe transfers,
+//    `sys_futex_wait`, `sys_exit`, `sys_panic`, and `sys_poweroff`).
+//    The return value of a buffered `console_printf` is the cursor
+//    position as of the last flush.
+void console_set_buffered(bool on);
+void console_flush();
+
+
+// spsc_ring
+//    A single-producer, single-consumer byte ring in shared memory. One
+//    process calls `init` on memory from `sys_shm_map`; afterwards one
+//    process only writes and another only reads, and neither enters the
+//    kernel. The two positions sit on separate cache lines.
+
+struct spsc_ring {
+    // Lay out a ring in the `sz` bytes at `mem` and return it
+    static spsc_ring* init(void* mem, size_t sz);
+
+    // Copy up to `sz` bytes in; return the number copied (maybe 0)
+    size_t write(const void* buf, size_t sz);
+    // Copy up to `sz` bytes out; return the number copied (maybe 0)
+    size_t read(void* buf, size_t sz);
+    // Like `write` and `read`, but block in `sys_futex_wait` until at
+    // least one byte can be copied
+    size_t write_wait(const void* buf, size_t sz);
+    size_t read_wait(void* buf, size_t sz);
+
+  private:
+    alignas(64) std::atomic<size_t> head_;     // bytes ever read
+    alignas(64) std::atomic<size_t> tail_;     // bytes ever written
+    size_t capacity_;
+    alignas(64) std::atomic<uint32_t> reader_waiting_;
+    std::atomic<uint32_t> writer_waiting_;
+
+    char* data() {
+        return reinterpret_cast<char*>(this + 1);
+    }
+};
+
+
+// futex_mutex
+//    A mutual-exclusion lock for processes sharing memory. Uncontended
+//    `lock` and `unlock` are a single atomic operation; contended
+//    lockers sleep in `sys_futex_wait`. A zeroed `futex_mutex` is
+//    unlocked.
+
+struct futex_mutex {
+    void lock();
+    void unlock();
+
+  private:
+    // 0 = unlocked, 1 = locked, 2 = locked and maybe waited on
+    std::atomic<uint32_t> state_ = 0;
+};
 
 #endif
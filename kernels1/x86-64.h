@@ -179,6 +179,10 @@ typedef struct x86_64_msr_t {
 #define CR4_PCE                 0x00000100      // Perfmonitor Counter Enable
 #define CR4_OSFXSR              0x00000200      // OS FXSAVE/FXRSTOR support
 #define CR4_VMXE                0x00004000      // VMX Enable
+#define CR4_PCIDE               0x00020000      // Process-Context IDs Enable
+
+// %cr3 flag bits
+#define CR3_NOFLUSH             0x8000000000000000UL // keep PCID's TLB entries
 
 // eflags bits (useful for rdeflags() and wreflags())
 #define EFLAGS_CF               0x00000001      // Carry Flag
@@ -0,0 +1,112 @@
+#ifndef CS61_ARENA_ALLOCATOR_HH
+#define CS61_ARENA_ALLOCATOR_HH
+#include <cstddef>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+
+// arena
+//    A bump allocator. `allocate` carves objects out of large chunks, so
+//    objects allocated one after another are adjacent in memory.
+//    Individual objects are never freed; `release` (or destroying the
+//    arena) frees everything at once. Containers using the arena must be
+//    gone (or cleared) by then.
+class arena {
+  public:
+    explicit arena(size_t chunk_size = 1 << 20)
+        : chunk_size_(chunk_size) {
+    }
+    ~arena() {
+        release();
+    }
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    // Return `sz` bytes aligned to `align` (a power of 2).
+    void* allocate(size_t sz, size_t align) {
+        uintptr_t p = (reinterpret_cast<uintptr_t>(next_) + align - 1)
+            & ~uintptr_t(align - 1);
+        if (!next_ || p + sz > reinterpret_cast<uintptr_t>(end_)) {
+            new_chunk(sz + align);
+            p = (reinterpret_cast<uintptr_t>(next_) + align - 1)
+                & ~uintptr_t(align - 1);
+        }
+        next_ = reinterpret_cast<char*>(p + sz);
+        return reinterpret_cast<void*>(p);
+    }
+
+    // Free every chunk.
+    void release() {
+        while (chunks_) {
+            chunk* c = chunks_;
+            chunks_ = c->prev;
+            free(c);
+        }
+        next_ = end_ = nullptr;
+    }
+
+  private:
+    struct chunk {
+        chunk* prev;
+    };
+    chunk* chunks_ = nullptr;
+    char* next_ = nullptr;
+    char* end_ = nullptr;
+    size_t chunk_size_;
+
+    void new_chunk(size_t min_size) {
+        size_t sz = sizeof(chunk)
+            + (min_size > chunk_size_ ? min_size : chunk_size_);
+        chunk* c = reinterpret_cast<chunk*>(malloc(sz));
+        if (!c) {
+            throw std::bad_alloc();
+        }
+        c->prev = chunks_;
+        chunks_ = c;
+        next_ = reinterpret_cast<char*>(c + 1);
+        end_ = reinterpret_cast<char*>(c) + sz;
+    }
+};
+
+
+// arena_allocator<T>
+//    A standard allocator that draws from an `arena`, for use as a
+//    container's allocator parameter:
+//        arena a;
+//        std::list<int, arena_allocator<int>> l{arena_allocator<int>(a)};
+//    `deallocate` does nothing; memory returns when the arena is released.
+template <typename T>
+class arena_allocator {
+  public:
+    using value_type = T;
+
+    arena_allocator(arena& a)
+        : arena_(&a) {
+    }
+    template <typename U>
+    arena_allocator(const arena_allocator<U>& x)
+        : arena_(x.arena_) {
+    }
+
+    T* allocate(size_t n) {
+        return reinterpret_cast<T*>(arena_->allocate(n * sizeof(T),
+                                                     alignof(T)));
+    }
+    void deallocate(T*, size_t) {
+    }
+
+    template <typename U>
+    bool operator==(const arena_allocator<U>& x) const {
+        return arena_ == x.arena_;
+    }
+    template <typename U>
+    bool operator!=(const arena_allocator<U>& x) const {
+        return arena_ != x.arena_;
+    }
+
+  private:
+    arena* arena_;
+    template <typename U> friend class arena_allocator;
+};
+
+#endif
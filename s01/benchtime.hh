@@ -0,0 +1,257 @@
+#ifndef CS61_BENCHTIME_HH
+#define CS61_BENCHTIME_HH
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+# define BENCHTIME_TSC 1
+#endif
+#if defined(__linux__)
+# include <linux/perf_event.h>
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+#endif
+
+// Benchmark timers. `cputime()` in hexdump.hh sums CPU time over all
+// threads and ticks coarsely; these measure elapsed time on the calling
+// thread, down to single cycles.
+
+
+// walltime()
+//    Return the current monotonic wall-clock time in seconds.
+inline double walltime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+// rdtsc(), rdtscp()
+//    Return the CPU's timestamp counter. `rdtsc()` is fenced so earlier
+//    instructions finish before it reads the counter; use it to start an
+//    interval. `rdtscp()` waits for earlier instructions and fences later
+//    ones; use it to end an interval. Without a TSC, both count
+//    nanoseconds of wall-clock time.
+inline uint64_t rdtsc() {
+#if BENCHTIME_TSC
+    _mm_lfence();
+    return __rdtsc();
+#else
+    return walltime() * 1e9;
+#endif
+}
+
+inline uint64_t rdtscp() {
+#if BENCHTIME_TSC
+    unsigned aux;
+    uint64_t t = __rdtscp(&aux);
+    _mm_lfence();
+    return t;
+#else
+    return walltime() * 1e9;
+#endif
+}
+
+// tsc_hz()
+//    Return the timestamp counter's rate in ticks per second. The first
+//    call calibrates it against `walltime()`, which takes about 20ms.
+inline double tsc_hz() {
+    static double hz = [] () {
+#if BENCHTIME_TSC
+        double w0 = walltime(), w1;
+        uint64_t c0 = rdtsc();
+        while ((w1 = walltime()) - w0 < 0.02) {
+        }
+        return (rdtscp() - c0) / (w1 - w0);
+#else
+        return 1e9;
+#endif
+    }();
+    return hz;
+}
+
+// tsc_seconds(ticks)
+//    Convert a difference of `rdtsc()` values to seconds.
+inline double tsc_seconds(uint64_t ticks) {
+    return ticks / tsc_hz();
+}
+
+
+// perf_counters
+//    Count this thread's user-level cache misses and branch misses with
+//    `perf_event_open`. Counting is often unavailable (non-Linux systems,
+//    containers, `perf_event_paranoid`); then `ok()` is false and all
+//    counts read as zero.
+class perf_counters {
+public:
+    perf_counters() {
+#if defined(__linux__)
+        group_ = open_event(PERF_COUNT_HW_CACHE_MISSES, -1);
+        if (group_ >= 0) {
+            branch_ = open_event(PERF_COUNT_HW_BRANCH_MISSES, group_);
+        }
+        if (branch_ < 0 && group_ >= 0) {
+            close(group_);
+            group_ = -1;
+        }
+#endif
+    }
+    ~perf_counters() {
+        if (branch_ >= 0) {
+            close(branch_);
+        }
+        if (group_ >= 0) {
+            close(group_);
+        }
+    }
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    bool ok() const {
+        return group_ >= 0;
+    }
+
+    // start(), stop(): reset and enable counting; disable counting
+    void start() {
+#if defined(__linux__)
+        if (ok()) {
+            ioctl(group_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(group_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+    }
+    void stop() {
+#if defined(__linux__)
+        if (ok()) {
+            ioctl(group_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            uint64_t vals[3] = {0, 0, 0};   // nr, cache misses, branch misses
+            if (read(group_, vals, sizeof(vals)) == (ssize_t) sizeof(vals)) {
+                cache_misses_ += vals[1];
+                branch_misses_ += vals[2];
+            }
+        }
+#endif
+    }
+
+    // cache_misses(), branch_misses(): totals over all start/stop pairs
+    uint64_t cache_misses() const {
+        return cache_misses_;
+    }
+    uint64_t branch_misses() const {
+        return branch_misses_;
+    }
+
+private:
+    int group_ = -1;
+    int branch_ = -1;
+    uint64_t cache_misses_ = 0;
+    uint64_t branch_misses_ = 0;
+
+#if defined(__linux__)
+    static int open_event(uint64_t config, int group) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.disabled = group < 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+    }
+#endif
+};
+
+
+// bench_result
+//    Summary of repeated measurements. Times are seconds per repetition;
+//    counter values are per repetition, or -1 if counters were not
+//    requested or are unavailable.
+struct bench_result {
+    int reps = 0;
+    double min = 0;
+    double median = 0;
+    double p90 = 0;
+    double p99 = 0;
+    double max = 0;
+    double mean = 0;
+    double stddev = 0;
+    double cache_misses = -1;
+    double branch_misses = -1;
+};
+
+// bench_percentile(sorted, p)
+//    Return the `p`th percentile (0 to 100) of the nonempty sorted
+//    vector `sorted`, interpolating between neighboring samples.
+inline double bench_percentile(const std::vector<double>& sorted, double p) {
+    double pos = (sorted.size() - 1) * p / 100;
+    size_t i = pos;
+    if (i + 1 >= sorted.size()) {
+        return sorted.back();
+    }
+    return sorted[i] + (sorted[i + 1] - sorted[i]) * (pos - i);
+}
+
+// bench_run(fn, reps, [warmups], [counters])
+//    Call `fn()` `warmups` times (default 1) untimed, to fault in memory
+//    and warm caches, then `reps` times, timing each call with the TSC.
+//    If `counters` is true, also count cache and branch misses over the
+//    timed calls.
+template <typename F>
+bench_result bench_run(F&& fn, int reps, int warmups = 1,
+                       bool counters = false) {
+    assert(reps > 0);
+    for (int i = 0; i < warmups; ++i) {
+        fn();
+    }
+    tsc_hz();
+
+    std::unique_ptr<perf_counters> pc;
+    if (counters) {
+        pc.reset(new perf_counters);
+    }
+    std::vector<double> t;
+    t.reserve(reps);
+    for (int i = 0; i != reps; ++i) {
+        if (pc) {
+            pc->start();
+        }
+        uint64_t c0 = rdtsc();
+        fn();
+        uint64_t c1 = rdtscp();
+        if (pc) {
+            pc->stop();
+        }
+        t.push_back(tsc_seconds(c1 - c0));
+    }
+
+    bench_result r;
+    r.reps = reps;
+    for (double x : t) {
+        r.mean += x / reps;
+    }
+    for (double x : t) {
+        r.stddev += (x - r.mean) * (x - r.mean) / reps;
+    }
+    r.stddev = sqrt(r.stddev);
+    std::sort(t.begin(), t.end());
+    r.min = t.front();
+    r.median = bench_percentile(t, 50);
+    r.p90 = bench_percentile(t, 90);
+    r.p99 = bench_percentile(t, 99);
+    r.max = t.back();
+    if (pc && pc->ok()) {
+        r.cache_misses = (double) pc->cache_misses() / reps;
+        r.branch_misses = (double) pc->branch_misses() / reps;
+    }
+    return r;
+}
+
+#endif
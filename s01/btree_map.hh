@@ -0,0 +1,660 @@
+#ifndef CS61_BTREE_MAP_HH
+#define CS61_BTREE_MAP_HH
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// btree_map<K, V, [Compare], [NodeBytes]>
+//    An ordered map stored as a B+ tree. Nodes are about `NodeBytes`
+//    bytes (default 256, four cache lines) and cache-line aligned, so one
+//    node holds many keys: a lookup touches a few wide nodes instead of
+//    one red-black node per level, and a range scan walks leaves full of
+//    adjacent elements. Elements live only in leaves, which are linked
+//    in key order; inner nodes hold copies of separating keys.
+//
+//    The interface is the part of `std::map` that the map demos use:
+//    `insert`, `emplace`, `operator[]`, `find`, `count`, `erase`,
+//    `lower_bound`, `upper_bound`, `size`, `empty`, `clear`, and
+//    bidirectional iteration in key order. Unlike `std::map`, inserting or
+//    erasing moves other elements within and between leaves, so it
+//    invalidates iterators and references.
+
+template <typename K, typename V, typename Compare = std::less<K>,
+          size_t NodeBytes = 256>
+class btree_map {
+    struct leaf;
+  public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<const K, V>;
+    using size_type = size_t;
+    using key_compare = Compare;
+
+    template <bool Const> class basic_iterator;
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    btree_map() = default;
+    btree_map(const btree_map& x)
+        : comp_(x.comp_) {
+        for (auto& kv : x) {
+            emplace(kv.first, kv.second);
+        }
+    }
+    btree_map(btree_map&& x) noexcept {
+        swap(x);
+    }
+    ~btree_map() {
+        clear();
+    }
+    btree_map& operator=(btree_map x) noexcept {
+        swap(x);
+        return *this;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+    bool empty() const {
+        return size_ == 0;
+    }
+    // Return the number of levels (0 for an empty map).
+    int height() const {
+        return height_;
+    }
+    // Return the bytes allocated for nodes. Memory owned by the elements
+    // themselves (e.g., long strings) is not included.
+    size_t node_bytes() const {
+        return nleaves_ * sizeof(leaf) + ninners_ * sizeof(inner);
+    }
+
+    iterator begin() {
+        return iterator(this, leftmost_, 0);
+    }
+    iterator end() {
+        return iterator(this, nullptr, 0);
+    }
+    const_iterator begin() const {
+        return const_iterator(this, leftmost_, 0);
+    }
+    const_iterator end() const {
+        return const_iterator(this, nullptr, 0);
+    }
+
+    // Return an iterator to the first element whose key is not less
+    // than (`lower_bound`) or is greater than (`upper_bound`) `key`.
+    iterator lower_bound(const K& key) {
+        auto [l, i] = bound(key, false);
+        return iterator(this, l, i);
+    }
+    const_iterator lower_bound(const K& key) const {
+        auto [l, i] = bound(key, false);
+        return const_iterator(this, l, i);
+    }
+    iterator upper_bound(const K& key) {
+        auto [l, i] = bound(key, true);
+        return iterator(this, l, i);
+    }
+    const_iterator upper_bound(const K& key) const {
+        auto [l, i] = bound(key, true);
+        return const_iterator(this, l, i);
+    }
+
+    iterator find(const K& key) {
+        iterator it = lower_bound(key);
+        return it != end() && !comp_(key, it->first) ? it : end();
+    }
+    const_iterator find(const K& key) const {
+        const_iterator it = lower_bound(key);
+        return it != end() && !comp_(key, it->first) ? it : end();
+    }
+    size_t count(const K& key) const {
+        return find(key) != end();
+    }
+
+    // Insert `kv` unless its key is present. Return an iterator to the
+    // element with that key, and true iff it was inserted.
+    std::pair<iterator, bool> insert(const value_type& kv) {
+        return emplace(kv.first, kv.second);
+    }
+    std::pair<iterator, bool> insert(value_type&& kv) {
+        return emplace(kv.first, std::move(kv.second));
+    }
+    template <typename KK, typename... Args>
+    std::pair<iterator, bool> emplace(KK&& key, Args&&... args);
+
+    // Return a reference to `key`'s value, inserting a value-initialized
+    // one if `key` is absent.
+    V& operator[](const K& key) {
+        return emplace(key).first->second;
+    }
+
+    // Remove the element with key `key`, if any. Return the number of
+    // elements removed.
+    size_t erase(const K& key);
+    // Remove the element at `it`; return an iterator to the next one.
+    iterator erase(iterator it) {
+        K key = it->first;
+        erase(key);
+        return lower_bound(key);
+    }
+
+    void clear() {
+        if (root_) {
+            destroy(root_, 1);
+        }
+        root_ = nullptr;
+        leftmost_ = rightmost_ = nullptr;
+        height_ = 0;
+        size_ = nleaves_ = ninners_ = 0;
+    }
+
+    void swap(btree_map& x) noexcept {
+        std::swap(root_, x.root_);
+        std::swap(leftmost_, x.leftmost_);
+        std::swap(rightmost_, x.rightmost_);
+        std::swap(height_, x.height_);
+        std::swap(size_, x.size_);
+        std::swap(nleaves_, x.nleaves_);
+        std::swap(ninners_, x.ninners_);
+        std::swap(comp_, x.comp_);
+    }
+
+
+    template <bool Const>
+    class basic_iterator {
+      public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = btree_map::value_type;
+        using difference_type = ptrdiff_t;
+        using pointer = std::conditional_t<Const, const value_type*,
+                                           value_type*>;
+        using reference = std::conditional_t<Const, const value_type&,
+                                             value_type&>;
+        using map_pointer = std::conditional_t<Const, const btree_map*,
+                                               btree_map*>;
+
+        basic_iterator() = default;
+        basic_iterator(map_pointer m, leaf* l, unsigned i)
+            : m_(m), l_(l), i_(i) {
+        }
+        // iterator converts to const_iterator
+        template <bool C, typename = std::enable_if_t<Const && !C>>
+        basic_iterator(const basic_iterator<C>& x)
+            : m_(x.m_), l_(x.l_), i_(x.i_) {
+        }
+
+        reference operator*() const {
+            return l_->value(i_);
+        }
+        pointer operator->() const {
+            return &l_->value(i_);
+        }
+        basic_iterator& operator++() {
+            if (++i_ == l_->n) {
+                l_ = l_->next;
+                i_ = 0;
+            }
+            return *this;
+        }
+        basic_iterator operator++(int) {
+            basic_iterator it = *this;
+            ++*this;
+            return it;
+        }
+        basic_iterator& operator--() {
+            if (!l_) {
+                l_ = m_->rightmost_;
+                i_ = l_->n;
+            } else if (i_ == 0) {
+                l_ = l_->prev;
+                i_ = l_->n;
+            }
+            --i_;
+            return *this;
+        }
+        basic_iterator operator--(int) {
+            basic_iterator it = *this;
+            --*this;
+            return it;
+        }
+        bool operator==(const basic_iterator& x) const {
+            return l_ == x.l_ && i_ == x.i_;
+        }
+        bool operator!=(const basic_iterator& x) const {
+            return !(*this == x);
+        }
+
+      private:
+        map_pointer m_ = nullptr;
+        leaf* l_ = nullptr;     // nullptr means end()
+        unsigned i_ = 0;
+        friend class btree_map;
+        template <bool> friend class basic_iterator;
+    };
+
+  private:
+    // Elements are stored as `std::pair<K, V>`, so that shifting them
+    // within a node can move keys, and are handed out as
+    // `std::pair<const K, V>`, which has the same layout.
+    using mutable_value = std::pair<K, V>;
+    template <typename T>
+    union alignas(T) raw {
+        T x;
+        raw() {
+        }
+        ~raw() {
+        }
+    };
+
+    struct node {
+        unsigned n = 0;         // number of elements (leaf) or keys (inner)
+    };
+
+    static constexpr size_t leaf_header = sizeof(node) + 2 * sizeof(void*);
+    static constexpr unsigned leaf_max =
+        std::max<size_t>(3, (NodeBytes - leaf_header) / sizeof(mutable_value));
+
+    struct alignas(64) leaf : node {
+        leaf* prev = nullptr;
+        leaf* next = nullptr;
+        raw<mutable_value> slots[leaf_max];
+
+        mutable_value& slot(unsigned i) {
+            return slots[i].x;
+        }
+        value_type& value(unsigned i) {
+            return *std::launder(reinterpret_cast<value_type*>(&slots[i].x));
+        }
+        const K& key(unsigned i) const {
+            return slots[i].x.first;
+        }
+    };
+
+    static constexpr unsigned inner_max =
+        std::max<size_t>(3, (NodeBytes - sizeof(node) - sizeof(void*))
+                            / (sizeof(K) + sizeof(void*)));
+
+    // `children[i]` holds keys in `[keys[i-1], keys[i])`.
+    struct alignas(64) inner : node {
+        raw<K> keys[inner_max];
+        node* children[inner_max + 1];
+
+        K& key(unsigned i) {
+            return keys[i].x;
+        }
+    };
+
+    // Nodes other than the root keep at least this many elements/keys.
+    static constexpr unsigned leaf_min = leaf_max / 2;
+    static constexpr unsigned inner_min = (inner_max - 1) / 2;
+    // Enough levels for any tree that fits in memory.
+    static constexpr int max_height = 64;
+
+    node* root_ = nullptr;
+    leaf* leftmost_ = nullptr;
+    leaf* rightmost_ = nullptr;
+    int height_ = 0;            // leaves are at level `height_ - 1`
+    size_t size_ = 0;
+    size_t nleaves_ = 0;
+    size_t ninners_ = 0;
+    Compare comp_;
+
+
+    // Move-construct `*dst` from `*src`, then destroy `*src`.
+    template <typename T>
+    static void relocate(T* dst, T* src) {
+        new (dst) T(std::move(*src));
+        src->~T();
+    }
+
+    // Return the index of the first key in `keys[0, n)` not less than
+    // (or, if `upper`, greater than) `key`.
+    template <typename F>
+    unsigned search(unsigned n, F key_at, const K& key, bool upper) const {
+        unsigned lo = 0, hi = n;
+        while (lo < hi) {
+            unsigned mid = (lo + hi) / 2;
+            if (upper ? !comp_(key, key_at(mid)) : comp_(key_at(mid), key)) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+    unsigned child_index(inner* in, const K& key) const {
+        return search(in->n, [&] (unsigned i) -> const K& {
+            return in->key(i);
+        }, key, true);
+    }
+    unsigned leaf_index(leaf* l, const K& key, bool upper) const {
+        return search(l->n, [&] (unsigned i) -> const K& {
+            return l->key(i);
+        }, key, upper);
+    }
+
+    std::pair<leaf*, unsigned> bound(const K& key, bool upper) const {
+        if (!root_) {
+            return {nullptr, 0};
+        }
+        node* x = root_;
+        for (int level = 0; level != height_ - 1; ++level) {
+            inner* in = static_cast<inner*>(x);
+            x = in->children[child_index(in, key)];
+        }
+        leaf* l = static_cast<leaf*>(x);
+        unsigned i = leaf_index(l, key, upper);
+        if (i == l->n) {
+            return {l->next, 0};
+        }
+        return {l, i};
+    }
+
+    bool full(node* x, int level) const {
+        return x->n == (level == height_ - 1 ? leaf_max : inner_max);
+    }
+
+    // split_child(p, i, level)
+    //    Split `p`'s full child `i`, which is at `level`, into two halves,
+    //    adding the new right half as child `i + 1`.
+    void split_child(inner* p, unsigned i, int level);
+
+    static void insert_child(inner* p, unsigned i, K&& key, node* child) {
+        for (unsigned j = p->n; j > i; --j) {
+            relocate(&p->key(j), &p->key(j - 1));
+            p->children[j + 1] = p->children[j];
+        }
+        new (&p->key(i)) K(std::move(key));
+        p->children[i + 1] = child;
+        ++p->n;
+    }
+    // remove key `i` and child `i + 1` from `p`
+    static void remove_child(inner* p, unsigned i) {
+        p->key(i).~K();
+        for (unsigned j = i; j + 1 < p->n; ++j) {
+            relocate(&p->key(j), &p->key(j + 1));
+            p->children[j + 1] = p->children[j + 2];
+        }
+        --p->n;
+    }
+
+    void rebalance_leaf(inner* p, unsigned i);
+    void rebalance_inner(inner* p, unsigned i);
+
+    void destroy(node* x, int level) {
+        if (level == height_) {
+            leaf* l = static_cast<leaf*>(x);
+            for (unsigned i = 0; i != l->n; ++i) {
+                l->slot(i).~mutable_value();
+            }
+            delete l;
+        } else {
+            inner* in = static_cast<inner*>(x);
+            for (unsigned i = 0; i != in->n; ++i) {
+                in->key(i).~K();
+            }
+            for (unsigned i = 0; i <= in->n; ++i) {
+                destroy(in->children[i], level + 1);
+            }
+            delete in;
+        }
+    }
+};
+
+
+template <typename K, typename V, typename C, size_t B>
+template <typename KK, typename... Args>
+auto btree_map<K, V, C, B>::emplace(KK&& key, Args&&... args)
+    -> std::pair<iterator, bool> {
+    if (!root_) {
+        leaf* l = new leaf;
+        ++nleaves_;
+        root_ = leftmost_ = rightmost_ = l;
+        height_ = 1;
+    }
+    if (full(root_, 0)) {
+        inner* r = new inner;
+        ++ninners_;
+        r->children[0] = root_;
+        root_ = r;
+        ++height_;
+        split_child(r, 0, 1);
+    }
+
+    // descend, splitting full nodes so there is room for the new element
+    // and any separators it causes
+    node* x = root_;
+    for (int level = 0; level != height_ - 1; ++level) {
+        inner* in = static_cast<inner*>(x);
+        unsigned i = child_index(in, key);
+        if (full(in->children[i], level + 1)) {
+            split_child(in, i, level + 1);
+            if (!comp_(key, in->key(i))) {
+                ++i;
+            }
+        }
+        x = in->children[i];
+    }
+
+    leaf* l = static_cast<leaf*>(x);
+    unsigned i = leaf_index(l, key, false);
+    if (i != l->n && !comp_(key, l->key(i))) {
+        return {iterator(this, l, i), false};
+    }
+    for (unsigned j = l->n; j > i; --j) {
+        relocate(&l->slot(j), &l->slot(j - 1));
+    }
+    new (&l->slot(i)) mutable_value(std::piecewise_construct,
+        std::forward_as_tuple(std::forward<KK>(key)),
+        std::forward_as_tuple(std::forward<Args>(args)...));
+    ++l->n;
+    ++size_;
+    return {iterator(this, l, i), true};
+}
+
+template <typename K, typename V, typename C, size_t B>
+void btree_map<K, V, C, B>::split_child(inner* p, unsigned i, int level) {
+    if (level == height_ - 1) {
+        leaf* l = static_cast<leaf*>(p->children[i]);
+        leaf* r = new leaf;
+        ++nleaves_;
+        unsigned mid = l->n / 2;
+        for (unsigned j = mid; j != l->n; ++j) {
+            relocate(&r->slot(j - mid), &l->slot(j));
+        }
+        r->n = l->n - mid;
+        l->n = mid;
+        r->prev = l;
+        r->next = l->next;
+        if (l->next) {
+            l->next->prev = r;
+        } else {
+            rightmost_ = r;
+        }
+        l->next = r;
+        insert_child(p, i, K(r->key(0)), r);
+    } else {
+        inner* l = static_cast<inner*>(p->children[i]);
+        inner* r = new inner;
+        ++ninners_;
+        unsigned mid = l->n / 2;
+        for (unsigned j = mid + 1; j != l->n; ++j) {
+            relocate(&r->key(j - mid - 1), &l->key(j));
+        }
+        for (unsigned j = mid + 1; j <= l->n; ++j) {
+            r->children[j - mid - 1] = l->children[j];
+        }
+        r->n = l->n - mid - 1;
+        l->n = mid;
+        K sep(std::move(l->key(mid)));
+        l->key(mid).~K();
+        insert_child(p, i, std::move(sep), r);
+    }
+}
+
+template <typename K, typename V, typename C, size_t B>
+size_t btree_map<K, V, C, B>::erase(const K& key) {
+    if (!root_) {
+        return 0;
+    }
+    inner* path[max_height];
+    unsigned index[max_height];
+    node* x = root_;
+    for (int level = 0; level != height_ - 1; ++level) {
+        inner* in = static_cast<inner*>(x);
+        path[level] = in;
+        index[level] = child_index(in, key);
+        x = in->children[index[level]];
+    }
+
+    leaf* l = static_cast<leaf*>(x);
+    unsigned i = leaf_index(l, key, false);
+    if (i == l->n || comp_(key, l->key(i))) {
+        return 0;
+    }
+    l->slot(i).~mutable_value();
+    for (unsigned j = i; j + 1 < l->n; ++j) {
+        relocate(&l->slot(j), &l->slot(j + 1));
+    }
+    --l->n;
+    --size_;
+
+    // restore minimum occupancy from the bottom up
+    int level = height_ - 1;
+    if (level > 0 && l->n < leaf_min) {
+        rebalance_leaf(path[level - 1], index[level - 1]);
+        for (--level; level > 0 && path[level]->n < inner_min; --level) {
+            rebalance_inner(path[level - 1], index[level - 1]);
+        }
+    }
+
+    // shrink the root
+    if (height_ > 1 && root_->n == 0) {
+        inner* r = static_cast<inner*>(root_);
+        root_ = r->children[0];
+        delete r;
+        --ninners_;
+        --height_;
+    } else if (height_ == 1 && root_->n == 0) {
+        delete static_cast<leaf*>(root_);
+        --nleaves_;
+        root_ = leftmost_ = rightmost_ = nullptr;
+        height_ = 0;
+    }
+    return 1;
+}
+
+// rebalance_leaf(p, i)
+//    `p`'s child `i`, a leaf, is below `leaf_min`. Borrow an element from a
+//    sibling, or merge with one (removing a key from `p`).
+template <typename K, typename V, typename C, size_t B>
+void btree_map<K, V, C, B>::rebalance_leaf(inner* p, unsigned i) {
+    leaf* c = static_cast<leaf*>(p->children[i]);
+    leaf* left = i > 0 ? static_cast<leaf*>(p->children[i - 1]) : nullptr;
+    leaf* right = i < p->n ? static_cast<leaf*>(p->children[i + 1]) : nullptr;
+
+    if (left && left->n > leaf_min) {
+        for (unsigned j = c->n; j > 0; --j) {
+            relocate(&c->slot(j), &c->slot(j - 1));
+        }
+        relocate(&c->slot(0), &left->slot(left->n - 1));
+        --left->n;
+        ++c->n;
+        p->key(i - 1) = c->key(0);
+    } else if (right && right->n > leaf_min) {
+        relocate(&c->slot(c->n), &right->slot(0));
+        for (unsigned j = 0; j + 1 < right->n; ++j) {
+            relocate(&right->slot(j), &right->slot(j + 1));
+        }
+        --right->n;
+        ++c->n;
+        p->key(i) = right->key(0);
+    } else {
+        // merge `c` into `left`, or `right` into `c`
+        if (!left) {
+            left = c;
+            c = right;
+            ++i;
+        }
+        for (unsigned j = 0; j != c->n; ++j) {
+            relocate(&left->slot(left->n + j), &c->slot(j));
+        }
+        left->n += c->n;
+        left->next = c->next;
+        if (c->next) {
+            c->next->prev = left;
+        } else {
+            rightmost_ = left;
+        }
+        delete c;
+        --nleaves_;
+        remove_child(p, i - 1);
+    }
+}
+
+// rebalance_inner(p, i)
+//    `p`'s child `i`, an inner node, is below `inner_min`. Rotate a key
+//    through `p` from a sibling, or merge with one.
+template <typename K, typename V, typename C, size_t B>
+void btree_map<K, V, C, B>::rebalance_inner(inner* p, unsigned i) {
+    inner* c = static_cast<inner*>(p->children[i]);
+    inner* left = i > 0 ? static_cast<inner*>(p->children[i - 1]) : nullptr;
+    inner* right = i < p->n ? static_cast<inner*>(p->children[i + 1]) : nullptr;
+
+    if (left && left->n > inner_min) {
+        c->children[c->n + 1] = c->children[c->n];
+        for (unsigned j = c->n; j > 0; --j) {
+            relocate(&c->key(j), &c->key(j - 1));
+            c->children[j] = c->children[j - 1];
+        }
+        relocate(&c->key(0), &p->key(i - 1));
+        c->children[0] = left->children[left->n];
+        relocate(&p->key(i - 1), &left->key(left->n - 1));
+        --left->n;
+        ++c->n;
+    } else if (right && right->n > inner_min) {
+        relocate(&c->key(c->n), &p->key(i));
+        c->children[c->n + 1] = right->children[0];
+        relocate(&p->key(i), &right->key(0));
+        for (unsigned j = 0; j + 1 < right->n; ++j) {
+            relocate(&right->key(j), &right->key(j + 1));
+        }
+        for (unsigned j = 0; j != right->n; ++j) {
+            right->children[j] = right->children[j + 1];
+        }
+        --right->n;
+        ++c->n;
+    } else {
+        if (!left) {
+            left = c;
+            c = right;
+            ++i;
+        }
+        // pull the separating key down, then append `c`
+        relocate(&left->key(left->n), &p->key(i - 1));
+        for (unsigned j = i - 1; j + 1 < p->n; ++j) {
+            relocate(&p->key(j), &p->key(j + 1));
+            p->children[j + 1] = p->children[j + 2];
+        }
+        --p->n;
+        for (unsigned j = 0; j != c->n; ++j) {
+            relocate(&left->key(left->n + 1 + j), &c->key(j));
+        }
+        for (unsigned j = 0; j <= c->n; ++j) {
+            left->children[left->n + 1 + j] = c->children[j];
+        }
+        left->n += c->n + 1;
+        delete c;
+        --ninners_;
+    }
+}
+
+#endif
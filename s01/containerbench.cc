@@ -0,0 +1,560 @@
+#include "arena_allocator.hh"
+#include "btree_map.hh"
+#include "flat_hash_map.hh"
+#include "benchtime.hh"
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <list>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// containerbench [-n KEYS] [-o OPS] [-m I,F,E,S] [-d DIST] [-z SKEW]
+//                [-r SCANLEN] [-T SECONDS] [-c NAME,...]
+//    Run one workload over every container the s01 demos and benchmarks
+//    use, and rank the containers by throughput. Each container holds
+//    64-bit keys with 64-bit values, starts with KEYS (default 100000)
+//    keys, and then runs OPS (default 4*KEYS) operations mixed in the
+//    proportions I:F:E:S (default 25,50,15,10) of inserts, finds, erases,
+//    and scans of up to SCANLEN (default 16) elements starting at a key.
+//    Operation keys are drawn from 2*KEYS possible keys, so about half of
+//    them are present at the start, with distribution DIST: `uniform`
+//    (the default), `zipf` (rank popularity with exponent SKEW, default
+//    0.99), or `seq` (ascending keys, wrapping around).
+//
+//    Each container runs in its own child process, so its peak RSS
+//    (`getrusage`) covers only that container plus the shared workload.
+//    The ranking shows millions of operations per second, nanoseconds
+//    per operation, nanoseconds per key to build the starting contents,
+//    peak RSS, and peak RSS growth over the workload alone. A container
+//    that exceeds SECONDS (default 10) of operations stops early and is
+//    ranked by the operations it finished; one that takes more than
+//    SECONDS just to build its starting contents runs no operations and
+//    is ranked last. -c runs only the named containers. Containers that
+//    finish must agree on their final size and on which finds succeeded.
+//
+//    Only ordered containers scan a key range. Hash tables and lists scan
+//    from `key` in iteration order instead, which is far cheaper and not
+//    comparable, so when the mix has scans they are ranked separately,
+//    after the ordered containers.
+
+
+enum op_type : uint8_t {
+    op_insert, op_find, op_erase, op_scan
+};
+
+struct op {
+    op_type type;
+    uint64_t key;
+};
+
+struct workload {
+    std::vector<uint64_t> fill;     // starting keys, in insertion order
+    std::vector<op> ops;
+    size_t scanlen;
+    double seconds;                 // time limit for `ops`
+};
+
+// Adapters give each container the same four operations. `scan` adds
+// the values of up to `len` elements starting at `key` (for unordered
+// containers, at `key`'s position in iteration order, or at the
+// beginning if `key` is absent) and returns the sum.
+
+template <typename M>
+struct ordered_adapter {
+    M m;
+    void insert(uint64_t k) {
+        m.insert({k, k});
+    }
+    bool find(uint64_t k) const {
+        return m.find(k) != m.end();
+    }
+    void erase(uint64_t k) {
+        m.erase(k);
+    }
+    uint64_t scan(uint64_t k, size_t len) const {
+        uint64_t sum = 0;
+        auto it = m.lower_bound(k);
+        for (size_t i = 0; i != len && it != m.end(); ++i, ++it) {
+            sum += it->second;
+        }
+        return sum;
+    }
+    size_t size() const {
+        return m.size();
+    }
+};
+
+template <typename M>
+struct unordered_adapter {
+    M m;
+    void insert(uint64_t k) {
+        m.insert({k, k});
+    }
+    bool find(uint64_t k) const {
+        return m.find(k) != m.end();
+    }
+    void erase(uint64_t k) {
+        m.erase(k);
+    }
+    uint64_t scan(uint64_t k, size_t len) const {
+        uint64_t sum = 0;
+        auto it = m.find(k);
+        if (it == m.end()) {
+            it = m.begin();
+        }
+        for (size_t i = 0; i != len && it != m.end(); ++i, ++it) {
+            sum += it->second;
+        }
+        return sum;
+    }
+    size_t size() const {
+        return m.size();
+    }
+};
+
+// sorted_vector_adapter: pairs kept sorted by key, as in vector1
+struct sorted_vector_adapter {
+    using value_type = std::pair<uint64_t, uint64_t>;
+    std::vector<value_type> v;
+
+    std::vector<value_type>::const_iterator lower_bound(uint64_t k) const {
+        return std::lower_bound(v.begin(), v.end(), k,
+            [] (const value_type& x, uint64_t key) { return x.first < key; });
+    }
+    void insert(uint64_t k) {
+        auto it = lower_bound(k);
+        if (it == v.end() || it->first != k) {
+            v.insert(it, {k, k});
+        }
+    }
+    bool find(uint64_t k) const {
+        auto it = lower_bound(k);
+        return it != v.end() && it->first == k;
+    }
+    void erase(uint64_t k) {
+        auto it = lower_bound(k);
+        if (it != v.end() && it->first == k) {
+            v.erase(it);
+        }
+    }
+    uint64_t scan(uint64_t k, size_t len) const {
+        uint64_t sum = 0;
+        for (auto it = lower_bound(k); len != 0 && it != v.end(); --len, ++it) {
+            sum += it->second;
+        }
+        return sum;
+    }
+    size_t size() const {
+        return v.size();
+    }
+};
+
+// list_adapter<L>: unsorted list with linear search, as in list1
+template <typename L>
+struct list_adapter {
+    L l;
+
+    template <typename... Args>
+    list_adapter(Args&&... args)
+        : l(std::forward<Args>(args)...) {
+    }
+    typename L::const_iterator find_it(uint64_t k) const {
+        return std::find_if(l.begin(), l.end(),
+            [&] (const auto& x) { return x.first == k; });
+    }
+    void insert(uint64_t k) {
+        if (find_it(k) == l.end()) {
+            l.push_back({k, k});
+        }
+    }
+    bool find(uint64_t k) const {
+        return find_it(k) != l.end();
+    }
+    void erase(uint64_t k) {
+        auto it = find_it(k);
+        if (it != l.end()) {
+            l.erase(it);
+        }
+    }
+    uint64_t scan(uint64_t k, size_t len) const {
+        uint64_t sum = 0;
+        auto it = find_it(k);
+        if (it == l.end()) {
+            it = l.begin();
+        }
+        for (; len != 0 && it != l.end(); --len, ++it) {
+            sum += it->second;
+        }
+        return sum;
+    }
+    size_t size() const {
+        return l.size();
+    }
+};
+
+using kv_list = std::list<std::pair<uint64_t, uint64_t>>;
+using arena_kv_list = std::list<std::pair<uint64_t, uint64_t>,
+    arena_allocator<std::pair<uint64_t, uint64_t>>>;
+
+
+static volatile uint64_t sink;
+
+struct result {
+    double fill_seconds;
+    size_t fill_done;               // starting keys inserted
+    bool fill_timed_out;
+    double op_seconds;
+    size_t ops_done;
+    bool timed_out;
+    size_t final_size;
+    uint64_t checksum;
+    long rss0_kib;                  // before building the container
+    long rss_kib;                   // peak
+};
+
+static long peak_rss_kib() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+// run(c, w)
+//    Fill the empty container adapter `c` and run `w`'s operations on it.
+//    The build and the operations are each limited to `w.seconds`.
+template <typename C>
+static result run(C& c, const workload& w) {
+    result r;
+    r.rss0_kib = peak_rss_kib();
+
+    // check the clock every `check` inserts or operations
+    constexpr size_t check = 1024;
+    uint64_t limit = w.seconds * tsc_hz();
+    size_t i = 0;
+    r.fill_timed_out = false;
+    uint64_t t0 = rdtsc();
+    uint64_t t1 = t0;
+    while (i != w.fill.size()) {
+        size_t stop = std::min(i + check, w.fill.size());
+        for (; i != stop; ++i) {
+            c.insert(w.fill[i]);
+        }
+        t1 = rdtscp();
+        if (t1 - t0 > limit && i != w.fill.size()) {
+            r.fill_timed_out = true;
+            break;
+        }
+    }
+    r.fill_seconds = tsc_seconds(t1 - t0);
+    r.fill_done = i;
+
+    uint64_t checksum = 0, scansum = 0;
+    i = 0;
+    r.timed_out = r.fill_timed_out;
+    t0 = t1 = rdtsc();
+    while (i != w.ops.size() && !r.fill_timed_out) {
+        size_t stop = std::min(i + check, w.ops.size());
+        for (; i != stop; ++i) {
+            const op& o = w.ops[i];
+            switch (o.type) {
+            case op_insert:
+                c.insert(o.key);
+                break;
+            case op_find:
+                checksum = checksum * 3 + c.find(o.key);
+                break;
+            case op_erase:
+                c.erase(o.key);
+                break;
+            case op_scan:
+                // unordered containers disagree on iteration order
+                scansum += c.scan(o.key, w.scanlen);
+                break;
+            }
+        }
+        t1 = rdtscp();
+        if (t1 - t0 > limit && i != w.ops.size()) {
+            r.timed_out = true;
+            break;
+        }
+    }
+    r.op_seconds = tsc_seconds(t1 - t0);
+    r.ops_done = i;
+    r.final_size = c.size();
+    r.checksum = checksum;
+    sink = scansum;
+    r.rss_kib = peak_rss_kib();
+    return r;
+}
+
+// run_child(w, f)
+//    Run `f(w)`, which returns a `result`, in a child process, and return
+//    its result. Returns false if the child failed.
+template <typename F>
+static bool run_child(const workload& w, F f, result& r) {
+    int pfd[2];
+    if (pipe(pfd) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    fflush(stdout);
+    pid_t p = fork();
+    if (p < 0) {
+        perror("fork");
+        exit(1);
+    } else if (p == 0) {
+        close(pfd[0]);
+        result cr = f(w);
+        ssize_t nw = write(pfd[1], &cr, sizeof(cr));
+        _exit(nw == (ssize_t) sizeof(cr) ? 0 : 1);
+    }
+    close(pfd[1]);
+    ssize_t nr;
+    while ((nr = read(pfd[0], &r, sizeof(r))) == -1 && errno == EINTR) {
+    }
+    close(pfd[0]);
+    int status;
+    waitpid(p, &status, 0);
+    return nr == (ssize_t) sizeof(r)
+        && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+struct contender {
+    const char* name;
+    bool range_scan;                // `scan` follows key order
+    result (*run)(const workload&);
+};
+
+static const contender contenders[] = {
+    {"sorted_vector", true, [] (const workload& w) {
+        sorted_vector_adapter c;
+        return run(c, w);
+    }},
+    {"std::list", false, [] (const workload& w) {
+        list_adapter<kv_list> c;
+        return run(c, w);
+    }},
+    {"arena_list", false, [] (const workload& w) {
+        arena a;
+        list_adapter<arena_kv_list> c{arena_kv_list::allocator_type(a)};
+        return run(c, w);
+    }},
+    {"std::map", true, [] (const workload& w) {
+        ordered_adapter<std::map<uint64_t, uint64_t>> c;
+        return run(c, w);
+    }},
+    {"btree_map", true, [] (const workload& w) {
+        ordered_adapter<btree_map<uint64_t, uint64_t>> c;
+        return run(c, w);
+    }},
+    {"std::unordered_map", false, [] (const workload& w) {
+        unordered_adapter<std::unordered_map<uint64_t, uint64_t>> c;
+        return run(c, w);
+    }},
+    {"flat_hash_map", false, [] (const workload& w) {
+        unordered_adapter<flat_hash_map<uint64_t, uint64_t>> c;
+        return run(c, w);
+    }},
+};
+
+
+// key_of(rank, dist)
+//    Return the key with popularity rank `rank`. Except for `seq`, keys
+//    are scattered so that popular keys are not neighbors.
+static uint64_t key_of(size_t rank, const std::string& dist) {
+    if (dist == "seq") {
+        return rank;
+    }
+    return rank * 0x9E3779B97F4A7C15ULL;
+}
+
+static workload make_workload(size_t nkeys, size_t nops, const int mix[4],
+                              const std::string& dist, double skew) {
+    workload w;
+    std::mt19937_64 rng(61);
+    size_t universe = 2 * nkeys;
+
+    // start with the `nkeys` most popular keys, in random order
+    // (ascending for `seq`)
+    w.fill.resize(nkeys);
+    for (size_t i = 0; i != nkeys; ++i) {
+        w.fill[i] = key_of(i, dist);
+    }
+    if (dist != "seq") {
+        std::shuffle(w.fill.begin(), w.fill.end(), rng);
+    }
+
+    // zipf: rank r has weight 1/(r+1)^skew; sample by inverting the CDF
+    std::vector<double> cdf;
+    if (dist == "zipf") {
+        cdf.resize(universe);
+        double sum = 0;
+        for (size_t r = 0; r != universe; ++r) {
+            sum += pow(r + 1, -skew);
+            cdf[r] = sum;
+        }
+        for (double& x : cdf) {
+            x /= sum;
+        }
+    }
+
+    std::discrete_distribution<int> pick_op(mix, mix + 4);
+    std::uniform_int_distribution<size_t> pick_rank(0, universe - 1);
+    std::uniform_real_distribution<double> unit(0, 1);
+    w.ops.resize(nops);
+    for (size_t i = 0; i != nops; ++i) {
+        size_t rank;
+        if (dist == "zipf") {
+            rank = std::lower_bound(cdf.begin(), cdf.end(), unit(rng))
+                - cdf.begin();
+            rank = std::min(rank, universe - 1);
+        } else if (dist == "seq") {
+            rank = (nkeys + i) % universe;
+        } else {
+            rank = pick_rank(rng);
+        }
+        w.ops[i] = {op_type(pick_op(rng)), key_of(rank, dist)};
+    }
+    return w;
+}
+
+
+static void usage() {
+    fprintf(stderr, "Usage: containerbench [-n KEYS] [-o OPS] [-m I,F,E,S] [-d uniform|zipf|seq]\n"
+            "                      [-z SKEW] [-r SCANLEN] [-T SECONDS] [-c NAME,...]\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    size_t nkeys = 100000;
+    size_t nops = 0;
+    int mix[4] = {25, 50, 15, 10};
+    std::string dist = "uniform";
+    double skew = 0.99;
+    size_t scanlen = 16;
+    double seconds = 10;
+    std::string only;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:o:m:d:z:r:T:c:")) != -1) {
+        if (opt == 'n') {
+            nkeys = strtoul(optarg, nullptr, 0);
+        } else if (opt == 'o') {
+            nops = strtoul(optarg, nullptr, 0);
+        } else if (opt == 'm') {
+            if (sscanf(optarg, "%d,%d,%d,%d",
+                       &mix[0], &mix[1], &mix[2], &mix[3]) != 4
+                || std::min({mix[0], mix[1], mix[2], mix[3]}) < 0
+                || mix[0] + mix[1] + mix[2] + mix[3] <= 0) {
+                usage();
+            }
+        } else if (opt == 'd') {
+            dist = optarg;
+        } else if (opt == 'z') {
+            skew = strtod(optarg, nullptr);
+        } else if (opt == 'r') {
+            scanlen = strtoul(optarg, nullptr, 0);
+        } else if (opt == 'T') {
+            seconds = strtod(optarg, nullptr);
+        } else if (opt == 'c') {
+            only = std::string(",") + optarg + ",";
+        } else {
+            usage();
+        }
+    }
+    if (nkeys == 0 || seconds <= 0
+        || (dist != "uniform" && dist != "zipf" && dist != "seq")) {
+        usage();
+    }
+    if (nops == 0) {
+        nops = 4 * nkeys;
+    }
+
+    workload w = make_workload(nkeys, nops, mix, dist, skew);
+    w.scanlen = scanlen;
+    w.seconds = seconds;
+    tsc_hz();                       // calibrate once, before forking
+
+    printf("%zu keys, %zu ops, mix insert:find:erase:scan %d:%d:%d:%d, "
+           "%s keys", nkeys, nops, mix[0], mix[1], mix[2], mix[3],
+           dist.c_str());
+    if (dist == "zipf") {
+        printf(" (skew %g)", skew);
+    }
+    printf(", scans of %zu\n", scanlen);
+
+    struct entry {
+        const char* name;
+        bool separate;              // ranked after the range scanners
+        result r;
+        double mops;
+    };
+    std::vector<entry> entries;
+    for (const contender& c : contenders) {
+        if (!only.empty()
+            && only.find(std::string(",") + c.name + ",") == std::string::npos) {
+            continue;
+        }
+        result r;
+        if (!run_child(w, c.run, r)) {
+            fprintf(stderr, "containerbench: %s failed\n", c.name);
+            continue;
+        }
+        double mops = r.fill_timed_out ? 0 : r.ops_done / r.op_seconds / 1e6;
+        entries.push_back({c.name, mix[3] > 0 && !c.range_scan, r, mops});
+    }
+    if (entries.empty()) {
+        fprintf(stderr, "containerbench: no containers ran\n");
+        exit(1);
+    }
+    std::stable_sort(entries.begin(), entries.end(),
+        [] (const entry& a, const entry& b) {
+            if (a.separate != b.separate) {
+                return b.separate;
+            }
+            return a.mops > b.mops;
+        });
+
+    const result* ref = nullptr;
+    bool mismatch = false;
+    for (size_t i = 0, rank = 1; i != entries.size(); ++i, ++rank) {
+        const entry& e = entries[i];
+        if (i == 0 || e.separate != entries[i - 1].separate) {
+            if (e.separate) {
+                printf("-- ranked separately: scans follow iteration order, "
+                       "not key ranges\n");
+                rank = 1;
+            }
+            printf("%4s %-18s %9s %9s %9s %10s %10s\n", "rank", "container",
+                   "Mops/s", "ns/op", "fill/key", "peakRSS-K", "+RSS-K");
+        }
+        printf("%4zu %-18s %9.3f %9.1f %9.1f %10ld %10ld", rank, e.name,
+               e.mops, e.r.op_seconds * 1e9 / std::max<size_t>(e.r.ops_done, 1),
+               e.r.fill_seconds * 1e9 / std::max<size_t>(e.r.fill_done, 1),
+               e.r.rss_kib, e.r.rss_kib - e.r.rss0_kib);
+        if (e.r.fill_timed_out) {
+            printf("  (build stopped after %zu of %zu keys)",
+                   e.r.fill_done, nkeys);
+        } else if (e.r.timed_out) {
+            printf("  (stopped after %zu ops)", e.r.ops_done);
+        } else if (!ref) {
+            ref = &e.r;
+        } else if (e.r.final_size != ref->final_size
+                   || e.r.checksum != ref->checksum) {
+            printf("  MISMATCH (size %zu, checksum %" PRIu64 ")",
+                   e.r.final_size, e.r.checksum);
+            mismatch = true;
+        }
+        printf("\n");
+    }
+    return mismatch ? 1 : 0;
+}
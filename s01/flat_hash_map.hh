@@ -0,0 +1,484 @@
+#ifndef CS61_FLAT_HASH_MAP_HH
+#define CS61_FLAT_HASH_MAP_HH
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+// flat_hash_map<K, V>
+//    An open-addressing hash map in the style of Abseil's Swiss tables.
+//    Elements live in one contiguous slot array, next to an array of
+//    one-byte control words: `ctrl_empty`, `ctrl_deleted`, or, for a
+//    full slot, the low 7 bits of its key's hash. A lookup probes 16
+//    control bytes at a time (with one SSE2 compare where available),
+//    and compares keys only in slots whose control byte matches.
+//
+//    The interface is the part of `std::unordered_map` that the uomap
+//    demos use: `insert`, `operator[]`, `find`, `count`, `erase`,
+//    `size`, `empty`, `clear`, `reserve`, and iteration. Unlike
+//    `std::unordered_map`, inserting may move elements, so any insertion
+//    invalidates iterators and references.
+//
+//    If `Hash` and `Eq` both define `is_transparent`, `find`, `count`,
+//    `erase`, and `emplace` accept any key type they can hash and compare,
+//    without converting to `K` first. For string keys, `string_hash`
+//    with `std::equal_to<>` lets `m.find("one")` skip building a
+//    temporary `std::string`.
+
+// string_hash
+//    Transparent hash for `std::string` keys: hashes anything convertible
+//    to `std::string_view`, with the same result as `std::hash<std::string>`.
+struct string_hash {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const {
+        return std::hash<std::string_view>()(s);
+    }
+};
+
+template <typename T, typename = void>
+struct has_is_transparent : std::false_type {
+};
+template <typename T>
+struct has_is_transparent<T, std::void_t<typename T::is_transparent>>
+    : std::true_type {
+};
+
+// flat_hash_key_arg<transparent>::type<KK, K>
+//    `KK` if `transparent`, else `K`. The transparent case must be a
+//    plain alias for `KK`, so that `KK` can be deduced from an argument.
+template <bool transparent>
+struct flat_hash_key_arg {
+    template <typename KK, typename K>
+    using type = K;
+};
+template <>
+struct flat_hash_key_arg<true> {
+    template <typename KK, typename K>
+    using type = KK;
+};
+
+template <typename K, typename V, typename Hash = std::hash<K>,
+          typename Eq = std::equal_to<K>>
+class flat_hash_map {
+  public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<const K, V>;
+    using size_type = size_t;
+
+    static constexpr bool transparent = has_is_transparent<Hash>::value
+        && has_is_transparent<Eq>::value;
+    // `key_arg<KK>` is `KK` for transparent maps and `K` otherwise, so
+    // non-transparent lookups convert their argument to `K` as usual.
+    template <typename KK>
+    using key_arg = typename flat_hash_key_arg<transparent>::template type<KK, K>;
+
+    template <bool Const> class basic_iterator;
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    flat_hash_map() = default;
+    flat_hash_map(const flat_hash_map& x) {
+        reserve(x.size());
+        for (auto& kv : x) {
+            insert(kv);
+        }
+    }
+    flat_hash_map(flat_hash_map&& x) noexcept {
+        swap(x);
+    }
+    ~flat_hash_map() {
+        destroy();
+    }
+    flat_hash_map& operator=(flat_hash_map x) noexcept {
+        swap(x);
+        return *this;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+    bool empty() const {
+        return size_ == 0;
+    }
+    // Return the number of slots (a power of 2, or 0).
+    size_t capacity() const {
+        return capacity_;
+    }
+    // Return the bytes allocated for slots and control words. Memory
+    // owned by the elements themselves (e.g., long strings) is not
+    // included.
+    size_t table_bytes() const {
+        return capacity_ ? capacity_ * (sizeof(slot) + 1) + group_width : 0;
+    }
+
+    iterator begin() {
+        return iterator(this, next_full(0));
+    }
+    iterator end() {
+        return iterator(this, capacity_);
+    }
+    const_iterator begin() const {
+        return const_iterator(this, next_full(0));
+    }
+    const_iterator end() const {
+        return const_iterator(this, capacity_);
+    }
+
+    template <typename KK = K>
+    iterator find(const key_arg<KK>& key) {
+        return iterator(this, find_index(key));
+    }
+    template <typename KK = K>
+    const_iterator find(const key_arg<KK>& key) const {
+        return const_iterator(this, find_index(key));
+    }
+    template <typename KK = K>
+    size_t count(const key_arg<KK>& key) const {
+        return find_index(key) != capacity_;
+    }
+
+    // Insert `kv` unless its key is present. Return an iterator to the
+    // element with that key, and true iff it was inserted.
+    std::pair<iterator, bool> insert(const value_type& kv) {
+        return emplace(kv.first, kv.second);
+    }
+    std::pair<iterator, bool> insert(value_type&& kv) {
+        return emplace(kv.first, std::move(kv.second));
+    }
+    template <typename KK, typename... Args>
+    std::pair<iterator, bool> emplace(KK&& key, Args&&... args) {
+        using lookup_type = key_arg<std::decay_t<KK>>;
+        auto [i, found] = find_or_prepare_insert(
+            static_cast<const lookup_type&>(key));
+        if (!found) {
+            new (&slots_[i].kv) value_type(std::piecewise_construct,
+                std::forward_as_tuple(std::forward<KK>(key)),
+                std::forward_as_tuple(std::forward<Args>(args)...));
+        }
+        return {iterator(this, i), !found};
+    }
+
+    // Return a reference to `key`'s value, inserting a value-initialized
+    // one if `key` is absent.
+    V& operator[](const K& key) {
+        return emplace(key).first->second;
+    }
+
+    // Remove the element with key `key`, if any. Return the number of
+    // elements removed.
+    template <typename KK = K>
+    size_t erase(const key_arg<KK>& key) {
+        size_t i = find_index(key);
+        if (i == capacity_) {
+            return 0;
+        }
+        erase_index(i);
+        return 1;
+    }
+    // Remove the element at `it`; return an iterator to the next one.
+    iterator erase(iterator it) {
+        erase_index(it.i_);
+        return iterator(this, next_full(it.i_ + 1));
+    }
+
+    void clear() {
+        for (size_t i = 0; i != capacity_; ++i) {
+            if (is_full(ctrl_[i])) {
+                slots_[i].kv.~value_type();
+            }
+        }
+        if (capacity_) {
+            memset(ctrl_, ctrl_empty, capacity_ + group_width);
+        }
+        size_ = 0;
+        growth_left_ = max_load(capacity_);
+    }
+
+    // Make room for at least `n` elements without rehashing.
+    void reserve(size_t n) {
+        size_t cap = group_width;
+        while (max_load(cap) < n) {
+            cap *= 2;
+        }
+        if (cap > capacity_) {
+            rehash(cap);
+        }
+    }
+
+    void swap(flat_hash_map& x) noexcept {
+        std::swap(ctrl_, x.ctrl_);
+        std::swap(slots_, x.slots_);
+        std::swap(capacity_, x.capacity_);
+        std::swap(size_, x.size_);
+        std::swap(growth_left_, x.growth_left_);
+        std::swap(hash_, x.hash_);
+        std::swap(eq_, x.eq_);
+    }
+
+
+    template <bool Const>
+    class basic_iterator {
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = flat_hash_map::value_type;
+        using difference_type = ptrdiff_t;
+        using pointer = std::conditional_t<Const, const value_type*,
+                                           value_type*>;
+        using reference = std::conditional_t<Const, const value_type&,
+                                             value_type&>;
+        using map_pointer = std::conditional_t<Const, const flat_hash_map*,
+                                               flat_hash_map*>;
+
+        basic_iterator() = default;
+        basic_iterator(map_pointer m, size_t i)
+            : m_(m), i_(i) {
+        }
+        // iterator converts to const_iterator
+        template <bool C, typename = std::enable_if_t<Const && !C>>
+        basic_iterator(const basic_iterator<C>& x)
+            : m_(x.m_), i_(x.i_) {
+        }
+
+        reference operator*() const {
+            return m_->slots_[i_].kv;
+        }
+        pointer operator->() const {
+            return &m_->slots_[i_].kv;
+        }
+        basic_iterator& operator++() {
+            i_ = m_->next_full(i_ + 1);
+            return *this;
+        }
+        basic_iterator operator++(int) {
+            basic_iterator it = *this;
+            ++*this;
+            return it;
+        }
+        bool operator==(const basic_iterator& x) const {
+            return i_ == x.i_;
+        }
+        bool operator!=(const basic_iterator& x) const {
+            return i_ != x.i_;
+        }
+
+      private:
+        map_pointer m_ = nullptr;
+        size_t i_ = 0;
+        friend class flat_hash_map;
+        template <bool> friend class basic_iterator;
+    };
+
+  private:
+    static constexpr size_t group_width = 16;
+    static constexpr int8_t ctrl_empty = -128;   // 0b10000000
+    static constexpr int8_t ctrl_deleted = -2;   // 0b11111110
+    // full slots hold 0b0xxxxxxx
+
+    union slot {
+        value_type kv;
+        slot() {
+        }
+        ~slot() {
+        }
+    };
+
+    // `ctrl_` has `capacity_ + group_width` bytes; the last `group_width`
+    // mirror the first, so a 16-byte group can be loaded at any index.
+    int8_t* ctrl_ = nullptr;
+    slot* slots_ = nullptr;
+    size_t capacity_ = 0;
+    size_t size_ = 0;
+    size_t growth_left_ = 0;    // insertions into empty slots before rehash
+    Hash hash_;
+    Eq eq_;
+
+
+    static bool is_full(int8_t c) {
+        return c >= 0;
+    }
+    // Keep at least 1/8 of slots empty so every probe terminates.
+    static size_t max_load(size_t cap) {
+        return cap - cap / 8;
+    }
+
+    // Mix the user's hash, since e.g. `std::hash<int>` is the identity.
+    template <typename KK>
+    size_t hash_of(const KK& key) const {
+        uint64_t h = hash_(key);
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    // group_match(g, c)
+    //    Return a bitmask of the positions in the 16-byte group `g` whose
+    //    control byte equals `c`.
+    static unsigned group_match(const int8_t* g, int8_t c) {
+#if defined(__SSE2__)
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8(c)));
+#else
+        unsigned m = 0;
+        for (size_t i = 0; i != group_width; ++i) {
+            m |= unsigned(g[i] == c) << i;
+        }
+        return m;
+#endif
+    }
+    // Return a bitmask of the empty or deleted positions in group `g`.
+    static unsigned group_match_free(const int8_t* g) {
+#if defined(__SSE2__)
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g));
+        return _mm_movemask_epi8(x);
+#else
+        unsigned m = 0;
+        for (size_t i = 0; i != group_width; ++i) {
+            m |= unsigned(g[i] < 0) << i;
+        }
+        return m;
+#endif
+    }
+
+    void set_ctrl(size_t i, int8_t c) {
+        ctrl_[i] = c;
+        if (i < group_width) {
+            ctrl_[capacity_ + i] = c;
+        }
+    }
+
+    size_t next_full(size_t i) const {
+        while (i < capacity_ && !is_full(ctrl_[i])) {
+            ++i;
+        }
+        return i;
+    }
+
+    // find_index(key)
+    //    Return the slot holding `key`, or `capacity_` if there is none.
+    //    Groups are probed at triangular-number offsets, which visit
+    //    every group when the capacity is a power of 2.
+    template <typename KK>
+    size_t find_index(const KK& key) const {
+        if (size_ == 0) {
+            return capacity_;
+        }
+        size_t h = hash_of(key);
+        size_t mask = capacity_ - 1;
+        size_t pos = (h >> 7) & mask;
+        for (size_t step = group_width; ; step += group_width) {
+            unsigned m = group_match(ctrl_ + pos, h & 0x7F);
+            while (m) {
+                size_t i = (pos + __builtin_ctz(m)) & mask;
+                if (eq_(slots_[i].kv.first, key)) {
+                    return i;
+                }
+                m &= m - 1;
+            }
+            if (group_match(ctrl_ + pos, ctrl_empty)) {
+                return capacity_;
+            }
+            pos = (pos + step) & mask;
+        }
+    }
+
+    // find_free(h)
+    //    Return the first empty or deleted slot on hash `h`'s probe
+    //    sequence.
+    size_t find_free(size_t h) const {
+        size_t mask = capacity_ - 1;
+        size_t pos = (h >> 7) & mask;
+        for (size_t step = group_width; ; step += group_width) {
+            if (unsigned m = group_match_free(ctrl_ + pos)) {
+                return (pos + __builtin_ctz(m)) & mask;
+            }
+            pos = (pos + step) & mask;
+        }
+    }
+
+    // find_or_prepare_insert(key)
+    //    Return {slot, true} if `key` is present. Otherwise claim a free
+    //    slot for it, growing the table if necessary, and return
+    //    {slot, false}; the caller must construct the element there.
+    template <typename KK>
+    std::pair<size_t, bool> find_or_prepare_insert(const KK& key) {
+        size_t i = find_index(key);
+        if (i != capacity_) {
+            return {i, true};
+        }
+        size_t h = hash_of(key);
+        if (growth_left_ == 0) {
+            // a table full of tombstones is cleaned, not grown
+            rehash(size_ < max_load(capacity_) / 2 ? capacity_
+                   : std::max(capacity_ * 2, group_width));
+        }
+        i = find_free(h);
+        if (ctrl_[i] == ctrl_empty) {
+            --growth_left_;
+        }
+        set_ctrl(i, h & 0x7F);
+        ++size_;
+        return {i, false};
+    }
+
+    void erase_index(size_t i) {
+        slots_[i].kv.~value_type();
+        set_ctrl(i, ctrl_deleted);
+        --size_;
+    }
+
+    // rehash(cap)
+    //    Move every element into a fresh table of `cap` slots, dropping
+    //    tombstones. Keys are copied, since they are `const`.
+    void rehash(size_t cap) {
+        int8_t* old_ctrl = ctrl_;
+        slot* old_slots = slots_;
+        size_t old_capacity = capacity_;
+
+        ctrl_ = static_cast<int8_t*>(::operator new(cap + group_width));
+        memset(ctrl_, ctrl_empty, cap + group_width);
+        slots_ = static_cast<slot*>(::operator new(cap * sizeof(slot),
+                                                   std::align_val_t(alignof(slot))));
+        capacity_ = cap;
+        growth_left_ = max_load(cap) - size_;
+
+        for (size_t j = 0; j != old_capacity; ++j) {
+            if (is_full(old_ctrl[j])) {
+                value_type& kv = old_slots[j].kv;
+                size_t i = find_free(hash_of(kv.first));
+                set_ctrl(i, old_ctrl[j]);
+                new (&slots_[i].kv) value_type(kv.first, std::move(kv.second));
+                kv.~value_type();
+            }
+        }
+        free_table(old_ctrl, old_slots);
+    }
+
+    static void free_table(int8_t* ctrl, slot* slots) {
+        if (ctrl) {
+            ::operator delete(ctrl);
+            ::operator delete(slots, std::align_val_t(alignof(slot)));
+        }
+    }
+
+    void destroy() {
+        clear();
+        free_table(ctrl_, slots_);
+        ctrl_ = nullptr;
+        slots_ = nullptr;
+        capacity_ = growth_left_ = 0;
+    }
+};
+
+#endif
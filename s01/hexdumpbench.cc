@@ -0,0 +1,96 @@
+#include "hexdump.hh"
+#include "benchtime.hh"
+#include <cstring>
+#include <string>
+#include <vector>
+
+// hexdumpbench [MIB]
+//    Check that `fhexdump_at` and `fhexdump_parallel` match the original
+//    per-byte `fprintf` implementation (reproduced below) byte for byte,
+//    then report the median throughput of each over 5 runs, in MB of
+//    input per second, dumping `MIB` MiB (default 4) to /dev/null. Build with `PTHREAD=1`
+//    for `fhexdump_parallel` to use threads.
+
+static void slow_fhexdump_ascii(FILE* f, const unsigned char* p, size_t pos) {
+    size_t first = pos - (pos % 16);
+    int n = pos + 1 - first;
+    char buf[17];
+    for (size_t i = first; i != first + n; ++i) {
+        buf[i - first] = (p[i] >= 32 && p[i] < 127 ? p[i] : '.');
+    }
+    fprintf(f, "%*s|%.*s|\n", 51 - (3 * n + (n > 8)), "", n, buf);
+}
+
+static void slow_fhexdump_at(FILE* f, size_t first_offset, const void* ptr,
+                             size_t size) {
+    const unsigned char* p = (const unsigned char*) ptr;
+    for (size_t i = 0; i != size; ++i) {
+        if (i % 16 == 0) {
+            fprintf(f, "%08zx", first_offset + i);
+        }
+        fprintf(f, "%s%02x", (i % 8 == 0 ? "  " : " "), (unsigned) p[i]);
+        if (i % 16 == 15 || i == size - 1) {
+            slow_fhexdump_ascii(f, p, i);
+        }
+    }
+}
+
+using dump_function = void (*)(FILE*, size_t, const void*, size_t);
+
+static void parallel_fhexdump_at(FILE* f, size_t first_offset,
+                                 const void* ptr, size_t size) {
+    fhexdump_parallel(f, first_offset, ptr, size);
+}
+
+static std::string dump_to_string(dump_function fn, size_t first_offset,
+                                  const void* ptr, size_t size) {
+    char* s;
+    size_t len;
+    FILE* f = open_memstream(&s, &len);
+    fn(f, first_offset, ptr, size);
+    fclose(f);
+    std::string result(s, len);
+    free(s);
+    return result;
+}
+
+static double bench(dump_function fn, const std::vector<unsigned char>& data) {
+    FILE* f = fopen("/dev/null", "w");
+    assert(f);
+    bench_result r = bench_run([&] () {
+        fn(f, 0, data.data(), data.size());
+        fflush(f);
+    }, 5);
+    fclose(f);
+    return data.size() / r.median / 1e6;
+}
+
+int main(int argc, char** argv) {
+    size_t mib = argc > 1 ? strtoul(argv[1], nullptr, 0) : 4;
+    std::vector<unsigned char> data(mib << 20);
+    for (size_t i = 0; i != data.size(); ++i) {
+        data[i] = (i * 2654435761U) >> 13;
+    }
+
+    // partial lines, large offsets, and every byte value
+    for (size_t size : {0, 1, 7, 8, 9, 15, 16, 17, 31, 100, 4096, 65537}) {
+        for (size_t offset : {size_t(0), size_t(0xfffffff8),
+                              size_t(0x7ffc12345670), size_t(-16)}) {
+            assert(dump_to_string(fhexdump_at, offset, data.data(), size)
+                   == dump_to_string(slow_fhexdump_at, offset,
+                                     data.data(), size));
+        }
+    }
+    std::string expected = dump_to_string(slow_fhexdump_at, 0x1000,
+                                          data.data(), data.size() - 5);
+    assert(dump_to_string(parallel_fhexdump_at, 0x1000,
+                          data.data(), data.size() - 5) == expected);
+
+    double slow = bench(slow_fhexdump_at, data);
+    double fast = bench(fhexdump_at, data);
+    double parallel = bench(parallel_fhexdump_at, data);
+    printf("fprintf per byte:  %8.1f MB/s\n", slow);
+    printf("fhexdump_at:       %8.1f MB/s (%.1fx)\n", fast, fast / slow);
+    printf("fhexdump_parallel: %8.1f MB/s (%.1fx)\n",
+           parallel, parallel / slow);
+}
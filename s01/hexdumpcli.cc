@@ -0,0 +1,51 @@
+#include "hexdump.hh"
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+
+// hexdump [-m] [-s OFFSET] [-n LENGTH] [FILE...]
+//    Print a hexdump of each FILE (or standard input) to standard output,
+//    streaming with `fhexdump_fd`, or with `fhexdump_mmap` given `-m`.
+//    `-s` skips to byte OFFSET; `-n` stops after LENGTH bytes.
+
+static void usage() {
+    fprintf(stderr, "Usage: hexdump [-m] [-s OFFSET] [-n LENGTH] [FILE...]\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    bool use_mmap = false;
+    off_t off = 0;
+    size_t len = SIZE_MAX;
+    int opt;
+    while ((opt = getopt(argc, argv, "ms:n:")) != -1) {
+        if (opt == 'm') {
+            use_mmap = true;
+        } else if (opt == 's') {
+            off = strtoll(optarg, nullptr, 0);
+        } else if (opt == 'n') {
+            len = strtoull(optarg, nullptr, 0);
+        } else {
+            usage();
+        }
+    }
+
+    int status = 0;
+    for (int i = optind; i == optind || i < argc; ++i) {
+        const char* name = i < argc ? argv[i] : "-";
+        int fd = strcmp(name, "-") == 0 ? STDIN_FILENO : open(name, O_RDONLY);
+        int r = fd < 0 ? -1
+            : use_mmap ? fhexdump_mmap(stdout, fd, off, len)
+            : fhexdump_fd(stdout, fd, off, len);
+        if (r < 0) {
+            fprintf(stderr, "hexdump: %s: %s\n", name, strerror(errno));
+            status = 1;
+        }
+        if (fd > STDIN_FILENO) {
+            close(fd);
+        }
+    }
+    return status;
+}
@@ -1,6 +1,7 @@
 #include <list>
 #include <cstdio>
 #include <cassert>
+#include "arena_allocator.hh"
 
 int main() {
     // Create a list containing specific elements
@@ -39,5 +40,18 @@ int main() {
     l.clear();        // erase all elements
     assert(l.empty());
 
+    // A list's allocator decides where its nodes live. With an
+    // `arena_allocator`, nodes allocated in sequence are adjacent.
+    arena a;
+    std::list<int, arena_allocator<int>> al{arena_allocator<int>(a)};
+    for (int i = 0; i != 4; ++i) {
+        al.push_back(i);
+    }
+    printf("arena list node addresses:");
+    for (auto it = al.begin(); it != al.end(); ++it) {
+        printf(" %p", (void*) &*it);
+    }
+    printf("\n");
+
     printf("Done!\n");
 }
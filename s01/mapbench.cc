@@ -0,0 +1,170 @@
+#include "btree_map.hh"
+#include "benchtime.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+#include <unistd.h>
+
+// mapbench [-n MAXKEYS] [-t TRIALS] [-r RANGE]
+//    Compare `std::map` with `btree_map` for 1K, 10K, ..., MAXKEYS
+//    (default 10M) 64-bit keys, inserted in random order. Report
+//    nanoseconds per insert, per point lookup, per element of RANGE-element
+//    (default 100) range scans starting at random keys, per element of a
+//    full in-order scan, and per erase, plus node bytes per key. Lookups
+//    and scans are the median of TRIALS runs (default 3).
+
+
+// counting_allocator<T>
+//    Forwards to `std::allocator`, adding the bytes in use to `*bytes`.
+template <typename T>
+struct counting_allocator {
+    using value_type = T;
+    size_t* bytes;
+
+    explicit counting_allocator(size_t* b)
+        : bytes(b) {
+    }
+    template <typename U>
+    counting_allocator(const counting_allocator<U>& x)
+        : bytes(x.bytes) {
+    }
+    T* allocate(size_t n) {
+        *bytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* p, size_t n) {
+        *bytes -= n * sizeof(T);
+        std::allocator<T>().deallocate(p, n);
+    }
+    template <typename U>
+    bool operator==(const counting_allocator<U>& x) const {
+        return bytes == x.bytes;
+    }
+    template <typename U>
+    bool operator!=(const counting_allocator<U>& x) const {
+        return bytes != x.bytes;
+    }
+};
+
+using std_map = std::map<uint64_t, uint64_t, std::less<uint64_t>,
+    counting_allocator<std::pair<const uint64_t, uint64_t>>>;
+
+static volatile uint64_t sink;
+
+struct results {
+    double insert, lookup, range, scan, erase;  // ns per operation/element
+    double bytes;                               // node bytes per key
+};
+
+// run(m, keys, trials, range, bytes)
+//    Time operations on the empty map `m`; `bytes()` returns its
+//    current node memory.
+template <typename M, typename B>
+static results run(M& m, const std::vector<uint64_t>& keys, int trials,
+                   size_t range, B bytes) {
+    size_t n = keys.size();
+    results r;
+
+    uint64_t t0 = rdtsc();
+    for (uint64_t k : keys) {
+        m.insert({k, k});
+    }
+    r.insert = tsc_seconds(rdtscp() - t0) * 1e9 / n;
+    r.bytes = (double) bytes() / n;
+
+    r.lookup = bench_run([&] () {
+        uint64_t sum = 0;
+        for (size_t i = 0; i != n; ++i) {
+            sum += m.find(keys[(i * 7919) % n])->second;
+        }
+        sink = sum;
+    }, trials).median * 1e9 / n;
+
+    // ranges start at random keys; each visits up to `range` elements
+    size_t nranges = std::max<size_t>(n / range, 1000);
+    size_t visited = 0;
+    r.range = bench_run([&] () {
+        uint64_t sum = 0;
+        visited = 0;
+        for (size_t i = 0; i != nranges; ++i) {
+            auto it = m.lower_bound(keys[(i * 7919) % n]);
+            for (size_t j = 0; j != range && it != m.end(); ++j, ++it) {
+                sum += it->second;
+                ++visited;
+            }
+        }
+        sink = sum;
+    }, trials).median * 1e9 / visited;
+
+    r.scan = bench_run([&] () {
+        uint64_t sum = 0;
+        for (auto& kv : m) {
+            sum += kv.second;
+        }
+        sink = sum;
+    }, trials).median * 1e9 / n;
+
+    t0 = rdtsc();
+    for (size_t i = 0; i != n; ++i) {
+        m.erase(keys[(i * 7919) % n]);
+    }
+    r.erase = tsc_seconds(rdtscp() - t0) * 1e9 / n;
+    assert(m.empty());
+    return r;
+}
+
+static void print_row(size_t n, const char* name, const results& r) {
+    printf("%9zu %-10s %8.1f %8.1f %8.2f %8.2f %8.1f %8.1f\n",
+           n, name, r.insert, r.lookup, r.range, r.scan, r.erase, r.bytes);
+}
+
+
+int main(int argc, char** argv) {
+    size_t maxkeys = 10000000;
+    int trials = 3;
+    size_t range = 100;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:r:")) != -1) {
+        if (opt == 'n') {
+            maxkeys = strtoul(optarg, nullptr, 0);
+        } else if (opt == 't') {
+            trials = strtol(optarg, nullptr, 0);
+        } else if (opt == 'r') {
+            range = strtoul(optarg, nullptr, 0);
+        } else {
+            fprintf(stderr, "Usage: mapbench [-n MAXKEYS] [-t TRIALS] [-r RANGE]\n");
+            exit(1);
+        }
+    }
+    assert(trials > 0 && range > 0);
+
+    printf("%9s %-10s %8s %8s %8s %8s %8s %8s\n", "keys", "map",
+           "insert", "lookup", "range/el", "scan/el", "erase", "B/key");
+    std::mt19937_64 rng(61);
+    for (size_t n = 1000; n <= maxkeys; n *= 10) {
+        // distinct keys in random order
+        std::vector<uint64_t> keys(n);
+        for (size_t i = 0; i != n; ++i) {
+            keys[i] = i * 0x9E3779B97F4A7C15ULL;
+        }
+        std::shuffle(keys.begin(), keys.end(), rng);
+
+        results r;
+        {
+            size_t bytes = 0;
+            std_map m{std::less<uint64_t>(),
+                      counting_allocator<std::pair<const uint64_t, uint64_t>>(&bytes)};
+            r = run(m, keys, trials, range, [&] () { return bytes; });
+        }
+        print_row(n, "std::map", r);
+        {
+            btree_map<uint64_t, uint64_t> m;
+            r = run(m, keys, trials, range,
+                    [&] () { return m.node_bytes(); });
+        }
+        print_row(n, "btree_map", r);
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef CS61_STRING_INTERNER_HH
+#define CS61_STRING_INTERNER_HH
+#include "flat_hash_map.hh"
+#include <deque>
+#include <string>
+#include <string_view>
+
+// interned_string
+//    A handle to a string owned by a `string_interner`. Equal strings
+//    from the same interner have equal handles, so hashing and comparing
+//    handles is hashing and comparing pointers, however long the string.
+//    A default-constructed handle is null.
+class interned_string {
+  public:
+    interned_string() = default;
+
+    explicit operator bool() const {
+        return s_ != nullptr;
+    }
+    const std::string& str() const {
+        return *s_;
+    }
+    const char* c_str() const {
+        return s_->c_str();
+    }
+
+    bool operator==(interned_string x) const {
+        return s_ == x.s_;
+    }
+    bool operator!=(interned_string x) const {
+        return s_ != x.s_;
+    }
+
+  private:
+    const std::string* s_ = nullptr;
+
+    explicit interned_string(const std::string* s)
+        : s_(s) {
+    }
+    friend class string_interner;
+    friend struct std::hash<interned_string>;
+};
+
+namespace std {
+template <>
+struct hash<interned_string> {
+    size_t operator()(interned_string x) const {
+        return hash<const void*>()(x.s_);
+    }
+};
+}
+
+
+// string_interner
+//    Stores one copy of each distinct string. `intern` copies a string
+//    the first time it is seen; `find` never allocates. Handles stay
+//    valid until the interner is destroyed.
+class string_interner {
+  public:
+    interned_string intern(std::string_view s) {
+        if (interned_string x = find(s)) {
+            return x;
+        }
+        strings_.emplace_back(s);   // deque elements never move
+        interned_string x(&strings_.back());
+        index_.emplace(std::string_view(strings_.back()), x);
+        return x;
+    }
+
+    // Return the handle for `s`, or a null handle if `s` was never
+    // interned.
+    interned_string find(std::string_view s) const {
+        auto it = index_.find(s);
+        return it != index_.end() ? it->second : interned_string();
+    }
+
+    size_t size() const {
+        return strings_.size();
+    }
+
+  private:
+    std::deque<std::string> strings_;
+    flat_hash_map<std::string_view, interned_string> index_;
+};
+
+#endif
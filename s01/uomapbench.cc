@@ -0,0 +1,295 @@
+#include "flat_hash_map.hh"
+#include "string_interner.hh"
+#include "benchtime.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+// uomapbench [-s] [-n MAXKEYS] [-t TRIALS]
+//    Compare `std::unordered_map` with `flat_hash_map` for 1K, 10K, ...,
+//    MAXKEYS (default 10M) keys. For each size, report nanoseconds per
+//    insert (into an empty map, growing as it goes), per successful and
+//    unsuccessful lookup (median over TRIALS runs, default 3), and per
+//    erase, plus table bytes per key and heap allocations per insert and
+//    per lookup.
+//
+//    Keys are 64-bit integers, or with -s, 16-character strings (whose
+//    own heap memory is not counted), looked up by `const char*` as in
+//    uomap1. Then `std::unordered_map` and a `flat_hash_map` with
+//    `std::hash` build a temporary `std::string` per lookup; a
+//    transparent `flat_hash_map` (`string_hash`, `std::equal_to<>`)
+//    hashes the characters in place; and an interned map looks the text
+//    up in a `string_interner` and then the handle in the map.
+
+
+// Count every heap allocation.
+static size_t nallocs;
+
+void* operator new(size_t sz) {
+    ++nallocs;
+    if (void* p = malloc(sz ? sz : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void* operator new(size_t sz, std::align_val_t align) {
+    ++nallocs;
+    void* p;
+    if (posix_memalign(&p, std::max(size_t(align), sizeof(void*)),
+                       sz ? sz : 1) == 0) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept {
+    free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+void operator delete(void* p, std::align_val_t) noexcept {
+    free(p);
+}
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    free(p);
+}
+
+
+// counting_allocator<T>
+//    Forwards to `std::allocator`, adding the bytes in use to `*bytes`.
+template <typename T>
+struct counting_allocator {
+    using value_type = T;
+    size_t* bytes;
+
+    explicit counting_allocator(size_t* b)
+        : bytes(b) {
+    }
+    template <typename U>
+    counting_allocator(const counting_allocator<U>& x)
+        : bytes(x.bytes) {
+    }
+    T* allocate(size_t n) {
+        *bytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* p, size_t n) {
+        *bytes -= n * sizeof(T);
+        std::allocator<T>().deallocate(p, n);
+    }
+    template <typename U>
+    bool operator==(const counting_allocator<U>& x) const {
+        return bytes == x.bytes;
+    }
+    template <typename U>
+    bool operator!=(const counting_allocator<U>& x) const {
+        return bytes != x.bytes;
+    }
+};
+
+template <typename K>
+using std_map = std::unordered_map<K, int, std::hash<K>, std::equal_to<K>,
+    counting_allocator<std::pair<const K, int>>>;
+
+static volatile size_t sink;
+
+// interned_map
+//    A `flat_hash_map` keyed by interned strings, looked up by text.
+struct interned_map {
+    const string_interner& strings;
+    flat_hash_map<interned_string, int> m;
+
+    void insert(const std::pair<interned_string, int>& kv) {
+        m.insert(kv);
+    }
+    size_t count(const char* s) const {
+        interned_string x = strings.find(s);
+        return x ? m.count(x) : 0;
+    }
+    void erase(interned_string x) {
+        m.erase(x);
+    }
+    bool empty() const {
+        return m.empty();
+    }
+};
+
+struct results {
+    double insert, hit, miss, erase;    // ns per operation
+    double bytes;                       // table bytes per key
+    double insert_allocs;               // allocations per insert
+    double lookup_allocs;               // allocations per lookup
+};
+
+// run(m, keys, hits, misses, trials, bytes)
+//    Time operations on the empty map `m`: insert `keys`, look up `hits`
+//    (the same keys in lookup form) and `misses`, and erase `keys`.
+//    `bytes()` returns the map's current table size.
+template <typename M, typename K, typename L, typename B>
+static results run(M& m, const std::vector<K>& keys,
+                   const std::vector<L>& hits, const std::vector<L>& misses,
+                   int trials, B bytes) {
+    size_t n = keys.size();
+    results r;
+
+    size_t a0 = nallocs;
+    uint64_t t0 = rdtsc();
+    for (size_t i = 0; i != n; ++i) {
+        m.insert({keys[i], int(i)});
+    }
+    r.insert = tsc_seconds(rdtscp() - t0) * 1e9 / n;
+    r.insert_allocs = (double) (nallocs - a0) / n;
+    r.bytes = (double) bytes() / n;
+
+    // look keys up in a different order than they were inserted;
+    // `bench_run` runs each loop `trials + 1` times
+    a0 = nallocs;
+    r.hit = bench_run([&] () {
+        size_t found = 0;
+        for (size_t i = 0; i != n; ++i) {
+            found += m.count(hits[(i * 7919) % n]);
+        }
+        assert(found == n);
+        sink = found;
+    }, trials).median * 1e9 / n;
+    r.miss = bench_run([&] () {
+        size_t found = 0;
+        for (auto& k : misses) {
+            found += m.count(k);
+        }
+        assert(found == 0);
+        sink = found;
+    }, trials).median * 1e9 / n;
+    r.lookup_allocs = (double) (nallocs - a0) / (2 * n * (trials + 1));
+
+    t0 = rdtsc();
+    for (auto& k : keys) {
+        m.erase(k);
+    }
+    r.erase = tsc_seconds(rdtscp() - t0) * 1e9 / n;
+    assert(m.empty());
+    return r;
+}
+
+static void print_row(size_t n, const char* name, const results& r) {
+    printf("%9zu %-16s %8.1f %8.1f %8.1f %8.1f %8.1f %8.2f %8.2f\n",
+           n, name, r.insert, r.hit, r.miss, r.erase, r.bytes,
+           r.insert_allocs, r.lookup_allocs);
+}
+
+// Keys are spread out, but distinct for distinct `i`.
+static uint64_t int_key(uint64_t i) {
+    return i * 0x9E3779B97F4A7C15ULL;
+}
+
+static std::string string_key(uint64_t i) {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016lx", (unsigned long) int_key(i));
+    return buf;
+}
+
+
+static void bench_ints(size_t n, int trials) {
+    std::vector<uint64_t> keys, misses;
+    for (size_t i = 0; i != n; ++i) {
+        keys.push_back(int_key(2 * i));
+        misses.push_back(int_key(2 * i + 1));
+    }
+
+    results r;
+    {
+        size_t bytes = 0;
+        std_map<uint64_t> m(0, std::hash<uint64_t>(),
+                            std::equal_to<uint64_t>(),
+                            counting_allocator<std::pair<const uint64_t, int>>(&bytes));
+        r = run(m, keys, keys, misses, trials, [&] () { return bytes; });
+    }
+    print_row(n, "unordered_map", r);
+    {
+        flat_hash_map<uint64_t, int> m;
+        r = run(m, keys, keys, misses, trials,
+                [&] () { return m.table_bytes(); });
+    }
+    print_row(n, "flat_hash_map", r);
+}
+
+static void bench_strings(size_t n, int trials) {
+    std::vector<std::string> keys, miss_keys;
+    for (size_t i = 0; i != n; ++i) {
+        keys.push_back(string_key(2 * i));
+        miss_keys.push_back(string_key(2 * i + 1));
+    }
+    std::vector<const char*> hits, misses;
+    for (size_t i = 0; i != n; ++i) {
+        hits.push_back(keys[i].c_str());
+        misses.push_back(miss_keys[i].c_str());
+    }
+
+    results r;
+    {
+        size_t bytes = 0;
+        std_map<std::string> m(0, std::hash<std::string>(),
+                               std::equal_to<std::string>(),
+                               counting_allocator<std::pair<const std::string, int>>(&bytes));
+        r = run(m, keys, hits, misses, trials, [&] () { return bytes; });
+    }
+    print_row(n, "unordered_map", r);
+    {
+        flat_hash_map<std::string, int> m;
+        r = run(m, keys, hits, misses, trials,
+                [&] () { return m.table_bytes(); });
+    }
+    print_row(n, "flat_hash_map", r);
+    {
+        flat_hash_map<std::string, int, string_hash, std::equal_to<>> m;
+        r = run(m, keys, hits, misses, trials,
+                [&] () { return m.table_bytes(); });
+    }
+    print_row(n, "flat transparent", r);
+    {
+        // intern outside the timed region, as a program would at load
+        string_interner strings;
+        std::vector<interned_string> handles;
+        for (auto& k : keys) {
+            handles.push_back(strings.intern(k));
+        }
+        interned_map m{strings, {}};
+        r = run(m, handles, hits, misses, trials,
+                [&] () { return m.m.table_bytes(); });
+    }
+    print_row(n, "flat interned", r);
+}
+
+
+int main(int argc, char** argv) {
+    bool strings = false;
+    size_t maxkeys = 10000000;
+    int trials = 3;
+    int opt;
+    while ((opt = getopt(argc, argv, "sn:t:")) != -1) {
+        if (opt == 's') {
+            strings = true;
+        } else if (opt == 'n') {
+            maxkeys = strtoul(optarg, nullptr, 0);
+        } else if (opt == 't') {
+            trials = strtol(optarg, nullptr, 0);
+        } else {
+            fprintf(stderr, "Usage: uomapbench [-s] [-n MAXKEYS] [-t TRIALS]\n");
+            exit(1);
+        }
+    }
+    assert(trials > 0);
+
+    printf("%9s %-16s %8s %8s %8s %8s %8s %8s %8s\n", "keys", "map",
+           "insert", "hit", "miss", "erase", "B/key", "ins-allc", "lkp-allc");
+    for (size_t n = 1000; n <= maxkeys; n *= 10) {
+        if (strings) {
+            bench_strings(n, trials);
+        } else {
+            bench_ints(n, trials);
+        }
+    }
+}
@@ -0,0 +1,223 @@
+#include "alloc_tracer.hh"
+#include "benchtime.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// vectorbench [-n N] [-e ERASEN]
+//    Measure the vector operations that vector1 and vectorq use. For each
+//    experiment, print nanoseconds per operation and, from alloc_tracer,
+//    the heap allocations, frees, and bytes allocated.
+//      growth: N `push_back`s of ints, with and without `reserve(N)`
+//      front:  drain ERASEN ints from the front of a vector
+//              (`erase(begin())`), a `std::deque` (`pop_front`), and a
+//              ring buffer
+//      move:   N `push_back`s and `emplace_back`s of a string-holding
+//              type, counting its copies and moves; once with a
+//              `noexcept` move constructor and once without, since
+//              vectors copy on reallocation when moving might throw
+
+
+static volatile long sink;
+
+// experiment(name, ops, f)
+//    Run `f()` once, and print its time per operation and the heap
+//    allocations it made.
+template <typename F>
+static void experiment(const char* name, size_t ops, F f) {
+    alloc_tracer_stats a0 = alloc_tracer_snapshot();
+    uint64_t t0 = rdtsc();
+    f();
+    uint64_t t1 = rdtscp();
+    alloc_tracer_stats a1 = alloc_tracer_snapshot();
+    printf("%-42s %9.2f ns/op %8zu allocs %8zu frees %11zu bytes\n", name,
+           tsc_seconds(t1 - t0) * 1e9 / ops, a1.nallocs - a0.nallocs,
+           a1.nfrees - a0.nfrees, a1.total_bytes - a0.total_bytes);
+}
+
+
+// ring_buffer<T>
+//    A growable FIFO over a power-of-two array; `pop_front` is O(1) and
+//    never frees.
+template <typename T>
+class ring_buffer {
+  public:
+    void push_back(const T& x) {
+        if (size_ == v_.size()) {
+            grow();
+        }
+        v_[(head_ + size_) & (v_.size() - 1)] = x;
+        ++size_;
+    }
+    T& front() {
+        return v_[head_];
+    }
+    void pop_front() {
+        head_ = (head_ + 1) & (v_.size() - 1);
+        --size_;
+    }
+    bool empty() const {
+        return size_ == 0;
+    }
+
+  private:
+    std::vector<T> v_;
+    size_t head_ = 0;
+    size_t size_ = 0;
+
+    void grow() {
+        std::vector<T> nv(v_.empty() ? 16 : 2 * v_.size());
+        for (size_t i = 0; i != size_; ++i) {
+            nv[i] = std::move(v_[(head_ + i) & (v_.size() - 1)]);
+        }
+        v_.swap(nv);
+        head_ = 0;
+    }
+};
+
+
+// tracked<NoexceptMove>
+//    Holds a heap-allocated string and counts its copies and moves.
+static size_t ncopies, nmoves;
+
+template <bool NoexceptMove>
+struct tracked {
+    std::string s;
+
+    explicit tracked(size_t i)
+        : s("a string too long for the small-string buffer " + std::to_string(i)) {
+    }
+    tracked(const tracked& x)
+        : s(x.s) {
+        ++ncopies;
+    }
+    tracked(tracked&& x) noexcept(NoexceptMove)
+        : s(std::move(x.s)) {
+        ++nmoves;
+    }
+    tracked& operator=(const tracked&) = default;
+    tracked& operator=(tracked&&) = default;
+};
+
+template <bool NoexceptMove>
+static void move_experiments(size_t n) {
+    using T = tracked<NoexceptMove>;
+    const char* suffix = NoexceptMove ? "noexcept move" : "throwing move";
+    char name[64];
+    auto run = [&] (const char* what, auto f) {
+        snprintf(name, sizeof(name), "%s, %s", what, suffix);
+        ncopies = nmoves = 0;
+        size_t copies = 0, moves = 0;
+        experiment(name, n, [&] () {
+            f();
+            copies = ncopies;
+            moves = nmoves;
+        });
+        printf("%42s %zu copies, %zu moves\n", "", copies, moves);
+    };
+
+    run("push_back(lvalue)", [&] () {
+        std::vector<T> v;
+        for (size_t i = 0; i != n; ++i) {
+            T x(i);
+            v.push_back(x);
+        }
+        sink = v.size();
+    });
+    run("push_back(T(i))", [&] () {
+        std::vector<T> v;
+        for (size_t i = 0; i != n; ++i) {
+            v.push_back(T(i));
+        }
+        sink = v.size();
+    });
+    run("emplace_back(i)", [&] () {
+        std::vector<T> v;
+        for (size_t i = 0; i != n; ++i) {
+            v.emplace_back(i);
+        }
+        sink = v.size();
+    });
+    run("emplace_back(i), reserved", [&] () {
+        std::vector<T> v;
+        v.reserve(n);
+        for (size_t i = 0; i != n; ++i) {
+            v.emplace_back(i);
+        }
+        sink = v.size();
+    });
+}
+
+
+int main(int argc, char** argv) {
+    size_t n = 1000000;
+    size_t erasen = 100000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:e:")) != -1) {
+        if (opt == 'n') {
+            n = strtoul(optarg, nullptr, 0);
+        } else if (opt == 'e') {
+            erasen = strtoul(optarg, nullptr, 0);
+        } else {
+            fprintf(stderr, "Usage: vectorbench [-n N] [-e ERASEN]\n");
+            exit(1);
+        }
+    }
+    tsc_hz();
+
+    printf("== growth: %zu push_backs\n", n);
+    experiment("push_back", n, [&] () {
+        std::vector<int> v;
+        for (size_t i = 0; i != n; ++i) {
+            v.push_back(i);
+        }
+        sink = v.size();
+    });
+    experiment("reserve + push_back", n, [&] () {
+        std::vector<int> v;
+        v.reserve(n);
+        for (size_t i = 0; i != n; ++i) {
+            v.push_back(i);
+        }
+        sink = v.size();
+    });
+
+    printf("\n== front: drain %zu elements from the front\n", erasen);
+    std::vector<int> vfront(erasen);
+    experiment("vector erase(begin())", erasen, [&] () {
+        long sum = 0;
+        while (!vfront.empty()) {
+            sum += vfront.front();
+            vfront.erase(vfront.begin());
+        }
+        sink = sum;
+    });
+    std::deque<int> dfront(erasen);
+    experiment("deque pop_front", erasen, [&] () {
+        long sum = 0;
+        while (!dfront.empty()) {
+            sum += dfront.front();
+            dfront.pop_front();
+        }
+        sink = sum;
+    });
+    ring_buffer<int> rfront;
+    for (size_t i = 0; i != erasen; ++i) {
+        rfront.push_back(i);
+    }
+    experiment("ring_buffer pop_front", erasen, [&] () {
+        long sum = 0;
+        while (!rfront.empty()) {
+            sum += rfront.front();
+            rfront.pop_front();
+        }
+        sink = sum;
+    });
+
+    printf("\n== move: %zu elements holding heap strings\n", n);
+    move_experiments<true>(n);
+    move_experiments<false>(n);
+}
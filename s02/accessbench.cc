@@ -0,0 +1,175 @@
+#include "hexdump.hh"
+#include "benchtime.hh"
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <vector>
+#include <unistd.h>
+
+// accessbench [-t TRIALS] [-m MIB] [-s SECTIONS] [-c]
+//    Memory access benchmark suite. Prints CSV: one row per test, giving
+//    the median, 90th percentile, and standard deviation over TRIALS runs
+//    (default 5) of the nanoseconds per access. With -c, also report
+//    cache and branch misses per access where perf counters are available
+//    (-1 otherwise). MIB (default 64) is the size of the data
+//    array and the largest pointer-chasing working set. SECTIONS picks
+//    tests (default "src"):
+//      s: sum an int array with strides of 1 to 4096 ints; every element
+//         is read once per trial, whatever the stride
+//      r: sum an int array at random indices (precomputed outside the
+//         timed region), with and without software prefetch
+//      c: follow a random cyclic pointer chain of one cache line per
+//         node, with working sets from 4 KiB to MIB, exposing the
+//         L1/L2/L3/DRAM steps
+
+
+static volatile unsigned long sink;
+
+static bool counters = false;
+
+// trial_stats(trials, accesses, f)
+//    Run `f` `trials` times plus one warmup with `bench_run`, and return
+//    the results scaled to one access (nanoseconds, misses).
+static bench_result trial_stats(int trials, size_t accesses,
+                                const std::function<unsigned long()>& f) {
+    bench_result r = bench_run([&] () { sink = f(); }, trials, 1, counters);
+    for (double* t : {&r.min, &r.median, &r.p90, &r.p99, &r.max,
+                      &r.mean, &r.stddev}) {
+        *t *= 1e9 / accesses;
+    }
+    if (r.cache_misses >= 0) {
+        r.cache_misses /= accesses;
+        r.branch_misses /= accesses;
+    }
+    return r;
+}
+
+static void print_row(const char* test, size_t param, bool prefetch,
+                      int trials, const bench_result& r) {
+    printf("%s,%zu,%d,%d,%.3f,%.3f,%.3f",
+           test, param, prefetch, trials, r.median, r.p90, r.stddev);
+    if (counters) {
+        printf(",%.4f,%.4f", r.cache_misses, r.branch_misses);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+
+static void bench_strides(const std::vector<int>& v, int trials) {
+    for (size_t stride = 1; stride <= 4096; stride *= 2) {
+        auto f = [&] () {
+            unsigned long sum = 0;
+            for (size_t off = 0; off != stride; ++off) {
+                for (size_t i = off; i < v.size(); i += stride) {
+                    sum += v[i];
+                }
+            }
+            return sum;
+        };
+        print_row("stride", stride, false, trials,
+                  trial_stats(trials, v.size(), f));
+    }
+}
+
+static void bench_random(const std::vector<int>& v, int trials,
+                         std::mt19937_64& rng) {
+    std::vector<unsigned> idx(v.size());
+    std::uniform_int_distribution<unsigned> dist(0, v.size() - 1);
+    for (auto& i : idx) {
+        i = dist(rng);
+    }
+    constexpr size_t distance = 16;   // prefetch this many accesses ahead
+
+    for (bool prefetch : {false, true}) {
+        auto f = [&] () {
+            unsigned long sum = 0;
+            size_t n = idx.size();
+            for (size_t i = 0; i != n; ++i) {
+                if (prefetch && i + distance < n) {
+                    __builtin_prefetch(&v[idx[i + distance]]);
+                }
+                sum += v[idx[i]];
+            }
+            return sum;
+        };
+        print_row("random", v.size(), prefetch, trials,
+                  trial_stats(trials, idx.size(), f));
+    }
+}
+
+static void bench_chase(size_t max_bytes, int trials, std::mt19937_64& rng) {
+    struct alignas(64) node {
+        size_t next;
+    };
+    constexpr size_t hops = 1 << 22;
+    for (size_t bytes = 4096; bytes <= max_bytes; bytes *= 2) {
+        // Sattolo's algorithm: a random permutation that is one cycle
+        size_t n = bytes / sizeof(node);
+        std::vector<node> chain(n);
+        std::vector<size_t> order(n);
+        for (size_t i = 0; i != n; ++i) {
+            order[i] = i;
+        }
+        for (size_t i = n - 1; i > 0; --i) {
+            std::swap(order[i], order[rng() % i]);
+        }
+        for (size_t i = 0; i != n; ++i) {
+            chain[order[i]].next = order[(i + 1) % n];
+        }
+
+        auto f = [&] () {
+            size_t p = 0;
+            for (size_t i = 0; i != hops; ++i) {
+                p = chain[p].next;
+            }
+            return (unsigned long) p;
+        };
+        print_row("chase", bytes, false, trials, trial_stats(trials, hops, f));
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    int trials = 5;
+    size_t mib = 64;
+    const char* sections = "src";
+    int opt;
+    while ((opt = getopt(argc, argv, "t:m:s:c")) != -1) {
+        if (opt == 't') {
+            trials = strtol(optarg, nullptr, 0);
+        } else if (opt == 'm') {
+            mib = strtoul(optarg, nullptr, 0);
+        } else if (opt == 's') {
+            sections = optarg;
+        } else if (opt == 'c') {
+            counters = true;
+        } else {
+            fprintf(stderr, "Usage: accessbench [-t TRIALS] [-m MIB] [-s SECTIONS] [-c]\n");
+            exit(1);
+        }
+    }
+    assert(trials > 0 && mib > 0);
+
+    std::mt19937_64 rng(61);
+    std::vector<int> v;
+    if (strchr(sections, 's') || strchr(sections, 'r')) {
+        v.resize((mib << 20) / sizeof(int));
+        for (auto& x : v) {
+            x = rng();
+        }
+    }
+
+    printf("test,param,prefetch,trials,median_ns,p90_ns,stddev_ns%s\n",
+           counters ? ",cache_misses,branch_misses" : "");
+    if (strchr(sections, 's')) {
+        bench_strides(v, trials);
+    }
+    if (strchr(sections, 'r')) {
+        bench_random(v, trials, rng);
+    }
+    if (strchr(sections, 'c')) {
+        bench_chase(mib << 20, trials, rng);
+    }
+}
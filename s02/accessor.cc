@@ -1,37 +1,252 @@
 #include "hexdump.hh"
+#include "benchtime.hh"
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 #include <unistd.h>
+#if defined(_REENTRANT)
+# include <thread>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+# include <immintrin.h>
+# define ACCESSOR_X86 1
+#endif
 
-int main(int argc, char* argv[]) {
-    constexpr int size = 100000000;
+// accessor [-u|-d|-r] [-k KERNEL] [-t NTHREADS] [-F|-P]
+//    Sum 100M integers in up, down, or random order, split into disjoint
+//    slices over NTHREADS threads (default 1), and report aggregate
+//    GB/s and each thread's time. With -F (adjacent) or -P (cache-line
+//    padded), instead have each thread increment its own counter, to
+//    measure false sharing. More than one thread needs `PTHREAD=1`.
+//
+//    KERNEL selects the sum loop: `plain` (default; whatever the compiler
+//    makes of it), `unrolled` (4 independent scalar sums), or explicit
+//    SIMD `sse2`, `avx2` (gathers), or `avx512` (gathers), checked against
+//    CPUID at run time.
 
-    // initialize a very large array of integers
-    int* v = new int[size];
-    for (int i = 0; i != size; ++i) {
-        v[i] = rand();
+constexpr int size = 100000000;
+
+// run_threads(nthreads, f)
+//    Call `f(t)` for each `t` in `[0, nthreads)`, each in its own thread.
+template <typename F>
+static void run_threads(int nthreads, F f) {
+#if defined(_REENTRANT)
+    std::vector<std::thread> threads;
+    for (int t = 1; t < nthreads; ++t) {
+        threads.emplace_back(f, t);
+    }
+    f(0);
+    for (auto& th : threads) {
+        th.join();
+    }
+#else
+    assert(nthreads == 1);
+    f(0);
+#endif
+}
+
+// sum kernels
+//    Each returns the sum of `v[idx[i]]` for `i` in `[0, n)`. The
+//    integers are nonnegative, so widening them to 64 bits with sign
+//    extension is exact.
+
+using sum_kernel = unsigned long (*)(const int* v, const int* idx, int n);
+
+static unsigned long sum_plain(const int* v, const int* idx, int n) {
+    unsigned long sum = 0;
+    for (int i = 0; i != n; ++i) {
+        sum += v[idx[i]];
+    }
+    return sum;
+}
+
+static unsigned long sum_unrolled(const int* v, const int* idx, int n) {
+    // independent accumulators break the loop-carried add chain
+    unsigned long s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += v[idx[i]];
+        s1 += v[idx[i + 1]];
+        s2 += v[idx[i + 2]];
+        s3 += v[idx[i + 3]];
+    }
+    for (; i != n; ++i) {
+        s0 += v[idx[i]];
+    }
+    return s0 + s1 + s2 + s3;
+}
+
+#if ACCESSOR_X86
+__attribute__((target("sse2")))
+static unsigned long sum_sse2(const int* v, const int* idx, int n) {
+    // SSE2 has no gather: load lanes one by one, add in 64-bit lanes
+    __m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+    __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_setr_epi32(v[idx[i]], v[idx[i + 1]],
+                                   v[idx[i + 2]], v[idx[i + 3]]);
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(x, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(x, zero));
+    }
+    alignas(16) unsigned long lanes[2];
+    _mm_store_si128((__m128i*) lanes, _mm_add_epi64(acc0, acc1));
+    unsigned long sum = lanes[0] + lanes[1];
+    for (; i != n; ++i) {
+        sum += v[idx[i]];
+    }
+    return sum;
+}
+
+__attribute__((target("avx2")))
+static unsigned long sum_avx2(const int* v, const int* idx, int n) {
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i ix = _mm256_loadu_si256((const __m256i*) &idx[i]);
+        __m256i x = _mm256_i32gather_epi32(v, ix, 4);
+        acc0 = _mm256_add_epi64(acc0,
+                                _mm256_cvtepi32_epi64(_mm256_castsi256_si128(x)));
+        acc1 = _mm256_add_epi64(acc1,
+                                _mm256_cvtepi32_epi64(_mm256_extracti128_si256(x, 1)));
+    }
+    alignas(32) unsigned long lanes[4];
+    _mm256_store_si256((__m256i*) lanes, _mm256_add_epi64(acc0, acc1));
+    unsigned long sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i != n; ++i) {
+        sum += v[idx[i]];
+    }
+    return sum;
+}
+
+// GCC 12's avx512fintrin.h trips -Wuninitialized in its own helpers
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f")))
+static unsigned long sum_avx512(const int* v, const int* idx, int n) {
+    __m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i ix = _mm512_loadu_si512(&idx[i]);
+        __m512i x = _mm512_i32gather_epi32(ix, v, 4);
+        acc0 = _mm512_add_epi64(acc0,
+                                _mm512_cvtepi32_epi64(_mm512_castsi512_si256(x)));
+        acc1 = _mm512_add_epi64(acc1,
+                                _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(x, 1)));
+    }
+    unsigned long sum = _mm512_reduce_add_epi64(_mm512_add_epi64(acc0, acc1));
+    for (; i != n; ++i) {
+        sum += v[idx[i]];
     }
+    return sum;
+}
+#pragma GCC diagnostic pop
+#endif
+
+static sum_kernel find_kernel(const char* name) {
+    if (strcmp(name, "plain") == 0) {
+        return sum_plain;
+    } else if (strcmp(name, "unrolled") == 0) {
+        return sum_unrolled;
+    }
+#if ACCESSOR_X86
+    if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+        return sum_sse2;
+    } else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        return sum_avx2;
+    } else if (strcmp(name, "avx512") == 0
+               && __builtin_cpu_supports("avx512f")) {
+        return sum_avx512;
+    }
+#endif
+    return nullptr;
+}
+
 
-    // check for access style argument
+// counters for false-sharing mode
+struct alignas(64) padded_counter {
+    volatile unsigned long n;
+};
+static volatile unsigned long adjacent_counters[64];
+static padded_counter padded_counters[64];
+
+static void false_sharing(int nthreads, bool padded) {
+    constexpr unsigned long updates = 100000000;
+    std::vector<double> elapsed(nthreads);
+    tsc_hz();
+    uint64_t t0 = rdtsc();
+    run_threads(nthreads, [&] (int t) {
+        volatile unsigned long& n = padded ? padded_counters[t].n
+            : adjacent_counters[t];
+        uint64_t start = rdtsc();
+        for (unsigned long i = 0; i != updates; ++i) {
+            n = n + 1;
+        }
+        elapsed[t] = tsc_seconds(rdtscp() - start);
+    });
+    double total = tsc_seconds(rdtscp() - t0);
+
+    printf("%d threads updated %s counters %lu times each in %.09f sec\n",
+           nthreads, padded ? "padded" : "adjacent", updates, total);
+    for (int t = 0; t != nthreads; ++t) {
+        printf("  thread %d: %.09f sec, %.3f ns/update\n",
+               t, elapsed[t], elapsed[t] * 1e9 / updates);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    // check for access style and thread arguments
     enum access_style { access_up, access_down, access_random };
     access_style style = access_up;
+    int nthreads = 1;
+    int sharing = 0;
+    const char* kernel_name = "plain";
     int opt;
-    while ((opt = getopt(argc, argv, "rud")) != -1) {
+    while ((opt = getopt(argc, argv, "rudk:t:FP")) != -1) {
         if (opt == 'r') {
             style = access_random;
         } else if (opt == 'd') {
             style = access_down;
         } else if (opt == 'u') {
             style = access_up;
+        } else if (opt == 'k') {
+            kernel_name = optarg;
+        } else if (opt == 't') {
+            nthreads = strtol(optarg, nullptr, 0);
+        } else if (opt == 'F' || opt == 'P') {
+            sharing = opt;
         }
     }
+#if !defined(_REENTRANT)
+    if (nthreads != 1) {
+        fprintf(stderr, "accessor: rebuild with `make PTHREAD=1` for -t\n");
+        exit(1);
+    }
+#endif
+    assert(nthreads >= 1 && nthreads <= 64);
+    sum_kernel kernel = find_kernel(kernel_name);
+    if (!kernel) {
+        fprintf(stderr, "accessor: kernel `%s` unknown or unsupported\n",
+                kernel_name);
+        exit(1);
+    }
 
-    double t0 = cputime();
+    if (sharing) {
+        false_sharing(nthreads, sharing == 'P');
+        return 0;
+    }
 
-    // access 10M integers in up, down, or random order
-    unsigned long sum = 0;
-    unsigned long rand_sum = 0;
+    // initialize a very large array of integers
+    int* v = new int[size];
+    for (int i = 0; i != size; ++i) {
+        v[i] = rand();
+    }
 
+    // compute the indices to access (in up, down, or random order)
+    // before timing, so `rand()` costs every style the same: nothing
+    int* indices = new int[size];
+    unsigned long rand_sum = 0;
     for (int i = 0; i != size; ++i) {
         int r = rand() % size;
 
@@ -44,12 +259,39 @@ int main(int argc, char* argv[]) {
             idx = r;
         }
 
-        sum += v[idx];
+        indices[i] = idx;
         rand_sum += r;
     }
 
-    double t1 = cputime();
+    tsc_hz();
+    uint64_t t0 = rdtsc();
 
-    printf("accessed %d integers in %.09f sec\n", size, t1 - t0);
+    // access 100M integers in that order, thread `t` taking the `t`th
+    // slice of `indices`
+    std::vector<unsigned long> sums(nthreads);
+    std::vector<double> elapsed(nthreads);
+    run_threads(nthreads, [&] (int t) {
+        uint64_t start = rdtsc();
+        int lo = (long) size * t / nthreads;
+        int hi = (long) size * (t + 1) / nthreads;
+        sums[t] = kernel(v, indices + lo, hi - lo);
+        elapsed[t] = tsc_seconds(rdtscp() - start);
+    });
+    double total = tsc_seconds(rdtscp() - t0);
+
+    unsigned long sum = 0;
+    for (unsigned long s : sums) {
+        sum += s;
+    }
+    printf("accessed %d integers in %.09f sec (%s)\n",
+           size, total, kernel_name);
     printf("sum: %lu, rand_sum: %lu\n", sum, rand_sum);
+    if (nthreads > 1) {
+        // each access reads an index and an integer
+        printf("%d threads: %.3f GB/s\n", nthreads,
+               2.0 * sizeof(int) * size / total / 1e9);
+        for (int t = 0; t != nthreads; ++t) {
+            printf("  thread %d: %.09f sec\n", t, elapsed[t]);
+        }
+    }
 }
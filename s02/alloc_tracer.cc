@@ -0,0 +1,185 @@
+#include "alloc_tracer.hh"
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <new>
+
+// Every block carries a header just below the pointer returned to the
+// caller, giving its requested size and the distance back to the start
+// of the underlying `malloc` block (larger for over-aligned blocks).
+
+namespace {
+
+struct alignas(16) block_header {
+    size_t size;
+    size_t offset;
+};
+
+std::atomic<size_t> nallocs;
+std::atomic<size_t> nfrees;
+std::atomic<size_t> total_bytes;
+std::atomic<size_t> live_bytes;
+std::atomic<size_t> peak_live_bytes;
+std::atomic<size_t> histogram[65];
+
+unsigned size_bucket(size_t sz) {
+    return sz ? 64 - __builtin_clzl(sz) : 0;
+}
+
+void* trace_alloc(size_t sz, size_t align) {
+    size_t offset = align > sizeof(block_header) ? align
+        : sizeof(block_header);
+    void* base;
+    if (align > sizeof(block_header)) {
+        if (posix_memalign(&base, align, offset + sz) != 0) {
+            return nullptr;
+        }
+    } else if (!(base = malloc(offset + sz))) {
+        return nullptr;
+    }
+
+    char* p = static_cast<char*>(base) + offset;
+    block_header* h = reinterpret_cast<block_header*>(p) - 1;
+    h->size = sz;
+    h->offset = offset;
+
+    nallocs.fetch_add(1, std::memory_order_relaxed);
+    total_bytes.fetch_add(sz, std::memory_order_relaxed);
+    histogram[size_bucket(sz)].fetch_add(1, std::memory_order_relaxed);
+    size_t live = live_bytes.fetch_add(sz, std::memory_order_relaxed) + sz;
+    size_t peak = peak_live_bytes.load(std::memory_order_relaxed);
+    while (live > peak
+           && !peak_live_bytes.compare_exchange_weak(peak, live,
+                                                     std::memory_order_relaxed)) {
+    }
+    return p;
+}
+
+void* trace_alloc_or_throw(size_t sz, size_t align) {
+    void* p = trace_alloc(sz, align);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void trace_free(void* p) {
+    if (!p) {
+        return;
+    }
+    block_header* h = static_cast<block_header*>(p) - 1;
+    nfrees.fetch_add(1, std::memory_order_relaxed);
+    live_bytes.fetch_sub(h->size, std::memory_order_relaxed);
+    free(static_cast<char*>(p) - h->offset);
+}
+
+// Report at exit. Functions marked `destructor` run after static objects
+// are destroyed, so blocks still live here were never freed.
+__attribute__((destructor)) void report_at_exit() {
+    const char* hist = getenv("ALLOC_TRACER_HISTOGRAM");
+    fflush(stdout);     // keep the report after the program's output
+    alloc_tracer_report(stderr, hist && strcmp(hist, "0") != 0);
+}
+
+}
+
+
+alloc_tracer_stats alloc_tracer_snapshot() {
+    alloc_tracer_stats st;
+    st.nallocs = nallocs.load(std::memory_order_relaxed);
+    st.nfrees = nfrees.load(std::memory_order_relaxed);
+    st.total_bytes = total_bytes.load(std::memory_order_relaxed);
+    st.live_bytes = live_bytes.load(std::memory_order_relaxed);
+    st.peak_live_bytes = peak_live_bytes.load(std::memory_order_relaxed);
+    for (unsigned b = 0; b != 65; ++b) {
+        st.histogram[b] = histogram[b].load(std::memory_order_relaxed);
+    }
+    return st;
+}
+
+void alloc_tracer_report(FILE* f, bool show_histogram) {
+    alloc_tracer_stats st = alloc_tracer_snapshot();
+    fprintf(f, "alloc_tracer: %zu allocations (%zu bytes), %zu frees, "
+            "peak %zu bytes live, %zu bytes live now\n",
+            st.nallocs, st.total_bytes, st.nfrees, st.peak_live_bytes,
+            st.live_bytes);
+    if (show_histogram) {
+        for (unsigned b = 0; b != 65; ++b) {
+            if (st.histogram[b] == 0) {
+                continue;
+            } else if (b == 0) {
+                fprintf(f, "  %21s %zu\n", "0 bytes:", st.histogram[b]);
+            } else {
+                size_t lo = size_t(1) << (b - 1);
+                fprintf(f, "  %9zu-%9zu: %zu\n",
+                        lo, lo + (lo - 1), st.histogram[b]);
+            }
+        }
+    }
+}
+
+
+void* operator new(size_t sz) {
+    return trace_alloc_or_throw(sz, 0);
+}
+void* operator new[](size_t sz) {
+    return trace_alloc_or_throw(sz, 0);
+}
+void* operator new(size_t sz, const std::nothrow_t&) noexcept {
+    return trace_alloc(sz, 0);
+}
+void* operator new[](size_t sz, const std::nothrow_t&) noexcept {
+    return trace_alloc(sz, 0);
+}
+void* operator new(size_t sz, std::align_val_t align) {
+    return trace_alloc_or_throw(sz, size_t(align));
+}
+void* operator new[](size_t sz, std::align_val_t align) {
+    return trace_alloc_or_throw(sz, size_t(align));
+}
+void* operator new(size_t sz, std::align_val_t align,
+                   const std::nothrow_t&) noexcept {
+    return trace_alloc(sz, size_t(align));
+}
+void* operator new[](size_t sz, std::align_val_t align,
+                     const std::nothrow_t&) noexcept {
+    return trace_alloc(sz, size_t(align));
+}
+
+void operator delete(void* p) noexcept {
+    trace_free(p);
+}
+void operator delete[](void* p) noexcept {
+    trace_free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+    trace_free(p);
+}
+void operator delete[](void* p, size_t) noexcept {
+    trace_free(p);
+}
+void operator delete(void* p, std::align_val_t) noexcept {
+    trace_free(p);
+}
+void operator delete[](void* p, std::align_val_t) noexcept {
+    trace_free(p);
+}
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    trace_free(p);
+}
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+    trace_free(p);
+}
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    trace_free(p);
+}
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    trace_free(p);
+}
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    trace_free(p);
+}
+void operator delete[](void* p, std::align_val_t,
+                       const std::nothrow_t&) noexcept {
+    trace_free(p);
+}
@@ -0,0 +1,34 @@
+#ifndef CS61_ALLOC_TRACER_HH
+#define CS61_ALLOC_TRACER_HH
+#include <cstdio>
+#include <cstddef>
+
+// Allocation tracer. Linking `alloc_tracer.o` into a program (build with
+// `make TRACE_ALLOC=1`) replaces the global `operator new` and `operator
+// delete` with versions that count every call, and prints a report to
+// standard error at exit. Set `ALLOC_TRACER_HISTOGRAM=1` in the
+// environment to add a histogram of allocation sizes. Programs that want
+// numbers between phases can include this header and call the functions
+// below; they must then always be linked with `alloc_tracer.o`.
+
+struct alloc_tracer_stats {
+    size_t nallocs;             // calls to `operator new` (all forms)
+    size_t nfrees;              // calls to `operator delete` on non-null
+    size_t total_bytes;         // bytes requested over all allocations
+    size_t live_bytes;          // bytes currently allocated
+    size_t peak_live_bytes;     // maximum of `live_bytes`
+    // `histogram[0]` counts zero-byte allocations; `histogram[b]`, for
+    // `b > 0`, counts allocations of `[2^(b-1), 2^b)` bytes
+    size_t histogram[65];
+};
+
+// alloc_tracer_snapshot()
+//    Return the current counts.
+alloc_tracer_stats alloc_tracer_snapshot();
+
+// alloc_tracer_report(f, [histogram])
+//    Print the current counts to `f`, with a size histogram if
+//    `histogram` is true.
+void alloc_tracer_report(FILE* f, bool histogram = false);
+
+#endif
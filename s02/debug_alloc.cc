@@ -0,0 +1,649 @@
+#include <cstdio>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <csignal>
+#include <execinfo.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// debug_alloc: a lightweight checking allocator. Linking `debug_alloc.o`
+// into a program (build with `make DEBUG_ALLOC=1`) replaces the global
+// `operator new` and `operator delete`. It catches, at `delete` time or
+// at exit, the bugs that the membug programs demonstrate:
+//    - deleting a pointer that `new` never returned, such as the middle
+//      of a block (membug1) or a stack address (membug2, membug3);
+//    - deleting a block twice (membug5);
+//    - writing just past either end of a block (membug7), using canary
+//      redzones around every block;
+//    - writing to a block after deleting it (membug4), by keeping freed
+//      blocks, filled with a pattern, in a quarantine for a while;
+//    - `delete` of a `new[]` block and vice versa;
+//    - blocks never deleted (membug6), reported at exit.
+// Unlike AddressSanitizer, nothing is instrumented: the costs are a hash
+// table insert and erase and a few canary checks per block. Errors print
+// a message to standard error and abort. A sampling mode, cheap enough to
+// leave on in production, is described below.
+
+namespace {
+
+constexpr size_t redzone = 16;
+constexpr unsigned char redzone_byte = 0xAB;
+constexpr unsigned char freed_byte = 0xDD;
+constexpr size_t quarantine_blocks = 4096;
+constexpr size_t quarantine_bytes = 4 << 20;
+
+enum block_kind : uint32_t {
+    kind_new = 1, kind_new_array = 2
+};
+enum block_state : uint32_t {
+    state_live = 0x4C495645, state_freed = 0x46524545
+};
+
+// A block is laid out as
+//    [alignment padding][header][redzone][size user bytes][redzone]
+// where `offset` is the distance from the start of the underlying `malloc`
+// block to the user bytes.
+struct block_header {
+    size_t size;
+    size_t offset;
+    block_kind kind;
+    block_state state;
+    uint64_t serial;        // allocation number, for error messages
+};
+
+inline unsigned char* user_bytes(block_header* h) {
+    return reinterpret_cast<unsigned char*>(h + 1) + redzone;
+}
+inline block_header* header_of(void* p) {
+    return reinterpret_cast<block_header*>(
+        static_cast<unsigned char*>(p) - redzone) - 1;
+}
+
+
+// block_table
+//    Open-addressing hash set of the headers of live and quarantined
+//    blocks, keyed by user pointer. `delete` consults it before trusting
+//    any header, so wild pointers are never dereferenced.
+class block_table {
+  public:
+    block_header* find(const void* p) const {
+        if (!cap_) {
+            return nullptr;
+        }
+        for (size_t i = hash(p); ; i = (i + 1) & (cap_ - 1)) {
+            if (!slots_[i]) {
+                return nullptr;
+            } else if (slots_[i] != tombstone() && user_bytes(slots_[i]) == p) {
+                return slots_[i];
+            }
+        }
+    }
+    void insert(block_header* h) {
+        if (2 * (n_ + ntomb_ + 1) > cap_) {
+            rehash(2 * n_ + 2 > cap_ / 2 ? 2 * cap_ : cap_);
+        }
+        size_t i = hash(user_bytes(h));
+        while (slots_[i] && slots_[i] != tombstone()) {
+            i = (i + 1) & (cap_ - 1);
+        }
+        if (slots_[i] == tombstone()) {
+            --ntomb_;
+        }
+        slots_[i] = h;
+        ++n_;
+    }
+    void erase(block_header* h) {
+        for (size_t i = hash(user_bytes(h)); ; i = (i + 1) & (cap_ - 1)) {
+            if (slots_[i] == h) {
+                slots_[i] = tombstone();
+                --n_;
+                ++ntomb_;
+                return;
+            }
+        }
+    }
+    // Call `f(h)` for each block.
+    template <typename F>
+    void for_each(F f) const {
+        for (size_t i = 0; i != cap_; ++i) {
+            if (slots_[i] && slots_[i] != tombstone()) {
+                f(slots_[i]);
+            }
+        }
+    }
+
+  private:
+    block_header** slots_ = nullptr;
+    size_t cap_ = 0;        // a power of 2
+    size_t n_ = 0;
+    size_t ntomb_ = 0;
+
+    static block_header* tombstone() {
+        return reinterpret_cast<block_header*>(uintptr_t(1));
+    }
+    size_t hash(const void* p) const {
+        uint64_t x = reinterpret_cast<uintptr_t>(p);
+        x *= 0x9E3779B97F4A7C15ULL;
+        return (x >> 20) & (cap_ - 1);
+    }
+    void rehash(size_t cap) {
+        block_header** old = slots_;
+        size_t oldcap = cap_;
+        cap_ = cap < 1024 ? 1024 : cap;
+        slots_ = static_cast<block_header**>(calloc(cap_, sizeof(*slots_)));
+        if (!slots_) {
+            fprintf(stderr, "debug_alloc: out of memory\n");
+            abort();
+        }
+        n_ = ntomb_ = 0;
+        for (size_t i = 0; i != oldcap; ++i) {
+            if (old[i] && old[i] != tombstone()) {
+                insert(old[i]);
+            }
+        }
+        free(old);
+    }
+};
+
+block_table blocks;
+std::atomic_flag lock = ATOMIC_FLAG_INIT;
+uint64_t nserial;
+
+// quarantine: FIFO of freed blocks not yet returned to `free`
+block_header* quarantine[quarantine_blocks];
+size_t qhead, qcount, qbytes;
+
+struct guard {
+    guard() {
+        while (lock.test_and_set(std::memory_order_acquire)) {
+        }
+    }
+    ~guard() {
+        lock.clear(std::memory_order_release);
+    }
+};
+
+
+// fail(h, format, ...)
+//    Print an error message, describing block `h` if it is non-null, and
+//    abort.
+[[noreturn]] __attribute__((format(printf, 2, 3)))
+void fail(block_header* h, const char* fmt, ...) {
+    fflush(stdout);
+    fprintf(stderr, "debug_alloc: ");
+    va_list val;
+    va_start(val, fmt);
+    vfprintf(stderr, fmt, val);
+    va_end(val);
+    if (h) {
+        fprintf(stderr, " (%zu-byte block %p, allocation #%lu by %s)",
+                h->size, static_cast<void*>(user_bytes(h)),
+                (unsigned long) h->serial,
+                h->kind == kind_new_array ? "new[]" : "new");
+    }
+    fprintf(stderr, "\n");
+    abort();
+}
+
+// Return the first byte in `[p, p + n)` that differs from `c`, or null.
+const unsigned char* find_mismatch(const unsigned char* p, size_t n,
+                                   unsigned char c) {
+    for (size_t i = 0; i != n; ++i) {
+        if (p[i] != c) {
+            return p + i;
+        }
+    }
+    return nullptr;
+}
+
+void check_redzones(block_header* h, const char* when) {
+    unsigned char* u = user_bytes(h);
+    if (const unsigned char* bad = find_mismatch(u - redzone, redzone,
+                                                 redzone_byte)) {
+        fail(h, "heap buffer underflow detected %s: byte %zd overwritten",
+             when, bad - u);
+    }
+    if (const unsigned char* bad = find_mismatch(u + h->size, redzone,
+                                                 redzone_byte)) {
+        fail(h, "heap buffer overflow detected %s: byte %zd overwritten",
+             when, bad - u);
+    }
+}
+
+// release(h)
+//    Return quarantined block `h` to `free`, first checking that nothing
+//    wrote to it after it was deleted.
+void release(block_header* h) {
+    unsigned char* u = user_bytes(h);
+    if (const unsigned char* bad = find_mismatch(u, h->size, freed_byte)) {
+        fail(h, "use after free: byte %zd written after delete", bad - u);
+    }
+    check_redzones(h, "after delete");
+    blocks.erase(h);
+    free(u - h->offset);
+}
+
+
+void* checked_alloc(size_t sz, size_t align, block_kind kind) {
+    if (align < alignof(std::max_align_t)) {
+        align = alignof(std::max_align_t);
+    }
+    size_t offset = (sizeof(block_header) + redzone + align - 1) & ~(align - 1);
+    void* base;
+    if (posix_memalign(&base, align, offset + sz + redzone) != 0) {
+        return nullptr;
+    }
+    unsigned char* u = static_cast<unsigned char*>(base) + offset;
+    block_header* h = header_of(u);
+    h->size = sz;
+    h->offset = offset;
+    h->kind = kind;
+    h->state = state_live;
+    memset(u - redzone, redzone_byte, redzone);
+    memset(u + sz, redzone_byte, redzone);
+
+    guard g;
+    h->serial = ++nserial;
+    blocks.insert(h);
+    return u;
+}
+
+void checked_free(void* p, block_kind kind) {
+    if (!p) {
+        return;
+    }
+    guard g;
+    block_header* h = blocks.find(p);
+    const char* op = kind == kind_new_array ? "delete[]" : "delete";
+    if (!h) {
+        // Not a block start. Explain the pointer as well as we can; this
+        // scan is slow, but we are about to abort anyway.
+        block_header* inside = nullptr;
+        blocks.for_each([&] (block_header* b) {
+            unsigned char* u = user_bytes(b);
+            if (p > u && p < u + b->size + redzone) {
+                inside = b;
+            }
+        });
+        if (inside) {
+            fail(inside, "invalid %s of %p: %zd bytes inside a block", op, p,
+                 static_cast<unsigned char*>(p) - user_bytes(inside));
+        }
+        fail(nullptr, "invalid %s of %p: not allocated by new", op, p);
+    } else if (h->state == state_freed) {
+        fail(h, "double %s of %p", op, p);
+    } else if (h->kind != kind) {
+        fail(h, "%s of %p, which needs %s", op, p,
+             h->kind == kind_new_array ? "delete[]" : "delete");
+    }
+    check_redzones(h, "at delete");
+
+    h->state = state_freed;
+    memset(p, freed_byte, h->size);
+    size_t qtail = (qhead + qcount) % quarantine_blocks;
+    quarantine[qtail] = h;
+    ++qcount;
+    qbytes += h->size;
+    while (qcount == quarantine_blocks
+           || (qbytes > quarantine_bytes && qcount > 1)) {
+        block_header* old = quarantine[qhead];
+        qhead = (qhead + 1) % quarantine_blocks;
+        --qcount;
+        qbytes -= old->size;
+        release(old);
+    }
+}
+
+// Sampling mode. With `DEBUG_ALLOC_SAMPLE=N` in the environment, the
+// checks above are off: blocks come straight from `malloc`, except that
+// one allocation in N (of at most a page) is placed in its own page of
+// the sample pool, right against a `PROT_NONE` guard page. Deleting a
+// sampled block makes its page `PROT_NONE` too. Overflows and uses after
+// free of sampled blocks therefore fault at once, and a `SIGSEGV` handler
+// reports them with the block's allocation and free backtraces. (Link
+// with `-rdynamic` to get function names in backtraces.)
+//
+// The pool is
+//    [guard][slot 0][guard][slot 1]...[guard][slot N-1][guard]
+// with one page per slot and per guard.
+
+constexpr size_t pool_slots = 256;
+constexpr int trace_depth = 16;
+
+struct sample_slot {
+    unsigned char* ptr;     // null if never used
+    size_t size;
+    block_kind kind;
+    bool live;
+    int alloc_depth;
+    int free_depth;
+    void* alloc_trace[trace_depth];
+    void* free_trace[trace_depth];
+};
+
+enum { mode_uninitialized, mode_checked, mode_sampled };
+std::atomic<int> mode;
+size_t sample_rate;
+thread_local size_t sample_countdown;
+
+unsigned char* pool;
+size_t pool_bytes;
+size_t page_bytes;
+sample_slot slots[pool_slots];
+size_t next_slot;
+
+inline bool in_pool(const void* p) {
+    return size_t(static_cast<const unsigned char*>(p) - pool) < pool_bytes;
+}
+inline unsigned char* slot_page(size_t i) {
+    return pool + (2 * i + 1) * page_bytes;
+}
+
+// Write `label` and the backtrace `trace` to standard error. Uses only
+// `write` and `backtrace_symbols_fd`, so signal handlers can call it.
+void print_trace(const char* label, void* const* trace, int depth) {
+    ssize_t w = write(STDERR_FILENO, label, strlen(label));
+    (void) w;
+    if (trace) {
+        backtrace_symbols_fd(trace, depth, STDERR_FILENO);
+    }
+}
+
+void describe_slot(const sample_slot& s) {
+    char buf[128];
+    snprintf(buf, sizeof(buf), "debug_alloc: sampled %zu-byte block %p "
+             "allocated by %s at:\n", s.size, static_cast<void*>(s.ptr),
+             s.kind == kind_new_array ? "new[]" : "new");
+    print_trace(buf, s.alloc_trace, s.alloc_depth);
+    if (!s.live) {
+        print_trace("debug_alloc: and deleted at:\n", s.free_trace,
+                    s.free_depth);
+    }
+}
+
+void sample_fault(int sig, siginfo_t* si, void*) {
+    unsigned char* a = static_cast<unsigned char*>(si->si_addr);
+    if (in_pool(a)) {
+        // pages alternate guard, slot, guard, ...; a guard fault is most
+        // likely an overflow of the slot before (blocks end at the guard)
+        size_t page = (a - pool) / page_bytes;
+        const sample_slot* s = nullptr;
+        const char* what;
+        if (page % 2) {
+            s = &slots[page / 2];
+            what = "use after free";
+        } else if (page > 0 && slots[page / 2 - 1].ptr) {
+            s = &slots[page / 2 - 1];
+            what = "heap buffer overflow";
+        } else if (page / 2 < pool_slots && slots[page / 2].ptr) {
+            s = &slots[page / 2];
+            what = "heap buffer underflow";
+        } else {
+            what = "wild access to the sample pool";
+        }
+        char buf[160];
+        snprintf(buf, sizeof(buf), "debug_alloc: %s at %p", what,
+                 static_cast<void*>(a));
+        print_trace(buf, nullptr, 0);
+        if (s) {
+            snprintf(buf, sizeof(buf), " (byte %zd of the block)\n",
+                     a - s->ptr);
+            print_trace(buf, nullptr, 0);
+        } else {
+            print_trace("\n", nullptr, 0);
+        }
+        void* trace[trace_depth];
+        print_trace("debug_alloc: faulting access at:\n", trace,
+                    backtrace(trace, trace_depth));
+        if (s) {
+            describe_slot(*s);
+        }
+    }
+    // return and fault again, now with the default action
+    signal(sig, SIG_DFL);
+}
+
+// Choose the mode on the first allocation.
+void initialize() {
+    guard g;
+    if (mode != mode_uninitialized) {
+        return;
+    }
+    const char* rate = getenv("DEBUG_ALLOC_SAMPLE");
+    if (rate && (sample_rate = strtoul(rate, nullptr, 0)) > 0) {
+        page_bytes = sysconf(_SC_PAGESIZE);
+        pool_bytes = (2 * pool_slots + 1) * page_bytes;
+        void* m = mmap(nullptr, pool_bytes, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (m == MAP_FAILED) {
+            fail(nullptr, "cannot map the sample pool");
+        }
+        pool = static_cast<unsigned char*>(m);
+        // `backtrace` allocates the first time it runs; get that over with
+        void* trace[1];
+        backtrace(trace, 1);
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = sample_fault;
+        sa.sa_flags = SA_SIGINFO;
+        sigaction(SIGSEGV, &sa, nullptr);
+        sigaction(SIGBUS, &sa, nullptr);
+        mode = mode_sampled;
+    } else {
+        mode = mode_checked;
+    }
+}
+
+// sample_alloc(sz, align, kind)
+//    Return a sampled block, or null if the block is too large or the
+//    pool is full. The block ends at its page's end, so it is aligned
+//    only as much as its size allows (objects' sizes are multiples of
+//    their alignments) and overflows of even one byte fault.
+void* sample_alloc(size_t sz, size_t align, block_kind kind) {
+    if (sz > page_bytes || align > page_bytes) {
+        return nullptr;
+    }
+    size_t natural = sz ? sz & -sz : 1;
+    if (align < natural && align < alignof(std::max_align_t)) {
+        align = natural < alignof(std::max_align_t) ? natural
+            : alignof(std::max_align_t);
+    }
+
+    guard g;
+    size_t i = next_slot, tries = 0;
+    while (slots[i].live) {
+        i = (i + 1) % pool_slots;
+        if (++tries == pool_slots) {
+            return nullptr;
+        }
+    }
+    next_slot = (i + 1) % pool_slots;
+
+    sample_slot& s = slots[i];
+    unsigned char* page = slot_page(i);
+    mprotect(page, page_bytes, PROT_READ | PROT_WRITE);
+    // a zero-size block still needs an address inside its page
+    s.ptr = page + ((page_bytes - std::max(sz, size_t(1))) & ~(align - 1));
+    s.size = sz;
+    s.kind = kind;
+    s.live = true;
+    s.alloc_depth = backtrace(s.alloc_trace, trace_depth);
+    return s.ptr;
+}
+
+void sample_free(void* p, block_kind kind) {
+    guard g;
+    size_t page = (static_cast<unsigned char*>(p) - pool) / page_bytes;
+    const char* op = kind == kind_new_array ? "delete[]" : "delete";
+    sample_slot& s = slots[page / 2];
+    bool inside = page % 2 == 1 && s.ptr && p > s.ptr && p < s.ptr + s.size;
+    if (!inside && (page % 2 == 0 || s.ptr != p)) {
+        fail(nullptr, "invalid %s of %p: not a sampled block", op, p);
+    } else if (inside || !s.live || s.kind != kind) {
+        fflush(stdout);
+        if (inside) {
+            fprintf(stderr, "debug_alloc: invalid %s of %p: %zd bytes inside "
+                    "a block\n", op, p, static_cast<unsigned char*>(p) - s.ptr);
+        } else {
+            fprintf(stderr, "debug_alloc: %s %s of %p\n",
+                    s.live ? "mismatched" : "double", op, p);
+        }
+        void* trace[trace_depth];
+        print_trace("debug_alloc: at:\n", trace, backtrace(trace, trace_depth));
+        describe_slot(s);
+        abort();
+    }
+    s.live = false;
+    s.free_depth = backtrace(s.free_trace, trace_depth);
+    mprotect(slot_page(page / 2), page_bytes, PROT_NONE);
+}
+
+
+void* debug_alloc(size_t sz, size_t align, block_kind kind) {
+    if (__builtin_expect(mode != mode_sampled, 0)) {
+        if (mode == mode_uninitialized) {
+            initialize();
+        }
+        if (mode == mode_checked) {
+            return checked_alloc(sz, align, kind);
+        }
+    }
+    if (__builtin_expect(sample_countdown == 0, 0)) {
+        sample_countdown = sample_rate;
+        if (void* p = sample_alloc(sz, align, kind)) {
+            return p;
+        }
+    }
+    --sample_countdown;
+    if (align <= alignof(std::max_align_t)) {
+        return malloc(sz);
+    }
+    void* p;
+    return posix_memalign(&p, align, sz) == 0 ? p : nullptr;
+}
+
+void debug_free(void* p, block_kind kind) {
+    if (mode != mode_sampled) {
+        checked_free(p, kind);
+    } else if (in_pool(p)) {
+        sample_free(p, kind);
+    } else {
+        free(p);
+    }
+}
+
+void* debug_alloc_or_throw(size_t sz, size_t align, block_kind kind) {
+    void* p = debug_alloc(sz, align, kind);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+// At exit: check every block still in quarantine for writes after free,
+// check live blocks' redzones, and report leaks. In sampling mode, report
+// sampled blocks never deleted.
+__attribute__((destructor)) void debug_alloc_exit() {
+    guard g;
+    if (mode == mode_sampled) {
+        for (const sample_slot& s : slots) {
+            if (s.live) {
+                fflush(stdout);
+                fprintf(stderr, "debug_alloc: sampled block leaked\n");
+                describe_slot(s);
+            }
+        }
+        return;
+    }
+    while (qcount) {
+        block_header* old = quarantine[qhead];
+        qhead = (qhead + 1) % quarantine_blocks;
+        --qcount;
+        release(old);
+    }
+    size_t nleaks = 0, leaked = 0;
+    blocks.for_each([&] (block_header* h) {
+        check_redzones(h, "at exit");
+        ++nleaks;
+        leaked += h->size;
+    });
+    if (nleaks) {
+        fflush(stdout);
+        fprintf(stderr, "debug_alloc: %zu bytes leaked in %zu blocks\n",
+                leaked, nleaks);
+    }
+}
+
+}
+
+
+void* operator new(size_t sz) {
+    return debug_alloc_or_throw(sz, 0, kind_new);
+}
+void* operator new[](size_t sz) {
+    return debug_alloc_or_throw(sz, 0, kind_new_array);
+}
+void* operator new(size_t sz, const std::nothrow_t&) noexcept {
+    return debug_alloc(sz, 0, kind_new);
+}
+void* operator new[](size_t sz, const std::nothrow_t&) noexcept {
+    return debug_alloc(sz, 0, kind_new_array);
+}
+void* operator new(size_t sz, std::align_val_t align) {
+    return debug_alloc_or_throw(sz, size_t(align), kind_new);
+}
+void* operator new[](size_t sz, std::align_val_t align) {
+    return debug_alloc_or_throw(sz, size_t(align), kind_new_array);
+}
+void* operator new(size_t sz, std::align_val_t align,
+                   const std::nothrow_t&) noexcept {
+    return debug_alloc(sz, size_t(align), kind_new);
+}
+void* operator new[](size_t sz, std::align_val_t align,
+                     const std::nothrow_t&) noexcept {
+    return debug_alloc(sz, size_t(align), kind_new_array);
+}
+
+void operator delete(void* p) noexcept {
+    debug_free(p, kind_new);
+}
+void operator delete[](void* p) noexcept {
+    debug_free(p, kind_new_array);
+}
+void operator delete(void* p, size_t) noexcept {
+    debug_free(p, kind_new);
+}
+void operator delete[](void* p, size_t) noexcept {
+    debug_free(p, kind_new_array);
+}
+void operator delete(void* p, std::align_val_t) noexcept {
+    debug_free(p, kind_new);
+}
+void operator delete[](void* p, std::align_val_t) noexcept {
+    debug_free(p, kind_new_array);
+}
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    debug_free(p, kind_new);
+}
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+    debug_free(p, kind_new_array);
+}
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    debug_free(p, kind_new);
+}
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    debug_free(p, kind_new_array);
+}
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    debug_free(p, kind_new);
+}
+void operator delete[](void* p, std::align_val_t,
+                       const std::nothrow_t&) noexcept {
+    debug_free(p, kind_new_array);
+}
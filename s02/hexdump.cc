@@ -1,7 +1,19 @@
 #include "hexdump.hh"
 #include <cassert>
-
-static void fhexdump_ascii(FILE* f, const unsigned char* p, size_t pos);
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(_REENTRANT)
+# include <thread>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+# include <immintrin.h>
+# define HEXDUMP_SSSE3 1
+#endif
 
 void hexdump(const void* ptr, size_t size) {
     fhexdump_at(stdout, (size_t) ptr, ptr, size);
@@ -11,28 +23,262 @@ void fhexdump(FILE* f, const void* ptr, size_t size) {
     fhexdump_at(f, (size_t) ptr, ptr, size);
 }
 
+// hex_table
+//    `hex_table.pair[b]` holds the two lowercase hex digits for byte `b`.
+struct hex_table_type {
+    char pair[256][2];
+    constexpr hex_table_type()
+        : pair() {
+        for (int b = 0; b != 256; ++b) {
+            pair[b][0] = "0123456789abcdef"[b >> 4];
+            pair[b][1] = "0123456789abcdef"[b & 15];
+        }
+    }
+};
+static constexpr hex_table_type hex_table;
+
+// A line is at most 16 offset digits + 50 hex + 2 pad + 19 ASCII = 87
+// characters; the SSSE3 formatter may scribble a few past that.
+static constexpr size_t max_line_size = 96;
+
+
+#if HEXDUMP_SSSE3
+// line_shuffle
+//    `pshufb` controls that lay out the 50-character hex area of a full
+//    line from the interleaved hex digits of bytes 0-7 (`lo`) and 8-15
+//    (`hi`), followed by padding and the ASCII report's opening `|`.
+//    Positions that take no digit hold 0x80 (zero) and get `fill`.
+struct line_shuffle_type {
+    alignas(16) unsigned char lo[64];
+    alignas(16) unsigned char hi[64];
+    alignas(16) unsigned char fill[64];
+    constexpr line_shuffle_type()
+        : lo(), hi(), fill() {
+        for (int k = 0; k != 64; ++k) {
+            lo[k] = hi[k] = 0x80;
+            fill[k] = k == 52 ? '|' : ' ';
+            int kk = k < 25 ? k : k - 25;
+            if (k < 50 && kk != 0 && (kk - 1) % 3 != 0) {
+                unsigned char idx = 2 * ((kk - 1) / 3) + ((kk - 1) % 3 - 1);
+                (k < 25 ? lo : hi)[k] = idx;
+                fill[k] = 0;
+            }
+        }
+    }
+};
+static constexpr line_shuffle_type line_shuffle;
+
+// fhexdump_line16_ssse3(s, p)
+//    Format the hex area and ASCII report of a full 16-byte line at `p`
+//    into `s`, which follows the offset. Returns a pointer just past the
+//    newline. Writes 71 characters.
+__attribute__((target("ssse3")))
+static char* fhexdump_line16_ssse3(char* s, const unsigned char* p) {
+    __m128i v = _mm_loadu_si128((const __m128i*) p);
+    __m128i digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+                                   '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i hc = _mm_shuffle_epi8(digits,
+                                  _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+    __m128i lc = _mm_shuffle_epi8(digits, _mm_and_si128(v, nibble));
+    __m128i dlo = _mm_unpacklo_epi8(hc, lc);
+    __m128i dhi = _mm_unpackhi_epi8(hc, lc);
+    for (int i = 0; i != 4; ++i) {
+        __m128i x = _mm_or_si128(
+            _mm_shuffle_epi8(dlo, _mm_load_si128(
+                (const __m128i*) &line_shuffle.lo[16 * i])),
+            _mm_shuffle_epi8(dhi, _mm_load_si128(
+                (const __m128i*) &line_shuffle.hi[16 * i])));
+        x = _mm_or_si128(x, _mm_load_si128(
+            (const __m128i*) &line_shuffle.fill[16 * i]));
+        _mm_storeu_si128((__m128i*) (s + 16 * i), x);
+    }
+    // printable bytes are 32 through 126 (signed compares reject >= 128)
+    __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(31)),
+                                      _mm_cmplt_epi8(v, _mm_set1_epi8(127)));
+    __m128i ascii = _mm_or_si128(_mm_and_si128(printable, v),
+                                 _mm_andnot_si128(printable,
+                                                  _mm_set1_epi8('.')));
+    _mm_storeu_si128((__m128i*) (s + 53), ascii);
+    s[69] = '|';
+    s[70] = '\n';
+    return s + 71;
+}
+
+static const bool have_ssse3 = __builtin_cpu_supports("ssse3");
+#endif
+
+
+// fhexdump_line(s, offset, p, n)
+//    Format one hexdump line for the `n` bytes (1 <= n <= 16) at `p`,
+//    whose first byte has offset `offset`, into `s`. Returns a pointer
+//    just past the newline. Matches `fprintf` with `%08zx` for the offset
+//    and `%02x` for each byte; the ASCII report starts at column 51 (plus
+//    any offset digits past 8).
+static char* fhexdump_line(char* s, size_t offset, const unsigned char* p,
+                           int n) {
+    int ndigits = 8;
+    while (ndigits < 16 && (offset >> (4 * ndigits)) != 0) {
+        ++ndigits;
+    }
+    for (int d = ndigits - 1; d >= 0; --d) {
+        *s++ = "0123456789abcdef"[(offset >> (4 * d)) & 15];
+    }
+#if HEXDUMP_SSSE3
+    if (n == 16 && have_ssse3) {
+        return fhexdump_line16_ssse3(s, p);
+    }
+#endif
+    char* hexstart = s;
+    for (int i = 0; i != n; ++i) {
+        if (i % 8 == 0) {
+            *s++ = ' ';
+        }
+        *s++ = ' ';
+        memcpy(s, hex_table.pair[p[i]], 2);
+        s += 2;
+    }
+    // pad so the ASCII report lines up with that of a full line
+    int pad = 52 - (s - hexstart);
+    memset(s, ' ', pad);
+    s += pad;
+    *s++ = '|';
+    for (int i = 0; i != n; ++i) {
+        *s++ = (p[i] >= 32 && p[i] < 127 ? p[i] : '.');
+    }
+    *s++ = '|';
+    *s++ = '\n';
+    return s;
+}
+
+// fhexdump_format(s, first_offset, p, size)
+//    Format the lines for `[p, p+size)` into `s`, which must have room for
+//    `max_line_size` characters per line. Returns the number of characters
+//    written.
+static size_t fhexdump_format(char* s, size_t first_offset,
+                              const unsigned char* p, size_t size) {
+    char* s0 = s;
+    for (size_t i = 0; i < size; i += 16) {
+        int n = size - i < 16 ? size - i : 16;
+        s = fhexdump_line(s, first_offset + i, p + i, n);
+    }
+    return s - s0;
+}
+
 void fhexdump_at(FILE* f, size_t first_offset, const void* ptr, size_t size) {
+    // Format lines into a buffer and write it out in large chunks.
     const unsigned char* p = (const unsigned char*) ptr;
-    for (size_t i = 0; i != size; ++i) {
-        if (i % 16 == 0) {
-            fprintf(f, "%08zx", first_offset + i);
+    constexpr size_t chunk = 16 * 128;
+    char buf[chunk / 16 * max_line_size];
+    for (size_t i = 0; i < size; i += chunk) {
+        size_t n = fhexdump_format(buf, first_offset + i, p + i,
+                                   size - i < chunk ? size - i : chunk);
+        fwrite(buf, 1, n, f);
+    }
+}
+
+void fhexdump_parallel(FILE* f, size_t first_offset, const void* ptr,
+                       size_t size, unsigned nthreads) {
+#if defined(_REENTRANT)
+    // Each round, thread `t` formats slice `t` into its own buffer; then
+    // the buffers are written in order. Slices are whole lines.
+    constexpr size_t slice = 1 << 20;
+    if (nthreads == 0) {
+        nthreads = std::thread::hardware_concurrency();
+    }
+    if (nthreads <= 1 || size <= slice) {
+        fhexdump_at(f, first_offset, ptr, size);
+        return;
+    }
+    const unsigned char* p = (const unsigned char*) ptr;
+    std::vector<std::vector<char>> bufs(nthreads);
+    std::vector<size_t> lens(nthreads);
+    std::vector<std::thread> threads;
+    for (size_t pos = 0; pos < size; pos += slice * nthreads) {
+        auto work = [&] (unsigned t) {
+            size_t start = pos + t * slice;
+            size_t n = start < size ? std::min(slice, size - start) : 0;
+            bufs[t].resize(slice / 16 * max_line_size);
+            lens[t] = fhexdump_format(bufs[t].data(), first_offset + start,
+                                      p + start, n);
+        };
+        for (unsigned t = 1; t != nthreads; ++t) {
+            threads.emplace_back(work, t);
+        }
+        work(0);
+        for (auto& th : threads) {
+            th.join();
         }
-        fprintf(f, "%s%02x", (i % 8 == 0 ? "  " : " "), (unsigned) p[i]);
-        if (i % 16 == 15 || i == size - 1) {
-            fhexdump_ascii(f, p, i);
+        threads.clear();
+        for (unsigned t = 0; t != nthreads; ++t) {
+            fwrite(bufs[t].data(), 1, lens[t], f);
         }
     }
+#else
+    (void) nthreads;
+    fhexdump_at(f, first_offset, ptr, size);
+#endif
 }
 
-static void fhexdump_ascii(FILE* f, const unsigned char* p, size_t pos) {
-    // Print an ASCII report that ends with byte p[pos].
-    // The first byte printed is p[first], where first is the max multiple
-    // of 16 having `first < pos`. The report starts at column 51.
-    size_t first = pos - (pos % 16);  // first char to print
-    int n = pos + 1 - first;          // # chars to print
-    char buf[17];
-    for (size_t i = first; i != first + n; ++i) {
-        buf[i - first] = (p[i] >= 32 && p[i] < 127 ? p[i] : '.');
+int fhexdump_fd(FILE* f, int fd, off_t off, size_t len) {
+    // Read whole windows (a multiple of 16 bytes) so lines fall where a
+    // single `fhexdump_at` of the range would put them.
+    constexpr size_t window = 1 << 16;
+    if (off != 0 && lseek(fd, off, SEEK_SET) == -1) {
+        return -1;
+    }
+    std::vector<unsigned char> buf(window);
+    while (len != 0) {
+        size_t want = std::min(len, window), n = 0;
+        while (n != want) {
+            ssize_t r = read(fd, buf.data() + n, want - n);
+            if (r > 0) {
+                n += r;
+            } else if (r == 0) {
+                break;
+            } else if (errno != EINTR && errno != EAGAIN) {
+                return -1;
+            }
+        }
+        fhexdump_at(f, off, buf.data(), n);
+        if (n != want) {
+            break;
+        }
+        off += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int fhexdump_mmap(FILE* f, int fd, off_t off, size_t len) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return -1;
+    } else if (!S_ISREG(st.st_mode)) {
+        return fhexdump_fd(f, fd, off, len);
+    }
+    if (off >= st.st_size) {
+        return 0;
+    }
+    len = std::min(len, size_t(st.st_size - off));
+
+    // Map one window at a time; windows are page-aligned in the file, and
+    // each dumps a multiple of 16 bytes.
+    constexpr size_t window = 1 << 24;
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    while (len != 0) {
+        off_t map_off = off - off % pagesize;
+        size_t n = std::min(len, window);
+        size_t map_len = off - map_off + n;
+        void* map = mmap(nullptr, map_len, PROT_READ, MAP_SHARED, fd, map_off);
+        if (map == MAP_FAILED) {
+            return -1;
+        }
+        madvise(map, map_len, MADV_SEQUENTIAL);
+        fhexdump_parallel(f, off, (const char*) map + (off - map_off), n);
+        munmap(map, map_len);
+        off += n;
+        len -= n;
     }
-    fprintf(f, "%*s|%.*s|\n", 51 - (3 * n + (n > 8)), "", n, buf);
+    return 0;
 }
@@ -3,6 +3,7 @@
 #include <cstdio>
 #include <cassert>
 #include <cstdlib>
+#include <sys/types.h>
 #include <ctime>
 
 // hexdump(ptr, size)
@@ -35,6 +36,28 @@ void fhexdump(FILE* f, const void* ptr, size_t size);
 //    address of `ptr`.
 void fhexdump_at(FILE* f, size_t first_offset, const void* ptr, size_t size);
 
+// fhexdump_parallel(f, first_offset, ptr, size, [nthreads])
+//    Like fhexdump_at, but split large regions across `nthreads` threads
+//    (default: one per CPU). Output is identical. Threads are used only
+//    when built with `PTHREAD=1`.
+void fhexdump_parallel(FILE* f, size_t first_offset, const void* ptr,
+                       size_t size, unsigned nthreads = 0);
+
+
+// fhexdump_fd(f, fd, off, len)
+//    Print to `f` a hexdump of up to `len` bytes of file descriptor `fd`,
+//    starting at offset `off` (which is also the first offset printed),
+//    stopping early at end of file. Reads in fixed-size windows, so memory
+//    use is bounded. If `off != 0`, `fd` must be seekable. Returns 0 on
+//    success and -1 (with `errno` set) on error.
+int fhexdump_fd(FILE* f, int fd, off_t off, size_t len);
+
+// fhexdump_mmap(f, fd, off, len)
+//    Like `fhexdump_fd`, but maps regular files into memory a window at a
+//    time instead of reading them. Other file types fall back on
+//    `fhexdump_fd`.
+int fhexdump_mmap(FILE* f, int fd, off_t off, size_t len);
+
 
 // cputime()
 //    Return the amount of CPU time this process has taken so far.
@@ -1,57 +1,156 @@
 #include "hexdump.hh"
+#include "arena_allocator.hh"
+#include "benchtime.hh"
 #include <cstdlib>
 #include <cstring>
 #include <algorithm>
+#include <functional>
 #include <list>
+#include <set>
+#include <vector>
 #include <unistd.h>
 
+// inserter [-u|-d|-r] [-l|-p|-v|-s|-f] [-n SIZE]
+//    Insert SIZE integers (default 50000) into a sorted container, in up,
+//    down, or random order, and report the time per insert.
+//    Containers: -l std::list with a linear walk (default)
+//                -p the same, with list nodes from an `arena`
+//                -v std::vector with std::upper_bound + insert
+//                -s std::multiset
+//                -f flat sorted array, merging sorted batches of inserts
+
+
+// flat_sorted
+//    A sorted array. Inserts collect in an unsorted batch; when the batch
+//    reaches a quarter of the array's size (at least 1024), it is sorted
+//    and merged into the array in one linear pass. `contains` binary
+//    searches the array (after flushing the batch).
+struct flat_sorted {
+    std::vector<int> data;
+    std::vector<int> batch;
+    std::vector<int> scratch;
+
+    void insert(int x) {
+        batch.push_back(x);
+        if (batch.size() >= std::max(size_t(1024), data.size() / 4)) {
+            flush();
+        }
+    }
+    void flush() {
+        std::sort(batch.begin(), batch.end());
+        scratch.resize(data.size() + batch.size());
+        std::merge(data.begin(), data.end(), batch.begin(), batch.end(),
+                   scratch.begin());
+        data.swap(scratch);
+        batch.clear();
+    }
+    bool contains(int x) {
+        flush();
+        return std::binary_search(data.begin(), data.end(), x);
+    }
+};
+
+
+template <typename L>
+static void sorted_list_insert(L& ls, int x) {
+    auto it = ls.begin();
+    while (it != ls.end() && *it < x) {
+        ++it;
+    }
+    ls.insert(it, x);
+}
+
+// time_inserts(values, insert)
+//    Call `insert(x)` for each `x` in `values`; return the time taken.
+template <typename F>
+static double time_inserts(const std::vector<int>& values, F insert) {
+    tsc_hz();
+    uint64_t t0 = rdtsc();
+    for (int x : values) {
+        insert(x);
+    }
+    return tsc_seconds(rdtscp() - t0);
+}
+
+template <typename C>
+static void check_sorted(const C& c) {
+    auto it = std::adjacent_find(c.begin(), c.end(), std::greater<int>{});
+    assert(it == c.end());
+}
+
 int main(int argc, char* argv[]) {
-    constexpr int size = 50000;
+    int size = 50000;
 
-    // check for access style argument
+    // check for access style and container arguments
     enum access_style { access_up, access_down, access_random };
     access_style style = access_up;
+    char mode = 'l';
     int opt;
-    while ((opt = getopt(argc, argv, "rud")) != -1) {
+    while ((opt = getopt(argc, argv, "rudlpvsfn:")) != -1) {
         if (opt == 'r') {
             style = access_random;
         } else if (opt == 'd') {
             style = access_down;
         } else if (opt == 'u') {
             style = access_up;
+        } else if (opt == 'n') {
+            size = strtol(optarg, nullptr, 0);
+        } else if (strchr("lpvsf", opt)) {
+            mode = opt;
         }
     }
+    assert(size > 0);
 
-    double t0 = cputime();
-
-    // insert 50K integers into doubly-linked list
-    // in up, down, or random order
-    std::list<int> ls;
-
+    // generate `size` integers in up, down, or random order
+    std::vector<int> values(size);
     for (int i = 0; i != size; ++i) {
         int r = rand() % size;
-
-        int idx = 0;
         if (style == access_up) {
-            idx = i;
+            values[i] = i;
         } else if (style == access_down) {
-            idx = size - i - 1;
+            values[i] = size - i - 1;
         } else if (style == access_random) {
-            idx = r;
-        }
-
-        auto it = ls.begin();
-        while (it != ls.end() && *it < idx) {
-            ++it;
+            values[i] = r;
         }
-        ls.insert(it, idx);
     }
 
-    double t1 = cputime();
-
-    printf("inserted %d integers to sorted list in %.09f sec\n", size, t1 - t0);
+    // insert them into the chosen sorted container
+    const char* name;
+    double t;
+    if (mode == 'l') {
+        name = "list";
+        std::list<int> ls;
+        t = time_inserts(values, [&] (int x) { sorted_list_insert(ls, x); });
+        check_sorted(ls);
+    } else if (mode == 'p') {
+        name = "arena list";
+        arena a;
+        std::list<int, arena_allocator<int>> ls{arena_allocator<int>(a)};
+        t = time_inserts(values, [&] (int x) { sorted_list_insert(ls, x); });
+        check_sorted(ls);
+    } else if (mode == 'v') {
+        name = "vector";
+        std::vector<int> v;
+        t = time_inserts(values, [&] (int x) {
+            v.insert(std::upper_bound(v.begin(), v.end(), x), x);
+        });
+        check_sorted(v);
+    } else if (mode == 's') {
+        name = "set";
+        std::multiset<int> s;
+        t = time_inserts(values, [&] (int x) { s.insert(x); });
+        check_sorted(s);
+    } else {
+        name = "flat array";
+        flat_sorted fs;
+        t = time_inserts(values, [&] (int x) { fs.insert(x); });
+        uint64_t t0 = rdtsc();
+        assert(fs.contains(values[0]));
+        t += tsc_seconds(rdtscp() - t0);
+        check_sorted(fs.data);
+        assert(fs.data.size() == size_t(size));
+    }
 
-    // check that list is sorted
-    auto it = std::adjacent_find(ls.begin(), ls.end(), std::greater<int>{});
-    assert(it == ls.end());
+    printf("inserted %d integers to sorted %s in %.09f sec (%.1f ns/insert)\n",
+           size, name, t, t * 1e9 / size);
 }
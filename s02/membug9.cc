@@ -0,0 +1,5 @@
+int main() {
+    int* ptr = new int[0];
+    delete[] ptr;
+    delete[] ptr;
+}
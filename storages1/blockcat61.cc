@@ -0,0 +1,34 @@
+#include "io61.hh"
+#include <unistd.h>
+
+// blockcat61 [-b BLOCKSIZE] [FILE]
+//    Copy FILE (default standard input) to standard output in
+//    BLOCKSIZE-byte (default 3) `io61_read`s and `io61_write`s.
+
+int main(int argc, char** argv) {
+    size_t blocksize = 3;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:")) != -1) {
+        if (opt == 'b') {
+            blocksize = strtoul(optarg, nullptr, 0);
+        } else {
+            fprintf(stderr, "Usage: blockcat61 [-b BLOCKSIZE] [FILE]\n");
+            exit(1);
+        }
+    }
+    if (blocksize == 0) {
+        blocksize = 1;
+    }
+
+    io61_file* inf = io61_open_check(optind < argc ? argv[optind] : nullptr,
+                                     O_RDONLY);
+    io61_file* outf = io61_open_check(nullptr, O_WRONLY);
+    unsigned char* buf = new unsigned char[blocksize];
+    ssize_t n;
+    while ((n = io61_read(inf, buf, blocksize)) > 0) {
+        io61_write(outf, buf, n);
+    }
+    delete[] buf;
+    io61_close(inf);
+    io61_close(outf);
+}
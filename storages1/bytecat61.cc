@@ -0,0 +1,16 @@
+#include "io61.hh"
+
+// bytecat61 [FILE]
+//    Copy FILE (default standard input) to standard output one byte at
+//    a time, with `io61_readc` and `io61_writec`.
+
+int main(int argc, char** argv) {
+    io61_file* inf = io61_open_check(argc > 1 ? argv[1] : nullptr, O_RDONLY);
+    io61_file* outf = io61_open_check(nullptr, O_WRONLY);
+    int ch;
+    while ((ch = io61_readc(inf)) != EOF) {
+        io61_writec(outf, ch);
+    }
+    io61_close(inf);
+    io61_close(outf);
+}
@@ -0,0 +1,433 @@
+#include "io61.hh"
+#include "io61_aio.hh"
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// io61_file
+//    The current cache slot holds bytes `[tag, end_tag)` of the file, and
+//    `pos_tag` is the file position. For writing, the slot holds bytes
+//    not yet written to the file; `fd_pos` tracks the file descriptor's
+//    own offset, so `lseek` is called only when a flush starts somewhere
+//    else. Reads of seekable files use `pread` and so never seek.
+//
+//    For reading there are up to `nslots` slots, chosen by block number
+//    and allocated on first use, and seeks are watched for a pattern.
+//    After a seek, the new window usually starts at a multiple of
+//    `bufsize`. But when seeks keep moving backward by less than a block,
+//    the window is placed to end just after the sought byte, so the
+//    reads that follow are hits. Strided access (offsets 0, 4096, 1,
+//    4097, ...) revisits a few blocks in turn, and those blocks stay in
+//    separate slots. Either way each block is read about once, as long
+//    as one pass of a stride touches at most `nslots` blocks.
+//
+//    Regular files opened for reading are mapped into memory whole, if
+//    possible (set `IO61_MMAP=0` in the environment to disable this).
+//    The mapping then acts as one slot covering the file: `cbuf` points
+//    at it, `[tag, end_tag)` is `[0, size)`, and reads and seeks are
+//    memory accesses with no system calls at all. The size is fixed when
+//    the file is opened. Pipes, terminals, and files that cannot be
+//    mapped use the block cache.
+//
+//    With `IO61_ASYNC=1` in the environment (or `IO61_ASYNC=thread`, to
+//    skip `io_uring`), block-cache files also keep a `spare` slot with a
+//    request in flight. Sequential reads prefetch the next block into it
+//    while the caller consumes the current one, and a full write buffer
+//    becomes the spare while it is written behind, so the caller can
+//    keep filling the other. One request at a time keeps reads and
+//    writes at the file position in order.
+
+struct io61_slot {
+    static constexpr off_t bufsize = 4096;
+    alignas(4096) unsigned char cbuf[bufsize];
+    off_t tag = -1;
+    off_t end_tag = -1;
+};
+
+struct io61_file {
+    static constexpr off_t bufsize = io61_slot::bufsize;
+    static constexpr int nslots = 32;
+    io61_slot* slots[nslots] = {};
+    io61_slot* slot;                // current slot
+    int slot_index = 0;             // `slots[slot_index] == slot`
+    unsigned char* cbuf;            // == `slot->cbuf`
+    int fd;
+    int mode;
+    bool seekable;
+    off_t tag;                      // == `slot->tag`
+    off_t end_tag;                  // == `slot->end_tag`
+    off_t pos_tag;
+    off_t fd_pos;
+    off_t last_seek = 0;            // previous seek target
+    off_t seek_delta = 0;           // last distance between seek targets
+    bool reverse = false;           // recent seeks moved backward
+    bool seeked = false;            // seeked since the last fill
+    unsigned char* map = nullptr;   // whole-file mapping, if any
+    size_t map_size;
+    io61_aio* aio = nullptr;        // asynchronous mode, if enabled
+    io61_slot* spare = nullptr;     // read-ahead or write-behind buffer
+    long spare_ticket = -1;         // outstanding request on `spare`
+    off_t spare_tag;                // file offset of that request
+    size_t spare_len;               // and, for writes, its length
+};
+
+
+io61_file* io61_fdopen(int fd, int mode) {
+    assert(fd >= 0);
+    assert(mode == O_RDONLY || mode == O_WRONLY);
+    io61_file* f = new io61_file;
+    f->fd = fd;
+    f->mode = mode;
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    f->seekable = pos >= 0;
+    f->fd_pos = f->seekable ? pos : 0;
+    f->pos_tag = f->fd_pos;
+
+    struct stat st;
+    const char* want_mmap = getenv("IO61_MMAP");
+    if (mode == O_RDONLY
+        && (!want_mmap || strcmp(want_mmap, "0") != 0)
+        && fstat(fd, &st) == 0
+        && S_ISREG(st.st_mode)
+        && st.st_size > 0) {
+        void* m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m != MAP_FAILED) {
+            madvise(m, st.st_size, MADV_SEQUENTIAL);
+            f->map = f->cbuf = static_cast<unsigned char*>(m);
+            f->map_size = st.st_size;
+            f->slot = nullptr;
+            f->tag = 0;
+            f->end_tag = st.st_size;
+            return f;
+        }
+    }
+
+    f->slot = f->slots[0] = new io61_slot;
+    f->cbuf = f->slot->cbuf;
+    f->tag = f->end_tag = f->pos_tag;
+    f->slot->tag = f->slot->end_tag = f->tag;
+    const char* want_async = getenv("IO61_ASYNC");
+    if (want_async && strcmp(want_async, "0") != 0) {
+        f->aio = io61_aio_new(fd, strcmp(want_async, "thread") != 0);
+    }
+    return f;
+}
+
+io61_file* io61_open_check(const char* filename, int mode) {
+    int fd;
+    if (filename) {
+        fd = open(filename, mode == O_WRONLY ? O_WRONLY | O_CREAT | O_TRUNC
+                  : mode, 0666);
+    } else if (mode == O_RDONLY) {
+        fd = STDIN_FILENO;
+    } else {
+        fd = STDOUT_FILENO;
+    }
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        exit(1);
+    }
+    return io61_fdopen(fd, mode & O_ACCMODE);
+}
+
+int io61_close(io61_file* f) {
+    int r = io61_flush(f);
+    if (f->aio) {
+        io61_aio_delete(f->aio);    // waits for any read-ahead
+    }
+    if (close(f->fd) < 0) {
+        r = -1;
+    }
+    for (io61_slot* s : f->slots) {
+        delete s;
+    }
+    delete f->spare;
+    if (f->map) {
+        munmap(f->map, f->map_size);
+    }
+    delete f;
+    return r;
+}
+
+
+// Reposition `f->fd` at `pos` if it is not there already.
+static int io61_sync_fd_pos(io61_file* f, off_t pos) {
+    if (f->fd_pos != pos) {
+        if (lseek(f->fd, pos, SEEK_SET) != pos) {
+            return -1;
+        }
+        f->fd_pos = pos;
+    }
+    return 0;
+}
+
+// io61_switch_slot(f, tag)
+//    Make the slot for the window starting at `tag` current.
+static void io61_switch_slot(io61_file* f, off_t tag) {
+    f->slot->tag = f->tag;
+    f->slot->end_tag = f->end_tag;
+    io61_slot*& s = f->slots[(tag / io61_file::bufsize) % io61_file::nslots];
+    if (!s) {
+        s = new io61_slot;
+    }
+    f->slot = s;
+    f->slot_index = &s - f->slots;
+    f->cbuf = f->slot->cbuf;
+    f->tag = f->slot->tag;
+    f->end_tag = f->slot->end_tag;
+}
+
+// Exchange the current slot's buffer with the spare.
+static void io61_swap_spare(io61_file* f) {
+    if (!f->spare) {
+        f->spare = new io61_slot;
+    }
+    io61_slot* s = f->slot;
+    f->slot = f->slots[f->slot_index] = f->spare;
+    f->spare = s;
+    f->cbuf = f->slot->cbuf;
+}
+
+// io61_read_block(f, tag, sequential)
+//    Read the block at `tag` into the current slot's buffer and return
+//    the number of bytes read. In asynchronous mode, take the block from
+//    the read-ahead if that is where it is, then, if reading is
+//    `sequential`, start reading the following block into the spare.
+static ssize_t io61_read_block(io61_file* f, off_t tag, bool sequential) {
+    constexpr off_t bufsize = io61_file::bufsize;
+    ssize_t n = -1;
+    bool have = false;
+    if (f->spare_ticket >= 0) {
+        n = io61_aio_wait(f->aio, f->spare_ticket);
+        f->spare_ticket = -1;
+        if (f->spare_tag == tag) {
+            io61_swap_spare(f);
+            have = true;
+        }
+    }
+    // `pread` saves an `lseek` per block on seekable files
+    while (!have) {
+        if (f->seekable) {
+            n = pread(f->fd, f->cbuf, bufsize, tag);
+        } else {
+            n = read(f->fd, f->cbuf, bufsize);
+        }
+        have = n >= 0 || errno != EINTR;
+    }
+    if (f->aio && sequential && n > 0) {
+        if (!f->spare) {
+            f->spare = new io61_slot;
+        }
+        f->spare_tag = tag + n;
+        f->spare_ticket = io61_aio_submit(f->aio, false, f->spare->cbuf,
+                                          bufsize,
+                                          f->seekable ? f->spare_tag : -1);
+    }
+    return n;
+}
+
+// io61_fill(f)
+//    Load a window containing `f->pos_tag`, which is outside the current
+//    slot, into the cache. Return the number of bytes now available at
+//    `f->pos_tag`, 0 at end of file, or -1 on error.
+static ssize_t io61_fill(io61_file* f) {
+    assert(f->mode == O_RDONLY);
+    if (f->map) {
+        return 0;           // outside the mapping is past end of file
+    }
+    constexpr off_t bufsize = io61_file::bufsize;
+    // reads with no seek since the last fill continue in the current
+    // slot where it ended, even if that was short; otherwise choose a
+    // window from the seek pattern
+    off_t tag = f->pos_tag;
+    if (f->seekable && (tag != f->end_tag || f->seeked)) {
+        if (f->reverse) {
+            tag = tag + 1 > bufsize ? tag + 1 - bufsize : 0;
+        } else {
+            tag &= ~(bufsize - 1);
+            io61_switch_slot(f, tag);
+            if (f->pos_tag >= f->tag && f->pos_tag < f->end_tag) {
+                return f->end_tag - f->pos_tag;
+            }
+        }
+    }
+    bool sequential = !f->seeked;
+    f->seeked = false;
+    f->tag = f->end_tag = tag;
+    ssize_t n = io61_read_block(f, tag, sequential);
+    if (n < 0) {
+        return -1;
+    }
+    f->end_tag = tag + n;
+    return f->end_tag > f->pos_tag ? f->end_tag - f->pos_tag : 0;
+}
+
+int io61_readc(io61_file* f) {
+    if ((f->pos_tag < f->tag || f->pos_tag >= f->end_tag)
+        && io61_fill(f) <= 0) {
+        return EOF;
+    }
+    int ch = f->cbuf[f->pos_tag - f->tag];
+    ++f->pos_tag;
+    return ch;
+}
+
+ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz) {
+    size_t nread = 0;
+    while (nread != sz) {
+        if (f->pos_tag < f->tag || f->pos_tag >= f->end_tag) {
+            ssize_t n = io61_fill(f);
+            if (n <= 0) {
+                if (n < 0 && nread == 0) {
+                    return -1;
+                }
+                break;
+            }
+        }
+        size_t n = f->end_tag - f->pos_tag;
+        if (n > sz - nread) {
+            n = sz - nread;
+        }
+        memcpy(&buf[nread], &f->cbuf[f->pos_tag - f->tag], n);
+        f->pos_tag += n;
+        nread += n;
+    }
+    return nread;
+}
+
+
+static int io61_write_out(io61_file* f, bool wait);
+
+int io61_writec(io61_file* f, int ch) {
+    unsigned char c = ch;
+    return io61_write(f, &c, 1) == 1 ? 0 : -1;
+}
+
+ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz) {
+    assert(f->mode == O_WRONLY);
+    size_t nwritten = 0;
+    while (nwritten != sz) {
+        if (f->pos_tag == f->tag + io61_file::bufsize
+            && io61_write_out(f, false) < 0) {
+            return nwritten ? ssize_t(nwritten) : -1;
+        }
+        size_t n = f->tag + io61_file::bufsize - f->pos_tag;
+        if (n > sz - nwritten) {
+            n = sz - nwritten;
+        }
+        memcpy(&f->cbuf[f->pos_tag - f->tag], &buf[nwritten], n);
+        f->pos_tag += n;
+        if (f->pos_tag > f->end_tag) {
+            f->end_tag = f->pos_tag;
+        }
+        nwritten += n;
+    }
+    return nwritten;
+}
+
+int io61_flush(io61_file* f) {
+    return io61_write_out(f, true);
+}
+
+// Wait for the write-behind, if any, finishing it if it was short.
+static int io61_wait_behind(io61_file* f) {
+    if (f->spare_ticket < 0) {
+        return 0;
+    }
+    ssize_t n = io61_aio_wait(f->aio, f->spare_ticket);
+    f->spare_ticket = -1;
+    for (size_t off = n; n >= 0 && off != f->spare_len; ) {
+        n = write(f->fd, &f->spare->cbuf[off], f->spare_len - off);
+        if (n > 0) {
+            off += n;
+        } else if (n < 0 && errno == EINTR) {
+            n = 0;
+        }
+    }
+    return n < 0 ? -1 : 0;
+}
+
+// io61_write_out(f, wait)
+//    Write the buffered data in `f` to its file. In asynchronous mode,
+//    the write runs behind from the spare unless `wait` is true.
+static int io61_write_out(io61_file* f, bool wait) {
+    if (f->mode != O_WRONLY) {
+        return 0;
+    }
+    if (f->aio && io61_wait_behind(f) < 0) {
+        return -1;
+    }
+    if (f->end_tag != f->tag && io61_sync_fd_pos(f, f->tag) < 0) {
+        return -1;
+    }
+    if (f->aio && f->end_tag != f->tag) {
+        io61_swap_spare(f);
+        f->spare_len = f->end_tag - f->tag;
+        f->spare_ticket = io61_aio_submit(f->aio, true, f->spare->cbuf,
+                                          f->spare_len, -1);
+        if (f->spare_ticket < 0) {
+            return -1;
+        }
+        f->fd_pos += f->spare_len;
+        f->tag = f->end_tag = f->pos_tag;
+        return wait ? io61_wait_behind(f) : 0;
+    }
+    off_t off = 0;
+    while (f->tag + off != f->end_tag) {
+        ssize_t n = write(f->fd, &f->cbuf[off], f->end_tag - f->tag - off);
+        if (n < 0 && errno != EINTR) {
+            return -1;
+        } else if (n > 0) {
+            off += n;
+            f->fd_pos += n;
+        }
+    }
+    f->tag = f->end_tag = f->pos_tag;
+    return 0;
+}
+
+
+// Track the seek pattern: two backward seeks in a row, each by less
+// than a block, mean reverse reading.
+static void io61_note_seek(io61_file* f, off_t pos) {
+    off_t delta = pos - f->last_seek;
+    f->reverse = delta < 0 && delta > -io61_file::bufsize
+        && f->seek_delta < 0 && f->seek_delta > -io61_file::bufsize;
+    f->seek_delta = delta;
+    f->last_seek = pos;
+    f->seeked = true;
+}
+
+int io61_seek(io61_file* f, off_t pos) {
+    if (pos < 0 || (!f->seekable && pos != f->pos_tag)) {
+        return -1;
+    } else if (pos >= f->tag && pos <= f->end_tag) {
+        // in the cache (for writing, the bytes before `end_tag` are all
+        // buffered, so overwriting them in place is safe)
+        f->pos_tag = pos;
+        io61_note_seek(f, pos);
+        return 0;
+    }
+    // the next read or flush repositions the file descriptor
+    if (f->mode == O_RDONLY) {
+        f->pos_tag = pos;
+        io61_note_seek(f, pos);
+    } else if (io61_flush(f) < 0) {
+        return -1;
+    } else {
+        f->tag = f->end_tag = f->pos_tag = pos;
+    }
+    return 0;
+}
+
+off_t io61_filesize(io61_file* f) {
+    struct stat s;
+    if (fstat(f->fd, &s) == 0 && S_ISREG(s.st_mode)) {
+        return s.st_size;
+    }
+    return -1;
+}
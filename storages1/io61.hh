@@ -0,0 +1,67 @@
+#ifndef CS61_IO61_HH
+#define CS61_IO61_HH
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/types.h>
+
+// io61: buffered file I/O in the style of stdio. Each `io61_file` caches
+// 4 KiB blocks of its file, so byte-at-a-time reads and writes cost one
+// system call per block rather than one per byte. Reads that seek
+// backward or in a fixed stride are recognized and cost about the same.
+// Regular files opened for reading are memory-mapped when possible, so
+// their reads make no system calls.
+// Setting `IO61_ASYNC=1` makes other files read ahead and write behind
+// through `io_uring` (see io61_aio.hh).
+// A file is opened either for reading or for writing, not both.
+
+struct io61_file;
+
+// io61_fdopen(fd, mode)
+//    Return a new `io61_file` for file descriptor `fd`. `mode` is
+//    `O_RDONLY` or `O_WRONLY`.
+io61_file* io61_fdopen(int fd, int mode);
+
+// io61_open_check(filename, mode)
+//    Open `filename` (standard input or output if `filename` is null)
+//    and return an `io61_file` for it. Print an error and exit on failure.
+io61_file* io61_open_check(const char* filename, int mode);
+
+// io61_close(f)
+//    Flush and close `f` and free its memory. Return 0 or -1 on error.
+int io61_close(io61_file* f);
+
+// io61_readc(f)
+//    Read one byte from `f`. Return the byte (0-255), or EOF (-1) at end
+//    of file or on error.
+int io61_readc(io61_file* f);
+
+// io61_read(f, buf, sz)
+//    Read up to `sz` bytes from `f` into `buf`. Return the number of
+//    bytes read, which is less than `sz` only at end of file or on error,
+//    or -1 if an error occurred before any bytes were read.
+ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz);
+
+// io61_writec(f, ch)
+//    Write byte `ch` to `f`. Return 0 or -1 on error.
+int io61_writec(io61_file* f, int ch);
+
+// io61_write(f, buf, sz)
+//    Write `sz` bytes from `buf` to `f`. Return `sz`, or -1 if an error
+//    occurred before any bytes were written.
+ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz);
+
+// io61_seek(f, pos)
+//    Move `f`'s file position to `pos`. Seeks within the cached block
+//    make no system calls. Return 0 or -1 on error.
+int io61_seek(io61_file* f, off_t pos);
+
+// io61_flush(f)
+//    Write any buffered data in `f` to its file. Return 0 or -1 on error.
+int io61_flush(io61_file* f);
+
+// io61_filesize(f)
+//    Return the size of `f`'s file, or -1 if it is not a regular file.
+off_t io61_filesize(io61_file* f);
+
+#endif
@@ -0,0 +1,284 @@
+#include "io61_aio.hh"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Requests are numbered by ticket, and request `t` lives in
+// `reqs[t % io61_aio_depth]`. The helper thread runs requests in ticket
+// order; an `io_uring` may complete them in any order, so callers that
+// use the file position (`off == -1`) keep one such request outstanding.
+
+namespace {
+struct request {
+    bool in_use = false;
+    bool done;
+    bool write;
+    void* buf;
+    size_t sz;
+    off_t off;
+    ssize_t result;         // as for `read`/`write`, or -errno
+};
+}
+
+struct io61_aio {
+    int fd;
+    long next_ticket = 0;
+    request reqs[io61_aio_depth];
+
+    // io_uring backend (`ring_fd >= 0`)
+    int ring_fd = -1;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    io_uring_cqe* cqes;
+
+    // helper thread backend
+    std::thread thread;
+    std::mutex m;
+    std::condition_variable cv;
+    long next_run = 0;
+    bool stop = false;
+};
+
+
+static int io_uring_setup(unsigned entries, io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                          unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                   nullptr, 0);
+}
+
+// Set up `aio`'s ring. Return false if the kernel refuses, or predates
+// `IORING_OP_READ`/`IORING_OP_WRITE` at the file position (Linux 5.6).
+static bool uring_init(io61_aio* aio) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = io_uring_setup(io61_aio_depth, &p);
+    if (fd < 0) {
+        return false;
+    } else if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+        close(fd);
+        return false;
+    }
+
+    aio->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    aio->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (aio->cq_ring_size > aio->sq_ring_size) {
+            aio->sq_ring_size = aio->cq_ring_size;
+        }
+        aio->cq_ring_size = 0;
+    }
+    aio->sq_ring = mmap(nullptr, aio->sq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    aio->cq_ring = aio->sq_ring;
+    if (aio->sq_ring != MAP_FAILED && aio->cq_ring_size) {
+        aio->cq_ring = mmap(nullptr, aio->cq_ring_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    }
+    aio->sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = MAP_FAILED;
+    if (aio->sq_ring != MAP_FAILED && aio->cq_ring != MAP_FAILED) {
+        sqes = mmap(nullptr, aio->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    }
+    if (sqes == MAP_FAILED) {
+        if (aio->cq_ring != MAP_FAILED && aio->cq_ring_size) {
+            munmap(aio->cq_ring, aio->cq_ring_size);
+        }
+        if (aio->sq_ring != MAP_FAILED) {
+            munmap(aio->sq_ring, aio->sq_ring_size);
+        }
+        close(fd);
+        return false;
+    }
+
+    char* sq = static_cast<char*>(aio->sq_ring);
+    char* cq = static_cast<char*>(aio->cq_ring);
+    aio->sqes = static_cast<io_uring_sqe*>(sqes);
+    aio->sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    aio->sq_mask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    aio->sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    aio->cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    aio->cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    aio->cq_mask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    aio->cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    aio->ring_fd = fd;
+    return true;
+}
+
+static bool uring_submit(io61_aio* aio, long ticket, const request& r) {
+    unsigned tail = *aio->sq_tail;
+    unsigned idx = tail & *aio->sq_mask;
+    io_uring_sqe* sqe = &aio->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = r.write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = aio->fd;
+    sqe->addr = reinterpret_cast<uintptr_t>(r.buf);
+    sqe->len = r.sz;
+    sqe->off = r.off;               // -1 means the file position
+    sqe->user_data = ticket;
+    aio->sq_array[idx] = idx;
+    __atomic_store_n(aio->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    int n;
+    while ((n = io_uring_enter(aio->ring_fd, 1, 0, 0)) < 0 && errno == EINTR) {
+    }
+    return n == 1;
+}
+
+// Move completions from the ring into `aio->reqs`.
+static void uring_reap(io61_aio* aio) {
+    unsigned head = *aio->cq_head;
+    unsigned tail = __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        const io_uring_cqe* cqe = &aio->cqes[head & *aio->cq_mask];
+        request& r = aio->reqs[cqe->user_data % io61_aio_depth];
+        r.result = cqe->res;
+        r.done = true;
+    }
+    __atomic_store_n(aio->cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+static void thread_main(io61_aio* aio) {
+    std::unique_lock<std::mutex> guard(aio->m);
+    while (true) {
+        while (!aio->stop && aio->next_run == aio->next_ticket) {
+            aio->cv.wait(guard);
+        }
+        if (aio->next_run == aio->next_ticket) {
+            return;
+        }
+        request& r = aio->reqs[aio->next_run % io61_aio_depth];
+        guard.unlock();
+        ssize_t n;
+        do {
+            if (r.write) {
+                n = r.off < 0 ? write(aio->fd, r.buf, r.sz)
+                    : pwrite(aio->fd, r.buf, r.sz, r.off);
+            } else {
+                n = r.off < 0 ? read(aio->fd, r.buf, r.sz)
+                    : pread(aio->fd, r.buf, r.sz, r.off);
+            }
+        } while (n < 0 && errno == EINTR);
+        guard.lock();
+        r.result = n < 0 ? -errno : n;
+        r.done = true;
+        ++aio->next_run;
+        aio->cv.notify_all();
+    }
+}
+
+
+io61_aio* io61_aio_new(int fd, bool use_uring) {
+    io61_aio* aio = new io61_aio;
+    aio->fd = fd;
+    if (!use_uring || !uring_init(aio)) {
+        try {
+            aio->thread = std::thread(thread_main, aio);
+        } catch (...) {
+            delete aio;
+            return nullptr;
+        }
+    }
+    return aio;
+}
+
+void io61_aio_delete(io61_aio* aio) {
+    for (long t = aio->next_ticket - io61_aio_depth; t < aio->next_ticket; ++t) {
+        if (t >= 0 && aio->reqs[t % io61_aio_depth].in_use) {
+            io61_aio_wait(aio, t);
+        }
+    }
+    if (aio->ring_fd >= 0) {
+        munmap(aio->sqes, aio->sqes_size);
+        if (aio->cq_ring_size) {
+            munmap(aio->cq_ring, aio->cq_ring_size);
+        }
+        munmap(aio->sq_ring, aio->sq_ring_size);
+        close(aio->ring_fd);
+    } else {
+        {
+            std::lock_guard<std::mutex> guard(aio->m);
+            aio->stop = true;
+            aio->cv.notify_all();
+        }
+        aio->thread.join();
+    }
+    delete aio;
+}
+
+long io61_aio_submit(io61_aio* aio, bool write, void* buf, size_t sz,
+                     off_t off) {
+    std::unique_lock<std::mutex> guard(aio->m, std::defer_lock);
+    if (aio->ring_fd < 0) {
+        guard.lock();
+    }
+    long ticket = aio->next_ticket;
+    request& r = aio->reqs[ticket % io61_aio_depth];
+    if (r.in_use) {
+        errno = EAGAIN;
+        return -1;
+    }
+    r.in_use = true;
+    r.done = false;
+    r.write = write;
+    r.buf = buf;
+    r.sz = sz;
+    r.off = off;
+    if (aio->ring_fd >= 0 && !uring_submit(aio, ticket, r)) {
+        r.in_use = false;
+        return -1;
+    }
+    ++aio->next_ticket;
+    aio->cv.notify_all();
+    return ticket;
+}
+
+ssize_t io61_aio_wait(io61_aio* aio, long ticket) {
+    request& r = aio->reqs[ticket % io61_aio_depth];
+    if (aio->ring_fd >= 0) {
+        uring_reap(aio);
+        while (!r.done) {
+            if (io_uring_enter(aio->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0
+                && errno != EINTR) {
+                return -1;
+            }
+            uring_reap(aio);
+        }
+    } else {
+        std::unique_lock<std::mutex> guard(aio->m);
+        while (!r.done) {
+            aio->cv.wait(guard);
+        }
+    }
+    r.in_use = false;
+    if (r.result < 0) {
+        errno = -r.result;
+        return -1;
+    }
+    return r.result;
+}
+
+const char* io61_aio_backend(io61_aio* aio) {
+    return aio->ring_fd >= 0 ? "io_uring" : "thread";
+}
@@ -0,0 +1,40 @@
+#ifndef CS61_IO61_AIO_HH
+#define CS61_IO61_AIO_HH
+#include <sys/types.h>
+
+// io61_aio: asynchronous reads and writes on one file descriptor, for
+// io61's read-ahead and write-behind. Requests run on an `io_uring` when
+// the kernel allows one, and on a helper thread otherwise.
+
+struct io61_aio;
+
+// io61_aio_new(fd, use_uring)
+//    Return a request queue for `fd`. If `use_uring` is false, or no
+//    `io_uring` can be set up, use a helper thread. Return null if
+//    neither is possible.
+io61_aio* io61_aio_new(int fd, bool use_uring);
+
+// io61_aio_delete(aio)
+//    Wait for outstanding requests, then free `aio`.
+void io61_aio_delete(io61_aio* aio);
+
+// io61_aio_submit(aio, write, buf, sz, off)
+//    Start reading (or, if `write`, writing) `sz` bytes at file offset
+//    `off` (or at the file position, updating it, if `off` is -1). `buf`
+//    must stay valid until the request is waited for. Return a ticket
+//    for `io61_aio_wait`, or -1 on error. At most `io61_aio_depth`
+//    requests may be outstanding.
+long io61_aio_submit(io61_aio* aio, bool write, void* buf, size_t sz,
+                     off_t off);
+constexpr int io61_aio_depth = 4;
+
+// io61_aio_wait(aio, ticket)
+//    Wait for request `ticket` and return its result, as for `read` or
+//    `write` (-1 on error, with `errno` set).
+ssize_t io61_aio_wait(io61_aio* aio, long ticket);
+
+// io61_aio_backend(aio)
+//    Return "io_uring" or "thread".
+const char* io61_aio_backend(io61_aio* aio);
+
+#endif
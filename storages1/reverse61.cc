@@ -0,0 +1,22 @@
+#include "io61.hh"
+
+// reverse61 [FILE]
+//    Write the bytes of FILE (default standard input, which must be a
+//    regular file) to standard output in reverse order, seeking before
+//    each `io61_readc`.
+
+int main(int argc, char** argv) {
+    io61_file* inf = io61_open_check(argc > 1 ? argv[1] : nullptr, O_RDONLY);
+    io61_file* outf = io61_open_check(nullptr, O_WRONLY);
+    off_t size = io61_filesize(inf);
+    if (size < 0) {
+        fprintf(stderr, "reverse61: input must be a regular file\n");
+        exit(1);
+    }
+    for (off_t pos = size - 1; pos >= 0; --pos) {
+        io61_seek(inf, pos);
+        io61_writec(outf, io61_readc(inf));
+    }
+    io61_close(inf);
+    io61_close(outf);
+}
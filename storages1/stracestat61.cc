@@ -0,0 +1,542 @@
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// stracestat61 [-v] [-c NSEC] [-b BLOCKSIZE] [TRACE...]
+//    Summarize `strace` output (default standard input): count system
+//    calls by type and by open file, recognize wasteful I/O patterns
+//    (tiny reads and writes, an `lseek` before every access, seeks that
+//    go nowhere, reverse and strided scans), and estimate how many kernel
+//    crossings a BLOCKSIZE-byte (default 4096) cache would have saved, at
+//    NSEC nanoseconds (default 100) per crossing, or at the times recorded
+//    by `strace -T`. With several TRACEs, finish with a one-line-per-trace
+//    table for triage. `-v` also lists every system call type.
+
+static size_t blocksize = 4096;
+static double crossing_ns = 100;
+static bool verbose = false;
+
+// A pattern must cover this many accesses before it is reported.
+static constexpr unsigned min_accesses = 16;
+
+// file_stats: what one open file (one `open` to `close` span of a
+// file descriptor) saw
+struct file_stats {
+    int fd;
+    std::string name;
+    unsigned nread = 0, nwrite = 0, nseek = 0;
+    uint64_t bytes_read = 0, bytes_written = 0;
+    unsigned tiny = 0;              // accesses requesting < 512 bytes
+    uint64_t tiny_bytes = 0;
+    unsigned seek_access = 0;       // accesses right after an `lseek`
+    unsigned idle_seeks = 0;        // `lseek`s that left the position alone
+    unsigned backward = 0;          // accesses before the previous one
+    unsigned strided = 0;           // accesses repeating a non-sequential step
+    bool read_eof = false;
+    double seconds = 0;             // `strace -T` time in data calls
+
+    // position tracking; -1 means unknown (a pipe, say, before any seek)
+    off_t pos = 0;
+    bool last_seek = false;
+    off_t last_off = -1, last_end = -1, last_step = 0;
+    std::set<off_t> read_blocks, write_blocks;
+
+    unsigned accesses() const {
+        return nread + nwrite;
+    }
+    unsigned calls() const {
+        return nread + nwrite + nseek;
+    }
+    // Crossings a block cache would need: one per distinct block touched,
+    // plus one read to find end of file.
+    unsigned ideal() const {
+        return read_blocks.size() + write_blocks.size() + read_eof;
+    }
+    unsigned wasted() const {
+        return calls() > ideal() ? calls() - ideal() : 0;
+    }
+};
+
+// trace_stats: one trace
+struct trace_stats {
+    std::string name;
+    unsigned nlines = 0, ncalls = 0;
+    double seconds = 0;             // total `strace -T` time
+    bool timed = false;
+    std::map<std::string, unsigned> by_type;
+    std::vector<file_stats> files;  // closed files, in order of opening
+    std::map<int, file_stats> open;
+
+    file_stats& file(int fd);
+    void close(int fd);
+};
+
+file_stats& trace_stats::file(int fd) {
+    auto it = open.find(fd);
+    if (it == open.end()) {
+        file_stats& fs = open[fd];
+        fs.fd = fd;
+        if (fd == 0 || fd == 1 || fd == 2) {
+            static const char* const stdnames[] = {"stdin", "stdout", "stderr"};
+            fs.name = stdnames[fd];
+        } else {
+            fs.name = "fd " + std::to_string(fd);
+        }
+        return fs;
+    }
+    return it->second;
+}
+
+void trace_stats::close(int fd) {
+    auto it = open.find(fd);
+    if (it != open.end()) {
+        files.push_back(std::move(it->second));
+        open.erase(it);
+    }
+}
+
+
+// A parsed system call line.
+struct syscall_line {
+    std::string name;
+    std::vector<std::string> args;
+    std::string ret_text;           // text after " = "
+    long long ret;
+    double seconds = -1;            // `<...>` time, if present
+};
+
+// Parse `s` as `name(args) = ret [<time>]`. Return false for anything
+// else (signals, exits, unparseable lines).
+static bool parse_call(const std::string& s, syscall_line& c) {
+    size_t p = 0;
+    while (p < s.size() && (isalnum((unsigned char) s[p]) || s[p] == '_')) {
+        ++p;
+    }
+    if (p == 0 || p == s.size() || s[p] != '(') {
+        return false;
+    }
+    c.name = s.substr(0, p);
+    c.args.clear();
+
+    // split arguments at top-level commas
+    int depth = 0;
+    bool quoted = false;
+    size_t argstart = p + 1;
+    for (++p; p < s.size(); ++p) {
+        char ch = s[p];
+        if (quoted) {
+            if (ch == '\\') {
+                ++p;
+            } else if (ch == '"') {
+                quoted = false;
+            }
+        } else if (ch == '"') {
+            quoted = true;
+        } else if (ch == '(' || ch == '{' || ch == '[') {
+            ++depth;
+        } else if ((ch == ')' || ch == '}' || ch == ']') && depth > 0) {
+            --depth;
+        } else if ((ch == ',' || ch == ')') && depth == 0) {
+            size_t b = argstart;
+            while (b < p && s[b] == ' ') {
+                ++b;
+            }
+            if (ch == ',' || p > b) {
+                c.args.push_back(s.substr(b, p - b));
+            }
+            argstart = p + 1;
+            if (ch == ')') {
+                break;
+            }
+        }
+    }
+    size_t eq = s.find(" = ", p);
+    if (p >= s.size() || eq == std::string::npos) {
+        return false;
+    }
+    c.ret_text = s.substr(eq + 3);
+    if (c.ret_text.empty() || c.ret_text[0] == '?') {
+        return false;
+    }
+    c.ret = strtoll(c.ret_text.c_str(), nullptr, 0);
+    c.seconds = -1;
+    size_t lt = s.rfind('<');
+    if (lt != std::string::npos && lt > eq && s.back() == '>') {
+        c.seconds = strtod(s.c_str() + lt + 1, nullptr);
+    }
+    return true;
+}
+
+static long long arg_int(const syscall_line& c, size_t i) {
+    return i < c.args.size() ? strtoll(c.args[i].c_str(), nullptr, 0) : -1;
+}
+
+// Return the contents of quoted argument `i`, or "" if there isn't one.
+static std::string arg_string(const syscall_line& c, size_t i) {
+    if (i >= c.args.size() || c.args[i].size() < 2 || c.args[i][0] != '"') {
+        return "";
+    }
+    const std::string& a = c.args[i];
+    return a.substr(1, a.find('"', 1) - 1);
+}
+
+static void add_blocks(std::set<off_t>& blocks, off_t off, size_t n) {
+    for (off_t b = off / blocksize; b * (off_t) blocksize < off + (off_t) n; ++b) {
+        blocks.insert(b);
+    }
+}
+
+// Account for `n` bytes read or written at `off` (-1 if unknown) after
+// asking for `want`.
+static void note_access(file_stats& fs, bool write, off_t off,
+                        long long want, long long n) {
+    if (write) {
+        ++fs.nwrite;
+    } else {
+        ++fs.nread;
+    }
+    if (want >= 0 && want < 512) {
+        ++fs.tiny;
+        fs.tiny_bytes += want;
+    }
+    if (fs.last_seek) {
+        ++fs.seek_access;
+    }
+    fs.last_seek = false;
+    if (n <= 0) {
+        fs.read_eof = fs.read_eof || (!write && n == 0);
+        return;
+    }
+    if (write) {
+        fs.bytes_written += n;
+    } else {
+        fs.bytes_read += n;
+    }
+
+    // without a position, treat the file as a stream of sequential blocks
+    off_t where = off >= 0 ? off : (off_t) (write ? fs.bytes_written - n
+                                            : fs.bytes_read - n);
+    add_blocks(write ? fs.write_blocks : fs.read_blocks, where, n);
+    if (off >= 0 && fs.last_off >= 0) {
+        off_t step = off - fs.last_off;
+        if (off < fs.last_off) {
+            ++fs.backward;
+        }
+        if (off != fs.last_end && step == fs.last_step) {
+            ++fs.strided;
+        }
+        fs.last_step = step;
+    }
+    fs.last_off = off;
+    fs.last_end = off >= 0 ? off + n : -1;
+}
+
+static void analyze_call(trace_stats& t, const syscall_line& c) {
+    ++t.ncalls;
+    ++t.by_type[c.name];
+    if (c.seconds >= 0) {
+        t.seconds += c.seconds;
+        t.timed = true;
+    }
+    const std::string& n = c.name;
+    bool failed = c.ret < 0;
+    if (failed && c.ret_text.find("EBADF") != std::string::npos) {
+        return;                     // not a file
+    }
+
+    if (n == "open" || n == "openat" || n == "creat") {
+        if (!failed) {
+            t.close(c.ret);
+            file_stats& fs = t.file(c.ret);
+            fs.name = arg_string(c, n == "openat" ? 1 : 0);
+        }
+    } else if (n == "close") {
+        if (!failed) {
+            t.close(arg_int(c, 0));
+        }
+    } else if (n == "dup" || n == "dup2" || n == "dup3" || (n == "fcntl"
+               && c.args.size() > 1 && c.args[1].compare(0, 7, "F_DUPFD") == 0)) {
+        if (!failed && c.ret != arg_int(c, 0)) {
+            std::string name = t.file(arg_int(c, 0)).name;
+            t.close(c.ret);
+            t.file(c.ret).name = name;
+        }
+    } else if (n == "read" || n == "write" || n == "readv" || n == "writev") {
+        file_stats& fs = t.file(arg_int(c, 0));
+        bool write = n[0] == 'w';
+        long long want = n.back() == 'v' ? -1 : arg_int(c, 2);
+        note_access(fs, write, fs.pos, want, c.ret);
+        if (fs.pos >= 0 && !failed) {
+            fs.pos += c.ret;
+        }
+        fs.seconds += c.seconds > 0 ? c.seconds : 0;
+    } else if (n == "pread64" || n == "pwrite64" || n == "pread" || n == "pwrite") {
+        file_stats& fs = t.file(arg_int(c, 0));
+        note_access(fs, n[1] == 'w', arg_int(c, 3), arg_int(c, 2), c.ret);
+        fs.seconds += c.seconds > 0 ? c.seconds : 0;
+    } else if (n == "lseek") {
+        file_stats& fs = t.file(arg_int(c, 0));
+        ++fs.nseek;
+        fs.seconds += c.seconds > 0 ? c.seconds : 0;
+        if (!failed) {
+            if (fs.last_seek || fs.pos == c.ret) {
+                ++fs.idle_seeks;
+            }
+            fs.pos = c.ret;
+            fs.last_seek = true;
+        }
+    }
+}
+
+// Read one trace from `f`.
+static void read_trace(FILE* f, trace_stats& t) {
+    std::map<std::string, std::string> unfinished;   // by pid
+    char* line = nullptr;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, f)) > 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        ++t.nlines;
+        std::string s = line;
+
+        // strip `[pid N] ` or `N ` (strace -f), then timestamps (-t, -r)
+        std::string pid;
+        if (s.compare(0, 5, "[pid ") == 0 && s.find("] ") != std::string::npos) {
+            size_t e = s.find("] ");
+            pid = s.substr(5, e - 5);
+            s.erase(0, e + 2);
+        }
+        while (!s.empty() && isdigit((unsigned char) s[0])) {
+            size_t e = s.find_first_not_of("0123456789:.");
+            if (e == std::string::npos || s[e] != ' ') {
+                break;
+            }
+            if (pid.empty() && s.find_first_of(":.") > e) {
+                pid = s.substr(0, e);
+            }
+            s.erase(0, s.find_first_not_of(' ', e));
+        }
+
+        // rejoin calls that another thread interrupted
+        const char unf[] = " <unfinished ...>";
+        size_t unflen = sizeof(unf) - 1;
+        if (s.size() > unflen && s.compare(s.size() - unflen, unflen, unf) == 0) {
+            unfinished[pid] = s.substr(0, s.size() - unflen);
+            continue;
+        } else if (s.compare(0, 5, "<... ") == 0) {
+            size_t e = s.find(" resumed>");
+            if (e == std::string::npos || !unfinished.count(pid)) {
+                continue;
+            }
+            s = unfinished[pid] + s.substr(e + 9);
+            unfinished.erase(pid);
+        }
+
+        syscall_line c;
+        if (parse_call(s, c)) {
+            analyze_call(t, c);
+        }
+    }
+    free(line);
+    for (auto& it : t.open) {
+        t.files.push_back(std::move(it.second));
+    }
+    t.open.clear();
+}
+
+
+// Sums over a trace's files.
+struct totals {
+    unsigned calls = 0, ideal = 0, wasted = 0;
+    double seconds = 0;
+};
+
+static totals sum_files(const trace_stats& t) {
+    totals s;
+    for (const file_stats& fs : t.files) {
+        s.calls += fs.calls();
+        s.ideal += fs.ideal();
+        s.wasted += fs.wasted();
+        if (fs.calls()) {
+            s.seconds += fs.seconds * fs.wasted() / fs.calls();
+        }
+    }
+    return s;
+}
+
+// Estimated time for `wasted` crossings: the traced average if `strace
+// -T` times are present, otherwise `crossing_ns` each.
+static double wasted_ms(const trace_stats& t, const totals& s) {
+    if (t.timed) {
+        return s.seconds * 1e3;
+    }
+    return s.wasted * crossing_ns / 1e6;
+}
+
+// Describe `fs`'s patterns into `pats` (short names) and, if `out`,
+// print them with suggestions.
+static void find_patterns(const file_stats& fs, std::set<std::string>& pats,
+                          FILE* out) {
+    unsigned a = fs.accesses();
+    char detail[200];
+    auto report = [&] (const char* tag, const char* suggest) {
+        pats.insert(tag);
+        if (out) {
+            fprintf(out, "    fd %d (%s): %s\n      suggest: %s\n",
+                    fs.fd, fs.name.c_str(), detail, suggest);
+        }
+    };
+    if (fs.idle_seeks >= min_accesses && fs.idle_seeks * 4 > fs.nseek) {
+        snprintf(detail, sizeof(detail), "idle seeks: %u of %u lseeks moved "
+                 "nowhere, or were overridden before any access",
+                 fs.idle_seeks, fs.nseek);
+        report("idle-seek", "skip seeks that land in the cached block; "
+               "seek lazily, at the next fill");
+    }
+    if (a < min_accesses) {
+        return;
+    }
+    if (fs.tiny * 2 > a) {
+        snprintf(detail, sizeof(detail), "tiny accesses: %u of %u ask for "
+                 "< 512 bytes, %.1f on average",
+                 fs.tiny, a, fs.tiny_bytes / (double) fs.tiny);
+        report("tiny", "buffer into blocks (io61 caches 4096 bytes at a time)");
+    }
+    if (fs.seek_access * 2 > a) {
+        snprintf(detail, sizeof(detail), "seek before access: %u of %u "
+                 "accesses follow an lseek", fs.seek_access, a);
+        report("seek+access", "track the file position in the cache, or "
+               "use pread/pwrite, instead of seeking for every access");
+    }
+    uint64_t distinct = fs.read_blocks.size() * blocksize;
+    if (fs.bytes_read > 2 * distinct) {
+        snprintf(detail, sizeof(detail), "rereads: %zu-block working set "
+                 "read %.1f times over", fs.read_blocks.size(),
+                 fs.bytes_read / (double) distinct);
+        report("reread", "keep the blocks in memory (several cache slots, "
+               "or map the file) instead of reading them again");
+    }
+    if (fs.backward * 2 > a) {
+        snprintf(detail, sizeof(detail), "reverse scan: %u of %u accesses "
+                 "go backward", fs.backward, a);
+        report("reverse", "fill the block that ends at the accessed byte, so "
+               "a backward scan costs one read per block");
+    } else if (fs.strided * 2 > a) {
+        snprintf(detail, sizeof(detail), "strided scan: %u of %u accesses "
+                 "repeat a fixed step", fs.strided, a);
+        report("stride", "cache several blocks and prefetch along the "
+               "stride, or map the file");
+    }
+}
+
+static std::string join(const std::set<std::string>& pats) {
+    std::string s;
+    for (const std::string& p : pats) {
+        s += (s.empty() ? "" : ",") + p;
+    }
+    return s.empty() ? "-" : s;
+}
+
+static void print_trace(const trace_stats& t) {
+    totals s = sum_files(t);
+    printf("%s: %u lines, %u system calls, %u on file data\n",
+           t.name.c_str(), t.nlines, t.ncalls, s.calls);
+    if (verbose) {
+        std::vector<std::pair<unsigned, std::string>> types;
+        for (auto& it : t.by_type) {
+            types.emplace_back(it.second, it.first);
+        }
+        std::sort(types.rbegin(), types.rend());
+        for (auto& ty : types) {
+            printf("  %-16s %8u\n", ty.second.c_str(), ty.first);
+        }
+    }
+
+    printf("  %4s %-20s %7s %7s %7s %10s %10s %7s %7s\n", "fd", "file",
+           "read", "write", "lseek", "bytes in", "bytes out", "ideal", "wasted");
+    for (const file_stats& fs : t.files) {
+        if (fs.calls() == 0 || (!verbose && fs.calls() < min_accesses
+                                && fs.wasted() == 0)) {
+            continue;
+        }
+        std::string name = fs.name;
+        if (name.size() > 20) {
+            name = "..." + name.substr(name.size() - 17);
+        }
+        printf("  %4d %-20s %7u %7u %7u %10" PRIu64 " %10" PRIu64 " %7u %7u\n",
+               fs.fd, name.c_str(), fs.nread, fs.nwrite, fs.nseek,
+               fs.bytes_read, fs.bytes_written, fs.ideal(), fs.wasted());
+    }
+
+    std::set<std::string> pats;
+    for (const file_stats& fs : t.files) {
+        find_patterns(fs, pats, nullptr);
+    }
+    if (!pats.empty()) {
+        printf("  patterns:\n");
+        for (const file_stats& fs : t.files) {
+            find_patterns(fs, pats, stdout);
+        }
+    }
+    printf("  wasted: %u of %u data crossings, about %.3f ms%s\n\n",
+           s.wasted, s.calls, wasted_ms(t, s),
+           t.timed ? " (strace -T)" : "");
+}
+
+
+int main(int argc, char** argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "vc:b:")) != -1) {
+        if (opt == 'v') {
+            verbose = true;
+        } else if (opt == 'c') {
+            crossing_ns = strtod(optarg, nullptr);
+        } else if (opt == 'b' && strtoul(optarg, nullptr, 0) > 0) {
+            blocksize = strtoul(optarg, nullptr, 0);
+        } else {
+            fprintf(stderr, "Usage: stracestat61 [-v] [-c NSEC] [-b BLOCKSIZE] [TRACE...]\n");
+            exit(1);
+        }
+    }
+
+    std::vector<trace_stats> traces;
+    for (int i = optind; i < argc || i == optind; ++i) {
+        FILE* f = stdin;
+        traces.emplace_back();
+        traces.back().name = i < argc ? argv[i] : "<stdin>";
+        if (i < argc && !(f = fopen(argv[i], "r"))) {
+            fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+            exit(1);
+        }
+        read_trace(f, traces.back());
+        if (f != stdin) {
+            fclose(f);
+        }
+        print_trace(traces.back());
+    }
+
+    if (traces.size() > 1) {
+        printf("%-20s %9s %9s %7s %9s %9s  %s\n", "trace", "syscalls",
+               "data", "ideal", "wasted", "est. ms", "patterns");
+        for (const trace_stats& t : traces) {
+            totals s = sum_files(t);
+            std::set<std::string> pats;
+            for (const file_stats& fs : t.files) {
+                find_patterns(fs, pats, nullptr);
+            }
+            printf("%-20s %9u %9u %7u %9u %9.3f  %s\n", t.name.c_str(),
+                   t.ncalls, s.calls, s.ideal, s.wasted, wasted_ms(t, s),
+                   join(pats).c_str());
+        }
+    }
+}
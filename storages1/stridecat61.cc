@@ -0,0 +1,44 @@
+#include "io61.hh"
+#include <unistd.h>
+
+// stridecat61 [-s STRIDE] [FILE]
+//    Write the bytes of FILE (default standard input, which must be a
+//    regular file) to standard output in stride order: offsets 0, STRIDE,
+//    2*STRIDE, ..., then 1, STRIDE+1, ..., and so on. STRIDE defaults to
+//    4096. Each byte is read with an `io61_seek` and an `io61_readc`.
+
+int main(int argc, char** argv) {
+    off_t stride = 4096;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        if (opt == 's') {
+            stride = strtol(optarg, nullptr, 0);
+        } else {
+            fprintf(stderr, "Usage: stridecat61 [-s STRIDE] [FILE]\n");
+            exit(1);
+        }
+    }
+    if (stride <= 0) {
+        stride = 1;
+    }
+
+    io61_file* inf = io61_open_check(optind < argc ? argv[optind] : nullptr,
+                                     O_RDONLY);
+    io61_file* outf = io61_open_check(nullptr, O_WRONLY);
+    off_t size = io61_filesize(inf);
+    if (size < 0) {
+        fprintf(stderr, "stridecat61: input must be a regular file\n");
+        exit(1);
+    }
+    off_t pos = 0;
+    for (off_t i = 0; i != size; ++i) {
+        io61_seek(inf, pos);
+        io61_writec(outf, io61_readc(inf));
+        pos += stride;
+        if (pos >= size) {
+            pos = pos % stride + 1;
+        }
+    }
+    io61_close(inf);
+    io61_close(outf);
+}